@@ -0,0 +1,245 @@
+// Generated by tools/punctgen.c from the OP() entries of TOK_LIST. Do not edit.
+
+#pragma once
+
+#include <stdint.h>
+
+#define PUNCT_MAX_LEN 3
+
+typedef enum {
+  LEX_INVALID,
+  LEX_IDENT,
+  LEX_NUMBER,
+  LEX_STRING,
+  LEX_CHAR,
+  LEX_PUNCT,
+  LEX_END
+} LexStart;
+
+static const uint8_t lex_start[256] = {
+    [0] = LEX_END,
+    ['!'] = LEX_PUNCT,
+    ['"'] = LEX_STRING,
+    ['#'] = LEX_PUNCT,
+    ['%'] = LEX_PUNCT,
+    ['&'] = LEX_PUNCT,
+    ['\''] = LEX_CHAR,
+    ['('] = LEX_PUNCT,
+    [')'] = LEX_PUNCT,
+    ['*'] = LEX_PUNCT,
+    ['+'] = LEX_PUNCT,
+    [','] = LEX_PUNCT,
+    ['-'] = LEX_PUNCT,
+    ['.'] = LEX_PUNCT,
+    ['/'] = LEX_PUNCT,
+    ['0'] = LEX_NUMBER,
+    ['1'] = LEX_NUMBER,
+    ['2'] = LEX_NUMBER,
+    ['3'] = LEX_NUMBER,
+    ['4'] = LEX_NUMBER,
+    ['5'] = LEX_NUMBER,
+    ['6'] = LEX_NUMBER,
+    ['7'] = LEX_NUMBER,
+    ['8'] = LEX_NUMBER,
+    ['9'] = LEX_NUMBER,
+    [':'] = LEX_PUNCT,
+    [';'] = LEX_PUNCT,
+    ['<'] = LEX_PUNCT,
+    ['='] = LEX_PUNCT,
+    ['>'] = LEX_PUNCT,
+    ['?'] = LEX_PUNCT,
+    ['A'] = LEX_IDENT,
+    ['B'] = LEX_IDENT,
+    ['C'] = LEX_IDENT,
+    ['D'] = LEX_IDENT,
+    ['E'] = LEX_IDENT,
+    ['F'] = LEX_IDENT,
+    ['G'] = LEX_IDENT,
+    ['H'] = LEX_IDENT,
+    ['I'] = LEX_IDENT,
+    ['J'] = LEX_IDENT,
+    ['K'] = LEX_IDENT,
+    ['L'] = LEX_IDENT,
+    ['M'] = LEX_IDENT,
+    ['N'] = LEX_IDENT,
+    ['O'] = LEX_IDENT,
+    ['P'] = LEX_IDENT,
+    ['Q'] = LEX_IDENT,
+    ['R'] = LEX_IDENT,
+    ['S'] = LEX_IDENT,
+    ['T'] = LEX_IDENT,
+    ['U'] = LEX_IDENT,
+    ['V'] = LEX_IDENT,
+    ['W'] = LEX_IDENT,
+    ['X'] = LEX_IDENT,
+    ['Y'] = LEX_IDENT,
+    ['Z'] = LEX_IDENT,
+    ['['] = LEX_PUNCT,
+    ['\\'] = LEX_PUNCT,
+    [']'] = LEX_PUNCT,
+    ['^'] = LEX_PUNCT,
+    ['_'] = LEX_IDENT,
+    ['a'] = LEX_IDENT,
+    ['b'] = LEX_IDENT,
+    ['c'] = LEX_IDENT,
+    ['d'] = LEX_IDENT,
+    ['e'] = LEX_IDENT,
+    ['f'] = LEX_IDENT,
+    ['g'] = LEX_IDENT,
+    ['h'] = LEX_IDENT,
+    ['i'] = LEX_IDENT,
+    ['j'] = LEX_IDENT,
+    ['k'] = LEX_IDENT,
+    ['l'] = LEX_IDENT,
+    ['m'] = LEX_IDENT,
+    ['n'] = LEX_IDENT,
+    ['o'] = LEX_IDENT,
+    ['p'] = LEX_IDENT,
+    ['q'] = LEX_IDENT,
+    ['r'] = LEX_IDENT,
+    ['s'] = LEX_IDENT,
+    ['t'] = LEX_IDENT,
+    ['u'] = LEX_IDENT,
+    ['v'] = LEX_IDENT,
+    ['w'] = LEX_IDENT,
+    ['x'] = LEX_IDENT,
+    ['y'] = LEX_IDENT,
+    ['z'] = LEX_IDENT,
+    ['{'] = LEX_PUNCT,
+    ['|'] = LEX_PUNCT,
+    ['}'] = LEX_PUNCT,
+    ['~'] = LEX_PUNCT,
+};
+
+static const uint8_t punct_class[256] = {
+    ['!'] = 18,
+    ['#'] = 11,
+    ['%'] = 17,
+    ['&'] = 1,
+    ['('] = 16,
+    [')'] = 23,
+    ['*'] = 5,
+    ['+'] = 12,
+    [','] = 9,
+    ['-'] = 3,
+    ['.'] = 19,
+    ['/'] = 10,
+    [':'] = 8,
+    [';'] = 24,
+    ['<'] = 15,
+    ['='] = 2,
+    ['>'] = 4,
+    ['?'] = 20,
+    ['['] = 14,
+    ['\\'] = 6,
+    [']'] = 22,
+    ['^'] = 26,
+    ['{'] = 13,
+    ['|'] = 7,
+    ['}'] = 21,
+    ['~'] = 25,
+};
+
+static const uint8_t punct_next[49][27] = {
+    {0, 1, 14, 4, 16, 6, 7, 8, 9, 10, 12, 18, 20, 22, 23, 24, 26, 30, 32, 36, 38, 39, 40, 41, 44, 45, 47},
+    {0, 2, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 29, 11, 5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 46, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 35, 0, 0, 0, 0, 34, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 13, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 17, 0, 42, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 37, 0, 0, 0, 0, 0, 0, 0, 0, 0, 21, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 25, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 27, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 28, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 31, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 33, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 43, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 48, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+};
+
+static const uint8_t punct_accept[49] = {
+    INVALID,
+    AMPER, // "&"
+    AND, // "&&"
+    ANDEQ, // "&="
+    MINUS, // "-"
+    ARROW, // "->"
+    ASTERISK, // "*"
+    BACKSLASH, // "\"
+    BITOR, // "|"
+    COLON, // ":"
+    COMMA, // ","
+    DECREM, // "--"
+    SLASH, // "/"
+    DIVEQ, // "/="
+    EQUALS, // "="
+    EQEQ, // "=="
+    GT, // ">"
+    GE, // ">="
+    HASH, // "#"
+    HASHHASH, // "##"
+    PLUS, // "+"
+    INCREM, // "++"
+    LBRACE, // "{"
+    LBRACKET, // "["
+    LT, // "<"
+    LE, // "<="
+    LPAREN, // "("
+    LSHIFT, // "<<"
+    LSHIFTEQ, // "<<="
+    MINUSEQ, // "-="
+    MODULO, // "%"
+    MODEQ, // "%="
+    NOT, // "!"
+    NEQ, // "!="
+    OR, // "||"
+    OREQ, // "|="
+    PERIOD, // "."
+    PLUSEQ, // "+="
+    QUESTION, // "?"
+    RBRACE, // "}"
+    RBRACKET, // "]"
+    RPAREN, // ")"
+    RSHIFT, // ">>"
+    RSHIFTEQ, // ">>="
+    SEMI, // ";"
+    TILDE, // "~"
+    TIMESEQ, // "*="
+    XOR, // "^"
+    XOREQ, // "^="
+};
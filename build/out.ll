@@ -0,0 +1,21 @@
+define i32 @safe_div(i32 noundef %0, i32 noundef %1) {
+  %3 = alloca i32, align 4
+  %4 = alloca i32, align 4
+  store i32 %0, ptr %4, align 4
+  %5 = alloca i32, align 4
+  store i32 %1, ptr %5, align 4
+  %6 = load i32, ptr %5, align 4
+  %7 = icmp eq i32 %6, 0
+  br i1 %7, label %then.0, label %after.0
+
+then.0:
+  ret i32 0
+  br label %after.0
+
+after.0:
+  %9 = load i32, ptr %4, align 4
+  %10 = load i32, ptr %5, align 4
+  %11 = sdiv i32 %9, %10
+  ret i32 %11
+}
+
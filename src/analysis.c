@@ -1,85 +1,114 @@
 #include "analysis.h"
 #include "utils/ast.h"
 
-void analyze(ast_node *root) {
-  switch (root->type) {
-    case PRGM: {
-      for (size_t i = 0; i < root->ast_prgm.func_decls->len; ++i)
-        analyze((ast_node *)root->ast_prgm.func_decls->el[i]);
-    } break;
+// Returns operand, or a cast of it allocated from arena if its type isn't
+// the type its parent expects.
+static ast_node *castTo(arena_t *arena, TokenType type, ast_node *operand) {
+  if (type == operand->value)
+    return operand;
 
-    case FUNC_DECL: {
-      ast_node *scope = root->ast_func_decl.scope;
+  ast_node *cast =
+      create_unop(arena, operand, getImplicitCastOp(type, operand->value));
+  cast->value = type;
+  return cast;
+}
 
-      for (size_t i = 0; i < scope->ast_stmt.scope.stmts->len; ++i) {
-        ast_node *stmt = scope->ast_stmt.scope.stmts->el[i];
+typedef struct {
+  ast_node *node;
+  size_t step; // Operands analyzed so far
+} analysis_frame;
 
-        switch (stmt->ast_stmt.type) {
-          case RET_STMT: stmt->value = root->value; break;
-          default:       break;
-        }
+// Inserts implicit casts wherever an operand in root has a type other than
+// the one its operator expects. Operands are analyzed before their operator,
+// with a stack in the work stack arena of cc. Casts are allocated from arena.
+static void analyzeExpr(compiler_t *cc, arena_t *arena, ast_node *root) {
+  arena_stack s = arena_stack_init(&cc->stack, sizeof(analysis_frame));
+  *(analysis_frame *)arena_push(&s) = (analysis_frame){.node = root};
 
-        analyze(stmt);
-      }
-    } break;
+  while (s.len) {
+    analysis_frame *f = (analysis_frame *)arena_top(&s);
+    ast_node *node = f->node, *next = NULL;
 
-    case STMT: {
-      ast_node *expr = NULL;
-      switch (root->ast_stmt.type) {
-        case RET_STMT:   expr = root->ast_stmt.ret.expr; break;
-        case VAR_ASSIGN: expr = root->ast_stmt.var_assign.expr; break;
-        default:         return;
-      }
-
-      analyze(expr);
-
-      // if the types don't match, insert an implicit cast ast_node
-      if (root->value != expr->value) {
-        ast_node *cast =
-            create_unop(expr, getImplicitCastOp(root->value, expr->value));
-        cast->value = root->value;
-
-        switch (root->ast_stmt.type) {
-          case RET_STMT:   root->ast_stmt.ret.expr = cast; break;
-          case VAR_ASSIGN: root->ast_stmt.var_assign.expr = cast; break;
-          default:         break; // unreachable
+    switch (node->type) {
+      case EXPR_BINOP: {
+        switch (f->step++) {
+          case 0:  next = node->ast_binary_op.left; break;
+          case 1:  next = node->ast_binary_op.right; break;
+          default: {
+            node->ast_binary_op.left =
+                castTo(arena, node->value, node->ast_binary_op.left);
+            node->ast_binary_op.right =
+                castTo(arena, node->value, node->ast_binary_op.right);
+          } break;
         }
-      }
-    } break;
+      } break;
 
-    case EXPR_BINOP: {
-      analyze(root->ast_binary_op.left);
-      analyze(root->ast_binary_op.right);
-
-      if (root->value != root->ast_binary_op.left->value) {
-        ast_node *cast = create_unop(
-            root->ast_binary_op.left,
-            getImplicitCastOp(root->value, root->ast_binary_op.left->value));
-        cast->value = root->value;
-        root->ast_binary_op.left = cast;
-      }
-
-      if (root->value != root->ast_binary_op.right->value) {
-        ast_node *cast = create_unop(
-            root->ast_binary_op.right,
-            getImplicitCastOp(root->value, root->ast_binary_op.right->value));
-        cast->value = root->value;
-        root->ast_binary_op.right = cast;
-      }
-    } break;
+      case EXPR_UNOP: {
+        if (f->step++ == 0)
+          next = node->ast_unary_op.right;
+        else
+          node->ast_unary_op.right =
+              castTo(arena, node->value, node->ast_unary_op.right);
+      } break;
+
+      default: break;
+    }
+
+    if (next)
+      *(analysis_frame *)arena_push(&s) = (analysis_frame){.node = next};
+    else
+      arena_pop(&s);
+  }
+}
 
-    case EXPR_UNOP: {
-      analyze(root->ast_unary_op.right);
+// Analyzes the expression of the statement root, casting it to the type of
+// the statement if they differ.
+static void analyzeStmt(compiler_t *cc, arena_t *arena, ast_node *root) {
+  ast_node **expr = NULL;
+  switch (root->ast_stmt.type) {
+    case RET_STMT:   expr = &root->ast_stmt.ret.expr; break;
+    case VAR_ASSIGN: expr = &root->ast_stmt.var_assign.expr; break;
+    default:         return;
+  }
+
+  analyzeExpr(cc, arena, *expr);
+  *expr = castTo(arena, root->value, *expr);
+}
+
+// Analyzes the statements of the body of the function root. Its casts go in
+// the arena of its nodes, so they are freed with them when a reparse
+// replaces it, and a function kept by a reparse is not analyzed again.
+static void analyzeFunc(compiler_t *cc, ast_node *root) {
+  if (root->ast_func_decl.analyzed)
+    return;
+
+  root->ast_func_decl.analyzed = true;
+  arena_t *arena = root->ast_func_decl.arena;
+  ast_node *scope = func_body(cc, root);
+
+  for (size_t i = 0; i < scope->ast_stmt.scope.stmts->len; ++i) {
+    ast_node *stmt = scope->ast_stmt.scope.stmts->el[i];
+
+    switch (stmt->ast_stmt.type) {
+      case RET_STMT: stmt->value = root->value; break;
+      default:       break;
+    }
 
-      if (root->value != root->ast_unary_op.right->value) {
-        ast_node *cast = create_unop(
-            root->ast_unary_op.right,
-            getImplicitCastOp(root->value, root->ast_unary_op.right->value));
-        cast->value = root->value;
-        root->ast_unary_op.right = cast;
-      }
+    analyzeStmt(cc, arena, stmt);
+  }
+}
+
+// Inserts implicit casts into the functions of root that haven't had them
+// yet.
+void analyze(compiler_t *cc, ast_node *root) {
+  switch (root->type) {
+    case PRGM: {
+      for (size_t i = 0; i < root->ast_prgm.func_decls->len; ++i)
+        analyzeFunc(cc, (ast_node *)root->ast_prgm.func_decls->el[i]);
     } break;
 
-    default: break;
+    case FUNC_DECL: analyzeFunc(cc, root); break;
+    case STMT:      analyzeStmt(cc, &cc->arena, root); break;
+    default:        analyzeExpr(cc, &cc->arena, root); break;
   }
 }
@@ -4,4 +4,4 @@
 #include "utils/ast.h"
 #include "utils/llvm.h"
 
-void analyze(ast_node *root);
+void analyze(compiler_t *cc, ast_node *root);
@@ -5,431 +5,501 @@
 #include <stdio.h>
 #include <string.h>
 
-static size_t ssa = 0;
-static size_t loopIndex = 0;
-static size_t ifIndex = 0;
-static TokenType ret_type;
-
+// Returns whether root can be evaluated at compile time, which is recorded
+// in each node as it is created.
 bool isComptimeExpr(ast_node *root) {
   if (!root)
     return true;
 
   switch (root->type) {
-    case NUM_LIT: return true;
-    case EXPR_BINOP:
-      return isComptimeExpr(root->ast_binary_op.left) &&
-             isComptimeExpr(root->ast_binary_op.right);
-    case EXPR_UNOP: return isComptimeExpr(root->ast_unary_op.right);
+    case NUM_LIT:    return true;
+    case EXPR_BINOP: return root->ast_binary_op.comptime;
+    case EXPR_UNOP:  return root->ast_unary_op.comptime;
 
-    default:        return false;
+    default:         return false;
   }
 }
 
-double eval_tree(ast_node *root) {
-  if (!root)
-    return 0.0;
-
-  switch (root->type) {
-    case NUM_LIT:    return root->num_lit;
-    case EXPR_BINOP: {
-      double left = eval_tree(root->ast_binary_op.left);
-      double right = eval_tree(root->ast_binary_op.right);
-
-      switch (root->ast_binary_op.type) {
-        case OP_PLUS:  return left + right;
-        case OP_MINUS: return left - right;
-        case OP_TIMES: return left * right;
-        case OP_DIV:   return (right != 0) ? left / right : 0;
-
-        case OP_EQEQ:  return left == right;
-        case OP_NEQ:   return left != right;
-
-        case OP_GE:    return left >= right;
-        case OP_GT:    return left > right;
-        case OP_LE:    return left <= right;
-        case OP_LT:    return left < right;
-        default:       return 0;
+typedef struct {
+  ast_node *node;
+  double left;  // Value of the left operand, once evaluated
+  uint8_t step; // Operands evaluated so far
+} eval_frame;
+
+// Evaluates the constant expression root. Operands are evaluated on a stack
+// in the work stack arena of cc, not the C stack.
+double eval_tree(compiler_t *cc, ast_node *root) {
+  arena_stack s = arena_stack_init(&cc->stack, sizeof(eval_frame));
+  *(eval_frame *)arena_push(&s) = (eval_frame){.node = root};
+
+  // Value of the last operand evaluated
+  double value = 0.0;
+  while (s.len) {
+    eval_frame *f = (eval_frame *)arena_top(&s);
+    ast_node *node = f->node;
+
+    if (!node) {
+      value = 0.0;
+    } else if (node->type == NUM_LIT) {
+      value = node->num_lit;
+    } else if (node->type == EXPR_BINOP && f->step < 2) {
+      if (f->step++ == 1)
+        f->left = value;
+
+      ast_node *operand = f->step == 1 ? node->ast_binary_op.left
+                                       : node->ast_binary_op.right;
+      *(eval_frame *)arena_push(&s) = (eval_frame){.node = operand};
+      continue;
+    } else if (node->type == EXPR_BINOP) {
+      double left = f->left, right = value;
+
+      switch (node->ast_binary_op.type) {
+        case OP_PLUS:  value = left + right; break;
+        case OP_MINUS: value = left - right; break;
+        case OP_TIMES: value = left * right; break;
+        case OP_DIV:   value = (right != 0) ? left / right : 0; break;
+
+        case OP_EQEQ:  value = left == right; break;
+        case OP_NEQ:   value = left != right; break;
+
+        case OP_GE:    value = left >= right; break;
+        case OP_GT:    value = left > right; break;
+        case OP_LE:    value = left <= right; break;
+        case OP_LT:    value = left < right; break;
+        default:       value = 0; break;
       }
+    } else if (node->type == EXPR_UNOP && f->step++ == 0) {
+      *(eval_frame *)arena_push(&s) =
+          (eval_frame){.node = node->ast_unary_op.right};
+      continue;
+    } else if (node->type == EXPR_UNOP) {
+      if (node->ast_unary_op.type == NUM_NEG)
+        value = -value;
+    } else {
+      value = 0.0;
     }
-    case EXPR_UNOP: {
-      double right = eval_tree(root->ast_unary_op.right);
 
-      switch (root->ast_unary_op.type) {
-        case NUM_NEG: return -right;
-        case NUM_POS:
-        default:      return right;
-      }
-    }
-    default: return 0.0;
+    arena_pop(&s);
   }
+
+  return value;
 }
 
-void generate_llvm(ast_node *root, FILE *out) {
-  if (!root)
-    return;
+// Writes the instruction of the binary operation root, whose operands that
+// aren't constant have been generated, left first.
+static void emitBinop(compiler_t *cc, ast_node *root, FILE *out) {
+  size_t lhs = 0, rhs = 0;
+  bool lhs_comptime = isComptimeExpr(root->ast_binary_op.left);
+  bool rhs_comptime = isComptimeExpr(root->ast_binary_op.right);
 
-  switch (root->type) {
+  if (lhs_comptime)
+    lhs = (int)eval_tree(cc, root->ast_binary_op.left);
+  if (rhs_comptime)
+    rhs = (int)eval_tree(cc, root->ast_binary_op.right);
 
-    case PRGM: {
-      for (size_t i = 0; i < root->ast_prgm.func_decls->len; ++i)
-        generate_llvm((ast_node *)root->ast_prgm.func_decls->el[i], out);
+  bool has_comptime_expr = lhs_comptime || rhs_comptime;
 
-    } break;
+  switch (root->ast_binary_op.type) {
+    case OP_PLUS: {
+      if (asBasicType(root->value) == FLOAT)
+        fprintf(out, "  %%%lu = fadd %s ", cc->ssa, asLLVMType(root->value));
+      else
+        fprintf(out, "  %%%lu = add nsw %s ", cc->ssa, asLLVMType(root->value));
 
-    case FUNC_DECL: {
-      ret_type = root->value;
-      fprintf(out, "define %s @%s(", asLLVMType(ret_type),
-              root->ast_func_decl.ident);
+      if (!lhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li, ",
+              (lhs_comptime ? lhs : cc->ssa - (2 - (int)has_comptime_expr)));
 
-      for (size_t i = 0; i < root->ast_func_decl.params->len; ++i) {
-        ast_node *param = (ast_node *)root->ast_func_decl.params->el[i];
-        Symbol *sym = findInSymTable(param->ident);
-        sym->loc = ssa++;
+      if (!rhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li\n", (rhs_comptime ? rhs : cc->ssa - 1));
 
-        fprintf(out, "%s noundef %%%lu", asLLVMType(sym->type), sym->loc);
+      ++cc->ssa;
 
-        if (i + 1 == root->ast_func_decl.params->len)
-          break;
+    } break;
 
-        fprintf(out, ", ");
-      }
+    case OP_MINUS: {
+      fprintf(out, "  %%%lu = sub nsw i32 ", cc->ssa);
 
-      ++ssa;
-      fprintf(out, ") {\n");
+      if (!lhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li, ",
+              (lhs_comptime ? lhs : cc->ssa - (2 - (int)has_comptime_expr)));
 
-      fprintf(out, "  %%%lu = alloca %s, align %lu\n", ssa++,
-              asLLVMType(ret_type), getAlignment(ret_type));
+      if (!rhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li\n", (rhs_comptime ? rhs : cc->ssa - 1));
 
-      for (size_t i = 0; i < root->ast_func_decl.params->len; ++i) {
-        ast_node *param = (ast_node *)root->ast_func_decl.params->el[i];
-        Symbol *sym = findInSymTable(param->ident);
+      ++cc->ssa;
 
-        fprintf(out, "  %%%lu = alloca %s, align %lu\n", ssa,
-                asLLVMType(sym->type), getAlignment(sym->type));
-        fprintf(out, "  store %s %%%lu, ptr %%%lu, align %lu\n",
-                asLLVMType(sym->type), sym->loc, ssa, getAlignment(sym->type));
-        sym->loc = ssa;
-        ++ssa;
-      }
+    } break;
 
-      generate_llvm(root->ast_func_decl.scope, out);
+    case OP_TIMES: {
+      fprintf(out, "  %%%lu = mul nsw i32 ", cc->ssa);
 
-      fprintf(out, "}\n\n");
+      if (!lhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li, ",
+              (lhs_comptime ? lhs : cc->ssa - (2 - (int)has_comptime_expr)));
 
-    } break;
+      if (!rhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li\n", (rhs_comptime ? rhs : cc->ssa - 1));
 
-    case STMT: {
-      switch (root->ast_stmt.type) {
+      ++cc->ssa;
 
-        case SCOPE: {
-          for (size_t i = 0; i < root->ast_stmt.scope.stmts->len; ++i)
-            generate_llvm((ast_node *)root->ast_stmt.scope.stmts->el[i], out);
+    } break;
 
-        } break;
+    case OP_DIV: {
+      fprintf(out, "  %%%lu = sdiv i32 ", cc->ssa);
 
-        case VAR_ASSIGN: {
-          Symbol *var = findInSymTable(root->ast_stmt.var_assign.ident);
-          var->loc = ssa;
+      if (!lhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li, ",
+              (lhs_comptime ? lhs : cc->ssa - (2 - (int)has_comptime_expr)));
 
-          fprintf(out, "  %%%lu = alloca %s, align %lu\n", ssa++,
-                  asLLVMType(var->type), getAlignment(var->type));
+      if (!rhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li\n", (rhs_comptime ? rhs : cc->ssa - 1));
 
-          if (isComptimeExpr(root->ast_stmt.var_assign.expr)) {
-            double num = eval_tree(root->ast_stmt.var_assign.expr);
-            fprintf(out, "  store i32 %i, ptr %%%lu, align 4\n", (int)num,
-                    ssa - 1);
+      ++cc->ssa;
 
-            break;
-          }
+    } break;
 
-          generate_llvm(root->ast_stmt.var_assign.expr, out);
+    case OP_EQEQ: {
+      fprintf(out, "  %%%lu = icmp eq %s ", cc->ssa, asLLVMType(root->value));
 
-          fprintf(out, "  store %s %%%lu, ptr %%%lu, align %lu\n",
-                  asLLVMType(root->value), ssa - 1, var->loc,
-                  getAlignment(root->value));
+      if (!lhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li, ",
+              (lhs_comptime ? lhs : cc->ssa - (2 - (int)has_comptime_expr)));
 
-        } break;
+      if (!rhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li\n", (rhs_comptime ? rhs : cc->ssa - 1));
 
-        case REASSIGN: {
-          Symbol *var = findInSymTable(root->ast_stmt.var_assign.ident);
+      ++cc->ssa;
 
-          if (isComptimeExpr(root->ast_stmt.var_assign.expr)) {
-            double num = eval_tree(root->ast_stmt.var_assign.expr);
-            fprintf(out, "  store i32 %i, ptr %%%lu, align 4\n", (int)num,
-                    ssa - 1);
+    } break;
 
-            break;
-          }
+    case OP_GT: {
+      fprintf(out, "  %%%lu = icmp sgt %s ", cc->ssa, asLLVMType(root->value));
 
-          generate_llvm(root->ast_stmt.var_assign.expr, out);
+      if (!lhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li, ",
+              (lhs_comptime ? lhs : cc->ssa - (2 - (int)has_comptime_expr)));
 
-          fprintf(out, "  store %s %%%lu, ptr %%%lu, align %lu\n",
-                  asLLVMType(root->value), ssa - 1, var->loc,
-                  getAlignment(root->value));
+      if (!rhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li\n", (rhs_comptime ? rhs : cc->ssa - 1));
 
-        } break;
+      ++cc->ssa;
 
-        case RET_STMT: {
-          if (isComptimeExpr(root->ast_stmt.ret.expr)) {
-            double num = eval_tree(root->ast_stmt.ret.expr);
-            fprintf(out, "  ret %s ", asLLVMType(ret_type));
-
-            switch (ret_type) {
-              case CHAR:   fprintf(out, "%i", (char)num); break;
-              case SHORT:  fprintf(out, "%i", (short)num); break;
-              case INT:    fprintf(out, "%i", (int)num); break;
-              case LONG:   fprintf(out, "%li", (long)num); break;
-              case FLOAT:  fprintf(out, "%f", (float)num); break;
-              case DOUBLE: fprintf(out, "%lf", (double)num); break;
-              default:     break;
-            }
+    } break;
 
-            fprintf(out, "\n");
+    case OP_LT: {
+      fprintf(out, "  %%%lu = icmp slt %s ", cc->ssa, asLLVMType(root->value));
 
-            break;
-          }
+      if (!lhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li, ",
+              (lhs_comptime ? lhs : cc->ssa - (2 - (int)has_comptime_expr)));
 
-          generate_llvm(root->ast_stmt.ret.expr, out);
+      if (!rhs_comptime)
+        fprintf(out, "%%");
+      fprintf(out, "%li\n", (rhs_comptime ? rhs : cc->ssa - 1));
 
-          fprintf(out, "  ret %s %%%lu\n", asLLVMType(ret_type), ssa - 1);
+      ++cc->ssa;
 
-        } break;
+    } break;
 
-        case IF_STMT: {
-          generate_llvm(root->ast_stmt.if_stmt.pred, out);
+    default: break;
+  }
+}
 
-          fprintf(out, "  br i1 %%%lu, label %%then.%lu, label %%%s.%lu\n",
-                  ssa - 1, ifIndex,
-                  (root->ast_stmt.if_stmt.alt) ? "else" : "after", ifIndex);
-          fprintf(out, "\nthen.%lu:\n", ifIndex);
-          ++ssa;
+// Writes the instruction of the unary operation root, whose operand has been
+// generated.
+static void emitUnop(compiler_t *cc, ast_node *root, FILE *out) {
+  switch (root->ast_unary_op.type) {
+    case NUM_NEG: {
+      fprintf(out, "  %%%lu = sub nsw 0, i32 %%%lu\n", cc->ssa, cc->ssa - 1);
+      ++cc->ssa;
 
-          generate_llvm(root->ast_stmt.if_stmt.scope, out);
-          fprintf(out, "  br label %%after.%lu\n", ifIndex);
+    } break;
 
-          if (root->ast_stmt.if_stmt.alt) {
-            fprintf(out, "\nelse.%lu:\n", ifIndex);
-            generate_llvm(root->ast_stmt.if_stmt.alt, out);
-            fprintf(out, "  br label %%after.%lu\n", ifIndex);
-          }
+    case EXTEND: {
+      switch (asBasicType(root->value)) {
+        case INT:   fprintf(out, "  %%%lu = sext ", cc->ssa); break;
+        case FLOAT: fprintf(out, "  %%%lu = fpext ", cc->ssa); break;
+        default:    break;
+      }
 
-          fprintf(out, "\nafter.%lu:\n", ifIndex);
+      fprintf(out, "%s %%%lu to %s\n",
+              asLLVMType(root->ast_unary_op.right->value), cc->ssa - 1,
+              asLLVMType(root->value));
+      ++cc->ssa;
+    } break;
 
-          ++ifIndex;
+    case TRUNC: {
+      switch (asBasicType(root->value)) {
+        case INT:   fprintf(out, "  %%%lu = trunc ", cc->ssa); break;
+        case FLOAT: fprintf(out, "  %%%lu = fptrunc ", cc->ssa); break;
+        default:    break;
+      }
 
-        } break;
+      fprintf(out, "%s %%%lu to %s\n",
+              asLLVMType(root->ast_unary_op.right->value), cc->ssa - 1,
+              asLLVMType(root->value));
+      ++cc->ssa;
+    } break;
 
-        case WHILE_STMT: {
-          size_t loop_start = ssa;
-          fprintf(out, "  br label %%%lu\n", loop_start);
-          fprintf(out, "\n%lu:\n", loop_start);
-          ++ssa;
+    case INT_TOFLOAT: {
+      fprintf(out, "  %%%lu = sitofp %s %%%lu to %s\n", cc->ssa,
+              asLLVMType(root->ast_unary_op.right->value), cc->ssa - 1,
+              asLLVMType(root->value));
+      ++cc->ssa;
+    } break;
 
-          generate_llvm(root->ast_stmt.while_stmt.pred, out);
+    case FLOAT_TOINT: {
+      fprintf(out, "  %%%lu = fptosi %s %%%lu to %s\n", cc->ssa,
+              asLLVMType(root->ast_unary_op.right->value), cc->ssa - 1,
+              asLLVMType(root->value));
+      ++cc->ssa;
+    } break;
 
-          fprintf(out, "  br i1 %%%lu, label %%loop.%lu, label %%exit.%lu\n",
-                  ssa - 1, loopIndex, loopIndex);
-          fprintf(out, "\nloop.%lu:\n", loopIndex);
-          ++ssa;
+    default: break;
+  }
+}
 
-          generate_llvm(root->ast_stmt.while_stmt.scope, out);
-          fprintf(out, "  br label %%%lu\n", loop_start);
+// Writes the start of the function root, up to its body.
+static void emitPrologue(compiler_t *cc, ast_node *root, FILE *out) {
+  cc->ret_type = root->value;
+  fprintf(out, "define %s @%s(", asLLVMType(cc->ret_type),
+          atom_name(&idents, root->ast_func_decl.ident));
 
-          fprintf(out, "\nexit.%lu:\n", loopIndex);
+  for (size_t i = 0; i < root->ast_func_decl.params->len; ++i) {
+    ast_node *param = (ast_node *)root->ast_func_decl.params->el[i];
+    Symbol *sym = param->sym;
+    sym->loc = cc->ssa++;
 
-        } break;
+    fprintf(out, "%s noundef %%%lu", asLLVMType(sym->type), sym->loc);
 
-        default: break;
-      }
+    if (i + 1 == root->ast_func_decl.params->len)
+      break;
 
-    } break;
+    fprintf(out, ", ");
+  }
 
-    case EXPR_BINOP: {
-      size_t lhs, rhs;
-      bool lhs_comptime = false, rhs_comptime = false;
+  ++cc->ssa;
+  fprintf(out, ") {\n");
 
-      if ((lhs_comptime = isComptimeExpr(root->ast_binary_op.left)))
-        lhs = (int)eval_tree(root->ast_binary_op.left);
-      else
-        generate_llvm(root->ast_binary_op.left, out);
+  fprintf(out, "  %%%lu = alloca %s, align %lu\n", cc->ssa++,
+          asLLVMType(cc->ret_type), getAlignment(cc->ret_type));
 
-      if ((rhs_comptime = isComptimeExpr(root->ast_binary_op.right)))
-        rhs = (int)eval_tree(root->ast_binary_op.right);
-      else
-        generate_llvm(root->ast_binary_op.right, out);
+  for (size_t i = 0; i < root->ast_func_decl.params->len; ++i) {
+    ast_node *param = (ast_node *)root->ast_func_decl.params->el[i];
+    Symbol *sym = param->sym;
 
-      bool has_comptime_expr = lhs_comptime || rhs_comptime;
+    fprintf(out, "  %%%lu = alloca %s, align %lu\n", cc->ssa,
+            asLLVMType(sym->type), getAlignment(sym->type));
+    fprintf(out, "  store %s %%%lu, ptr %%%lu, align %lu\n",
+            asLLVMType(sym->type), sym->loc, cc->ssa,
+            getAlignment(sym->type));
+    sym->loc = cc->ssa;
+    ++cc->ssa;
+  }
+}
 
-      switch (root->ast_binary_op.type) {
+// Writes the return of the constant expr from the current function.
+static void emitConstRet(compiler_t *cc, ast_node *expr, FILE *out) {
+  double num = eval_tree(cc, expr);
+  fprintf(out, "  ret %s ", asLLVMType(cc->ret_type));
+
+  switch (cc->ret_type) {
+    case CHAR:   fprintf(out, "%i", (char)num); break;
+    case SHORT:  fprintf(out, "%i", (short)num); break;
+    case INT:    fprintf(out, "%i", (int)num); break;
+    case LONG:   fprintf(out, "%li", (long)num); break;
+    case FLOAT:  fprintf(out, "%f", (float)num); break;
+    case DOUBLE: fprintf(out, "%lf", (double)num); break;
+    default:     break;
+  }
 
-        case OP_PLUS: {
-          if (asBasicType(root->value) == FLOAT)
-            fprintf(out, "  %%%lu = fadd %s ", ssa, asLLVMType(root->value));
-          else
-            fprintf(out, "  %%%lu = add nsw %s ", ssa, asLLVMType(root->value));
+  fprintf(out, "\n");
+}
 
-          if (!lhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li, ",
-                  (lhs_comptime ? lhs : ssa - (2 - (int)has_comptime_expr)));
+typedef struct {
+  ast_node *node;
+  size_t step;  // Children generated so far, or the part of an if or while
+  size_t label; // Of the start of a while loop
+} gen_frame;
 
-          if (!rhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li\n", (rhs_comptime ? rhs : ssa - 1));
+// Writes what comes before the next child of the node of f is generated, or
+// after the last one. Returns the child, or NULL once the node is done.
+static ast_node *genStep(compiler_t *cc, gen_frame *f, FILE *out) {
+  ast_node *root = f->node;
 
-          ++ssa;
+  switch (root->type) {
 
-        } break;
+    case PRGM: {
+      // Numbering starts over, so a program generated again after a
+      // reparse is numbered as if compiled from scratch.
+      if (f->step == 0)
+        cc->ssa = cc->loop_index = cc->if_index = 0;
+      if (f->step < root->ast_prgm.func_decls->len)
+        return (ast_node *)root->ast_prgm.func_decls->el[f->step++];
 
-        case OP_MINUS: {
-          fprintf(out, "  %%%lu = sub nsw i32 ", ssa);
+    } break;
 
-          if (!lhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li, ",
-                  (lhs_comptime ? lhs : ssa - (2 - (int)has_comptime_expr)));
+    case FUNC_DECL: {
+      if (f->step++ == 0) {
+        emitPrologue(cc, root, out);
+        return func_body(cc, root);
+      }
 
-          if (!rhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li\n", (rhs_comptime ? rhs : ssa - 1));
+      fprintf(out, "}\n\n");
 
-          ++ssa;
+    } break;
 
-        } break;
+    case STMT: {
+      switch (root->ast_stmt.type) {
 
-        case OP_TIMES: {
-          fprintf(out, "  %%%lu = mul nsw i32 ", ssa);
+        case SCOPE: {
+          if (f->step < root->ast_stmt.scope.stmts->len)
+            return (ast_node *)root->ast_stmt.scope.stmts->el[f->step++];
 
-          if (!lhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li, ",
-                  (lhs_comptime ? lhs : ssa - (2 - (int)has_comptime_expr)));
+        } break;
 
-          if (!rhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li\n", (rhs_comptime ? rhs : ssa - 1));
+        case VAR_ASSIGN: {
+          Symbol *var = root->sym;
+          ast_node *expr = root->ast_stmt.var_assign.expr;
 
-          ++ssa;
+          if (f->step++ == 0) {
+            var->loc = cc->ssa;
 
-        } break;
+            fprintf(out, "  %%%lu = alloca %s, align %lu\n", cc->ssa++,
+                    asLLVMType(var->type), getAlignment(var->type));
 
-        case OP_DIV: {
-          fprintf(out, "  %%%lu = sdiv i32 ", ssa);
+            if (!isComptimeExpr(expr))
+              return expr;
 
-          if (!lhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li, ",
-                  (lhs_comptime ? lhs : ssa - (2 - (int)has_comptime_expr)));
+            double num = eval_tree(cc, expr);
+            fprintf(out, "  store i32 %i, ptr %%%lu, align 4\n", (int)num,
+                    cc->ssa - 1);
 
-          if (!rhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li\n", (rhs_comptime ? rhs : ssa - 1));
+            break;
+          }
 
-          ++ssa;
+          fprintf(out, "  store %s %%%lu, ptr %%%lu, align %lu\n",
+                  asLLVMType(root->value), cc->ssa - 1, var->loc,
+                  getAlignment(root->value));
 
         } break;
 
-        case OP_EQEQ: {
-          fprintf(out, "  %%%lu = icmp eq %s ", ssa, asLLVMType(root->value));
+        case REASSIGN: {
+          Symbol *var = root->sym;
+          ast_node *expr = root->ast_stmt.var_assign.expr;
+
+          if (f->step++ == 0) {
+            if (!isComptimeExpr(expr))
+              return expr;
 
-          if (!lhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li, ",
-                  (lhs_comptime ? lhs : ssa - (2 - (int)has_comptime_expr)));
+            double num = eval_tree(cc, expr);
+            fprintf(out, "  store i32 %i, ptr %%%lu, align 4\n", (int)num,
+                    cc->ssa - 1);
 
-          if (!rhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li\n", (rhs_comptime ? rhs : ssa - 1));
+            break;
+          }
 
-          ++ssa;
+          fprintf(out, "  store %s %%%lu, ptr %%%lu, align %lu\n",
+                  asLLVMType(root->value), cc->ssa - 1, var->loc,
+                  getAlignment(root->value));
 
         } break;
 
-        case OP_GT: {
-          fprintf(out, "  %%%lu = icmp sgt %s ", ssa, asLLVMType(root->value));
+        case RET_STMT: {
+          ast_node *expr = root->ast_stmt.ret.expr;
 
-          if (!lhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li, ",
-                  (lhs_comptime ? lhs : ssa - (2 - (int)has_comptime_expr)));
+          if (f->step++ == 0) {
+            if (!isComptimeExpr(expr))
+              return expr;
 
-          if (!rhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li\n", (rhs_comptime ? rhs : ssa - 1));
+            emitConstRet(cc, expr, out);
+            break;
+          }
 
-          ++ssa;
+          fprintf(out, "  ret %s %%%lu\n", asLLVMType(cc->ret_type),
+                  cc->ssa - 1);
 
         } break;
 
-        case OP_LT: {
-          fprintf(out, "  %%%lu = icmp slt %s ", ssa, asLLVMType(root->value));
+        case IF_STMT: {
+          ast_node *alt = root->ast_stmt.if_stmt.alt;
 
-          if (!lhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li, ",
-                  (lhs_comptime ? lhs : ssa - (2 - (int)has_comptime_expr)));
+          switch (f->step++) {
+            case 0: return root->ast_stmt.if_stmt.pred;
 
-          if (!rhs_comptime)
-            fprintf(out, "%%");
-          fprintf(out, "%li\n", (rhs_comptime ? rhs : ssa - 1));
+            case 1: {
+              fprintf(out,
+                      "  br i1 %%%lu, label %%then.%lu, label %%%s.%lu\n",
+                      cc->ssa - 1, cc->if_index, alt ? "else" : "after",
+                      cc->if_index);
+              fprintf(out, "\nthen.%lu:\n", cc->if_index);
+              ++cc->ssa;
 
-          ++ssa;
+              return root->ast_stmt.if_stmt.scope;
+            }
 
-        } break;
+            case 2: {
+              fprintf(out, "  br label %%after.%lu\n", cc->if_index);
 
-        default: break;
-      }
+              if (alt) {
+                fprintf(out, "\nelse.%lu:\n", cc->if_index);
+                return alt;
+              }
+            } break;
 
-    } break;
+            default: {
+              fprintf(out, "  br label %%after.%lu\n", cc->if_index);
+            } break;
+          }
 
-    case EXPR_UNOP: {
-      generate_llvm(root->ast_unary_op.right, out);
+          fprintf(out, "\nafter.%lu:\n", cc->if_index);
 
-      switch (root->ast_unary_op.type) {
-        case NUM_NEG: {
-          fprintf(out, "  %%%lu = sub nsw 0, i32 %%%lu\n", ssa, ssa - 1);
-          ++ssa;
+          ++cc->if_index;
 
         } break;
 
-        case EXTEND: {
-          switch (asBasicType(root->value)) {
-            case INT:   fprintf(out, "  %%%lu = sext ", ssa); break;
-            case FLOAT: fprintf(out, "  %%%lu = fpext ", ssa); break;
-            default:    break;
-          }
+        case WHILE_STMT: {
+          switch (f->step++) {
+            case 0: {
+              f->label = cc->ssa;
+              fprintf(out, "  br label %%%lu\n", f->label);
+              fprintf(out, "\n%lu:\n", f->label);
+              ++cc->ssa;
+
+              return root->ast_stmt.while_stmt.pred;
+            }
 
-          fprintf(out, "%s %%%lu to %s\n",
-                  asLLVMType(root->ast_unary_op.right->value), ssa - 1,
-                  asLLVMType(root->value));
-          ++ssa;
-        } break;
+            case 1: {
+              fprintf(out,
+                      "  br i1 %%%lu, label %%loop.%lu, label %%exit.%lu\n",
+                      cc->ssa - 1, cc->loop_index, cc->loop_index);
+              fprintf(out, "\nloop.%lu:\n", cc->loop_index);
+              ++cc->ssa;
 
-        case TRUNC: {
-          switch (asBasicType(root->value)) {
-            case INT:   fprintf(out, "  %%%lu = trunc ", ssa); break;
-            case FLOAT: fprintf(out, "  %%%lu = fptrunc ", ssa); break;
-            default:    break;
-          }
+              return root->ast_stmt.while_stmt.scope;
+            }
 
-          fprintf(out, "%s %%%lu to %s\n",
-                  asLLVMType(root->ast_unary_op.right->value), ssa - 1,
-                  asLLVMType(root->value));
-          ++ssa;
-        } break;
+            default: {
+              fprintf(out, "  br label %%%lu\n", f->label);
 
-        case INT_TOFLOAT: {
-          fprintf(out, "  %%%lu = sitofp %s %%%lu to %s\n", ssa,
-                  asLLVMType(root->ast_unary_op.right->value), ssa - 1,
-                  asLLVMType(root->value));
-          ++ssa;
-        } break;
+              fprintf(out, "\nexit.%lu:\n", cc->loop_index);
+            } break;
+          }
 
-        case FLOAT_TOINT: {
-          fprintf(out, "  %%%lu = fptosi %s %%%lu to %s\n", ssa,
-                  asLLVMType(root->ast_unary_op.right->value), ssa - 1,
-                  asLLVMType(root->value));
-          ++ssa;
         } break;
 
         default: break;
@@ -437,34 +507,53 @@ void generate_llvm(ast_node *root, FILE *out) {
 
     } break;
 
+    // Operands that are constant are written as numbers rather than
+    // generated.
+    case EXPR_BINOP: {
+      if (f->step == 0) {
+        f->step = 1;
+        if (!isComptimeExpr(root->ast_binary_op.left))
+          return root->ast_binary_op.left;
+      }
+
+      if (f->step == 1) {
+        f->step = 2;
+        if (!isComptimeExpr(root->ast_binary_op.right))
+          return root->ast_binary_op.right;
+      }
+
+      emitBinop(cc, root, out);
+
+    } break;
+
+    case EXPR_UNOP: {
+      if (f->step++ == 0)
+        return root->ast_unary_op.right;
+
+      emitUnop(cc, root, out);
+
+    } break;
+
     case IDENT_NODE: {
-      Symbol *ident = findInSymTable(root->ident);
-      assert(ident, "Identifier referenced before declaration.\n");
+      Symbol *ident = root->sym;
 
-      fprintf(out, "  %%%lu = load %s, ptr %%%lu, align %lu\n", ssa,
+      fprintf(out, "  %%%lu = load %s, ptr %%%lu, align %lu\n", cc->ssa,
               asLLVMType(ident->type), ident->loc, getAlignment(ident->type));
-      ++ssa;
+      ++cc->ssa;
 
       root->value = ident->type;
 
     } break;
 
     case FUNC_CALL: {
-      Symbol *ident = findInSymTable(root->ast_func_call.ident);
-      assert(ident, "Call to undefined function.\n");
-
-      for (size_t i = 0; i < root->ast_func_call.args->len; ++i) {
-        ast_node *expr = (ast_node *)root->ast_func_call.args->el[i];
-        if (isComptimeExpr(expr)) {
-          // double num = eval_tree(expr);
-        }
+      Symbol *ident = root->sym;
 
-        generate_llvm((ast_node *)root->ast_func_call.args->el[i], out);
-      }
+      if (f->step < root->ast_func_call.args->len)
+        return (ast_node *)root->ast_func_call.args->el[f->step++];
 
-      fprintf(out, "  %%%lu = call %s @%s(", ssa, asLLVMType(ident->type),
-              ident->ident);
-      ssa++;
+      fprintf(out, "  %%%lu = call %s @%s(", cc->ssa, asLLVMType(ident->type),
+              atom_name(&idents, ident->ident));
+      cc->ssa++;
 
       fprintf(out, ")\n");
 
@@ -472,4 +561,25 @@ void generate_llvm(ast_node *root, FILE *out) {
 
     default: break;
   }
+
+  return NULL;
+}
+
+// Writes the LLVM IR of root to out, numbering values and labels with the
+// counters of cc. Nodes are visited with a stack in the work stack arena of
+// cc, so a deeply nested program can't overflow the C stack.
+void generate_llvm(compiler_t *cc, ast_node *root, FILE *out) {
+  if (!root)
+    return;
+
+  arena_stack s = arena_stack_init(&cc->stack, sizeof(gen_frame));
+  *(gen_frame *)arena_push(&s) = (gen_frame){.node = root};
+
+  while (s.len) {
+    ast_node *child = genStep(cc, (gen_frame *)arena_top(&s), out);
+    if (child)
+      *(gen_frame *)arena_push(&s) = (gen_frame){.node = child};
+    else
+      arena_pop(&s);
+  }
 }
@@ -7,6 +7,6 @@
 #include <fcntl.h>
 #include <stdio.h>
 
-void generate_x64(ast_node *root, FILE *out);
-void generate_arm(ast_node *root, FILE *out);
-void generate_llvm(ast_node *root, FILE *out);
+void generate_x64(compiler_t *cc, ast_node *root, FILE *out);
+void generate_arm(compiler_t *cc, ast_node *root, FILE *out);
+void generate_llvm(compiler_t *cc, ast_node *root, FILE *out);
@@ -0,0 +1,215 @@
+#include "compiler.h"
+#include "utils/assert.h"
+#include "utils/ast.h"
+#include <stdarg.h>
+
+// Least size of the arena AST nodes and symbols are allocated from.
+#define AST_ARENA (1024 * 1024 * 4)
+
+// Initial number of name slots and scope depths.
+#define SYM_SLOTS 64
+#define SCOPE_DEPTHS 16
+
+// Returns the size of arena that holds the nodes and symbols made from
+// tokens tokens. Each token gives at most one node and one symbol, and
+// analysis adds at most a cast per node. Pages of the arena that are never
+// used are never touched, so this costs address space rather than memory.
+static size_t arenaSize(size_t tokens) {
+  size_t size = tokens * (2 * sizeof(ast_node) + sizeof(Symbol));
+  return size < AST_ARENA ? AST_ARENA : size;
+}
+
+// Sets up cc with an arena of size bytes, and a work stack arena as large.
+// Every level of nesting in the AST comes from at least one token, so the
+// stack holds more levels than there are nodes. The number of tokens of a
+// stream isn't known up front, so the arena chains more blocks as it fills
+// and the stack grows when it is full.
+static void init(compiler_t *cc, str src, tok_buf *toks, size_t size) {
+  *cc = (compiler_t){.src = src, .toks = toks, .decls = dyn_init(5)};
+  arena_init_chained(&cc->arena, size);
+  arena_init(&cc->stack, size);
+
+  sym_table *t = &cc->syms;
+  t->cap = SYM_SLOTS;
+  t->slots = (sym_slot *)calloc(t->cap, sizeof(sym_slot));
+  t->max_depth = SCOPE_DEPTHS;
+  t->open = (uint32_t *)calloc(t->max_depth, sizeof(uint32_t));
+  assert(t->slots && t->open, "Allocation failed");
+}
+
+void compiler_init(compiler_t *cc, str src, tok_buf *toks) {
+  init(cc, src, toks,
+       arenaSize(toks && !toks->stream ? toks->base + toks->len : 0));
+}
+
+// Sets up worker to parse part of the tokens of cc, tokens of them, while
+// cc waits. Names the worker has no declaration of are looked up in the
+// file scope of cc.
+void compiler_init_worker(compiler_t *worker, compiler_t *cc, size_t tokens) {
+  init(worker, cc->src, cc->toks, arenaSize(tokens));
+  worker->lazy = cc->lazy;
+  worker->syms.outer = &cc->syms;
+}
+
+// Frees the symbol table, the arena and those of the workers. The AST must
+// be destroyed first, as its nodes live in the arenas.
+void compiler_destroy(compiler_t *cc) {
+  for (size_t w = 0; w < cc->nworkers; ++w) {
+    compiler_destroy(cc->workers[w]);
+    free(cc->workers[w]);
+  }
+  free(cc->workers);
+  free(cc->funcs);
+  free(cc->diags);
+
+  free(cc->syms.slots);
+  free(cc->syms.open);
+  dyn_destroy(cc->decls);
+  arena_destroy(&cc->arena);
+  arena_destroy(&cc->stack);
+}
+
+// Returns the slot of ident, or the empty slot it would go in.
+static sym_slot *findSlot(sym_table *t, uint32_t ident) {
+  size_t mask = t->cap - 1;
+  size_t k = (ident * 0x9E3779B1u) & mask;
+  while (t->slots[k].ident != ident && t->slots[k].ident != NO_ATOM)
+    k = (k + 1) & mask;
+
+  return &t->slots[k];
+}
+
+// Doubles the number of slots once three quarters are used.
+static void grow(sym_table *t) {
+  sym_slot *old = t->slots;
+  size_t cap = t->cap;
+
+  t->cap *= 2;
+  t->slots = (sym_slot *)calloc(t->cap, sizeof(sym_slot));
+  assert(t->slots, "Allocation failed");
+  for (size_t k = 0; k < cap; ++k)
+    if (old[k].ident != NO_ATOM)
+      *findSlot(t, old[k].ident) = old[k];
+
+  free(old);
+}
+
+static inline bool isOpen(sym_table *t, Symbol *sym) {
+  return sym->depth <= t->depth && t->open[sym->depth] == sym->scope;
+}
+
+// Returns the innermost declaration in slot whose scope is still open,
+// dropping the ones in front of it. Scopes close innermost first, so the
+// declarations a name's open one shadows are in enclosing scopes and open
+// too.
+static Symbol *innermost(sym_table *t, sym_slot *slot) {
+  Symbol *sym = slot->sym;
+  while (sym && !isOpen(t, sym))
+    sym = sym->shadowed;
+
+  slot->sym = sym;
+  return sym;
+}
+
+// Opens a scope nested in the current one.
+void scope_enter(compiler_t *cc) {
+  sym_table *t = &cc->syms;
+  if (++t->depth == t->max_depth) {
+    t->max_depth *= 2;
+    t->open = (uint32_t *)realloc(t->open, sizeof(uint32_t) * t->max_depth);
+    assert(t->open, "Allocation failed");
+  }
+
+  t->open[t->depth] = ++t->serial;
+}
+
+// Closes the current scope, ending its declarations.
+void scope_exit(compiler_t *cc) {
+  assert(cc->syms.depth > 0, "File scope closed");
+  --cc->syms.depth;
+}
+
+// Declares ident in the current scope, hiding any declaration of it in an
+// enclosing one.
+Symbol *sym_declare(compiler_t *cc, uint32_t ident, TokenType type) {
+  Symbol *sym = arena_alloc_type(&cc->arena, Symbol);
+  assert(sym, "Out of memory for symbols");
+  *sym = (Symbol){.ident = ident, .type = type};
+
+  sym_bind(cc, sym);
+  dyn_push(cc->decls, sym);
+  return sym;
+}
+
+// Brings a symbol declared earlier into the current scope, as parameters
+// are when the body of their function is parsed after their scope closed.
+void sym_bind(compiler_t *cc, Symbol *sym) {
+  sym_table *t = &cc->syms;
+  if ((t->used + 1) * 4 > t->cap * 3)
+    grow(t);
+
+  sym_slot *slot = findSlot(t, sym->ident);
+  if (slot->ident == NO_ATOM) {
+    slot->ident = sym->ident;
+    ++t->used;
+  }
+
+  sym->shadowed = innermost(t, slot);
+  sym->depth = t->depth;
+  sym->scope = t->open[t->depth];
+  slot->sym = sym;
+}
+
+// Returns the declaration ident refers to at the parser's place, or NULL
+// if none is in scope.
+Symbol *sym_lookup(compiler_t *cc, uint32_t ident) {
+  sym_table *t = &cc->syms;
+  sym_slot *slot = findSlot(t, ident);
+  Symbol *sym = slot->ident == NO_ATOM ? NULL : innermost(t, slot);
+
+  // The outer table only has file scope, which never closes, so its slots
+  // hold open declarations and can be read as they are.
+  if (!sym && t->outer)
+    sym = findSlot((sym_table *)t->outer, ident)->sym;
+
+  return sym;
+}
+
+// Adds a copy of diag to the errors of cc, after those found at or before
+// its token. Errors are mostly found in order, so this is usually an append.
+void diag_add(compiler_t *cc, const diagnostic *diag) {
+  if (cc->ndiags == cc->diags_cap) {
+    cc->diags_cap = cc->diags_cap ? cc->diags_cap * 2 : 16;
+    cc->diags = (diagnostic *)realloc(cc->diags,
+                                      sizeof(diagnostic) * cc->diags_cap);
+    assert(cc->diags, "Allocation failed");
+  }
+
+  size_t k = cc->ndiags++;
+  for (; k > 0 && cc->diags[k - 1].tok > diag->tok; --k)
+    cc->diags[k] = cc->diags[k - 1];
+  cc->diags[k] = *diag;
+}
+
+// Records an error at token tok, with a message formatted from fmt.
+void diag_report(compiler_t *cc, size_t tok, const char *fmt, ...) {
+  diagnostic diag = {.tok = tok};
+  diag.loc = tok_locate(cc->toks, tok_get(cc->toks, tok).start);
+
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(diag.msg, sizeof(diag.msg), fmt, args);
+  va_end(args);
+
+  diag_add(cc, &diag);
+}
+
+// Writes the errors of cc to out, one per line, in source order.
+void diag_print(compiler_t *cc, FILE *out) {
+  for (size_t k = 0; k < cc->ndiags; ++k) {
+    diagnostic *diag = &cc->diags[k];
+    fprintf(out, "%s on line %lu, column %lu", diag->msg, diag->loc.line,
+            diag->loc.col);
+    fprintf(out, diag->loc.path ? " of %s\n" : "\n", diag->loc.path);
+  }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "tokens.h"
+#include "utils/arena.h"
+#include "utils/dynarray.h"
+#include <stdio.h>
+
+typedef struct Symbol {
+  uint32_t ident;
+  TokenType type;
+  size_t loc;
+  bool func; // Names a function, which isn't a variable
+
+  struct Symbol *shadowed; // Declaration of the same name this one hides
+  uint32_t depth;          // Depth of the scope it was declared in
+  uint32_t scope;          // Serial of that scope
+} Symbol;
+
+typedef struct {
+  uint32_t ident; // NO_ATOM while the slot is empty
+  Symbol *sym;    // Innermost declaration of ident, which may have ended
+} sym_slot;
+
+// Declarations visible at the parser's place, by name. Each name has one
+// slot holding its innermost declaration, which links to the ones it
+// shadows, so a lookup is one probe. Leaving a scope only closes it: a
+// declaration from a closed scope is recognized by its depth and serial no
+// longer being open, and is unlinked the next time its name is looked up.
+typedef struct sym_table {
+  sym_slot *slots;
+  size_t cap;  // Power of two
+  size_t used; // Slots holding a name
+
+  uint32_t *open; // Serial of the open scope at each depth
+  size_t depth;   // Depth of the innermost open scope, 0 for file scope
+  size_t max_depth;
+  uint32_t serial; // Serial of the last scope opened
+
+  // File scope declarations of another table, seen where this one has none
+  // for a name. It is only read, so it must not change while this is used.
+  const struct sym_table *outer;
+} sym_table;
+
+// Longest message of a diagnostic, which is cut short beyond it.
+#define DIAG_MSG 96
+
+// An error found in the source, located when it was found, as a streamed
+// token can't be located once it is dropped.
+typedef struct diagnostic {
+  size_t tok; // Index of the token it was found at
+  src_loc loc;
+  char msg[DIAG_MSG];
+} diagnostic;
+
+// State of one compilation: the parser's place in the tokens, the symbols
+// declared so far, the arena AST nodes come from, and the counters code
+// generation numbers values and labels with. Every pass takes it explicitly,
+// so compilations on separate threads share nothing but the interned
+// identifiers.
+typedef struct compiler_t {
+  str src;
+  tok_buf *toks;
+  size_t pos; // Index of the token being parsed
+  bool lazy;  // Skip function bodies until they are asked for (func_body())
+
+  sym_table syms;   // Symbols in scope
+  dyn_array *decls; // Every symbol, in the order they were declared
+  dyn_array *early; // Calls made ahead of any declaration (try_parse_prgm())
+  arena_t arena;    // AST nodes and symbols
+  arena_t stack;    // Work stacks of the parser and the passes over the AST
+
+  size_t ssa;         // Next unnamed LLVM value
+  size_t loop_index;  // Label of the next while loop
+  size_t if_index;    // Label of the next if statement
+  TokenType ret_type; // Return type of the function being generated
+
+  // Errors found by the parser, in the order of their tokens
+  diagnostic *diags;
+  size_t ndiags, diags_cap;
+  bool panic; // An error was reported and the parser hasn't resynchronized
+
+  // Contexts function bodies were parsed in, which own their nodes and
+  // symbols
+  struct compiler_t **workers;
+  size_t nworkers;
+  size_t live; // Functions still in the program, if this is a worker
+
+  // Top-level functions as scanned by parse_parallel(), for reparse()
+  struct func_span *funcs;
+  size_t nfuncs;
+} compiler_t;
+
+void compiler_init(compiler_t *cc, str src, tok_buf *toks);
+void compiler_init_worker(compiler_t *worker, compiler_t *cc, size_t tokens);
+void compiler_destroy(compiler_t *cc);
+
+void scope_enter(compiler_t *cc);
+void scope_exit(compiler_t *cc);
+Symbol *sym_declare(compiler_t *cc, uint32_t ident, TokenType type);
+void sym_bind(compiler_t *cc, Symbol *sym);
+Symbol *sym_lookup(compiler_t *cc, uint32_t ident);
+
+void diag_report(compiler_t *cc, size_t tok, const char *fmt, ...);
+void diag_add(compiler_t *cc, const diagnostic *diag);
+void diag_print(compiler_t *cc, FILE *out);
@@ -1,195 +1,271 @@
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "analysis.h"
 #include "codegen.h"
 #include "parser.h"
+#include "pch.h"
+#include "preproc.h"
 #include "tokens.h"
 #include "utils/ast.h"
 #include "utils/dynarray.h"
 #include "utils/str.h"
 
-// Prints the AST to stdout
-void printTree(ast_node *root) {
-  if (!root)
-    return;
+// Pushes the children of a node on s in reverse, so they are printed in
+// order.
+static void pushChildren(arena_stack *s, ast_node **children, size_t len) {
+  for (size_t i = len; i-- > 0;)
+    *(ast_node **)arena_push(s) = children[i];
+}
 
-  switch (root->type) {
-    case PRGM: {
-      printf("PRGM:\n");
+// Prints the AST to stdout, with a stack of the nodes still to print in the
+// work stack arena of cc.
+void printTree(compiler_t *cc, ast_node *root) {
+  arena_stack s = arena_stack_init(&cc->stack, sizeof(ast_node *));
+  *(ast_node **)arena_push(&s) = root;
 
-      for (size_t i = 0; i < root->ast_prgm.func_decls->len; ++i)
-        printTree((ast_node *)dyn_get(root->ast_prgm.func_decls, i));
+  while (s.len) {
+    root = *(ast_node **)arena_top(&s);
+    arena_pop(&s);
+    if (!root)
+      continue;
 
-    } break;
+    switch (root->type) {
+      case PRGM: {
+        printf("PRGM:\n");
 
-    case FUNC_DECL: {
-      printf("FUNC:\n");
+        pushChildren(&s, (ast_node **)root->ast_prgm.func_decls->el,
+                     root->ast_prgm.func_decls->len);
 
-      printTree(root->ast_func_decl.scope);
+      } break;
 
-    } break;
+      case FUNC_DECL: {
+        printf("FUNC:\n");
 
-    case SCOPE: {
-      for (size_t i = 0; i < root->ast_stmt.scope.stmts->len; ++i)
-        printTree((ast_node *)dyn_get(root->ast_stmt.scope.stmts, i));
+        *(ast_node **)arena_push(&s) = root->ast_func_decl.scope;
 
-    } break;
+      } break;
 
-    case STMT: {
-      printf("STMT: ");
+      case SCOPE: {
+        pushChildren(&s, (ast_node **)root->ast_stmt.scope.stmts->el,
+                     root->ast_stmt.scope.stmts->len);
 
-      switch (root->ast_stmt.type) {
-        case RET_STMT:
-          printf("RETURN\n");
-          printTree(root->ast_stmt.ret.expr);
-          break;
+      } break;
 
-        case VAR_DECL:
-          printf("VAR DECL %s\n", root->ast_stmt.ident_decl);
-          break;
+      case STMT: {
+        printf("STMT: ");
 
-        case VAR_ASSIGN:
-          printf("VAR ASSIGN %s\n", root->ast_stmt.var_assign.ident);
-          printTree(root->ast_stmt.var_assign.expr);
-          break;
+        switch (root->ast_stmt.type) {
+          case RET_STMT:
+            printf("RETURN\n");
+            *(ast_node **)arena_push(&s) = root->ast_stmt.ret.expr;
+            break;
 
-        default: break;
-      }
+          case VAR_DECL:
+            printf("VAR DECL %s\n",
+                   atom_name(&idents, root->ast_stmt.ident_decl));
+            break;
 
-    } break;
+          case VAR_ASSIGN:
+            printf("VAR ASSIGN %s\n",
+                   atom_name(&idents, root->ast_stmt.var_assign.ident));
+            *(ast_node **)arena_push(&s) = root->ast_stmt.var_assign.expr;
+            break;
 
-    case EXPR_BINOP: {
-      printf("BINOP: ");
+          default: break;
+        }
 
-      switch (root->ast_binary_op.type) {
-        case OP_PLUS:  printf("+\n"); break;
-        case OP_MINUS: printf("-\n"); break;
-        case OP_TIMES: printf("*\n"); break;
-        case OP_DIV:   printf("/\n"); break;
-        default:       break;
-      }
+      } break;
 
-      printTree(root->ast_binary_op.left);
-      printTree(root->ast_binary_op.right);
+      case EXPR_BINOP: {
+        printf("BINOP: ");
 
-    } break;
+        switch (root->ast_binary_op.type) {
+          case OP_PLUS:  printf("+\n"); break;
+          case OP_MINUS: printf("-\n"); break;
+          case OP_TIMES: printf("*\n"); break;
+          case OP_DIV:   printf("/\n"); break;
+          default:       break;
+        }
 
-    case EXPR_UNOP: {
-      printf("UNOP: ");
+        *(ast_node **)arena_push(&s) = root->ast_binary_op.right;
+        *(ast_node **)arena_push(&s) = root->ast_binary_op.left;
 
-      switch (root->ast_unary_op.type) {
-        case NUM_NEG:     printf("-\n"); break;
-        case NUM_POS:     printf("+\n"); break;
-        case TRUNC:       printf("cast truncate\n"); break;
-        case EXTEND:      printf("cast extend\n"); break;
-        case FLOAT_TOINT: printf("cast float to int\n"); break;
-        case INT_TOFLOAT: printf("cast int to float\n"); break;
-        default:          break;
-      }
+      } break;
 
-      printTree(root->ast_unary_op.right);
+      case EXPR_UNOP: {
+        printf("UNOP: ");
 
-    } break;
+        switch (root->ast_unary_op.type) {
+          case NUM_NEG:     printf("-\n"); break;
+          case NUM_POS:     printf("+\n"); break;
+          case TRUNC:       printf("cast truncate\n"); break;
+          case EXTEND:      printf("cast extend\n"); break;
+          case FLOAT_TOINT: printf("cast float to int\n"); break;
+          case INT_TOFLOAT: printf("cast int to float\n"); break;
+          default:          break;
+        }
 
-    default: break;
-  }
-}
+        *(ast_node **)arena_push(&s) = root->ast_unary_op.right;
 
-int main(int argc, char *argv[]) {
-  // CLI must take in one argument, potentially more later.
-  if (argc != 2) {
-    fprintf(stderr, "Fmt: ./main <file>\n");
-    return EXIT_FAILURE;
-  }
+      } break;
 
-  // Attempt to open the file provided through CLI, panic on failure
-  FILE *fp = fopen(argv[1], "r");
-  if (!fp) {
-    fprintf(stderr, "Could not open file\n");
-    return EXIT_FAILURE;
+      default: break;
+    }
   }
+}
 
-  // Get the file length in characters
-  fseek(fp, 0, SEEK_END);
-  long fsize = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
+// Size of the input window used by --stream.
+#define STREAM_WINDOW (64 * 1024)
 
-  // Allocate a buffer to read the file into, panic on failure
-  char *buf = (char *)malloc(fsize + 1);
-  if (!buf) {
-    fprintf(stderr, "Memory alloc failed\n");
-    fclose(fp);
-    return EXIT_FAILURE;
+// Maximum number of -I directories.
+#define MAX_INCLUDE_DIRS 64
+
+int main(int argc, char *argv[]) {
+  // CLI takes in one file and, optionally, --stream to lex the file through a
+  // fixed-size window while it is parsed instead of reading it up front, or
+  // -j <n> to lex and parse it on n threads. -I <dir> adds a directory to
+  // search for #include files. Streamed files are not preprocessed.
+  // --emit-pch <out> preprocesses the file as a header and saves a snapshot
+  // to out without compiling it, and --use-pch <pch> starts from such a
+  // snapshot.
+  bool stream = false;
+  const char *emit_pch = NULL, *use_pch = NULL;
+  size_t jobs = 1;
+  const char *path = NULL;
+  const char *dirs[MAX_INCLUDE_DIRS];
+  size_t ndirs = 0;
+  for (int a = 1; a < argc; ++a) {
+    if (!strcmp(argv[a], "--stream"))
+      stream = true;
+    else if (!strcmp(argv[a], "-j") && a + 1 < argc)
+      jobs = strtoul(argv[++a], NULL, 10);
+    else if (!strcmp(argv[a], "-I") && a + 1 < argc &&
+             ndirs < MAX_INCLUDE_DIRS)
+      dirs[ndirs++] = argv[++a];
+    else if (!strcmp(argv[a], "--emit-pch") && a + 1 < argc)
+      emit_pch = argv[++a];
+    else if (!strcmp(argv[a], "--use-pch") && a + 1 < argc)
+      use_pch = argv[++a];
+    else if (!path)
+      path = argv[a];
+    else {
+      path = NULL;
+      break;
+    }
   }
 
-  // Read the file into the buffer, panic on failure
-  if (fread((void *)buf, fsize, 1, fp) == fsize) {
-    fprintf(stderr, "Could not read file into buffer\n");
-    fclose(fp);
-    free(buf);
+  if (!path || (stream && (emit_pch || use_pch)) || (emit_pch && use_pch)) {
+    fprintf(stderr, "Fmt: ./main [--stream | -j <n>] [-I <dir>]... "
+                    "[--emit-pch <out> | --use-pch <pch>] <file>\n");
     return EXIT_FAILURE;
   }
 
-  // Initialize the arena allocator used for parsing
-  arena_init(&alloc, 1024 * 1024 * 4);
+  FILE *fp = NULL;
+  lexer_t *lex = NULL;
+  tok_buf *toks = NULL;
+
+  if (stream) {
+    // Attempt to open the file provided through CLI, panic on failure
+    fp = fopen(path, "r");
+    if (!fp) {
+      fprintf(stderr, "Could not open file\n");
+      return EXIT_FAILURE;
+    }
+
+    // The parser pulls tokens from the lexer as it needs them.
+    lex = lexer_open(fp, STREAM_WINDOW);
+    toks = tok_init_stream(lex);
+
+  } else {
+    // Tokenize the whole input and the files it includes before parsing,
+    // panic on failure
+    preproc_t pp;
+    pp_init(&pp, dirs, ndirs, jobs);
+    toks = tok_init(0);
+    bool ok = (!use_pch || pch_load(&pp, use_pch)) &&
+              preprocess(&pp, path, toks) &&
+              (!emit_pch || pch_save(&pp, toks, emit_pch));
+    pp_destroy(&pp);
+    if (!ok || emit_pch) {
+      tok_destroy(toks);
+      pp_cache_destroy(&sources);
+      intern_destroy(&idents);
+      return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    dump(toks);
+  }
 
-  // Initialize the tokens array.
-  dyn_array *toks = dyn_init(fsize / 10);
+  // Everything the passes share lives in one compilation context
+  compiler_t cc;
+  compiler_init(&cc, toks->src, toks);
   ast_node *ast = NULL;
 
-  // Initialize the Symbol table
-  table = dyn_init(5);
+  // Parse the input, with function bodies split between jobs threads
+  parse_parallel(&cc, &ast, jobs);
 
-  // Tokenize and parse the input
-  tokenize((str){.len = fsize, .chars = buf}, toks, fsize);
-  parse((str){.len = fsize, .chars = buf}, toks, &ast);
-  analyze(ast);
+  // Report every error found, and stop before code is generated
+  if (cc.ndiags) {
+    diag_print(&cc, stderr);
+    tok_destroy(toks);
+    ast_destroy(ast);
+    compiler_destroy(&cc);
+    intern_destroy(&idents);
+    if (lex)
+      lexer_close(lex);
+    if (fp)
+      fclose(fp);
+    pp_cache_destroy(&sources);
+    return EXIT_FAILURE;
+  }
 
-  printTree(ast);
+  analyze(&cc, ast);
+
+  printTree(&cc, ast);
   printf("\n");
 
   // Attempt to open a file to write generated LLVM IR, panic on failure
   FILE *out = fopen("build/out.ll", "w");
-  if (!fp) {
+  if (!out) {
     fprintf(stderr, "Could not open file\n");
-    fclose(fp);
-    fclose(out);
-    free(buf);
-    freeTokens(toks);
-    dyn_destroy(toks);
+    if (fp)
+      fclose(fp);
+    pp_cache_destroy(&sources);
+    tok_destroy(toks);
     ast_destroy(ast);
-    arena_destroy(&alloc);
+    compiler_destroy(&cc);
     return EXIT_FAILURE;
   }
 
   // Generate LLVM
-  generate_llvm(ast, out);
+  generate_llvm(&cc, ast, out);
 
   // Print Symbol table contents to stdout
-  for (size_t i = 0; i < table->len; ++i) {
-    Symbol *sym = (Symbol *)dyn_get(table, i);
-    printf("Symbol: %s\tLocation: %lu\n", sym->ident, sym->loc);
-    free(sym);
+  for (size_t i = 0; i < cc.decls->len; ++i) {
+    Symbol *sym = (Symbol *)dyn_get(cc.decls, i);
+    printf("Symbol: %s\tLocation: %lu\n", atom_name(&idents, sym->ident),
+           sym->loc);
   }
   printf("\n\n");
 
-  // Clean up table, tokens, AST, and arena allocator, and all file
+  // Clean up tokens, AST, the compilation context, and all file
   // pointers/buffers
-  dyn_destroy(table);
-
-  freeTokens(toks);
-
-  dyn_destroy(toks);
+  tok_destroy(toks);
   ast_destroy(ast);
+  compiler_destroy(&cc);
+  intern_destroy(&idents);
 
-  arena_destroy(&alloc);
+  if (lex)
+    lexer_close(lex);
 
   fclose(out);
-  fclose(fp);
-  free(buf);
+  if (fp)
+    fclose(fp);
+  pp_cache_destroy(&sources);
 
   return EXIT_SUCCESS;
 }
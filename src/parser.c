@@ -3,67 +3,86 @@
 #include "utils/ast.h"
 #include "utils/dynarray.h"
 #include "utils/str.h"
-#include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
-dyn_array *table;
-static size_t i = 0;
-
 // Macro for handling errors
 #define error_expected(_m)                                                     \
   {                                                                            \
-    Token *curr = (Token *)dyn_get(toks, i);                                   \
-    fprintf(stderr, "Expected %s on line %lu\n", _m,                           \
-            getLineNo(buf, buf.len, curr->start));                             \
+    expected(cc, _m);                                                          \
     return NULL;                                                               \
   }
 
 // Useful macros for accessing tokens
-#define current_token() (Token *)dyn_get(toks, i)
-#define peek() (Token *)dyn_get(toks, i + 1);
-#define peek_n(n) (Token *)dyn_get(toks, i + 1 + n);
-#define consume() (Token *)dyn_get(toks, i++)
-#define consume_discard() ++i
-
-// Retrieves the symbol in the symbol table with the respective name.
-Symbol *findInSymTable(const char *ident) {
-  for (size_t i = 0; i < table->len; ++i) {
-    Symbol *sym = (Symbol *)table->el[i];
-    if (!strcmp(ident, sym->ident))
-      return sym;
+#define current_token() tok_get(cc->toks, cc->pos)
+#define peek() tok_get(cc->toks, cc->pos + 1)
+#define peek_n(n) tok_get(cc->toks, cc->pos + 1 + n)
+#define consume() advance(cc)
+
+// Returns the current token and moves past it. The END token is never moved
+// past, so however the parse fails it cannot read beyond the end of toks.
+// Every other token is moved past once, parsed or skipped, so this is where
+// unrecognized ones are reported, and they are errors like any other.
+static inline Token advance(compiler_t *cc) {
+  Token tok = current_token();
+  if (tok.type == INVALID) {
+    diag_report(cc, cc->pos, "Unrecognized token %c", (char)tok.atom);
+    cc->panic = true;
   }
 
-  return NULL;
+  cc->pos += tok.type != END;
+  return tok;
 }
 
-// Parses the string starting at position i and returns the numeric value
-double parseNum(str buf, size_t i) {
-  size_t len = 0;
-  while (isdigit(at(buf, i)) || at(buf, i) == '.') {
-    ++i;
-    ++len;
-  }
+// Reports that what was expected is missing at the current token, unless
+// the parser is still skipping past an earlier error, which is the one that
+// explains this. An unrecognized token is reported as it is skipped instead.
+static void expected(compiler_t *cc, const char *what) {
+  if (!cc->panic && current_token().type != INVALID)
+    diag_report(cc, cc->pos, "Expected %s", what);
+  cc->panic = true;
+}
+
+// Returns the index of the token closing the parenthesis or brace at k, or
+// that of END if it is never closed. Other kinds of bracket are not counted.
+static size_t skipGroup(tok_buf *toks, size_t k) {
+  TokenType open = tok_get(toks, k).type;
+  TokenType close = open == LPAREN ? RPAREN : RBRACE;
 
-  char *dst = (char *)malloc(len);
-  strncpy(dst, buf.chars + (i - len), len);
+  TokenType type;
+  for (int depth = 0; (type = tok_get(toks, k).type) != END; ++k) {
+    depth += (type == open) - (type == close);
+    if (depth == 0)
+      break;
+  }
 
-  double result = atof(dst);
-  free(dst);
-  return result;
+  return k;
 }
 
-// Parses the string starting at position i and returns the string value
-str parseString(str buf, size_t i) {
-  str parsed = {0};
-  while (isalnum(at(buf, i)) || at(buf, i) == '_') {
-    ++i;
-    ++parsed.len;
+// Returns a hash of the tokens from start up to end: their types, the names
+// of identifiers and the values of literals, but not their offsets, which
+// an edit before them changes.
+static uint64_t hashTokens(tok_buf *toks, size_t start, size_t end) {
+  uint64_t hash = 0xcbf29ce484222325u; // FNV-1a, a word at a time
+  for (size_t k = start; k < end; ++k) {
+    Token tok = tok_get(toks, k);
+    uint64_t word = (uint64_t)tok.type << 32 | tok.atom;
+    if (tok.type == INTLIT || tok.type == FLOATLIT) {
+      lit_value val = tok_num(toks, tok);
+      hash = (hash ^ val.u) * 0x100000001b3u;
+      word = (uint64_t)tok.type << 32 | val.flags;
+    }
+    hash = (hash ^ word) * 0x100000001b3u;
   }
 
-  parsed.chars = dupl(buf, i - parsed.len, parsed.len);
+  return hash;
+}
 
-  return parsed;
+// Returns the value of the numeric literal tok, which the lexer decoded
+double parseNum(tok_buf *toks, Token tok) {
+  lit_value val = tok_num(toks, tok);
+  return (val.flags & LIT_FLOAT) ? val.d : (double)val.u;
 }
 
 // Returns true if type is a valid C type, and false otherwise
@@ -78,412 +97,1216 @@ inline bool isNumberLiteral(TokenType type) {
   return type == INTLIT || type == FLOATLIT;
 }
 
+// Returns whether the current token starts a function declaration: a type,
+// a name and '('. None can be nested in a function, so one found in a
+// function's body means its closing brace is missing.
+static bool atFuncDecl(compiler_t *cc) {
+  return isType(current_token().type) && peek().type == IDENT &&
+         peek_n(1).type == LPAREN;
+}
+
+// Skips the rest of a statement with an error in it, which begins at token
+// start, up to and including its ';' or a block in it, or up to the '}' or
+// function declaration that shows it was cut short, and resumes parsing.
+// The token the error was found at may have been consumed, so the ';' that
+// ends the statement or the '{' that opens a block may be behind the parser.
+static void skipStmt(compiler_t *cc, size_t start) {
+  TokenType last = END;
+  if (cc->pos > start)
+    last = tok_get(cc->toks, cc->pos - 1).type;
+
+  for (int depth = last == LBRACE; last != SEMI;) {
+    TokenType type = current_token().type;
+    if (type == END || (depth == 0 && (type == RBRACE || atFuncDecl(cc))))
+      break;
+
+    consume();
+    depth += (type == LBRACE) - (type == RBRACE);
+    if (depth == 0 && (type == SEMI || type == RBRACE)) {
+      if (type == RBRACE && current_token().type == SEMI)
+        consume();
+      break;
+    }
+  }
+
+  cc->panic = false;
+}
+
+// Skips to the next top-level function declaration after one that failed to
+// parse, passing over the braces of its body, and resumes parsing.
+static void skipFunc(compiler_t *cc) {
+  int depth = 0;
+  while (current_token().type != END && (depth > 0 || !atFuncDecl(cc))) {
+    TokenType type = consume().type;
+    depth += (type == LBRACE) - (depth > 0 && type == RBRACE);
+  }
+
+  cc->panic = false;
+}
+
 // PARSING METHODS
 // See grammar.bnf for the actual grammar rules and specifications needed to
 // parse the tokens array.
 
-ast_node *try_parse_param(str buf, dyn_array *toks) {
-  Token *front = consume();
+ast_node *try_parse_param(compiler_t *cc) {
+  Token front = consume();
 
-  if (!isType(front->type))
+  if (!isType(front.type))
     error_expected("type");
 
-  TokenType type = front->type;
+  TokenType type = front.type;
 
   front = consume();
-  if (front->type != IDENT)
+  if (front.type != IDENT)
     error_expected("identifier");
 
-  Symbol *sym = (Symbol *)malloc(sizeof(Symbol));
-  char *ident = parseString(buf, front->start).chars;
-  sym->ident = ident;
-  sym->type = type;
-  dyn_push(table, sym);
-
-  return create_param(type, ident);
+  ast_node *param = create_param(&cc->arena, type, front.atom);
+  param->sym = sym_declare(cc, front.atom, type);
+  return param;
 }
 
-ast_node *try_parse_factor(str buf, dyn_array *toks) {
-  Token *front = consume();
+// Declares the function ident in the current scope.
+static Symbol *declareFunc(compiler_t *cc, uint32_t ident, TokenType type) {
+  Symbol *sym = sym_declare(cc, ident, type);
+  sym->func = true;
+  return sym;
+}
 
-  if (front->type == PLUS || front->type == MINUS) {
-    ast_node *atom = NULL;
-    if (!(atom = try_parse_factor(buf, toks)))
-      error_expected("atomic expression");
+// A function called ahead of any declaration of it while a program is
+// parsed serially, which a function further on may yet declare.
+typedef struct {
+  Symbol *sym; // Stand-in for it, declared where it was called
+  size_t tok;  // Where it was called
+  src_loc loc; // Located now, as a streamed token can't be later
+} early_use;
+
+// Returns the declaration of the name at token tok, which is called if call
+// is set and used as a variable otherwise, which a function can't be. A name
+// with no declaration is reported and declared as an int in the current
+// scope, so the rest of the scope isn't reported again and the AST stays
+// whole.
+//
+// While try_parse_prgm() parses a program serially, the functions after
+// the one being parsed aren't declared yet, so the report of a call waits
+// for the end of the program, and is dropped if one of them declares it.
+static Symbol *lookup(compiler_t *cc, size_t tok, bool call) {
+  uint32_t ident = tok_get(cc->toks, tok).atom;
+  Symbol *sym = sym_lookup(cc, ident);
+  if (sym && (call || !sym->func))
+    return sym;
+
+  if (!call || !cc->early) {
+    diag_report(cc, tok, "%s \'%s\'",
+                call ? "Call to undeclared function" : "Undeclared identifier",
+                atom_name(&idents, ident));
+    return sym_declare(cc, ident, INT);
+  }
 
-    return create_unop(atom, (front->type == MINUS) ? NUM_NEG : NUM_POS);
+  sym = arena_alloc_type(&cc->arena, Symbol);
+  early_use *use = arena_alloc_type(&cc->arena, early_use);
+  *sym = (Symbol){.ident = ident, .type = INT, .func = true};
+  *use = (early_use){.sym = sym, .tok = tok};
+  use->loc = tok_locate(cc->toks, tok_get(cc->toks, tok).start);
 
-  } else if (isNumberLiteral(front->type))
-    return create_num(parseNum(buf, front->start), front->type);
+  sym_bind(cc, sym);
+  dyn_push(cc->early, use);
+  return sym;
+}
 
-  else if (front->type == IDENT) {
-    Token *next = current_token();
-    if (next->type != LPAREN) {
-      char *ident = parseString(buf, front->start).chars;
-      Symbol *sym = findInSymTable(ident);
-      assert(sym, "Symbol not declared in scope.");
+// Binding power and operator of each binary operator token. The higher
+// the power, the tighter the operator binds; tokens that are not binary
+// operators have none, which ends an expression.
+static const struct {
+  uint8_t power;
+  BinOpType op;
+} infix[TOK_COUNT] = {
+    [EQEQ] = {1, OP_EQEQ},     [NEQ] = {1, OP_NEQ},
+    [GE] = {2, OP_GE},         [GT] = {2, OP_GT},
+    [LE] = {2, OP_LE},         [LT] = {2, OP_LT},
+    [PLUS] = {3, OP_PLUS},     [MINUS] = {3, OP_MINUS},
+    [ASTERISK] = {4, OP_TIMES}, [SLASH] = {4, OP_DIV},
+};
+
+// What an expression being parsed is waiting on: a unary operator for its
+// operand, a parenthesis or call for the expression inside it to end, or a
+// binary operator for its right-hand side.
+typedef enum { EXPR_PREFIX, EXPR_GROUP, EXPR_CALL, EXPR_INFIX } expr_wait;
+
+typedef struct {
+  uint8_t wait;   // expr_wait
+  uint8_t power;  // Of an infix operator
+  uint8_t op;     // UnOpType or BinOpType
+  ast_node *node; // Left-hand side of an infix operator, or the call
+} expr_frame;
+
+static inline bool waitsFor(arena_stack *s, expr_wait wait) {
+  return s->len && ((expr_frame *)arena_top(s))->wait == wait;
+}
 
-      return create_ident(ident, sym->type);
+// Parses an expression, or only a factor if factor is set, by precedence
+// climbing with its own stack in place of recursion, so nesting is limited
+// only by memory. Each operand is followed by the binary operators that bind
+// tighter than the one before it, and an operator binding looser closes those
+// on the stack first.
+//
+// A parse that fails reports what the nested calls of a recursive descent
+// parser would as they returned: each unary operator its missing operand,
+// each expression its missing factor, each binary operator its right-hand
+// side, and each parenthesis or call its contents.
+static ast_node *parseExpr(compiler_t *cc, bool factor) {
+  arena_stack s = arena_stack_init(&cc->stack, sizeof(expr_frame));
+  ast_node *node = NULL;
+
+  for (;;) {
+    // An operand, after any unary operators and opening parentheses
+    Token front = consume();
+    expr_frame *f;
+    node = NULL;
+
+    if (front.type == PLUS || front.type == MINUS) {
+      f = (expr_frame *)arena_push(&s);
+      *f = (expr_frame){.wait = EXPR_PREFIX,
+                        .op = front.type == MINUS ? NUM_NEG : NUM_POS};
+      continue;
+
+    } else if (front.type == LPAREN) {
+      f = (expr_frame *)arena_push(&s);
+      *f = (expr_frame){.wait = EXPR_GROUP};
+      continue;
+
+    } else if (isNumberLiteral(front.type)) {
+      node = create_num(&cc->arena, parseNum(cc->toks, front), front.type);
+
+    } else if (front.type == IDENT && current_token().type != LPAREN) {
+      Symbol *sym = lookup(cc, cc->pos - 1, false);
+
+      node = create_ident(&cc->arena, front.atom, sym->type);
+      node->sym = sym;
+
+    } else if (front.type == IDENT) {
+      Symbol *sym = lookup(cc, cc->pos - 1, true);
+      consume();
+
+      node = create_funccall(&cc->arena, front.atom, sym->type);
+      node->sym = sym;
+      if (current_token().type == RPAREN)
+        consume();
+      else {
+        f = (expr_frame *)arena_push(&s);
+        *f = (expr_frame){.wait = EXPR_CALL, .node = node};
+        continue;
+      }
     }
 
-    consume_discard();
+    // Close what the operand completes: unary operators, and the binary
+    // operators, parentheses and calls that end after it.
+    bool failed = !node, done = false;
+    while (!failed && !done) {
+      while (waitsFor(&s, EXPR_PREFIX)) {
+        node = create_unop(&cc->arena, node,
+                           ((expr_frame *)arena_top(&s))->op);
+        arena_pop(&s);
+      }
 
-    char *ident = parseString(buf, front->start).chars;
-    Symbol *sym = findInSymTable(ident);
-    assert(sym, "Call to undeclared function.\n");
+      if (factor && s.len == 0) {
+        done = true;
+        break;
+      }
 
-    ast_node *func = create_funccall(ident, sym->type);
+      uint8_t power = infix[current_token().type].power;
+      while (waitsFor(&s, EXPR_INFIX) &&
+             ((expr_frame *)arena_top(&s))->power >= power) {
+        f = (expr_frame *)arena_top(&s);
+        node = create_binop(&cc->arena, f->node, node, f->op);
+        arena_pop(&s);
+      }
 
-    front = current_token();
-    ast_node *expr = NULL;
-    if (front->type != RPAREN && (expr = try_parse_expr(buf, toks))) {
-      dyn_push(func->ast_func_call.args, expr);
+      if (power) {
+        f = (expr_frame *)arena_push(&s);
+        *f = (expr_frame){.wait = EXPR_INFIX,
+                          .power = power,
+                          .op = infix[consume().type].op,
+                          .node = node};
+        break;
+      }
 
-      front = consume();
-      while (front->type == COMMA && (expr = try_parse_expr(buf, toks))) {
-        dyn_push(func->ast_func_call.args, expr);
-        front = current_token();
+      if (s.len == 0) {
+        done = true;
+
+      } else if (waitsFor(&s, EXPR_GROUP)) {
+        arena_pop(&s);
+        if (consume().type != RPAREN) {
+          expected(cc, "\')\'");
+          ast_destroy(node);
+          failed = true;
+        }
+
+      } else {
+        ast_node *call = ((expr_frame *)arena_top(&s))->node;
+        dyn_push(call->ast_func_call.args, node);
+        if (current_token().type == COMMA) {
+          consume();
+          break;
+        }
+
+        arena_pop(&s);
+        if (current_token().type != RPAREN) {
+          expected(cc, "\')\'");
+          ast_destroy(call);
+          failed = true;
+        } else {
+          consume();
+          node = call;
+        }
       }
     }
 
-    if (front->type != RPAREN)
-      error_expected("\')\'");
-
-    consume_discard();
-
-    return func;
-  }
-
-  else if (front->type == LPAREN) {
-    ast_node *expr = NULL;
-    if (!(expr = try_parse_expr(buf, toks)))
-      error_expected("expression");
-
-    front = consume();
-    if (front->type != RPAREN)
-      error_expected("\')\'");
-
-    return expr;
-  }
-
-  return NULL;
-}
-
-ast_node *try_parse_term(str buf, dyn_array *toks) {
-  ast_node *lhs = NULL;
-  if (!(lhs = try_parse_factor(buf, toks)))
-    error_expected("factor expression");
-
-  Token *front = current_token();
-  while (front->type == ASTERISK || front->type == SLASH) {
-    consume_discard();
-    ast_node *rhs = NULL;
-    if (!(rhs = try_parse_factor(buf, toks)))
-      error_expected("factor expression");
-
-    lhs = create_binop(lhs, rhs, (front->type == ASTERISK) ? OP_TIMES : OP_DIV);
-
-    front = current_token();
-  }
-
-  return lhs;
-}
+    if (done)
+      return node;
+    if (!failed)
+      continue;
+
+    // Unwind, reporting a factor missing from each expression on the way
+    // until one is the whole of what was asked for, and dropping the
+    // operands and calls parsed so far.
+    for (;;) {
+      while (waitsFor(&s, EXPR_PREFIX)) {
+        expected(cc, "atomic expression");
+        arena_pop(&s);
+      }
 
-ast_node *try_parse_cond(str buf, dyn_array *toks) {
-  ast_node *lhs = NULL;
-  if (!(lhs = try_parse_term(buf, toks)))
-    error_expected("terminal expression");
+      if (factor && s.len == 0)
+        return NULL;
 
-  Token *front = current_token();
-  while (front->type == PLUS || front->type == MINUS) {
-    consume_discard();
-    ast_node *rhs = NULL;
-    if (!(rhs = try_parse_term(buf, toks)))
-      error_expected("terminal expression");
+      expected(cc, "factor expression");
+      while (waitsFor(&s, EXPR_INFIX)) {
+        expected(cc, "expression");
+        ast_destroy(((expr_frame *)arena_top(&s))->node);
+        arena_pop(&s);
+      }
 
-    lhs = create_binop(lhs, rhs, (front->type == PLUS) ? OP_PLUS : OP_MINUS);
+      if (s.len == 0)
+        return NULL;
 
-    front = current_token();
+      f = (expr_frame *)arena_top(&s);
+      if (f->wait == EXPR_GROUP)
+        expected(cc, "expression");
+      else {
+        expected(cc, f->node->ast_func_call.args->len ? "argument"
+                                                       : "\')\'");
+        ast_destroy(f->node);
+      }
+      arena_pop(&s);
+    }
   }
-
-  return lhs;
 }
 
-ast_node *try_parse_equality(str buf, dyn_array *toks) {
-  ast_node *lhs = NULL;
-  if (!(lhs = try_parse_cond(buf, toks)))
-    error_expected("conditional expression");
+ast_node *try_parse_factor(compiler_t *cc) { return parseExpr(cc, true); }
 
-  Token *front = current_token();
-  while (front->type == GE || front->type == GT || front->type == LE ||
-         front->type == LT) {
-    consume_discard();
-    ast_node *rhs = NULL;
-    if (!(rhs = try_parse_cond(buf, toks)))
-      error_expected("conditional expression");
+ast_node *try_parse_expr(compiler_t *cc) { return parseExpr(cc, false); }
 
-    BinOpType op;
-    switch (front->type) {
-      case GE: op = OP_GE; break;
-      case GT: op = OP_GT; break;
-      case LE: op = OP_LE; break;
-      case LT: op = OP_LT; break;
-      default: error_expected("valid operator");
-    }
+// Returned in place of a statement whose nested statement is to be parsed
+// next.
+static ast_node opened;
 
-    lhs = create_binop(lhs, rhs, op);
+// What a statement being parsed is waiting on: the next statement of a
+// block, or the one an if, else or while runs.
+typedef enum { STMT_SCOPE, STMT_IF, STMT_ELSE, STMT_WHILE } stmt_wait;
 
-    front = current_token();
-  }
+typedef struct {
+  uint8_t wait;   // stmt_wait
+  ast_node *node; // The block or if, or the predicate of an if or while
+} stmt_frame;
 
-  return lhs;
+static void pushStmt(arena_stack *s, stmt_wait wait, ast_node *node) {
+  stmt_frame *f = (stmt_frame *)arena_push(s);
+  *f = (stmt_frame){.wait = wait, .node = node};
 }
 
-ast_node *try_parse_expr(str buf, dyn_array *toks) {
-  ast_node *lhs = NULL;
-  if (!(lhs = try_parse_equality(buf, toks)))
-    error_expected("equality expression");
-
-  Token *front = current_token();
-  while (front->type == EQEQ || front->type == NEQ) {
-    consume_discard();
-    ast_node *rhs = NULL;
-    if (!(rhs = try_parse_equality(buf, toks)))
-      error_expected("equality expression");
-
-    lhs = create_binop(lhs, rhs, (front->type == EQEQ) ? OP_EQEQ : OP_NEQ);
-
-    front = current_token();
-  }
-
-  return lhs;
+// Opens a block at its '{'.
+static void openScope(compiler_t *cc, arena_stack *s) {
+  consume();
+  pushStmt(s, STMT_SCOPE, create_scope(&cc->arena));
+  scope_enter(cc);
 }
 
-ast_node *try_parse_stmt(str buf, dyn_array *toks) {
-  Token *front = current_token();
+// Parses a statement that nests none, or the start of one that does up to
+// the statement nested in it, which is pushed on s as what it waits on.
+// Returns NULL if there is no statement or it is invalid, and drops what was
+// parsed of it.
+static ast_node *beginStmt(compiler_t *cc, arena_stack *s) {
+  Token front = current_token();
 
   ast_node *stmt = NULL;
-  if (isType(front->type)) {
-    TokenType value = front->type;
-    consume_discard();
+  if (isType(front.type)) {
+    TokenType value = front.type;
+    consume();
 
     front = consume();
-    if (front->type != IDENT)
+    if (front.type != IDENT)
       error_expected("identifier");
 
-    str ident = parseString(buf, front->start);
+    uint32_t ident = front.atom;
 
     front = consume();
-    if (front->type == SEMI) {
-      stmt = create_vardecl(value, ident.chars);
+    if (front.type == SEMI) {
+      stmt = create_vardecl(&cc->arena, value, ident);
 
-    } else if (front->type == EQUALS) {
+    } else if (front.type == EQUALS) {
       ast_node *expr = NULL;
-      if (!(expr = try_parse_expr(buf, toks)))
-        error_expected("expression");
-
-      front = consume();
-      if (front->type != SEMI)
-        error_expected("\';\'");
-
-      stmt = create_varassign(value, ident.chars, expr);
+      if (!(expr = try_parse_expr(cc)))
+        expected(cc, "expression");
+      else if (consume().type != SEMI) {
+        ast_destroy(expr);
+        expected(cc, "\';\'");
+      } else
+        stmt = create_varassign(&cc->arena, value, ident, expr);
 
     } else
-      error_expected("\';\' or \'=\'");
+      expected(cc, "\';\' or \'=\'");
 
-    Symbol *sym = (Symbol *)malloc(sizeof(Symbol));
-    sym->type = value;
-    sym->ident = ident.chars;
-    dyn_push(table, sym);
+    // The name is declared even if the rest is invalid, so its uses aren't
+    // reported as well.
+    Symbol *sym = sym_declare(cc, ident, value);
+    if (stmt)
+      stmt->sym = sym;
 
-  } else if (front->type == RETURN) {
-    consume_discard();
+  } else if (front.type == RETURN) {
+    consume();
 
     ast_node *expr = NULL;
-    if (!(expr = try_parse_expr(buf, toks)))
+    if (!(expr = try_parse_expr(cc)))
       error_expected("expression");
 
     front = consume();
-    if (front->type != SEMI)
+    if (front.type != SEMI) {
+      ast_destroy(expr);
       error_expected("\';\'");
-
-    stmt = create_return(VOID, expr);
-
-  } else if (front->type == IF) {
-    consume_discard();
-
-    front = consume();
-    if (front->type != LPAREN)
-      error_expected("\'(\'");
-
-    ast_node *pred = NULL;
-    if (!(pred = try_parse_expr(buf, toks)))
-      error_expected("predicate");
-
-    front = consume();
-    if (front->type != RPAREN)
-      error_expected("\')\'");
-
-    ast_node *scope = NULL;
-    if (!(scope = try_parse_stmt(buf, toks)))
-      error_expected("scope or statement");
-
-    stmt = create_if_stmt(pred, scope, NULL);
-
-    front = current_token();
-    ast_node *alt = NULL;
-    if (front->type == ELSE) {
-      consume_discard();
-
-      if (!(alt = try_parse_stmt(buf, toks)))
-        error_expected("else scope or statement");
     }
 
-    stmt->ast_stmt.if_stmt.alt = alt;
+    stmt = create_return(&cc->arena, VOID, expr);
 
-  } else if (front->type == LBRACE) {
-    if (!(stmt = try_parse_scope(buf, toks)))
-      error_expected("scope");
-
-  } else if (front->type == WHILE) {
-    consume_discard();
+  } else if (front.type == IF || front.type == WHILE) {
+    bool loop = front.type == WHILE;
+    consume();
 
     front = consume();
-    if (front->type != LPAREN)
+    if (front.type != LPAREN)
       error_expected("\'(\'");
 
     ast_node *pred = NULL;
-    if (!(pred = try_parse_expr(buf, toks)))
-      error_expected("predicate expression");
+    if (!(pred = try_parse_expr(cc)))
+      error_expected(loop ? "predicate expression" : "predicate");
 
     front = consume();
-    if (front->type != RPAREN)
+    if (front.type != RPAREN) {
+      ast_destroy(pred);
       error_expected("\')\'");
+    }
 
-    ast_node *scope = NULL;
-    if (!(scope = try_parse_stmt(buf, toks)))
-      error_expected("scope or statement");
-
-    stmt = create_while_stmt(pred, scope);
+    pushStmt(s, loop ? STMT_WHILE : STMT_IF, pred);
+    stmt = &opened;
 
-  } else if (front->type == IDENT) {
-    consume_discard();
-    str ident = parseString(buf, front->start);
+  } else if (front.type == LBRACE) {
+    openScope(cc, s);
+    stmt = &opened;
 
-    Symbol *sym = findInSymTable(ident.chars);
-    assert(sym, "Identifier referenced before declaration.");
+  } else if (front.type == IDENT) {
+    consume();
+    Symbol *sym = lookup(cc, cc->pos - 1, false);
 
     front = consume();
-    if (front->type != EQUALS)
+    if (front.type != EQUALS)
       error_expected("\'=\'");
 
     ast_node *expr = NULL;
-    if (!(expr = try_parse_expr(buf, toks)))
+    if (!(expr = try_parse_expr(cc)))
       error_expected("expression");
 
     front = consume();
-    if (front->type != SEMI)
+    if (front.type != SEMI) {
+      ast_destroy(expr);
       error_expected("\';\'");
+    }
 
-    stmt = create_reassign(sym->type, sym->ident, expr);
+    stmt = create_reassign(&cc->arena, sym->type, sym->ident, expr);
+    stmt->sym = sym;
   }
 
   return stmt;
 }
 
-ast_node *try_parse_scope(str buf, dyn_array *toks) {
-  Token *front = consume();
-  if (front->type != LBRACE)
-    error_expected("\'{\'");
+// Returns whether the block being parsed ends at the current token: at its
+// '}', or where one is missing.
+static bool atScopeEnd(compiler_t *cc) {
+  TokenType type = current_token().type;
+  return type == RBRACE || type == END || atFuncDecl(cc);
+}
 
-  ast_node *scope = create_scope();
+// Parses a statement, and then the rest of those frames waits on, keeping
+// the blocks and branches the statement is nested in on frames rather than
+// the C stack. Returns the outermost.
+//
+// A statement with an error in it is dropped, along with the if, else or
+// while it is the body of, and the parser skips to the end of it to carry on
+// with the rest of the block.
+static ast_node *parseStmts(compiler_t *cc, arena_stack *frames) {
+  size_t start = cc->pos; // First token of the last statement begun
+  for (;;) {
+    stmt_frame *f = frames->len ? (stmt_frame *)arena_top(frames) : NULL;
+    ast_node *stmt = NULL;
+
+    // Stray characters between statements are reported and dropped.
+    if (f && f->wait == STMT_SCOPE && current_token().type == INVALID) {
+      while (current_token().type == INVALID)
+        consume();
+      cc->panic = false;
+    }
 
-  ast_node *stmt = NULL;
-  while ((stmt = try_parse_stmt(buf, toks))) {
-    dyn_push(scope->ast_stmt.scope.stmts, stmt);
+    if (f && f->wait == STMT_SCOPE && atScopeEnd(cc)) {
+      if (current_token().type == RBRACE)
+        consume();
+      else
+        expected(cc, "\'}\'");
 
-    front = current_token();
-    if (front->type == RBRACE) {
-      consume_discard();
-      break;
+      scope_exit(cc);
+      stmt = f->node;
+      arena_pop(frames);
+    } else {
+      start = cc->pos;
+      stmt = beginStmt(cc, frames);
+    }
+
+    // Hand the statement to the one it is nested in, until one takes
+    // another.
+    while (stmt != &opened) {
+      if (frames->len == 0)
+        return stmt;
+
+      f = (stmt_frame *)arena_top(frames);
+      switch ((stmt_wait)f->wait) {
+        case STMT_SCOPE: {
+          if (stmt)
+            dyn_push(f->node->ast_stmt.scope.stmts, stmt);
+          else {
+            expected(cc, "statement");
+            skipStmt(cc, start);
+          }
+
+          stmt = &opened;
+        } break;
+
+        case STMT_IF: {
+          ast_node *pred = f->node;
+          arena_pop(frames);
+          if (!stmt) {
+            expected(cc, "scope or statement");
+            ast_destroy(pred);
+            break;
+          }
+
+          stmt = create_if_stmt(&cc->arena, pred, stmt, NULL);
+          if (current_token().type == ELSE) {
+            consume();
+            pushStmt(frames, STMT_ELSE, stmt);
+            stmt = &opened;
+          }
+        } break;
+
+        case STMT_ELSE: {
+          ast_node *if_stmt = f->node;
+          arena_pop(frames);
+          if (!stmt) {
+            expected(cc, "else scope or statement");
+            ast_destroy(if_stmt);
+            break;
+          }
+
+          if_stmt->ast_stmt.if_stmt.alt = stmt;
+          stmt = if_stmt;
+        } break;
+
+        case STMT_WHILE: {
+          ast_node *pred = f->node;
+          arena_pop(frames);
+          if (!stmt) {
+            expected(cc, "scope or statement");
+            ast_destroy(pred);
+          } else
+            stmt = create_while_stmt(&cc->arena, pred, stmt);
+        } break;
+      }
     }
   }
+}
+
+ast_node *try_parse_stmt(compiler_t *cc) {
+  arena_stack s = arena_stack_init(&cc->stack, sizeof(stmt_frame));
+  return parseStmts(cc, &s);
+}
+
+ast_node *try_parse_scope(compiler_t *cc) {
+  if (current_token().type != LBRACE) {
+    consume();
+    error_expected("\'{\'");
+  }
 
-  return scope;
+  arena_stack s = arena_stack_init(&cc->stack, sizeof(stmt_frame));
+  openScope(cc, &s);
+  return parseStmts(cc, &s);
 }
 
-ast_node *try_parse_funcdecl(str buf, dyn_array *toks) {
-  Token *front = consume();
+// Parses a function declaration. Its symbol is sym if the function was
+// declared ahead of it, and is declared once its body is parsed otherwise.
+static ast_node *parseFuncdecl(compiler_t *cc, Symbol *sym) {
+  size_t start = cc->pos;
+  Token front = consume();
 
-  if (!isType(front->type))
+  if (!isType(front.type))
     error_expected("type");
 
-  TokenType ret_type = front->type;
+  TokenType ret_type = front.type;
 
   front = consume();
-  if (front->type != IDENT)
+  if (front.type != IDENT)
     error_expected("identifier");
 
-  str ident = parseString(buf, front->start);
-  ast_node *func = create_funcdecl(ret_type, ident.chars, NULL);
+  uint32_t ident = front.atom;
+  ast_node *func = create_funcdecl(&cc->arena, ret_type, ident, NULL);
 
   front = consume();
-  if (front->type != LPAREN)
+  if (front.type != LPAREN) {
+    ast_destroy(func);
     error_expected("\'(\'");
+  }
+
+  // Parameters are in a scope of their own, around the body's
+  scope_enter(cc);
 
   front = current_token();
   ast_node *param = NULL;
-  if (front->type != RPAREN && (param = try_parse_param(buf, toks))) {
+  if (front.type != RPAREN && (param = try_parse_param(cc))) {
     dyn_push(func->ast_func_decl.params, param);
 
     front = current_token();
 
-    if (front->type == COMMA) {
-      consume_discard();
-      while ((param = try_parse_param(buf, toks))) {
+    if (front.type == COMMA) {
+      consume();
+      while ((param = try_parse_param(cc))) {
         dyn_push(func->ast_func_decl.params, param);
 
         front = current_token();
-        if (front->type != COMMA)
+        if (front.type != COMMA)
           break;
         else
-          consume_discard();
+          consume();
       }
     }
   }
 
-  if (front->type != RPAREN)
+  if (front.type != RPAREN) {
+    scope_exit(cc);
+    ast_destroy(func);
     error_expected("\')\'");
+  }
 
-  consume_discard();
-
-  func->ast_func_decl.scope = try_parse_scope(buf, toks);
+  consume();
+
+  // A lazy body is only checked for matching braces, and parsed by
+  // func_body() when it is needed.
+  func->ast_func_decl.body = cc->pos;
+  if (cc->lazy && !cc->toks->stream && current_token().type == LBRACE) {
+    size_t end = skipGroup(cc->toks, cc->pos);
+    if (tok_get(cc->toks, end).type == END) {
+      scope_exit(cc);
+      ast_destroy(func);
+      error_expected("\'}\'");
+    }
+    cc->pos = end + 1;
+  } else if (!(func->ast_func_decl.scope = try_parse_scope(cc))) {
+    scope_exit(cc);
+    ast_destroy(func);
+    return NULL;
+  }
+  scope_exit(cc);
 
-  Symbol *sym = (Symbol *)malloc(sizeof(Symbol));
-  sym->ident = ident.chars;
-  sym->type = ret_type;
-  dyn_push(table, sym);
+  func->sym = sym ? sym : declareFunc(cc, ident, ret_type);
+  if (!cc->toks->stream)
+    func->ast_func_decl.hash = hashTokens(cc->toks, start, cc->pos);
 
   return func;
 }
 
-ast_node *try_parse_prgm(str buf, dyn_array *toks) {
-  ast_node *ast = create_prgm();
+ast_node *try_parse_funcdecl(compiler_t *cc) {
+  return parseFuncdecl(cc, NULL);
+}
+
+// Returns the body of func, parsing it first if it was skipped. Its
+// parameters are brought back into scope around it, and the names it uses
+// are resolved against the file scope as it is when the body is parsed.
+ast_node *func_body(compiler_t *cc, ast_node *func) {
+  if (func->ast_func_decl.scope || !cc->lazy)
+    return func->ast_func_decl.scope;
+
+  size_t pos = cc->pos;
+  cc->pos = func->ast_func_decl.body;
+
+  scope_enter(cc);
+  for (size_t i = 0; i < func->ast_func_decl.params->len; ++i)
+    sym_bind(cc, ((ast_node *)dyn_get(func->ast_func_decl.params, i))->sym);
+
+  cc->panic = false;
+
+  func->ast_func_decl.scope = try_parse_scope(cc);
+  scope_exit(cc);
+
+  cc->pos = pos;
+  return func->ast_func_decl.scope;
+}
+
+// Types the expressions of root again from their operands up, once calls
+// made early have the types of the functions they call.
+static void retype(ast_node *root) {
+  dyn_array *stack = dyn_init(16), *order = dyn_init(16);
+  dyn_push(stack, root);
+
+  // Nodes in reverse preorder come after everything under them.
+  while (stack->len > 0) {
+    ast_node *node = dyn_pop(stack);
+    dyn_push(order, node);
+
+    switch (node->type) {
+      case EXPR_BINOP: {
+        dyn_push(stack, node->ast_binary_op.left);
+        dyn_push(stack, node->ast_binary_op.right);
+      } break;
+
+      case EXPR_UNOP: dyn_push(stack, node->ast_unary_op.right); break;
+
+      case FUNC_CALL: {
+        for (size_t i = 0; i < node->ast_func_call.args->len; ++i)
+          dyn_push(stack, dyn_get(node->ast_func_call.args, i));
+      } break;
+
+      case FUNC_DECL: {
+        if (node->ast_func_decl.scope)
+          dyn_push(stack, node->ast_func_decl.scope);
+      } break;
+
+      case PRGM: {
+        for (size_t i = 0; i < node->ast_prgm.func_decls->len; ++i)
+          dyn_push(stack, dyn_get(node->ast_prgm.func_decls, i));
+      } break;
+
+      case STMT: {
+        switch (node->ast_stmt.type) {
+          case VAR_ASSIGN:
+          case REASSIGN:
+            dyn_push(stack, node->ast_stmt.var_assign.expr);
+            break;
+          case RET_STMT: dyn_push(stack, node->ast_stmt.ret.expr); break;
+
+          case SCOPE: {
+            for (size_t i = 0; i < node->ast_stmt.scope.stmts->len; ++i)
+              dyn_push(stack, dyn_get(node->ast_stmt.scope.stmts, i));
+          } break;
+
+          case IF_STMT: {
+            dyn_push(stack, node->ast_stmt.if_stmt.pred);
+            dyn_push(stack, node->ast_stmt.if_stmt.scope);
+            if (node->ast_stmt.if_stmt.alt)
+              dyn_push(stack, node->ast_stmt.if_stmt.alt);
+          } break;
+
+          case WHILE_STMT: {
+            dyn_push(stack, node->ast_stmt.if_stmt.pred);
+            dyn_push(stack, node->ast_stmt.if_stmt.scope);
+          } break;
+
+          default: break;
+        }
+      } break;
+
+      default: break;
+    }
+  }
+
+  for (size_t k = order->len; k-- > 0;) {
+    ast_node *node = dyn_get(order, k);
+    switch (node->type) {
+      case EXPR_BINOP: {
+        node->value = getStrongerType(node->ast_binary_op.left->value,
+                                      node->ast_binary_op.right->value);
+      } break;
+
+      case EXPR_UNOP: node->value = node->ast_unary_op.right->value; break;
+      case FUNC_CALL: node->value = node->sym->type; break;
+      default:        break;
+    }
+  }
+
+  dyn_destroy(stack);
+  dyn_destroy(order);
+}
+
+// Settles the calls prgm made ahead of any declaration, once all of its
+// functions are declared: those to a function refer to it, and the rest are
+// reported. Expressions are typed again if any was typed wrongly.
+static void settleEarly(compiler_t *cc, ast_node *prgm) {
+  bool wrong = false;
+  for (size_t k = 0; k < cc->early->len; ++k) {
+    early_use *use = dyn_get(cc->early, k);
+    Symbol *func = sym_lookup(cc, use->sym->ident);
+    if (func) {
+      wrong |= use->sym->type != func->type;
+      use->sym->type = func->type;
+      continue;
+    }
 
-  while (i + 1 < toks->len) {
+    diagnostic diag = {.tok = use->tok, .loc = use->loc};
+    snprintf(diag.msg, sizeof(diag.msg), "Call to undeclared function \'%s\'",
+             atom_name(&idents, use->sym->ident));
+    diag_add(cc, &diag);
+  }
+
+  if (wrong)
+    retype(prgm);
+}
+
+// Parses the functions of the program one after another. A body can call a
+// function declared after it, as it can when scanFunctions() declares them
+// all first, as the calls it makes to names that aren't declared yet are
+// settled at the end.
+ast_node *try_parse_prgm(compiler_t *cc) {
+  ast_node *ast = create_prgm(&cc->arena);
+  cc->early = dyn_init(4);
+
+  while (current_token().type != END) {
+    cc->panic = false;
     ast_node *func = NULL;
-    if ((func = try_parse_funcdecl(buf, toks))) {
+    if ((func = try_parse_funcdecl(cc)))
       dyn_push(ast->ast_prgm.func_decls, func);
+    else
+      skipFunc(cc);
+  }
 
-    } else {
-      fprintf(stderr, "Tried to parse function declaration and failed.\n");
+  settleEarly(cc, ast);
+  dyn_destroy(cc->early);
+  cc->early = NULL;
+  return ast;
+}
+
+// A top-level function declaration found by scanFunctions().
+typedef struct func_span {
+  size_t start; // Index of its first token
+  size_t end;   // Index one past its closing brace
+  Symbol *sym;
+  ast_node *func;     // Declaration, once parsed, NULL if that failed
+  compiler_t *worker; // Context it was parsed in
+  size_t decls;       // Index in worker->decls of the first symbol it declared
+  size_t ndecls;      // Number of symbols it declared
+  bool whole;         // Whether it parsed up to the end the scan found
+} func_span;
+
+// A run of consecutive functions parsed by one worker.
+typedef struct {
+  compiler_t *cc;
+  func_span *spans;
+  size_t len;
+} parse_chunk;
+
+// Returns the index one past the closing brace of the function declaration
+// at k, found by matching parentheses and braces, or 0 if the tokens there
+// don't fit the pattern of one.
+static size_t scanFunction(tok_buf *toks, size_t k) {
+  if (!isType(tok_get(toks, k).type) || tok_get(toks, k + 1).type != IDENT ||
+      tok_get(toks, k + 2).type != LPAREN)
+    return 0;
+
+  k = skipGroup(toks, k + 2);
+  if (tok_get(toks, k).type == END || tok_get(toks, ++k).type != LBRACE)
+    return 0;
+
+  k = skipGroup(toks, k);
+  return tok_get(toks, k).type == END ? 0 : k + 1;
+}
+
+// Appends span to the len spans of *spans, which has room for *cap.
+static void pushSpan(func_span **spans, size_t *len, size_t *cap,
+                     func_span span) {
+  if (*len == *cap) {
+    *cap = *cap ? *cap * 2 : 64;
+    *spans = (func_span *)realloc(*spans, sizeof(func_span) * *cap);
+    assert(*spans, "Could not allocate memory for functions");
+  }
+
+  (*spans)[(*len)++] = span;
+}
+
+// Finds the top-level function declarations by matching parentheses and
+// braces, without parsing them, and declares their symbols at file scope.
+// Returns their number, or 0 if the tokens don't all fit the pattern of
+// one, in which case nothing is declared.
+static size_t scanFunctions(compiler_t *cc, func_span **spans) {
+  func_span *s = NULL;
+  size_t len = 0, cap = 0, k = 0, end;
+  while (tok_get(cc->toks, k).type != END &&
+         (end = scanFunction(cc->toks, k))) {
+    pushSpan(&s, &len, &cap, (func_span){.start = k, .end = end});
+    k = end;
+  }
+
+  if (tok_get(cc->toks, k).type != END) {
+    free(s);
+    return 0;
+  }
+
+  for (size_t f = 0; f < len; ++f)
+    s[f].sym = declareFunc(cc, tok_get(cc->toks, s[f].start + 1).atom,
+                           tok_get(cc->toks, s[f].start).type);
+
+  *spans = s;
+  return len;
+}
+
+// Parses the function of span in the context of worker.
+static void parseSpan(compiler_t *worker, func_span *span) {
+  span->worker = worker;
+  span->decls = worker->decls->len;
+  ++worker->live;
+
+  worker->pos = span->start;
+  worker->panic = false;
+  span->func = parseFuncdecl(worker, span->sym);
+  span->ndecls = worker->decls->len - span->decls;
+  span->whole = span->func && worker->pos == span->end;
+}
+
+// Parses the functions of a chunk in its worker's context.
+static void *parseChunk(void *arg) {
+  parse_chunk *c = (parse_chunk *)arg;
+  for (size_t f = 0; f < c->len; ++f)
+    parseSpan(c->cc, &c->spans[f]);
+
+  return NULL;
+}
+
+// Adds a worker to cc to parse tokens tokens.
+static compiler_t *addWorker(compiler_t *cc, size_t tokens) {
+  compiler_t *worker = (compiler_t *)malloc(sizeof(compiler_t));
+  cc->workers = (compiler_t **)realloc(
+      cc->workers, sizeof(compiler_t *) * (cc->nworkers + 1));
+  assert(worker && cc->workers, "Could not allocate memory for a worker");
+
+  compiler_init_worker(worker, cc, tokens);
+  cc->workers[cc->nworkers++] = worker;
+  return worker;
+}
+
+// Fills prgm with the declarations of the functions of cc and cc->decls
+// with their symbols, in source order, leaving out those that failed to
+// parse as the serial parser does, and collects the errors of the workers
+// into cc.
+static void gather(compiler_t *cc, ast_node *prgm) {
+  cc->ndiags = 0;
+  for (size_t w = 0; w < cc->nworkers; ++w)
+    for (size_t k = 0; k < cc->workers[w]->ndiags; ++k)
+      diag_add(cc, &cc->workers[w]->diags[k]);
+
+  cc->decls->len = 0;
+  prgm->ast_prgm.func_decls->len = 0;
+  for (size_t f = 0; f < cc->nfuncs; ++f) {
+    func_span *span = &cc->funcs[f];
+    if (!span->func)
+      continue;
+
+    for (size_t d = span->decls; d < span->decls + span->ndecls; ++d)
+      dyn_push(cc->decls, dyn_get(span->worker->decls, d));
+    dyn_push(cc->decls, span->sym);
+    dyn_push(prgm->ast_prgm.func_decls, span->func);
+  }
+
+  cc->pos = cc->funcs[cc->nfuncs - 1].end;
+}
+
+// Frees the program *ast and sets cc up afresh to parse it again.
+static void restart(compiler_t *cc, ast_node **ast) {
+  bool lazy = cc->lazy;
+  ast_destroy(*ast);
+  compiler_destroy(cc);
+
+  compiler_init(cc, cc->src, cc->toks);
+  cc->lazy = lazy;
+}
+
+// Returns whether every function of cc parsed up to the end the scan found
+// for it.
+static bool parsedWhole(compiler_t *cc) {
+  for (size_t f = 0; f < cc->nfuncs; ++f)
+    if (!cc->funcs[f].whole)
+      return false;
+
+  return true;
+}
+
+// Parses the program *ast again in cc on one thread, from scratch, after a
+// function with an error in it ended somewhere other than where the scan
+// said it would. The serial parser goes on from there, so it is the one
+// whose errors are reported, whatever the number of threads.
+static void parseSerially(compiler_t *cc, ast_node **ast) {
+  restart(cc, ast);
+  *ast = try_parse_prgm(cc);
+}
+
+void parse(compiler_t *cc, ast_node **ast) { parse_parallel(cc, ast, 1); }
+
+// Parses the program like parse(), but parses the bodies of its functions
+// on jobs threads.
+//
+// The top-level functions are found by brace matching and declared first,
+// so every body can see every function. They are then split into runs of
+// about equal numbers of tokens, and each run is parsed by a worker with
+// its own compiler context: its own arena, and a symbol table that falls
+// back on the file scope of cc. The declarations are collected into the
+// program in source order, and the workers are kept in cc as they own the
+// nodes, as are the functions for reparse(). Streamed tokens, and programs
+// the scan can't split, are parsed serially, as are those where an error
+// ends a function somewhere other than where the scan did.
+void parse_parallel(compiler_t *cc, ast_node **ast, size_t jobs) {
+  cc->pos = 0;
+
+  func_span *spans = NULL;
+  size_t len = cc->toks->stream ? 0 : scanFunctions(cc, &spans);
+  if (len == 0) {
+    *ast = try_parse_prgm(cc);
+    return;
+  }
+
+  if (jobs < 1)
+    jobs = 1;
+  if (jobs > len)
+    jobs = len;
+
+  parse_chunk *chunks = (parse_chunk *)malloc(sizeof(parse_chunk) * jobs);
+  pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * jobs);
+  assert(chunks && threads, "Could not allocate memory for parser threads");
+
+  // Each worker takes functions until it has its share of the tokens,
+  // leaving at least one for each worker after it.
+  size_t total = spans[len - 1].end, f = 0;
+  for (size_t w = 0; w < jobs; ++w) {
+    size_t first = f, last = len - (jobs - w - 1);
+    size_t share = total * (w + 1) / jobs;
+    do
+      ++f;
+    while (f < last && spans[f - 1].end < share);
+
+    chunks[w] = (parse_chunk){
+        .cc = addWorker(cc, spans[f - 1].end - spans[first].start),
+        .spans = spans + first,
+        .len = f - first};
+  }
+
+  for (size_t w = 1; w < jobs; ++w)
+    assert(!pthread_create(&threads[w], NULL, parseChunk, &chunks[w]),
+           "Could not start parser thread");
+  parseChunk(&chunks[0]);
+  for (size_t w = 1; w < jobs; ++w)
+    pthread_join(threads[w], NULL);
+
+  cc->funcs = spans;
+  cc->nfuncs = len;
+  *ast = create_prgm(&cc->arena);
+  gather(cc, *ast);
+
+  free(threads);
+  free(chunks);
+  if (!parsedWhole(cc))
+    parseSerially(cc, ast);
+}
+
+// Returns where the token at k before edit is after it, if it is after the
+// tokens edit replaced.
+static inline size_t moved(size_t k, tok_splice edit) {
+  return k - edit.removed + edit.inserted;
+}
+
+// Parses the whole program again into a new context in place of cc.
+static void parseAgain(compiler_t *cc, ast_node **ast) {
+  restart(cc, ast);
+  parse(cc, ast);
+}
+
+// Parses the program *ast again after tokenize_edit() made edit to its
+// tokens, rebuilding only the functions the edit touched. *ast must come
+// from parse_parallel() or reparse() in cc.
+//
+// The functions wholly before or after the edit keep their subtree, their
+// symbols and their analysis, and are only moved. The tokens from the end of
+// the last function before the edit to the start of the first after it are
+// scanned for functions again; those whose tokens hash the same as one the
+// edit touched keep its declaration, and the rest are parsed in a worker of
+// their own. Workers with none of their functions left are freed. Only the
+// program's list of functions and cc->decls are built again in full, which
+// copies pointers.
+//
+// A function keeps its symbol while its name and return type don't change,
+// so the calls kept bodies make stay bound. Calls aren't tracked, so if a
+// function is removed or either of those changes, or the tokens no longer
+// scan as functions, the whole program is parsed again. So is a program
+// with errors, as which of them the edit fixed isn't tracked either.
+void reparse(compiler_t *cc, ast_node **ast, tok_splice edit) {
+  func_span *old = cc->funcs;
+  size_t n = cc->nfuncs;
+  if (n == 0 || cc->ndiags) {
+    parseAgain(cc, ast);
+    return;
+  }
+
+  // The functions before first end before the edit, and those from after
+  // on start after it.
+  size_t first = 0, after = n;
+  while (first < after) {
+    size_t mid = (first + after) / 2;
+    if (old[mid].end <= edit.first)
+      first = mid + 1;
+    else
+      after = mid;
+  }
+  after = n;
+  for (size_t lo = first; lo < after;) {
+    size_t mid = (lo + after) / 2;
+    if (old[mid].start < edit.first + edit.removed)
+      lo = mid + 1;
+    else
+      after = mid;
+  }
+
+  // Scan until the start of a function after the edit, or the end, which
+  // can take in some of those after it too.
+  func_span *spans = NULL;
+  size_t len = 0, cap = 0, next = after;
+  for (size_t k = first ? old[first - 1].end : 0, end;; k = end) {
+    while (next < n && moved(old[next].start, edit) < k)
+      ++next;
+    if (next < n ? moved(old[next].start, edit) == k
+                 : tok_get(cc->toks, k).type == END)
       break;
+
+    if (!(end = scanFunction(cc->toks, k))) {
+      free(spans);
+      parseAgain(cc, ast);
+      return;
     }
+    pushSpan(&spans, &len, &cap, (func_span){.start = k, .end = end});
   }
 
-  return ast;
-}
+  // Keep the touched functions whose tokens are unchanged, and hand the
+  // symbols of the others on to new ones of the same name and type.
+  size_t touched = next - first, tokens = 0;
+  uint8_t *fate = (uint8_t *)calloc(touched + 1, 1); // Kept 1, handed on 2
+  assert(fate, "Could not allocate memory for functions");
+  for (size_t f = 0; f < len; ++f) {
+    func_span *span = &spans[f];
+    uint64_t hash = hashTokens(cc->toks, span->start, span->end);
+    for (size_t t = 0; t < touched && !span->func; ++t) {
+      func_span *was = &old[first + t];
+      if (fate[t] || !was->func || was->func->ast_func_decl.hash != hash)
+        continue;
+
+      fate[t] = 1;
+      size_t start = span->start, end = span->end;
+      was->func->ast_func_decl.body += start - was->start;
+      *span = *was;
+      span->start = start;
+      span->end = end;
+    }
+  }
+
+  bool rescan = false;
+  for (size_t f = 0; f < len && !rescan; ++f) {
+    func_span *span = &spans[f];
+    if (span->func)
+      continue;
+
+    uint32_t ident = tok_get(cc->toks, span->start + 1).atom;
+    TokenType type = tok_get(cc->toks, span->start).type;
+    for (size_t t = 0; t < touched && !span->sym; ++t) {
+      Symbol *sym = old[first + t].sym;
+      if (!fate[t] && sym->ident == ident && sym->type == type) {
+        fate[t] = 2;
+        span->sym = sym;
+      }
+    }
+
+    // A new name mustn't hide or be hidden by one still declared.
+    if (!span->sym) {
+      rescan = sym_lookup(cc, ident);
+      span->sym = declareFunc(cc, ident, type);
+    }
+    tokens += span->end - span->start;
+  }
+  for (size_t t = 0; t < touched; ++t)
+    rescan |= !fate[t];
+
+  if (rescan) {
+    free(fate);
+    free(spans);
+    parseAgain(cc, ast);
+    return;
+  }
+
+  // Only now that the program is known to fit can anything be freed.
+  if (tokens) {
+    compiler_t *worker = addWorker(cc, tokens);
+    for (size_t f = 0; f < len; ++f)
+      if (!spans[f].worker)
+        parseSpan(worker, &spans[f]);
+  }
+
+  for (size_t t = 0; t < touched; ++t) {
+    func_span *was = &old[first + t];
+    if (fate[t] == 1)
+      continue;
+
+    if (was->func)
+      ast_destroy(was->func);
+    --was->worker->live;
+  }
+  free(fate);
+
+  size_t w = 0;
+  for (size_t v = 0; v < cc->nworkers; ++v) {
+    if (cc->workers[v]->live) {
+      cc->workers[w++] = cc->workers[v];
+    } else {
+      compiler_destroy(cc->workers[v]);
+      free(cc->workers[v]);
+    }
+  }
+  cc->nworkers = w;
+
+  // Splice the functions in, moving those after them.
+  func_span *funcs =
+      (func_span *)malloc(sizeof(func_span) * (first + len + n - next));
+  assert(funcs, "Could not allocate memory for functions");
+  memcpy(funcs, old, sizeof(func_span) * first);
+  memcpy(funcs + first, spans, sizeof(func_span) * len);
+  for (size_t f = next; f < n; ++f) {
+    func_span *span = &funcs[first + len + f - next];
+    *span = old[f];
+    span->start = moved(span->start, edit);
+    span->end = moved(span->end, edit);
+    if (span->func)
+      span->func->ast_func_decl.body =
+          moved(span->func->ast_func_decl.body, edit);
+  }
 
-void parse(str buf, dyn_array *toks, ast_node **ast) {
-  *ast = try_parse_prgm(buf, toks);
+  free(old);
+  free(spans);
+  cc->funcs = funcs;
+  cc->nfuncs = first + len + n - next;
+  gather(cc, *ast);
+  if (!parsedWhole(cc))
+    parseSerially(cc, ast);
 }
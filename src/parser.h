@@ -1,36 +1,26 @@
 #pragma once
 
-#include "parser.h"
+#include "compiler.h"
 #include "tokens.h"
 #include "utils/arena.h"
 #include "utils/ast.h"
 #include "utils/dynarray.h"
 #include <stdbool.h>
 
-extern dyn_array *table;
-
-typedef struct {
-  char *ident;
-  TokenType type;
-  size_t loc;
-} Symbol;
-
-Symbol *findInSymTable(const char *ident);
-
-double parseNum(str, size_t);
-str parseString(str, size_t);
+double parseNum(tok_buf *, Token);
 
 bool isType(TokenType);
 bool isNumberLiteral(TokenType);
 
-ast_node *try_parse_param(str, dyn_array *);
-ast_node *try_parse_factor(str, dyn_array *);
-ast_node *try_parse_term(str, dyn_array *);
-ast_node *try_parse_cond(str, dyn_array *);
-ast_node *try_parse_expr(str, dyn_array *);
-ast_node *try_parse_stmt(str, dyn_array *);
-ast_node *try_parse_scope(str, dyn_array *);
-ast_node *try_parse_funcdecl(str, dyn_array *);
-ast_node *try_parse_prgm(str, dyn_array *);
-
-void parse(str buf, dyn_array *toks, ast_node **ast);
+ast_node *try_parse_param(compiler_t *);
+ast_node *try_parse_factor(compiler_t *);
+ast_node *try_parse_expr(compiler_t *);
+ast_node *try_parse_stmt(compiler_t *);
+ast_node *try_parse_scope(compiler_t *);
+ast_node *try_parse_funcdecl(compiler_t *);
+ast_node *try_parse_prgm(compiler_t *);
+ast_node *func_body(compiler_t *cc, ast_node *func);
+
+void parse(compiler_t *cc, ast_node **ast);
+void parse_parallel(compiler_t *cc, ast_node **ast, size_t jobs);
+void reparse(compiler_t *cc, ast_node **ast, tok_splice edit);
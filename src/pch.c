@@ -0,0 +1,511 @@
+#define _DEFAULT_SOURCE // st_mtim
+
+#include "pch.h"
+#include "utils/assert.h"
+#include "utils/file.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define PCH_MAGIC "minipch"
+#define PCH_VERSION 1
+
+// Arrays of the snapshot, in the order they are written.
+typedef enum {
+  PCH_FILES,
+  PCH_PATHS,
+  PCH_LINES,
+  PCH_ATOMS,
+  PCH_MACROS,
+  PCH_BODY,
+  PCH_TYPES,
+  PCH_STARTS,
+  PCH_LENS,
+  PCH_IDS,
+  PCH_NUMS,
+  PCH_TEXT,
+  PCH_SECTIONS,
+} pch_section;
+
+typedef struct {
+  uint64_t offset; // From the start of the file, a multiple of 8
+  uint64_t len;    // Number of elements
+} pch_range;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t unused;
+  pch_range sections[PCH_SECTIONS];
+} pch_header;
+
+// A file read while preprocessing the header.
+typedef struct {
+  uint64_t base; // Its base when the snapshot was made
+  uint64_t size;
+  int64_t mtime;   // In nanoseconds, to tell if it changed since
+  uint32_t path;   // Resolved path, in the text section
+  uint32_t lines;  // Index of its first line start
+  uint32_t nlines;
+  uint32_t guard;  // Atom
+  uint8_t once;
+  uint8_t seen; // A #pragma once file that was included
+} pch_file;
+
+// A path that a file was found by.
+typedef struct {
+  uint32_t file;
+  uint32_t path;
+} pch_path;
+
+typedef struct {
+  uint32_t text;
+  uint32_t len;
+} pch_atom;
+
+typedef struct {
+  uint32_t name; // Atom
+  uint32_t body; // Index of its first token in the body section
+  uint32_t len;
+  uint32_t nparams;
+  uint8_t function;
+  uint8_t variadic;
+} pch_macro;
+
+typedef struct {
+  lit_value num;
+  uint32_t text;
+  uint32_t len;
+  uint32_t id;
+  uint16_t param;
+  uint8_t type;
+  uint8_t space;
+} pch_tok;
+
+static const size_t elem_size[PCH_SECTIONS] = {
+    [PCH_FILES] = sizeof(pch_file),   [PCH_PATHS] = sizeof(pch_path),
+    [PCH_LINES] = sizeof(uint32_t),   [PCH_ATOMS] = sizeof(pch_atom),
+    [PCH_MACROS] = sizeof(pch_macro), [PCH_BODY] = sizeof(pch_tok),
+    [PCH_TYPES] = sizeof(uint8_t),    [PCH_STARTS] = sizeof(uint32_t),
+    [PCH_LENS] = sizeof(uint32_t),    [PCH_IDS] = sizeof(uint32_t),
+    [PCH_NUMS] = sizeof(lit_value),   [PCH_TEXT] = 1,
+};
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static int64_t mtimeOf(struct stat *st) {
+  return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// Sections of a snapshot being written, each a growing byte array.
+typedef struct {
+  char *data[PCH_SECTIONS];
+  size_t len[PCH_SECTIONS];
+  size_t cap[PCH_SECTIONS];
+} pch_writer;
+
+// Appends n bytes to section s and returns the index of the first element.
+static size_t add(pch_writer *w, pch_section s, const void *p, size_t n) {
+  if (w->len[s] + n > w->cap[s]) {
+    w->cap[s] = (w->len[s] + n) * 2;
+    w->data[s] = realloc(w->data[s], w->cap[s]);
+    assert(w->data[s] != NULL, "Could not allocate memory for snapshot");
+  }
+
+  size_t at = w->len[s];
+  if (n)
+    memcpy(w->data[s] + at, p, n);
+  w->len[s] += n;
+  return at / elem_size[s];
+}
+
+// Appends len bytes of text and a NUL, and returns their offset.
+static uint32_t addText(pch_writer *w, const char *text, size_t len) {
+  size_t at = add(w, PCH_TEXT, text, len);
+  add(w, PCH_TEXT, "", 1);
+  assert(at + len < UINT32_MAX, "Snapshot text too large");
+  return (uint32_t)at;
+}
+
+// Records the files of the cache and the paths they were found by. Fails if
+// one of them came from another snapshot or can no longer be found.
+static bool saveFiles(pch_writer *w, preproc_t *pp) {
+  pthread_mutex_lock(&sources.lock);
+
+  bool ok = true;
+  for (size_t k = 0; k < sources.len && ok; ++k) {
+    pp_file *f = sources.loaded[k];
+    const char *real = atom_name(&sources.paths, f->key);
+    struct stat st;
+    if (f->lazy || stat(real, &st)) {
+      fprintf(stderr, "Could not snapshot %s\n", real);
+      ok = false;
+      break;
+    }
+
+    line_index *lines = &f->toks->lines;
+    pch_file file = {
+        .base = f->base,
+        .size = f->size,
+        .mtime = mtimeOf(&st),
+        .path = addText(w, real, strlen(real)),
+        .lines = (uint32_t)add(w, PCH_LINES, lines->starts,
+                               sizeof(uint32_t) * lines->len),
+        .nlines = (uint32_t)lines->len,
+        .guard = f->guard,
+        .once = f->once,
+        .seen = f->once && f->key < pp->seen_cap && pp->seen[f->key],
+    };
+    add(w, PCH_FILES, &file, sizeof(file));
+  }
+
+  for (size_t key = 1; ok && key < sources.paths.len && key < sources.cap;
+       ++key) {
+    pp_file *f = sources.files[key];
+    if (!f || f->id >= sources.len || sources.loaded[f->id] != f)
+      continue;
+
+    str name = atom_str(&sources.paths, (uint32_t)key);
+    pch_path found = {.file = (uint32_t)f->id,
+                      .path = addText(w, name.chars, name.len)};
+    add(w, PCH_PATHS, &found, sizeof(found));
+  }
+
+  pthread_mutex_unlock(&sources.lock);
+  return ok;
+}
+
+// Writes the state of pp after preprocessing a header into toks to a
+// snapshot at path. Every file in the cache is recorded, so the cache should
+// hold only the files of the header.
+bool pch_save(preproc_t *pp, tok_buf *toks, const char *path) {
+  pch_writer w = {0};
+  bool ok = saveFiles(&w, pp);
+
+  // Every identifier, so atoms in the snapshot are atoms of idents here
+  for (uint32_t atom = 0; ok && atom < idents.len; ++atom) {
+    str name = atom_str(&idents, atom);
+    pch_atom entry = {.text = atom ? addText(&w, name.chars, name.len) : 0,
+                      .len = atom ? (uint32_t)name.len : 0};
+    add(&w, PCH_ATOMS, &entry, sizeof(entry));
+  }
+
+  for (uint32_t name = 0; ok && name < pp->macros_cap; ++name) {
+    pp_macro *m = pp->macros[name];
+    if (!m)
+      continue;
+
+    pch_macro entry = {.name = name,
+                       .body = (uint32_t)(w.len[PCH_BODY] / sizeof(pch_tok)),
+                       .len = m->len,
+                       .nparams = m->nparams,
+                       .function = m->function,
+                       .variadic = m->variadic};
+    add(&w, PCH_MACROS, &entry, sizeof(entry));
+
+    for (size_t k = 0; k < m->len; ++k) {
+      pp_tok *tok = &m->body[k];
+      pch_tok saved = {.num = tok->num,
+                       .text = addText(&w, tok->text, tok->len),
+                       .len = tok->len,
+                       .id = tok->id,
+                       .param = tok->param,
+                       .type = tok->type,
+                       .space = tok->space};
+      add(&w, PCH_BODY, &saved, sizeof(saved));
+    }
+  }
+
+  // The output, without END
+  size_t n = toks->len - 1;
+  add(&w, PCH_TYPES, toks->types, sizeof(*toks->types) * n);
+  add(&w, PCH_STARTS, toks->starts, sizeof(*toks->starts) * n);
+  add(&w, PCH_LENS, toks->lens, sizeof(*toks->lens) * n);
+  add(&w, PCH_IDS, toks->ids, sizeof(*toks->ids) * n);
+  add(&w, PCH_NUMS, toks->nums, sizeof(*toks->nums) * toks->nums_len);
+
+  pch_header h = {.version = PCH_VERSION};
+  memcpy(h.magic, PCH_MAGIC, sizeof(h.magic));
+  size_t offset = align8(sizeof(h));
+  for (int s = 0; s < PCH_SECTIONS; ++s) {
+    h.sections[s] = (pch_range){.offset = offset,
+                                .len = w.len[s] / elem_size[s]};
+    offset = align8(offset + w.len[s]);
+  }
+
+  FILE *fp = ok ? fopen(path, "wb") : NULL;
+  if (fp) {
+    static const char zeros[8];
+    ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    size_t at = sizeof(h);
+    for (int s = 0; s < PCH_SECTIONS && ok; ++s) {
+      ok = fwrite(zeros, 1, h.sections[s].offset - at, fp) ==
+               h.sections[s].offset - at &&
+           fwrite(w.data[s], 1, w.len[s], fp) == w.len[s];
+      at = h.sections[s].offset + w.len[s];
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+  }
+
+  if (!fp || !ok)
+    fprintf(stderr, "Could not write precompiled header %s\n", path);
+
+  for (int s = 0; s < PCH_SECTIONS; ++s)
+    free(w.data[s]);
+  return fp && ok;
+}
+
+// A mapped snapshot being loaded.
+typedef struct {
+  const char *data;
+  pch_header h;
+  const char *path;
+} pch_reader;
+
+static const void *section(pch_reader *r, pch_section s) {
+  return r->data + r->h.sections[s].offset;
+}
+
+static size_t count(pch_reader *r, pch_section s) {
+  return r->h.sections[s].len;
+}
+
+// Returns the len bytes of text at offset, or NULL unless they are inside
+// the text section and followed by a NUL.
+static const char *text(pch_reader *r, uint32_t offset, uint32_t len) {
+  const char *chars = (const char *)section(r, PCH_TEXT);
+  if ((uint64_t)offset + len >= count(r, PCH_TEXT) || chars[offset + len])
+    return NULL;
+
+  return chars + offset;
+}
+
+// Returns the NUL-terminated text at offset, or NULL unless it ends inside
+// the text section.
+static const char *string(pch_reader *r, uint32_t offset) {
+  const char *chars = (const char *)section(r, PCH_TEXT);
+  if (offset >= count(r, PCH_TEXT) ||
+      !memchr(chars + offset, '\0', count(r, PCH_TEXT) - offset))
+    return NULL;
+
+  return chars + offset;
+}
+
+static bool invalid(pch_reader *r, const char *why) {
+  fprintf(stderr, "Invalid precompiled header %s: %s\n", r->path, why);
+  return false;
+}
+
+// Checks that the sections fit in the size-byte snapshot and that the files
+// it was made from have not changed.
+static bool checkSnapshot(pch_reader *r, size_t size) {
+  if (size < sizeof(pch_header))
+    return invalid(r, "too short");
+
+  memcpy(&r->h, r->data, sizeof(r->h));
+  if (memcmp(r->h.magic, PCH_MAGIC, sizeof(r->h.magic)) ||
+      r->h.version != PCH_VERSION)
+    return invalid(r, "wrong format or version");
+
+  for (int s = 0; s < PCH_SECTIONS; ++s) {
+    pch_range range = r->h.sections[s];
+    if (range.offset % 8 || range.offset > size ||
+        range.len > (size - range.offset) / elem_size[s])
+      return invalid(r, "section out of bounds");
+  }
+
+  const pch_file *files = section(r, PCH_FILES);
+  for (size_t k = 0; k < count(r, PCH_FILES); ++k) {
+    const char *path = string(r, files[k].path);
+    if (!path || (uint64_t)files[k].lines + files[k].nlines >
+                     count(r, PCH_LINES) ||
+        files[k].guard >= count(r, PCH_ATOMS) ||
+        (k && files[k].base <= files[k - 1].base))
+      return invalid(r, "bad file entry");
+
+    struct stat st;
+    if (stat(path, &st) || (uint64_t)st.st_size != files[k].size ||
+        mtimeOf(&st) != files[k].mtime) {
+      fprintf(stderr, "Precompiled header %s is out of date: %s changed\n",
+              r->path, path);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Enters the files of the snapshot into the cache, and sets delta[k] to how
+// far the offsets of file k move.
+static bool loadFiles(pch_reader *r, preproc_t *pp, const uint32_t *atoms,
+                      int64_t *delta) {
+  const pch_file *files = section(r, PCH_FILES);
+  const uint32_t *lines = section(r, PCH_LINES);
+  pp_file **loaded = (pp_file **)malloc(sizeof(pp_file *) *
+                                        (count(r, PCH_FILES) + 1));
+  assert(loaded != NULL, "Could not allocate memory for snapshot");
+
+  for (size_t k = 0; k < count(r, PCH_FILES); ++k) {
+    const pch_file *file = &files[k];
+    pp_file *f = pp_add_lazy(string(r, file->path), file->size,
+                             lines + file->lines, file->nlines,
+                             atoms[file->guard], file->once);
+    delta[k] = (int64_t)f->base - (int64_t)file->base;
+    loaded[k] = f;
+
+    if (file->seen)
+      pp_set_seen(pp, f);
+  }
+
+  bool ok = true;
+  const pch_path *paths = section(r, PCH_PATHS);
+  for (size_t k = 0; k < count(r, PCH_PATHS) && ok; ++k) {
+    const char *path = string(r, paths[k].path);
+    ok = path && paths[k].file < count(r, PCH_FILES);
+    if (ok)
+      pp_add_path(path, loaded[paths[k].file]);
+  }
+
+  free(loaded);
+  return ok || invalid(r, "bad path entry");
+}
+
+static bool loadMacros(pch_reader *r, preproc_t *pp, const uint32_t *atoms) {
+  const pch_macro *macros = section(r, PCH_MACROS);
+  const pch_tok *body = section(r, PCH_BODY);
+  size_t natoms = count(r, PCH_ATOMS);
+
+  for (size_t k = 0; k < count(r, PCH_MACROS); ++k) {
+    const pch_macro *entry = &macros[k];
+    if (entry->name >= natoms || entry->nparams > PP_MAX_PARAMS ||
+        (uint64_t)entry->body + entry->len > count(r, PCH_BODY))
+      return invalid(r, "bad macro entry");
+
+    pp_macro *m = (pp_macro *)pp_alloc(&pp->defs, sizeof(pp_macro));
+    *m = (pp_macro){.len = entry->len,
+                    .nparams = entry->nparams,
+                    .function = entry->function,
+                    .variadic = entry->variadic};
+    m->body = (pp_tok *)pp_alloc(&pp->defs, sizeof(pp_tok) * (m->len + 1));
+
+    for (size_t j = 0; j < m->len; ++j) {
+      const pch_tok *saved = &body[entry->body + j];
+      const char *spelling = text(r, saved->text, saved->len);
+      if (!spelling || saved->id >= natoms || saved->type >= TOK_COUNT ||
+          saved->param > m->nparams)
+        return invalid(r, "bad macro token");
+
+      char *copy = (char *)pp_alloc(&pp->defs, saved->len + 1);
+      memcpy(copy, spelling, saved->len + 1);
+      m->body[j] = (pp_tok){.text = copy,
+                            .num = saved->num,
+                            .len = saved->len,
+                            .id = atoms[saved->id],
+                            .param = saved->param,
+                            .type = saved->type,
+                            .space = saved->space};
+    }
+
+    pp_set_macro(pp, atoms[entry->name], m);
+  }
+
+  return true;
+}
+
+// Copies the output tokens of the snapshot into pp->prefix, moving their
+// offsets into the ranges their files have in this process.
+static bool loadTokens(pch_reader *r, preproc_t *pp, const uint32_t *atoms,
+                       const int64_t *delta) {
+  const uint8_t *types = section(r, PCH_TYPES);
+  const uint32_t *starts = section(r, PCH_STARTS);
+  const uint32_t *lens = section(r, PCH_LENS);
+  const uint32_t *ids = section(r, PCH_IDS);
+  const lit_value *nums = section(r, PCH_NUMS);
+  const pch_file *files = section(r, PCH_FILES);
+  size_t n = count(r, PCH_TYPES), nfiles = count(r, PCH_FILES);
+
+  if (count(r, PCH_STARTS) != n || count(r, PCH_LENS) != n ||
+      count(r, PCH_IDS) != n)
+    return invalid(r, "token columns differ in length");
+
+  tok_buf *prefix = tok_init(n);
+  for (size_t k = 0; k < count(r, PCH_NUMS); ++k)
+    tok_push_num(prefix, nums[k]);
+
+  // Tokens come in runs from one file, so the last file is tried first.
+  size_t file = 0;
+  for (size_t k = 0; k < n; ++k) {
+    uint64_t start = starts[k];
+    if (file >= nfiles || start < files[file].base ||
+        start > files[file].base + files[file].size) {
+      size_t lo = 0, hi = nfiles;
+      while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (files[mid].base <= start)
+          lo = mid;
+        else
+          hi = mid;
+      }
+      file = lo;
+    }
+
+    bool number = types[k] == INTLIT || types[k] == FLOATLIT;
+    if (file >= nfiles || start < files[file].base ||
+        start > files[file].base + files[file].size ||
+        types[k] >= TOK_COUNT ||
+        ids[k] >= (number ? count(r, PCH_NUMS) : count(r, PCH_ATOMS))) {
+      tok_destroy(prefix);
+      return invalid(r, "bad token");
+    }
+
+    tok_push(prefix, (TokenType)types[k], (size_t)(start + delta[file]),
+             lens[k], number ? ids[k] : atoms[ids[k]]);
+  }
+
+  if (pp->prefix)
+    tok_destroy(pp->prefix);
+  pp->prefix = prefix;
+  return true;
+}
+
+// Loads the snapshot at path into pp, as if the header it was made from had
+// been included before the main file. Fails if it is malformed or any of
+// its files changed since it was made.
+bool pch_load(preproc_t *pp, const char *path) {
+  source_file src;
+  if (!file_load(path, &src)) {
+    fprintf(stderr, "Could not read precompiled header %s\n", path);
+    return false;
+  }
+
+  pch_reader r = {.data = src.text.chars, .path = path};
+  bool ok = checkSnapshot(&r, src.text.len);
+
+  // Atoms are renumbered by interning their names in this process.
+  lex_init();
+  size_t natoms = ok ? count(&r, PCH_ATOMS) : 0;
+  uint32_t *atoms = (uint32_t *)malloc(sizeof(uint32_t) * (natoms + 1));
+  int64_t *delta =
+      (int64_t *)malloc(sizeof(int64_t) * (ok ? count(&r, PCH_FILES) + 1 : 1));
+  assert(atoms && delta, "Could not allocate memory for snapshot");
+
+  const pch_atom *entries = ok ? section(&r, PCH_ATOMS) : NULL;
+  for (size_t k = 0; k < natoms && ok; ++k) {
+    const char *name = text(&r, entries[k].text, entries[k].len);
+    if (k == 0)
+      atoms[k] = NO_ATOM;
+    else if (!name)
+      ok = invalid(&r, "bad identifier");
+    else
+      atoms[k] = intern(&idents, name, entries[k].len);
+  }
+
+  ok = ok && loadFiles(&r, pp, atoms, delta) && loadMacros(&r, pp, atoms) &&
+       loadTokens(&r, pp, atoms, delta);
+
+  free(atoms);
+  free(delta);
+  file_unload(&src);
+  return ok;
+}
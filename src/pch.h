@@ -0,0 +1,19 @@
+#pragma once
+
+#include "preproc.h"
+#include "tokens.h"
+#include <stdbool.h>
+
+// A precompiled header is a snapshot of the preprocessor after one header:
+// its output tokens, the macros defined at its end, the identifiers they
+// name, and the files it read (with their line starts, include guards and
+// the paths they were found by). It holds no pointers, only offsets from the
+// start of the file, so it is mapped and read in place.
+//
+// A unit compiled with it starts as if it had included the header first.
+// Its files are entered into the file cache without being read, so a later
+// #include of one of them is skipped by its guard or #pragma once without
+// any I/O, and atoms and token offsets are relocated into this process.
+
+bool pch_save(preproc_t *pp, tok_buf *toks, const char *path);
+bool pch_load(preproc_t *pp, const char *path);
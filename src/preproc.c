@@ -0,0 +1,1599 @@
+#define _DEFAULT_SOURCE // realpath()
+
+#include "preproc.h"
+#include "utils/assert.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+pp_cache sources = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Stands in for every path that was looked up and could not be read.
+static pp_file missing;
+
+#define PP_ARENA_BLOCK (64 * 1024)
+
+// Allocates size bytes from a, starting a new block if the current one is
+// full.
+void *pp_alloc(pp_arena *a, size_t size) {
+  if (!a->block.memory) {
+    arena_init(&a->block, PP_ARENA_BLOCK);
+    a->full = dyn_init(4);
+  }
+
+  void *ptr = arena_alloc(&a->block, size);
+  if (!ptr) {
+    arena_t *full = (arena_t *)malloc(sizeof(arena_t));
+    assert(full != NULL, "Could not allocate memory for preprocessor");
+    *full = a->block;
+    dyn_push(a->full, full);
+
+    size_t cap = PP_ARENA_BLOCK;
+    while (cap <= size + 8)
+      cap *= 2;
+    arena_init(&a->block, cap);
+    ptr = arena_alloc(&a->block, size);
+  }
+
+  return ptr;
+}
+
+// Frees everything allocated from a, keeping only its latest block.
+static void ppReset(pp_arena *a) {
+  if (!a->block.memory)
+    return;
+
+  for (size_t k = 0; k < a->full->len; ++k) {
+    arena_destroy((arena_t *)dyn_get(a->full, k));
+    free(dyn_get(a->full, k));
+  }
+  a->full->len = 0;
+  arena_reset(&a->block);
+}
+
+static void ppArenaDestroy(pp_arena *a) {
+  if (!a->block.memory)
+    return;
+
+  ppReset(a);
+  arena_destroy(&a->block);
+  dyn_destroy(a->full);
+  *a = (pp_arena){0};
+}
+
+// Directive names that are identifiers (if and else are keywords), and the
+// pragma that marks a file to be included once.
+static uint32_t names[PP_UNKNOWN];
+static uint32_t once_atom, defined_atom, va_args_atom;
+static pthread_once_t names_ready = PTHREAD_ONCE_INIT;
+
+static void initNames(void) {
+  const char *spellings[PP_UNKNOWN] = {
+      [PP_INCLUDE] = "include", [PP_DEFINE] = "define",
+      [PP_UNDEF] = "undef",     [PP_IFDEF] = "ifdef",
+      [PP_IFNDEF] = "ifndef",   [PP_ELIF] = "elif",
+      [PP_ENDIF] = "endif",     [PP_PRAGMA] = "pragma",
+      [PP_ERROR] = "error",
+  };
+
+  for (int k = 0; k < PP_UNKNOWN; ++k) {
+    if (spellings[k])
+      names[k] = intern(&idents, spellings[k], strlen(spellings[k]));
+  }
+  once_atom = intern(&idents, "once", 4);
+  defined_atom = intern(&idents, "defined", 7);
+  va_args_atom = intern(&idents, "__VA_ARGS__", 11);
+}
+
+// Returns true if token k is the first on its line. A backslash at the end of
+// a line continues it.
+static bool startsLine(tok_buf *toks, const char *text, size_t k) {
+  if (k == 0)
+    return true;
+
+  size_t end = toks->starts[k - 1] + toks->lens[k - 1];
+  if (!memchr(text + end, '\n', toks->starts[k] - end))
+    return false;
+
+  return toks->types[k - 1] != BACKSLASH ||
+         (text[end] != '\n' && text[end] != '\r');
+}
+
+// Returns true if token k of f is a backslash that continues its line.
+static bool isContinuation(pp_file *f, size_t k) {
+  char next = f->src.text.chars[f->toks->starts[k] + 1];
+  return f->toks->types[k] == BACKSLASH && (next == '\n' || next == '\r');
+}
+
+static pp_kind directiveKind(tok_buf *toks, size_t first, size_t end) {
+  if (first + 1 == end)
+    return PP_NULL;
+
+  switch (toks->types[first + 1]) {
+    case IF:    return PP_IF;
+    case ELSE:  return PP_ELSE;
+    case IDENT: break;
+    default:    return PP_UNKNOWN;
+  }
+
+  for (int k = 0; k < PP_UNKNOWN; ++k) {
+    if (names[k] && names[k] == toks->ids[first + 1])
+      return (pp_kind)k;
+  }
+
+  return PP_UNKNOWN;
+}
+
+static bool isConditional(pp_kind kind) {
+  return kind == PP_IF || kind == PP_IFDEF || kind == PP_IFNDEF;
+}
+
+static void pushDirective(pp_file *f, pp_directive dir) {
+  if (f->ndirs % 16 == 0) {
+    f->dirs = realloc(f->dirs, sizeof(*f->dirs) * (f->ndirs + 16));
+    assert(f->dirs != NULL, "Could not allocate memory for directives");
+  }
+
+  f->dirs[f->ndirs++] = dir;
+}
+
+// Returns token k of f as an expansion token.
+static pp_tok fileTok(pp_file *f, size_t k) {
+  tok_buf *toks = f->toks;
+  pp_tok tok = {.text = f->src.text.chars + toks->starts[k],
+                .start = (uint32_t)(f->base + toks->starts[k]),
+                .len = toks->lens[k],
+                .id = toks->ids[k],
+                .type = toks->types[k],
+                .space = k > 0 && toks->starts[k] >
+                                      toks->starts[k - 1] + toks->lens[k - 1]};
+
+  if (tok.type == INTLIT || tok.type == FLOATLIT) {
+    tok.num = toks->nums[tok.id];
+    tok.id = NO_ATOM;
+  }
+
+  return tok;
+}
+
+// Returns true if tokens k to k + 2 of toks, before end, spell "...".
+static bool isEllipsis(tok_buf *toks, size_t k, size_t end) {
+  return k + 2 < end && toks->types[k] == PERIOD &&
+         toks->types[k + 1] == PERIOD && toks->types[k + 2] == PERIOD &&
+         toks->starts[k + 1] == toks->starts[k] + 1 &&
+         toks->starts[k + 2] == toks->starts[k] + 2;
+}
+
+static pp_macro *macroError(pp_file *f, size_t tok, const char *msg) {
+  f->error = msg;
+  f->error_tok = tok;
+  return NULL;
+}
+
+// Parses the definition of the macro named by token k of f, whose #define
+// line ends before token end. Returns NULL and records the error in f if it
+// is malformed.
+static pp_macro *parseMacro(pp_arena *defs, pp_file *f, size_t k, size_t end) {
+  tok_buf *toks = f->toks;
+  pp_macro *m = (pp_macro *)pp_alloc(defs, sizeof(pp_macro));
+  *m = (pp_macro){0};
+
+  // A parenthesis right after the name, with no space, opens the parameters.
+  uint32_t params[PP_MAX_PARAMS];
+  size_t i = k + 1;
+  if (i < end && toks->types[i] == LPAREN &&
+      toks->starts[i] == toks->starts[k] + toks->lens[k]) {
+    m->function = true;
+
+    if (++i < end && toks->types[i] == RPAREN)
+      ++i;
+    else {
+      for (;;) {
+        if (isEllipsis(toks, i, end)) {
+          m->variadic = true;
+          params[m->nparams++] = va_args_atom;
+          i += 3;
+          if (i >= end || toks->types[i] != RPAREN)
+            return macroError(f, i - 1, "Expected ) after ...");
+
+          ++i;
+          break;
+        }
+
+        if (i >= end || toks->types[i] != IDENT ||
+            m->nparams == PP_MAX_PARAMS)
+          return macroError(f, k, "Invalid macro parameter list");
+        params[m->nparams++] = toks->ids[i++];
+
+        if (i < end && toks->types[i] == COMMA) {
+          ++i;
+          continue;
+        }
+        if (i < end && toks->types[i] == RPAREN) {
+          ++i;
+          break;
+        }
+
+        return macroError(f, k, "Invalid macro parameter list");
+      }
+    }
+  }
+
+  size_t first = i;
+  m->body = (pp_tok *)pp_alloc(defs, sizeof(pp_tok) * (end - i + 1));
+  for (; i < end; ++i) {
+    if (isContinuation(f, i))
+      continue;
+
+    pp_tok tok = fileTok(f, i);
+    for (uint32_t p = 0; m->function && tok.type == IDENT && p < m->nparams;
+         ++p) {
+      if (params[p] == tok.id)
+        tok.param = (uint16_t)(p + 1);
+    }
+
+    m->body[m->len++] = tok;
+  }
+
+  if (m->len && (m->body[0].type == HASHHASH ||
+                 m->body[m->len - 1].type == HASHHASH))
+    return macroError(f, k, "## at either end of a macro");
+
+  for (size_t j = 0; m->function && j < m->len; ++j) {
+    if (m->body[j].type == HASH && (j + 1 == m->len || !m->body[j + 1].param))
+      return macroError(f, first, "Expected a macro parameter after #");
+  }
+
+  return m;
+}
+
+// Records the directives of f and links the branches of each conditional,
+// parsing macro definitions into defs. Malformed directives are recorded in
+// f->error, to be reported wherever f is included.
+static void scanDirectives(pp_arena *defs, pp_file *f) {
+  tok_buf *toks = f->toks;
+  const char *text = f->src.text.chars;
+  size_t len = toks->len - 1; // Not counting END
+
+  uint32_t open[PP_MAX_DEPTH];
+  size_t depth = 0;
+
+  for (size_t k = 0; k < len; ++k) {
+    if (toks->types[k] != HASH || !startsLine(toks, text, k))
+      continue;
+
+    size_t end = k + 1;
+    while (end < len && !startsLine(toks, text, end))
+      ++end;
+
+    pp_directive dir = {.first = (uint32_t)k,
+                        .end = (uint32_t)end,
+                        .kind = directiveKind(toks, k, end)};
+    uint32_t at = (uint32_t)f->ndirs;
+    k = end - 1;
+
+    switch (dir.kind) {
+      case PP_DEFINE:
+      case PP_UNDEF:
+      case PP_IFDEF:
+      case PP_IFNDEF: {
+        if (dir.first + 2 >= end || toks->types[dir.first + 2] != IDENT) {
+          f->error = "Expected a macro name";
+          f->error_tok = dir.first;
+          return;
+        }
+
+        dir.name = toks->ids[dir.first + 2];
+        if (dir.kind == PP_DEFINE &&
+            !(dir.macro = parseMacro(defs, f, dir.first + 2, end)))
+          return;
+      } break;
+
+      case PP_PRAGMA: {
+        if (dir.first + 2 < end && toks->ids[dir.first + 2] == once_atom &&
+            toks->types[dir.first + 2] == IDENT)
+          f->once = true;
+      } break;
+
+      default: break;
+    }
+
+    if (isConditional(dir.kind)) {
+      if (depth == PP_MAX_DEPTH) {
+        f->error = "Conditionals nested too deeply";
+        f->error_tok = dir.first;
+        return;
+      }
+
+      open[depth++] = at;
+    } else if (dir.kind == PP_ELIF || dir.kind == PP_ELSE ||
+               dir.kind == PP_ENDIF) {
+      bool after_else = depth && f->dirs[open[depth - 1]].kind == PP_ELSE;
+      if (depth == 0 || (after_else && dir.kind != PP_ENDIF)) {
+        f->error = depth ? "Directive after #else" : "Directive without #if";
+        f->error_tok = dir.first;
+        return;
+      }
+
+      f->dirs[open[depth - 1]].next = at;
+      if (dir.kind == PP_ENDIF)
+        --depth;
+      else
+        open[depth - 1] = at;
+    }
+
+    pushDirective(f, dir);
+  }
+
+  if (depth) {
+    f->error = "Unterminated conditional";
+    f->error_tok = f->dirs[open[depth - 1]].first;
+    return;
+  }
+
+  // The whole file is inside #ifndef X, #define X ... #endif, so once X is
+  // defined, including it again has no effect.
+  pp_directive *d = f->dirs;
+  if (f->ndirs >= 3 && d[0].kind == PP_IFNDEF && d[0].first == 0 &&
+      d[1].kind == PP_DEFINE && d[1].first == d[0].end &&
+      d[1].name == d[0].name && d[0].next == f->ndirs - 1 &&
+      d[f->ndirs - 1].end == len)
+    f->guard = d[0].name;
+}
+
+// Makes room for the file of every path atom.
+static void growFiles(pp_cache *cache) {
+  if (cache->paths.len <= cache->cap)
+    return;
+
+  size_t cap = cache->paths.len * 2;
+  cache->files = realloc(cache->files, sizeof(*cache->files) * cap);
+  assert(cache->files != NULL, "Could not allocate memory for file cache");
+  memset(cache->files + cache->cap, 0,
+         sizeof(*cache->files) * (cap - cache->cap));
+  cache->cap = cap;
+}
+
+static void cacheReady(pp_cache *cache) {
+  if (!cache->ready) {
+    intern_init(&cache->paths, 256);
+    cache->ready = true;
+  }
+}
+
+// Creates the file at the path atom key, whose resolved path is the atom
+// real, and gives it the next size + 1 bytes of the combined offset space.
+// One past the end of each file is its END token's offset, so ranges never
+// touch.
+static pp_file *addFile(pp_cache *cache, uint32_t key, uint32_t real,
+                        size_t size) {
+  assert(cache->next_base + size < UINT32_MAX,
+         "Too much source text for 32-bit token offsets");
+
+  pp_file *f = (pp_file *)calloc(1, sizeof(pp_file));
+  assert(f != NULL, "Could not allocate memory for file");
+
+  f->path = atom_name(&cache->paths, key);
+  const char *slash = strrchr(f->path, '/');
+  f->dir_len = slash ? (size_t)(slash - f->path) + 1 : 0;
+  f->key = real;
+  f->size = size;
+  f->base = cache->next_base;
+  cache->next_base += size + 1;
+
+  if (cache->len == cache->loaded_cap) {
+    cache->loaded_cap = cache->loaded_cap ? cache->loaded_cap * 2 : 16;
+    cache->loaded =
+        realloc(cache->loaded, sizeof(*cache->loaded) * cache->loaded_cap);
+    assert(cache->loaded != NULL, "Could not allocate memory for file cache");
+  }
+  f->id = cache->len;
+  cache->loaded[cache->len++] = f;
+
+  cache->files[real] = f;
+  return f;
+}
+
+// Tokenizes the text of f and finds its directives.
+static void lexFile(pp_cache *cache, pp_file *f, size_t jobs) {
+  tok_reserve(f->toks, f->src.text.len / 4);
+  tokenize_parallel(f->src.text, f->toks, f->src.text.len, jobs);
+
+  pthread_once(&names_ready, initNames);
+  scanDirectives(&cache->defs, f);
+}
+
+// Reads and tokenizes the file at path, whose atom is key, unless it was
+// already read through another path. Returns NULL if it cannot be read.
+static pp_file *loadFile(pp_cache *cache, uint32_t key, size_t jobs) {
+  const char *path = atom_name(&cache->paths, key);
+
+  source_file src;
+  if (!file_load(path, &src))
+    return NULL;
+
+  char *resolved = realpath(path, NULL);
+  uint32_t real = key;
+  if (resolved) {
+    real = intern(&cache->paths, resolved, strlen(resolved));
+    free(resolved);
+    growFiles(cache);
+  }
+
+  if (cache->files[real] && cache->files[real] != &missing) {
+    file_unload(&src);
+    return cache->files[real];
+  }
+
+  pp_file *f = addFile(cache, key, real, src.text.len);
+  f->src = src;
+  f->toks = tok_init(0);
+  lexFile(cache, f, jobs);
+  return f;
+}
+
+// Adds a file known from a precompiled header to the cache without reading
+// it. It is given its offset range and the line starts that locate its
+// tokens, and is only read if it is entered. If its resolved path real was
+// already looked up, that file is returned instead.
+pp_file *pp_add_lazy(const char *real, size_t size, const uint32_t *lines,
+                     size_t nlines, uint32_t guard, bool once) {
+  pp_cache *cache = &sources;
+  pthread_mutex_lock(&cache->lock);
+  cacheReady(cache);
+
+  uint32_t key = intern(&cache->paths, real, strlen(real));
+  growFiles(cache);
+
+  pp_file *f = cache->files[key];
+  if (!f || f == &missing) {
+    f = addFile(cache, key, key, size);
+    f->lazy = true;
+    f->guard = guard;
+    f->once = once;
+
+    f->toks = tok_init(0);
+    line_index *index = &f->toks->lines;
+    index->starts = (uint32_t *)malloc(sizeof(uint32_t) * (nlines + 1));
+    assert(index->starts != NULL, "Could not allocate memory for lines");
+    memcpy(index->starts, lines, sizeof(uint32_t) * nlines);
+    index->len = index->cap = nlines;
+  }
+
+  pthread_mutex_unlock(&cache->lock);
+  return f;
+}
+
+// Makes f the file looked up by path, unless path was looked up already.
+void pp_add_path(const char *path, pp_file *f) {
+  pp_cache *cache = &sources;
+  pthread_mutex_lock(&cache->lock);
+  cacheReady(cache);
+
+  uint32_t key = intern(&cache->paths, path, strlen(path));
+  growFiles(cache);
+  if (!cache->files[key])
+    cache->files[key] = f;
+
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// Reads a file that was added by pp_add_lazy() the first time it is entered.
+// Its text must not have changed size, since its offset range is fixed.
+static bool readLazy(pp_file *f, size_t jobs) {
+  pp_cache *cache = &sources;
+  pthread_mutex_lock(&cache->lock);
+
+  bool ok = true;
+  if (f->lazy) {
+    ok = file_load(f->path, &f->src);
+    if (ok && f->src.text.len != f->size) {
+      file_unload(&f->src);
+      ok = false;
+    }
+
+    if (ok) {
+      lexFile(cache, f, jobs);
+      f->lazy = false;
+    }
+  }
+
+  pthread_mutex_unlock(&cache->lock);
+  if (!ok)
+    fprintf(stderr, "Could not read %s as it was when precompiled\n", f->path);
+  return ok;
+}
+
+// Returns the file at the len-byte path, reading it on the first lookup, or
+// NULL if it cannot be read.
+static pp_file *findFile(const char *path, size_t len, size_t jobs) {
+  pp_cache *cache = &sources;
+  pthread_mutex_lock(&cache->lock);
+  cacheReady(cache);
+
+  uint32_t key = intern(&cache->paths, path, len);
+  growFiles(cache);
+
+  pp_file *f = cache->files[key];
+  if (!f) {
+    f = loadFile(cache, key, jobs);
+    cache->files[key] = f ? f : &missing;
+  }
+
+  pthread_mutex_unlock(&cache->lock);
+  return (f == &missing) ? NULL : f;
+}
+
+// Maps an offset of the combined offset space to its file, line and column.
+src_loc pp_locate(size_t pos) {
+  pthread_mutex_lock(&sources.lock);
+
+  size_t lo = 0, hi = sources.len;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (sources.loaded[mid]->base <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  pp_file *f = sources.loaded[lo];
+
+  // Reading a lazy file rebuilds its lines under the lock.
+  src_loc loc = lines_locate(&f->toks->lines, pos - f->base);
+  loc.path = f->path;
+
+  pthread_mutex_unlock(&sources.lock);
+  return loc;
+}
+
+static void report(src_loc loc, const char *fmt, va_list args) {
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, " (%s, line %lu, column %lu).\n", loc.path, loc.line,
+          loc.col);
+}
+
+// Reports an error at token tok of f. Always returns false.
+static bool fileError(pp_file *f, size_t tok, const char *fmt, ...) {
+  src_loc loc = lines_locate(&f->toks->lines, f->toks->starts[tok]);
+  loc.path = f->path;
+
+  va_list args;
+  va_start(args, fmt);
+  report(loc, fmt, args);
+  va_end(args);
+  return false;
+}
+
+// Reports an error at offset pos of the combined offset space. Always returns
+// false.
+static bool ppError(size_t pos, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  report(pp_locate(pos), fmt, args);
+  va_end(args);
+  return false;
+}
+
+static pp_macro *macroOf(preproc_t *pp, uint32_t name) {
+  return (name < pp->macros_cap) ? pp->macros[name] : NULL;
+}
+
+static bool isDefined(preproc_t *pp, uint32_t name) {
+  return macroOf(pp, name) != NULL;
+}
+
+void pp_set_macro(preproc_t *pp, uint32_t name, pp_macro *m) {
+  if (name >= pp->macros_cap) {
+    size_t grown = (name + 1) * 2;
+    pp->macros = realloc(pp->macros, sizeof(*pp->macros) * grown);
+    assert(pp->macros != NULL, "Could not allocate memory for macro table");
+    memset(pp->macros + pp->macros_cap, 0,
+           sizeof(*pp->macros) * (grown - pp->macros_cap));
+    pp->macros_cap = grown;
+  }
+
+  pp->macros[name] = m;
+}
+
+// Sets one flag of a table indexed by path atom, growing it as needed.
+static void setFlag(uint8_t **flags, size_t *cap, size_t idx, bool value) {
+  if (idx >= *cap) {
+    size_t grown = (idx + 1) * 2;
+    *flags = realloc(*flags, grown);
+    assert(*flags != NULL, "Could not allocate memory for preprocessor");
+    memset(*flags + *cap, 0, grown - *cap);
+    *cap = grown;
+  }
+
+  (*flags)[idx] = value;
+}
+
+// Appends tokens [from, to) of f to the output, moved into f's offset range.
+static void emit(preproc_t *pp, pp_file *f, size_t from, size_t to) {
+  tok_buf *in = f->toks, *out = pp->out;
+  size_t n = to - from;
+  if (n == 0)
+    return;
+
+  if (out->len + n > out->cap)
+    tok_reserve(out, (out->len + n > out->cap * 3 / 2) ? out->len + n
+                                                        : out->cap * 3 / 2);
+
+  memcpy(out->types + out->len, in->types + from, sizeof(*in->types) * n);
+  memcpy(out->lens + out->len, in->lens + from, sizeof(*in->lens) * n);
+
+  for (size_t k = 0; k < n; ++k) {
+    TokenType type = (TokenType)in->types[from + k];
+    uint32_t id = in->ids[from + k];
+    if (type == INTLIT || type == FLOATLIT)
+      id = tok_push_num(out, in->nums[id]);
+
+    out->starts[out->len + k] = (uint32_t)(f->base + in->starts[from + k]);
+    out->ids[out->len + k] = id;
+  }
+
+  out->len += n;
+}
+
+// Macro expansion follows Prosser's algorithm. Each token carries a hide-set
+// of the macros it came out of, which it may not invoke again; an expansion
+// is pushed back onto the input and rescanned together with whatever follows
+// it. Expansions are arrays of pp_tok in pp->scratch, and tokens outside
+// them are read from the file's tok_buf as they are needed, so text is never
+// copied and the arena is reset once the input is back in the file.
+
+struct pp_hide {
+  uint32_t name;
+  pp_hide *next;
+};
+
+static bool hideHas(pp_hide *hs, uint32_t name) {
+  for (; hs; hs = hs->next) {
+    if (hs->name == name)
+      return true;
+  }
+
+  return false;
+}
+
+static pp_hide *hideAdd(pp_arena *a, pp_hide *hs, uint32_t name) {
+  if (hideHas(hs, name))
+    return hs;
+
+  pp_hide *node = (pp_hide *)pp_alloc(a, sizeof(pp_hide));
+  *node = (pp_hide){.name = name, .next = hs};
+  return node;
+}
+
+// Sets built from one another share their tails, so a set that is a tail of
+// the other (as the sets of arguments usually are of the set added by their
+// macro) is recognized without comparing names.
+static pp_hide *hideUnion(pp_arena *a, pp_hide *x, pp_hide *y) {
+  for (pp_hide *tail = y; x && tail; tail = tail->next) {
+    if (tail == x)
+      return y;
+  }
+
+  for (; x; x = x->next)
+    y = hideAdd(a, y, x->name);
+  return y;
+}
+
+static pp_hide *hideIntersect(pp_arena *a, pp_hide *x, pp_hide *y) {
+  if (x == y)
+    return x;
+
+  pp_hide *both = NULL;
+  for (; x; x = x->next) {
+    if (hideHas(y, x->name))
+      both = hideAdd(a, both, x->name);
+  }
+
+  return both;
+}
+
+// Growable array of tokens in an arena.
+typedef struct {
+  pp_tok *toks;
+  size_t len;
+  size_t cap;
+} pp_vec;
+
+static void vecReserve(pp_arena *a, pp_vec *v, size_t cap) {
+  pp_tok *toks = (pp_tok *)pp_alloc(a, sizeof(pp_tok) * cap);
+  if (v->len)
+    memcpy(toks, v->toks, sizeof(pp_tok) * v->len);
+
+  v->toks = toks;
+  v->cap = cap;
+}
+
+static inline void vecPush(pp_arena *a, pp_vec *v, pp_tok tok) {
+  if (v->len == v->cap)
+    vecReserve(a, v, v->cap ? v->cap * 2 : 8);
+
+  v->toks[v->len++] = tok;
+}
+
+// The unread rest of an expansion.
+typedef struct {
+  pp_tok *toks;
+  size_t pos;
+  size_t len;
+} pp_frame;
+
+// Input of the expansion engine: expansions still being rescanned, innermost
+// last, and after them the tokens [pos, end) of file, if it is set.
+typedef struct {
+  pp_frame *frames;
+  size_t nframes;
+  size_t cap;
+
+  pp_file *file;
+  size_t pos;
+  size_t end;
+} pp_input;
+
+static void pushFrame(preproc_t *pp, pp_input *in, pp_tok *toks, size_t len) {
+  if (len == 0)
+    return;
+
+  if (in->nframes == in->cap) {
+    size_t cap = in->cap ? in->cap * 2 : 8;
+    pp_frame *frames = (pp_frame *)pp_alloc(&pp->scratch, sizeof(*frames) * cap);
+    if (in->nframes)
+      memcpy(frames, in->frames, sizeof(*frames) * in->nframes);
+
+    in->frames = frames;
+    in->cap = cap;
+  }
+
+  in->frames[in->nframes++] = (pp_frame){.toks = toks, .len = len};
+}
+
+// Drops the expansions that were read to the end. Returns true if one is left.
+static bool pending(pp_input *in) {
+  while (in->nframes &&
+         in->frames[in->nframes - 1].pos == in->frames[in->nframes - 1].len)
+    --in->nframes;
+
+  return in->nframes > 0;
+}
+
+static bool peekTok(pp_input *in, pp_tok *tok) {
+  if (pending(in)) {
+    pp_frame *top = &in->frames[in->nframes - 1];
+    *tok = top->toks[top->pos];
+    return true;
+  }
+
+  if (in->file && in->pos < in->end) {
+    *tok = fileTok(in->file, in->pos);
+    return true;
+  }
+
+  return false;
+}
+
+static bool nextTok(pp_input *in, pp_tok *tok) {
+  if (!peekTok(in, tok))
+    return false;
+
+  if (in->nframes)
+    ++in->frames[in->nframes - 1].pos;
+  else
+    ++in->pos;
+  return true;
+}
+
+// Appends tok to out, or to the output of pp if out is NULL.
+static void put(preproc_t *pp, pp_vec *out, pp_tok *tok) {
+  if (out) {
+    vecPush(&pp->scratch, out, *tok);
+    return;
+  }
+
+  uint32_t id = tok->id;
+  if (tok->type == INTLIT || tok->type == FLOATLIT)
+    id = tok_push_num(pp->out, tok->num);
+  tok_push(pp->out, (TokenType)tok->type, tok->start, tok->len, id);
+}
+
+// Reads the arguments of a call of m, whose name and ( were read already,
+// up to and including the closing ), which is stored in *close.
+static bool readArgs(preproc_t *pp, pp_input *in, pp_macro *m, pp_tok *name,
+                     pp_vec **args, pp_tok *close) {
+  const char *macro = atom_name(&idents, name->id);
+  size_t n = m->nparams ? m->nparams : 1;
+  pp_vec *arg = (pp_vec *)pp_alloc(&pp->scratch, sizeof(pp_vec) * n);
+  memset(arg, 0, sizeof(pp_vec) * n);
+
+  size_t k = 0, depth = 0;
+  for (pp_tok tok;;) {
+    if (!nextTok(in, &tok))
+      return ppError(name->start, "Unterminated call of macro %s", macro);
+
+    if (depth == 0 && tok.type == RPAREN) {
+      *close = tok;
+      break;
+    }
+
+    // The variadic argument takes every comma after the named ones.
+    if (depth == 0 && tok.type == COMMA &&
+        !(m->variadic && k + 1 == m->nparams)) {
+      if (++k == n)
+        return ppError(name->start, "Too many arguments to macro %s", macro);
+      continue;
+    }
+
+    if (tok.type == LPAREN)
+      ++depth;
+    else if (tok.type == RPAREN)
+      --depth;
+    vecPush(&pp->scratch, &arg[k], tok);
+  }
+
+  if (m->nparams == 0 && arg[0].len)
+    return ppError(name->start, "Too many arguments to macro %s", macro);
+
+  // Only the variadic argument may be left out entirely.
+  if (k + 1 < m->nparams && !(m->variadic && k + 2 == m->nparams))
+    return ppError(name->start, "Too few arguments to macro %s", macro);
+
+  *args = arg;
+  return true;
+}
+
+// Returns the string literal spelling the tokens of arg, as # does. It has no
+// source text, so its spelling is interned as its atom.
+static pp_tok stringify(preproc_t *pp, pp_vec *arg, pp_tok *at) {
+  size_t cap = 2;
+  for (size_t k = 0; k < arg->len; ++k)
+    cap += arg->toks[k].len * 2 + 1;
+
+  char *text = (char *)pp_alloc(&pp->scratch, cap);
+  size_t len = 0;
+  text[len++] = '"';
+
+  for (size_t k = 0; k < arg->len; ++k) {
+    pp_tok *tok = &arg->toks[k];
+    if (k && tok->space)
+      text[len++] = ' ';
+
+    // Quotes and backslashes inside literals are escaped.
+    bool literal = tok->type == STRINGLIT || tok->type == CHARLIT;
+    for (size_t c = 0; c < tok->len; ++c) {
+      if (literal && (tok->text[c] == '"' || tok->text[c] == '\\'))
+        text[len++] = '\\';
+      text[len++] = tok->text[c];
+    }
+  }
+  text[len++] = '"';
+
+  return (pp_tok){.text = text,
+                  .start = at->start,
+                  .len = (uint32_t)len,
+                  .id = intern(&idents, text, len),
+                  .type = STRINGLIT,
+                  .space = at->space};
+}
+
+// Replaces *lhs by the token spelled by lhs followed by rhs, as ## does.
+static bool paste(preproc_t *pp, pp_tok *lhs, pp_tok *rhs, pp_tok *at) {
+  size_t len = lhs->len + rhs->len;
+  char *text = (char *)pp_alloc(&pp->scratch, len + SRC_PADDING);
+  memcpy(text, lhs->text, lhs->len);
+  memcpy(text + lhs->len, rhs->text, rhs->len);
+  memset(text + len, 0, SRC_PADDING);
+
+  Token tok;
+  lit_value num = {0};
+  if (!lex_single(text, len, &tok, &num))
+    return ppError(at->start, "Pasting %.*s and %.*s does not give a token",
+                   (int)lhs->len, lhs->text, (int)rhs->len, rhs->text);
+
+  *lhs = (pp_tok){.text = text,
+                  .hide = lhs->hide,
+                  .num = num,
+                  .start = at->start,
+                  .len = (uint32_t)len,
+                  .id = tok.atom,
+                  .type = tok.type,
+                  .space = lhs->space};
+  return true;
+}
+
+static bool expandList(preproc_t *pp, pp_tok *toks, size_t len, pp_vec *out);
+
+// Returns true if arg names a macro that may expand, so that it needs to be
+// expanded before it is substituted.
+static bool hasMacro(preproc_t *pp, pp_vec *arg) {
+  for (size_t k = 0; k < arg->len; ++k) {
+    pp_tok *tok = &arg->toks[k];
+    if (tok->type == IDENT && macroOf(pp, tok->id) &&
+        !hideHas(tok->hide, tok->id))
+      return true;
+  }
+
+  return false;
+}
+
+// Pushes the replacement list of m onto in in place of the call named by
+// name, with args substituted for its parameters, # and ## applied and hs
+// added to every hide-set. Tokens of the list are located at the call.
+static bool substitute(preproc_t *pp, pp_input *in, pp_macro *m,
+                       pp_tok *name, pp_vec *args, pp_hide *hs) {
+  pp_arena *a = &pp->scratch;
+  pp_vec res = {0};
+  pp_vec *expanded = NULL; // Arguments macro-expanded, as they are needed
+  bool empty = false;      // The last operand appended was an empty argument
+
+  // Usually enough for the whole expansion
+  size_t cap = m->len;
+  for (size_t p = 0; args && p < m->nparams; ++p)
+    cap += args[p].len;
+  vecReserve(a, &res, cap + 1);
+
+  for (size_t i = 0; i < m->len; ++i) {
+    pp_tok *tok = &m->body[i];
+    bool pasted = i + 1 < m->len && m->body[i + 1].type == HASHHASH;
+
+    if (m->function && tok->type == HASH) {
+      vecPush(a, &res, stringify(pp, &args[m->body[++i].param - 1], name));
+      empty = false;
+      continue;
+    }
+
+    // The operands of ## are not expanded. An empty argument leaves the other
+    // operand as it is.
+    if (tok->type == HASHHASH) {
+      pp_tok *rhs = &m->body[++i], str;
+      size_t n = 1;
+      if (m->function && rhs->type == HASH) {
+        str = stringify(pp, &args[m->body[++i].param - 1], name);
+        rhs = &str;
+      } else if (rhs->param) {
+        n = args[rhs->param - 1].len;
+        rhs = args[rhs->param - 1].toks;
+      }
+
+      if (n == 0)
+        continue;
+
+      size_t k = 0;
+      if (!empty) {
+        if (!paste(pp, &res.toks[res.len - 1], &rhs[0], name))
+          return false;
+        k = 1;
+      }
+
+      for (; k < n; ++k)
+        vecPush(a, &res, rhs[k]);
+      empty = false;
+      continue;
+    }
+
+    if (tok->param) {
+      size_t p = tok->param - 1;
+      pp_vec *arg = &args[p];
+      if (!pasted && hasMacro(pp, arg)) {
+        if (!expanded) {
+          expanded = (pp_vec *)pp_alloc(a, sizeof(pp_vec) * m->nparams);
+          memset(expanded, 0, sizeof(pp_vec) * m->nparams);
+        }
+        if (!expanded[p].toks && !expandList(pp, arg->toks, arg->len,
+                                              &expanded[p]))
+          return false;
+        arg = &expanded[p];
+      }
+
+      for (size_t k = 0; k < arg->len; ++k)
+        vecPush(a, &res, arg->toks[k]);
+      empty = arg->len == 0;
+      continue;
+    }
+
+    pp_tok copy = *tok;
+    copy.start = name->start;
+    vecPush(a, &res, copy);
+    empty = false;
+  }
+
+  for (size_t k = 0; k < res.len; ++k)
+    res.toks[k].hide = hideUnion(a, res.toks[k].hide, hs);
+  if (res.len)
+    res.toks[0].space = name->space;
+
+  pushFrame(pp, in, res.toks, res.len);
+  return true;
+}
+
+// Reads one token from in. If it invokes a macro, the expansion is pushed
+// back onto in to be rescanned; otherwise the token is appended to out, or to
+// the output of pp if out is NULL.
+static bool expandOne(preproc_t *pp, pp_input *in, pp_vec *out) {
+  pp_tok tok;
+  nextTok(in, &tok);
+
+  pp_macro *m = (tok.type == IDENT) ? macroOf(pp, tok.id) : NULL;
+  if (!m || hideHas(tok.hide, tok.id)) {
+    put(pp, out, &tok);
+    return true;
+  }
+
+  if (!m->function)
+    return substitute(pp, in, m, &tok, NULL,
+                      hideAdd(&pp->scratch, tok.hide, tok.id));
+
+  // The name of a function-like macro without arguments is left alone.
+  pp_tok paren;
+  if (!peekTok(in, &paren) || paren.type != LPAREN) {
+    put(pp, out, &tok);
+    return true;
+  }
+  nextTok(in, &paren);
+
+  pp_vec *args = NULL;
+  pp_tok close = {0};
+  if (!readArgs(pp, in, m, &tok, &args, &close))
+    return false;
+
+  pp_hide *hs = hideIntersect(&pp->scratch, tok.hide, close.hide);
+  return substitute(pp, in, m, &tok, args, hideAdd(&pp->scratch, hs, tok.id));
+}
+
+// Fully expands toks on their own, as an argument is before substitution,
+// appending the result to out.
+static bool expandList(preproc_t *pp, pp_tok *toks, size_t len, pp_vec *out) {
+  pp_input in = {0};
+  pushFrame(pp, &in, toks, len);
+
+  while (pending(&in)) {
+    if (!expandOne(pp, &in, out))
+      return false;
+  }
+
+  return true;
+}
+
+// Appends tokens [from, to) of f to the output, expanding macros. Stretches
+// without a macro name are copied in bulk.
+static bool expandRun(preproc_t *pp, pp_file *f, size_t from, size_t to) {
+  tok_buf *toks = f->toks;
+
+  while (from < to) {
+    size_t k = from;
+    while (k < to && !(toks->types[k] == IDENT && macroOf(pp, toks->ids[k])))
+      ++k;
+
+    emit(pp, f, from, k);
+    if (k == to)
+      break;
+
+    // Rescanning may read the arguments of a call from the file, so the run
+    // resumes wherever the input is once no expansion is left.
+    pp_input in = {.file = f, .pos = k, .end = to};
+    do {
+      if (!expandOne(pp, &in, NULL))
+        return false;
+    } while (pending(&in));
+
+    ppReset(&pp->scratch);
+    from = in.pos;
+  }
+
+  return true;
+}
+
+// Evaluation of #if and #elif conditions, by precedence climbing over the
+// expanded tokens of the line. Operands that are not evaluated (as on the
+// right of a false &&) do not report division by zero.
+typedef struct {
+  pp_tok *toks;
+  size_t len;
+  size_t pos;
+  size_t at; // Offset of the directive
+} pp_eval;
+
+static int precedence(TokenType type) {
+  switch (type) {
+    case OR:       return 1;
+    case AND:      return 2;
+    case BITOR:    return 3;
+    case XOR:      return 4;
+    case AMPER:    return 5;
+    case EQEQ:
+    case NEQ:      return 6;
+    case LT:
+    case GT:
+    case LE:
+    case GE:       return 7;
+    case LSHIFT:
+    case RSHIFT:   return 8;
+    case PLUS:
+    case MINUS:    return 9;
+    case ASTERISK:
+    case SLASH:
+    case MODULO:   return 10;
+    default:       return 0;
+  }
+}
+
+// Returns the value of a character constant: its first character, with
+// escapes decoded.
+static int64_t charValue(pp_tok *tok) {
+  const char *s = tok->text + 1;
+  if (s[0] != '\\')
+    return (unsigned char)s[0];
+
+  switch (s[1]) {
+    case 'a': return '\a';
+    case 'b': return '\b';
+    case 'f': return '\f';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    case 'v': return '\v';
+    case 'x': return strtol(s + 2, NULL, 16);
+    default:  break;
+  }
+
+  if (s[1] >= '0' && s[1] <= '7') {
+    int64_t v = 0;
+    for (size_t k = 1; k <= 3 && s[k] >= '0' && s[k] <= '7'; ++k)
+      v = v * 8 + (s[k] - '0');
+    return v;
+  }
+
+  return (unsigned char)s[1];
+}
+
+static bool evalTernary(pp_eval *e, bool live, int64_t *v);
+
+static bool evalUnary(pp_eval *e, bool live, int64_t *v) {
+  if (e->pos == e->len)
+    return ppError(e->at, "Expected an expression in #if");
+
+  pp_tok *tok = &e->toks[e->pos++];
+  switch (tok->type) {
+    case PLUS: return evalUnary(e, live, v);
+
+    case MINUS:
+    case TILDE:
+    case NOT: {
+      if (!evalUnary(e, live, v))
+        return false;
+
+      if (tok->type == MINUS)
+        *v = (int64_t)(0 - (uint64_t)*v);
+      else
+        *v = (tok->type == TILDE) ? ~*v : !*v;
+      return true;
+    }
+
+    case LPAREN: {
+      if (!evalTernary(e, live, v))
+        return false;
+      if (e->pos == e->len || e->toks[e->pos].type != RPAREN)
+        return ppError(tok->start, "Expected ) in #if");
+
+      ++e->pos;
+      return true;
+    }
+
+    case INTLIT: *v = (int64_t)tok->num.u; return true;
+    case CHARLIT: *v = charValue(tok); return true;
+
+    // Identifiers and keywords left after expansion are 0.
+    default: {
+      if (!isalpha((unsigned char)tok->text[0]) && tok->text[0] != '_')
+        return ppError(tok->start, "Invalid token %.*s in #if", (int)tok->len,
+                       tok->text);
+
+      *v = 0;
+      return true;
+    }
+  }
+}
+
+static bool evalBinary(pp_eval *e, int min, bool live, int64_t *v) {
+  if (!evalUnary(e, live, v))
+    return false;
+
+  while (e->pos < e->len) {
+    pp_tok *op = &e->toks[e->pos];
+    int prec = precedence((TokenType)op->type);
+    if (prec == 0 || prec < min)
+      break;
+    ++e->pos;
+
+    bool right = live && !(op->type == AND && !*v) && !(op->type == OR && *v);
+    int64_t r;
+    if (!evalBinary(e, prec + 1, right, &r))
+      return false;
+
+    uint64_t x = (uint64_t)*v, y = (uint64_t)r;
+    switch (op->type) {
+      case OR:       *v = *v || r; break;
+      case AND:      *v = *v && r; break;
+      case BITOR:    *v = *v | r; break;
+      case XOR:      *v = *v ^ r; break;
+      case AMPER:    *v = *v & r; break;
+      case EQEQ:     *v = *v == r; break;
+      case NEQ:      *v = *v != r; break;
+      case LT:       *v = *v < r; break;
+      case GT:       *v = *v > r; break;
+      case LE:       *v = *v <= r; break;
+      case GE:       *v = *v >= r; break;
+      case LSHIFT:   *v = (int64_t)(x << (y & 63)); break;
+      case RSHIFT:   *v = *v >> (y & 63); break;
+      case PLUS:     *v = (int64_t)(x + y); break;
+      case MINUS:    *v = (int64_t)(x - y); break;
+      case ASTERISK: *v = (int64_t)(x * y); break;
+
+      default: {
+        if (r == 0) {
+          if (right)
+            return ppError(op->start, "Division by zero in #if");
+          *v = 0;
+        } else if (r == -1)
+          *v = (op->type == SLASH) ? (int64_t)(0 - x) : 0;
+        else
+          *v = (op->type == SLASH) ? *v / r : *v % r;
+      } break;
+    }
+  }
+
+  return true;
+}
+
+static bool evalTernary(pp_eval *e, bool live, int64_t *v) {
+  if (!evalBinary(e, 1, live, v))
+    return false;
+  if (e->pos == e->len || e->toks[e->pos].type != QUESTION)
+    return true;
+  ++e->pos;
+
+  bool cond = *v != 0;
+  int64_t then, other;
+  if (!evalTernary(e, live && cond, &then))
+    return false;
+  if (e->pos == e->len || e->toks[e->pos].type != COLON)
+    return ppError(e->at, "Expected : in #if");
+  ++e->pos;
+
+  if (!evalTernary(e, live && !cond, &other))
+    return false;
+  *v = cond ? then : other;
+  return true;
+}
+
+// Evaluates the condition of #if or #elif dir of f into *taken.
+static bool evalCondition(preproc_t *pp, pp_file *f, pp_directive *dir,
+                          bool *taken) {
+  tok_buf *toks = f->toks;
+  pp_vec line = {0}, expanded = {0};
+
+  // defined X and defined(X) are replaced first, so X is never expanded.
+  for (size_t k = dir->first + 2; k < dir->end; ++k) {
+    if (isContinuation(f, k))
+      continue;
+
+    pp_tok tok = fileTok(f, k);
+    if (tok.type == IDENT && tok.id == defined_atom) {
+      bool paren = k + 1 < dir->end && toks->types[k + 1] == LPAREN;
+      size_t name = k + 1 + paren;
+      if (name >= dir->end || toks->types[name] != IDENT ||
+          (paren && (name + 1 >= dir->end || toks->types[name + 1] != RPAREN)))
+        return fileError(f, k, "Expected a macro name after defined");
+
+      tok.type = INTLIT;
+      tok.num = (lit_value){.u = isDefined(pp, toks->ids[name])};
+      tok.id = NO_ATOM;
+      k = name + paren;
+    }
+
+    vecPush(&pp->scratch, &line, tok);
+  }
+
+  pp_eval e = {.at = f->base + toks->starts[dir->first]};
+  int64_t value;
+  bool ok = expandList(pp, line.toks, line.len, &expanded);
+  if (ok) {
+    e.toks = expanded.toks;
+    e.len = expanded.len;
+    ok = evalTernary(&e, true, &value);
+  }
+  if (ok && e.pos < e.len)
+    ok = ppError(e.toks[e.pos].start, "Unexpected %.*s in #if",
+                 (int)e.toks[e.pos].len, e.toks[e.pos].text);
+
+  ppReset(&pp->scratch);
+  *taken = ok && value != 0;
+  return ok;
+}
+
+// Sets *name to the file name of an #include directive, and *quoted to
+// whether it was written in quotes rather than angle brackets.
+static bool includeName(pp_file *f, pp_directive *dir, str *name,
+                        bool *quoted) {
+  tok_buf *toks = f->toks;
+  const char *text = f->src.text.chars;
+  size_t k = dir->first + 2;
+  if (k >= dir->end)
+    return false;
+
+  if (toks->types[k] == STRINGLIT) {
+    *name = (str){.len = toks->lens[k] - 2,
+                  .chars = (char *)text + toks->starts[k] + 1};
+    *quoted = true;
+    return true;
+  }
+
+  if (toks->types[k] != LT)
+    return false;
+
+  for (size_t close = k + 1; close < dir->end; ++close) {
+    if (toks->types[close] == GT) {
+      size_t start = toks->starts[k] + 1;
+      *name = (str){.len = toks->starts[close] - start,
+                    .chars = (char *)text + start};
+      *quoted = false;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Looks name up next to the includer (for quoted names) and then in each
+// include directory.
+static pp_file *findInclude(preproc_t *pp, pp_file *from, str name,
+                            bool quoted) {
+  char path[PATH_MAX];
+
+  if (name.len && name.chars[0] == '/')
+    return findFile(name.chars, name.len, pp->jobs);
+
+  if (quoted) {
+    int len = snprintf(path, sizeof(path), "%.*s%.*s", (int)from->dir_len,
+                       from->path, (int)name.len, name.chars);
+    pp_file *f;
+    if (len < (int)sizeof(path) && (f = findFile(path, len, pp->jobs)))
+      return f;
+  }
+
+  for (size_t k = 0; k < pp->ndirs; ++k) {
+    int len = snprintf(path, sizeof(path), "%s/%.*s", pp->dirs[k],
+                       (int)name.len, name.chars);
+    pp_file *f;
+    if (len < (int)sizeof(path) && (f = findFile(path, len, pp->jobs)))
+      return f;
+  }
+
+  return NULL;
+}
+
+static bool processFile(preproc_t *pp, pp_file *f);
+
+// Marks the #pragma once file f as included.
+void pp_set_seen(preproc_t *pp, pp_file *f) {
+  setFlag(&pp->seen, &pp->seen_cap, f->key, true);
+}
+
+// Sets *taken to whether the branch of a conditional that begins at dir is
+// entered. #else and #endif always are.
+static bool branchTaken(preproc_t *pp, pp_file *f, pp_directive *dir,
+                        bool *taken) {
+  switch (dir->kind) {
+    case PP_IFDEF:
+    case PP_IFNDEF: {
+      *taken = isDefined(pp, dir->name) == (dir->kind == PP_IFDEF);
+      return true;
+    }
+
+    case PP_IF:
+    case PP_ELIF: return evalCondition(pp, f, dir, taken);
+
+    default: {
+      *taken = true;
+      return true;
+    }
+  }
+}
+
+static bool include(preproc_t *pp, pp_file *from, pp_directive *dir) {
+  str name;
+  bool quoted;
+  if (!includeName(from, dir, &name, &quoted))
+    return fileError(from, dir->first, "Expected a file name after #include");
+
+  pp_file *f = findInclude(pp, from, name, quoted);
+  if (!f)
+    return fileError(from, dir->first, "Could not find include file %.*s",
+                     (int)name.len, name.chars);
+
+  // Repeated includes stop here, without walking the file again.
+  if ((f->once && f->key < pp->seen_cap && pp->seen[f->key]) ||
+      (f->guard && isDefined(pp, f->guard))) {
+    ++pp->skipped;
+    return true;
+  }
+
+  if (f->once)
+    pp_set_seen(pp, f);
+
+  return processFile(pp, f);
+}
+
+// Appends the tokens of f to the output, carrying out its directives.
+static bool processFile(preproc_t *pp, pp_file *f) {
+  if (f->lazy && !readLazy(f, pp->jobs))
+    return false;
+
+  if (f->error)
+    return fileError(f, f->error_tok, "%s", f->error);
+
+  if (pp->depth == PP_MAX_DEPTH)
+    return fileError(f, 0, "Includes nested too deeply");
+  ++pp->depth;
+  ++pp->entered;
+
+  size_t tok = 0;
+  for (size_t d = 0; d < f->ndirs;) {
+    pp_directive *dir = &f->dirs[d++];
+    if (!expandRun(pp, f, tok, dir->first))
+      return false;
+    tok = dir->end;
+
+    switch (dir->kind) {
+      case PP_NULL:
+      case PP_PRAGMA: break;
+
+      case PP_DEFINE: pp_set_macro(pp, dir->name, dir->macro); break;
+      case PP_UNDEF:  pp_set_macro(pp, dir->name, NULL); break;
+
+      case PP_INCLUDE: {
+        if (!include(pp, f, dir))
+          return false;
+      } break;
+
+      // Branches that are not taken are skipped up to the first one that is,
+      // or past the #endif.
+      case PP_IF:
+      case PP_IFDEF:
+      case PP_IFNDEF: {
+        size_t at = d - 1;
+        for (bool taken;;) {
+          if (!branchTaken(pp, f, &f->dirs[at], &taken))
+            return false;
+          if (taken)
+            break;
+          at = f->dirs[at].next;
+        }
+
+        tok = f->dirs[at].end;
+        d = at + 1;
+      } break;
+
+      // The branch before this one was taken, so the rest of the group is
+      // skipped.
+      case PP_ELIF:
+      case PP_ELSE: {
+        size_t endif = dir->next;
+        while (f->dirs[endif].kind != PP_ENDIF)
+          endif = f->dirs[endif].next;
+
+        tok = f->dirs[endif].end;
+        d = endif + 1;
+      } break;
+
+      case PP_ENDIF: break;
+
+      case PP_ERROR: {
+        size_t from = f->toks->starts[dir->first];
+        size_t to = f->toks->starts[dir->end - 1] + f->toks->lens[dir->end - 1];
+        return fileError(f, dir->first, "%.*s", (int)(to - from),
+                         f->src.text.chars + from);
+      }
+
+      default: return fileError(f, dir->first, "Unknown directive");
+    }
+  }
+
+  if (!expandRun(pp, f, tok, f->toks->len - 1))
+    return false;
+  --pp->depth;
+  return true;
+}
+
+// Appends the tokens of in, whose starts are in the combined offset space, to
+// out.
+static void append(tok_buf *out, tok_buf *in) {
+  size_t n = in->len;
+  if (out->len + n > out->cap)
+    tok_reserve(out, out->len + n);
+
+  memcpy(out->types + out->len, in->types, sizeof(*in->types) * n);
+  memcpy(out->starts + out->len, in->starts, sizeof(*in->starts) * n);
+  memcpy(out->lens + out->len, in->lens, sizeof(*in->lens) * n);
+
+  for (size_t k = 0; k < n; ++k) {
+    uint32_t id = in->ids[k];
+    if (in->types[k] == INTLIT || in->types[k] == FLOATLIT)
+      id = tok_push_num(out, in->nums[id]);
+    out->ids[out->len + k] = id;
+  }
+
+  out->len += n;
+}
+
+void pp_init(preproc_t *pp, const char **dirs, size_t ndirs, size_t jobs) {
+  *pp = (preproc_t){.dirs = dirs, .ndirs = ndirs, .jobs = jobs};
+}
+
+// Tokenizes the file at path into out with its #include files spliced in.
+// Directives are carried out and removed, and END is appended. Token offsets
+// are in the combined offset space of sources, so out->locate is set to
+// pp_locate(). Errors are reported to stderr and return false.
+//
+// Tokens produced by macro expansion are located at the outermost call, apart
+// from those of arguments. They have no source text there, so the spelling of
+// a string literal made by # is kept as its atom.
+bool preprocess(preproc_t *pp, const char *path, tok_buf *out) {
+  pp->out = out;
+
+  pp_file *f = findFile(path, strlen(path), pp->jobs);
+  if (!f) {
+    fprintf(stderr, "Could not read file %s\n", path);
+    return false;
+  }
+
+  out->locate = pp_locate;
+  out->src = f->src.text;
+  out->src_origin = f->base;
+
+  if (pp->prefix)
+    append(out, pp->prefix);
+
+  bool ok = processFile(pp, f);
+  tok_push(out, END, f->base + f->src.text.len, 0, NO_ATOM);
+  return ok;
+}
+
+void pp_destroy(preproc_t *pp) {
+  free(pp->macros);
+  free(pp->seen);
+  ppArenaDestroy(&pp->scratch);
+  if (pp->prefix)
+    tok_destroy(pp->prefix);
+  ppArenaDestroy(&pp->defs);
+  *pp = (preproc_t){0};
+}
+
+void pp_cache_destroy(pp_cache *cache) {
+  pthread_mutex_lock(&cache->lock);
+
+  for (size_t k = 0; k < cache->len; ++k) {
+    pp_file *f = cache->loaded[k];
+    tok_destroy(f->toks);
+    file_unload(&f->src);
+    free(f->dirs);
+    free(f);
+  }
+
+  if (cache->ready)
+    intern_destroy(&cache->paths);
+  ppArenaDestroy(&cache->defs);
+  free(cache->files);
+  free(cache->loaded);
+
+  cache->files = NULL;
+  cache->loaded = NULL;
+  cache->cap = cache->len = cache->loaded_cap = cache->next_base = 0;
+  cache->ready = false;
+
+  pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "tokens.h"
+#include "utils/arena.h"
+#include "utils/dynarray.h"
+#include "utils/file.h"
+#include "utils/intern.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Maximum depth of nested #include files and of nested conditionals.
+#define PP_MAX_DEPTH 200
+
+// Maximum number of parameters of a function-like macro.
+#define PP_MAX_PARAMS 127
+
+typedef enum {
+  PP_NULL, // A lone #
+  PP_INCLUDE,
+  PP_DEFINE,
+  PP_UNDEF,
+  PP_IF,
+  PP_IFDEF,
+  PP_IFNDEF,
+  PP_ELIF,
+  PP_ELSE,
+  PP_ENDIF,
+  PP_PRAGMA,
+  PP_ERROR,
+  PP_UNKNOWN,
+} pp_kind;
+
+// Bump allocator that chains a new block when the current one is full, so
+// nothing allocated from it moves before it is reset.
+typedef struct {
+  arena_t block;
+  dyn_array *full; // Blocks filled before this one
+} pp_arena;
+
+// Set of macros that may not expand a token, because it came out of their
+// expansion. Sets are immutable lists in an arena, so tokens share them.
+typedef struct pp_hide pp_hide;
+
+// A token during macro expansion. Unlike a tok_buf entry it carries its own
+// spelling, since pasted and stringified tokens are in no source file.
+typedef struct {
+  const char *text;
+  pp_hide *hide;
+  lit_value num;  // Numeric literals
+  uint32_t start; // Offset in the combined offset space
+  uint32_t len;
+  uint32_t id;    // Atom of an identifier or of a stringified literal
+  uint16_t param; // In a replacement list, 1 + the index of the parameter
+  uint8_t type;
+  bool space; // Preceded by whitespace
+} pp_tok;
+
+// A #define, parsed once when its file is read. Parameters are numbered in
+// the replacement list, so expansion never compares their names.
+typedef struct {
+  pp_tok *body;
+  uint32_t len;
+  uint32_t nparams; // Including __VA_ARGS__
+  bool function;
+  bool variadic;
+} pp_macro;
+
+// A directive line, as the range of tokens from its # up to the next line.
+typedef struct {
+  uint32_t first; // Index of the # token
+  uint32_t end;   // Index one past the last token of the line
+  uint32_t next;  // For conditionals, the next #elif, #else or #endif
+  uint32_t name;  // Macro named by #define, #undef, #ifdef and #ifndef
+  pp_kind kind;
+  pp_macro *macro; // Definition of #define
+} pp_directive;
+
+// A source file, tokenized once per process. Its directives are found when it
+// is loaded, so including it again only walks the directive list.
+typedef struct {
+  const char *path; // Path it was first opened by
+  size_t dir_len;   // Length of the directory part of path
+  size_t id;        // Index in load order
+  uint32_t key;     // Atom of its resolved path in sources.paths
+  size_t base;      // Offset of its first byte in the combined offset space
+  size_t size;      // Length of its text
+  bool lazy;        // Known from a precompiled header and not read yet
+  source_file src;
+  tok_buf *toks;
+
+  pp_directive *dirs;
+  size_t ndirs;
+
+  uint32_t guard; // Include guard macro, or NO_ATOM
+  bool once;      // Has #pragma once
+
+  const char *error; // Malformed conditional structure, found when loaded
+  size_t error_tok;
+} pp_file;
+
+// Process-wide cache of the files read by the preprocessor. Files are keyed
+// by every path they were looked up by (the directory of the includer joined
+// with the name, or an include directory joined with it) and by their
+// resolved path, so a repeated include is one hash lookup and files reached
+// through different paths are read once.
+//
+// Each file is given its own range of a combined offset space, so tokens
+// from different files can share one tok_buf and still be located (see
+// pp_locate()).
+typedef struct {
+  interner_t paths;
+  pp_file **files; // File of each path atom, NULL if not looked up yet
+  size_t cap;
+
+  pp_file **loaded; // In load order, which is also the order of base
+  size_t len;
+  size_t loaded_cap;
+  size_t next_base;
+  pp_arena defs; // Macro definitions of every file
+
+  bool ready;
+  pthread_mutex_t lock;
+} pp_cache;
+
+extern pp_cache sources;
+
+// State of the preprocessing of one translation unit.
+typedef struct {
+  tok_buf *out;
+  const char **dirs; // Include directories, searched in order
+  size_t ndirs;
+  size_t jobs; // Threads to lex each newly read file on
+
+  pp_macro **macros; // Definition of each macro by atom, NULL if undefined
+  size_t macros_cap;
+  uint8_t *seen; // Whether a #pragma once file was included, by key
+  size_t seen_cap;
+  size_t depth;
+  pp_arena scratch; // Expansion buffers and hide-sets of one expansion
+
+  tok_buf *prefix; // Tokens of a precompiled header, output first
+  pp_arena defs;   // Its macro definitions
+
+  size_t entered; // Files whose tokens were walked
+  size_t skipped; // Includes skipped by #pragma once or an include guard
+} preproc_t;
+
+void pp_init(preproc_t *pp, const char **dirs, size_t ndirs, size_t jobs);
+bool preprocess(preproc_t *pp, const char *path, tok_buf *out);
+src_loc pp_locate(size_t pos);
+void pp_destroy(preproc_t *pp);
+void pp_cache_destroy(pp_cache *cache);
+
+// Used to load precompiled headers (see pch.h).
+void *pp_alloc(pp_arena *a, size_t size);
+void pp_set_macro(preproc_t *pp, uint32_t name, pp_macro *m);
+void pp_set_seen(preproc_t *pp, pp_file *f);
+pp_file *pp_add_lazy(const char *real, size_t size, const uint32_t *lines,
+                     size_t nlines, uint32_t guard, bool once);
+void pp_add_path(const char *path, pp_file *f);
@@ -1,429 +1,915 @@
+#define _DEFAULT_SOURCE // pthread_barrier_t
+
 #include "tokens.h"
 #include "utils/dynarray.h"
-#include <ctype.h>
+#include "utils/scan.h"
+#include "punct_table.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <string.h>
 
-#define max(a, b) ((((a) > (b)) ? (a) : (b)))
+// Perfect hash over the keywords in TOK_LIST. The multipliers were chosen so
+// that no two keywords share a slot; initTables() checks this on startup.
+#define KW_TABLE_SIZE 128
+#define KW_MIN_LEN 2
+#define KW_MAX_LEN 8
+#define KW_HASH(s, len)                                                        \
+  (((unsigned char)(s)[0] * 6 + (unsigned char)(s)[(len) - 1] * 115 + (len)) & \
+   (KW_TABLE_SIZE - 1))
+
+typedef struct {
+  const char *spelling;
+  size_t len;
+  TokenType type;
+} Keyword;
+
+static Keyword kw_table[KW_TABLE_SIZE];
+static pthread_once_t lexer_ready = PTHREAD_ONCE_INIT;
+
+interner_t idents;
+
+// Initial number of atoms the identifier interner has room for.
+#define IDENTS_INIT_CAP 1024
+
+// Sets up the identifier interner and fills the keyword table from the KW()
+// entries of TOK_LIST.
+static void initTables(void) {
+  intern_init(&idents, IDENTS_INIT_CAP);
+
+#undef KW
+#define KW(name, str)                                                          \
+  {                                                                            \
+    Keyword *kw = &kw_table[KW_HASH(str, sizeof(str) - 1)];                    \
+    assert(kw->spelling == NULL, "Keyword hash collision for " str);           \
+    *kw = (Keyword){.spelling = str, .len = sizeof(str) - 1, .type = name};    \
+  }
+#define X(name)
+  TOK_LIST
+#undef X
+#undef KW
+#define KW(name, spelling) X(name)
+}
 
-// Returns the line number of a character in a string
-size_t getLineNo(str buf, size_t len, size_t pos) {
-  assert(pos <= len, "Index out of bounds.");
+// Sets up the tables of the lexer the first time any thread lexes.
+static void initLexer(void) { pthread_once(&lexer_ready, initTables); }
 
-  size_t line = 1;
-  for (int i = 0; i <= pos; ++i) {
-    if (at(buf, i) == '\n')
-      ++line;
-  }
+// Returns the keyword type of the len characters at s, or IDENT if they do
+// not spell a keyword. At most one comparison is made per call.
+static TokenType lookupKeyword(const char *s, size_t len) {
+  if (len < KW_MIN_LEN || len > KW_MAX_LEN)
+    return IDENT;
 
-  return line;
+  const Keyword *kw = &kw_table[KW_HASH(s, len)];
+  if (kw->len == len && !memcmp(kw->spelling, s, len))
+    return kw->type;
+
+  return IDENT;
 }
 
-// Tokenizes buf into an array of Tokens.
-void tokenize(str buf, dyn_array *toks, size_t len) {
-  size_t i = 0; // Current character index
-
-  while (i < len) {
-    // The at() function performs runtime bounds checking on the string input.
-    // If the index is out of bounds, the program panics.
-    if (at(buf, i) == '/' && at(buf, i + 1) == '/') {
-      // Ignore comments
-      while (at(buf, i++) != '\n')
-        ;
+// Scans the string or character literal whose opening quote is at index i and
+// returns the index one past it. Escape sequences are skipped whole, so an
+// escaped quote does not end the literal and a backslash-newline continues it
+// on the next line. *closed is false if the literal is unterminated: it then
+// ends before the first unescaped newline, or at len.
+static size_t scanLiteral(const char *s, size_t i, size_t len, bool *closed) {
+  char quote = s[i++];
+
+  for (;;) {
+    i = scan_until3(s, i, len, quote, '\\', '\n');
+    if (i >= len || s[i] == '\n') {
+      *closed = false;
+      return (i < len) ? i : len;
     }
 
-    // Ignore whitespace
-    else if (isspace(at(buf, i))) {
-      ++i;
+    if (s[i] == quote) {
+      *closed = true;
+      return i + 1;
     }
 
-    // Tokenize string literal
-    else if (at(buf, i) == '"') {
-      ++i;
+    // Skip the escaped character, including both bytes of a CRLF.
+    i += (i + 2 < len && s[i + 1] == '\r' && s[i + 2] == '\n') ? 3 : 2;
+  }
+}
 
-      size_t toksize = 1;
-      while (at(buf, i++) != '"')
-        ++toksize;
+// Lexes the first token at or after index i of the len-byte buffer buf,
+// skipping whitespace and comments, and returns the index one past it.
+//
+// tok->type is INVALID if the character at tok->start cannot begin a token
+// (or the token is a malformed literal, or a block comment never closed,
+// which runs to len), with that character as its atom, and EMPTY if the
+// buffer ran out first. The value of a numeric literal is decoded into *num.
+// For EMPTY, tok->start is where the skipped whitespace and comments ended:
+// either len, or the start of a line comment that was still open at the end
+// of the buffer.
+//
+// buf.chars[len] must be a NUL sentinel (see SRC_PADDING). It ends every
+// token, so the lexer looks ahead without bounds checks but never past it,
+// and the same function lexes a whole file or a window of a stream that may
+// cut a token short.
+static size_t lexToken(str buf, size_t i, size_t len, Token *tok,
+                       lit_value *num) {
+  debug_assert(buf.chars[len] == '\0', "Source text has no sentinel");
+
+#define peekc(n) (buf.chars[i + (n)])
+
+  // Skip whitespace and comments
+  for (;;) {
+    i = scan_space(buf.chars, i, len);
+
+    if (peekc(0) == '/' && peekc(1) == '/') {
+      size_t nl = scan_until(buf.chars, i + 2, len, '\n');
+      if (nl == len) {
+        *tok = (Token){.type = EMPTY, .start = i, .len = 0};
+        return len;
+      }
 
-      // The token ptr is allocated in the tokenize() function, but must be
-      // freed later using freeTokens().
-      Token *ptr = (Token *)malloc(sizeof(Token));
-      ptr->type = STRINGLIT;
-      ptr->start = i - toksize;
+      i = nl + 1;
+    } else if (peekc(0) == '/' && peekc(1) == '*') {
+      size_t close = scan_pair(buf.chars, i + 2, len, '*', '/');
+      if (close == len) {
+        *tok = (Token){
+            .type = INVALID, .start = i, .len = len - i, .atom = '/'};
+        return len;
+      }
 
-      dyn_push(toks, ptr);
-    }
+      i = close + 2;
+    } else
+      break;
+  }
+
+  size_t start = i;
+  TokenType type;
+  bool closed;
+
+  // The first character decides the kind of token with one table lookup. A
+  // period followed by a digit begins a number, not a punctuator.
+  LexStart kind = lex_start[(unsigned char)buf.chars[i]];
+  if (buf.chars[i] == '.' && peekc(1) >= '0' && peekc(1) <= '9')
+    kind = LEX_NUMBER;
+
+  switch (kind) {
+
+    // Tokenize string literal
+    case LEX_STRING: {
+      i = scanLiteral(buf.chars, i, len, &closed);
+      type = closed ? STRINGLIT : INVALID;
+    } break;
 
     // Character literal
-    else if (at(buf, i) == '\'') {
+    // Currently accepts arbitrary length character literals, might change
+    // later.
+    case LEX_CHAR: {
+      i = scanLiteral(buf.chars, i, len, &closed);
+      type = closed ? CHARLIT : INVALID;
+    } break;
+
+    // Punctuators are matched by the DFA generated from the OP() entries of
+    // TOK_LIST, taking the longest match.
+    case LEX_PUNCT: {
+      uint8_t state = punct_next[0][punct_class[(unsigned char)buf.chars[i]]];
+      uint8_t next;
+      while ((next = punct_next[state]
+                               [punct_class[(unsigned char)buf.chars[++i]]]))
+        state = next;
+
+      type = punct_accept[state];
+    } break;
+
+    // Identifier/keyword
+    // First character must be alphabetic or _, and following characters may
+    // also be digits
+    case LEX_IDENT: {
+      i = scan_ident(buf.chars, i + 1, len);
+
+      // Keywords are matched in place, so identifiers never need to be copied
+      // out of the buffer.
+      type = lookupKeyword(buf.chars + start, i - start);
+    } break;
+
+    // Numeric literal
+    // Scanned like a preprocessing number, so that an exponent sign or a
+    // malformed suffix stays part of the token, then decoded.
+    case LEX_NUMBER: {
+      i = scan_number(buf.chars, i + 1, len);
+      while (i < len && (buf.chars[i] == '+' || buf.chars[i] == '-') &&
+             ((buf.chars[i - 1] | 0x20) == 'e' ||
+              (buf.chars[i - 1] | 0x20) == 'p'))
+        i = scan_number(buf.chars, i + 1, len);
+
+      if (!lit_decode(buf.chars + start, i - start, num))
+        type = INVALID;
+      else
+        type = (num->flags & LIT_FLOAT) ? FLOATLIT : INTLIT;
+    } break;
+
+    // The sentinel, or a NUL byte inside the text
+    case LEX_END: {
+      if (i >= len) {
+        *tok = (Token){.type = EMPTY, .start = len, .len = 0};
+        return len;
+      }
+
+      type = INVALID;
+      ++i;
+    } break;
+
+    default: {
+      type = INVALID;
       ++i;
+    } break;
+  }
+
+  *tok = (Token){.type = type, .start = start, .len = i - start};
+  if (type == INVALID)
+    tok->atom = (unsigned char)buf.chars[start];
+  return i;
+
+#undef peekc
+}
 
-      // Currently accepts arbitrary length character literals, might change
-      // later.
-      size_t toksize = 1;
-      while (at(buf, i++) != '\'')
-        ++toksize;
+// Sets the atom of tok, whose text is at text, if tok is an identifier.
+static inline void internToken(const char *text, Token *tok) {
+  if (tok->type == IDENT)
+    tok->atom = intern(&idents, text, tok->len);
+}
+
+static inline bool isNumberToken(TokenType type) {
+  return type == INTLIT || type == FLOATLIT;
+}
 
-      Token *ptr = (Token *)malloc(sizeof(Token));
-      ptr->type = CHARLIT;
-      ptr->start = i - toksize;
+// Appends tok, lexed from buf, to toks, together with its atom or the value
+// num of a numeric literal.
+static void pushToken(tok_buf *toks, str buf, Token tok, lit_value num) {
+  internToken(buf.chars + tok.start, &tok);
+  if (isNumberToken(tok.type))
+    tok.num = tok_push_num(toks, num);
 
-      dyn_push(toks, ptr);
+  tok_push(toks, tok.type, tok.start, tok.len, tok.atom);
+}
+
+// Sets up idents for code that interns names before lexing anything.
+void lex_init(void) { initLexer(); }
+
+// Tokenizes buf into an array of Tokens.
+void tokenize(str buf, tok_buf *toks, size_t len) {
+  assert(len <= UINT32_MAX, "Input too large for 32-bit token offsets");
+  initLexer();
+
+  // Diagnostics during and after lexing look lines up in this table.
+  lines_destroy(&toks->lines);
+  lines_build(&toks->lines, buf, len);
+  toks->src = buf;
+
+  Token tok;
+  lit_value num;
+  for (size_t i = lexToken(buf, 0, len, &tok, &num); tok.type != EMPTY;
+       i = lexToken(buf, i, len, &tok, &num))
+    pushToken(toks, buf, tok, num);
+
+  tok_push(toks, END, len, 0, NO_ATOM);
+}
+
+// Returns the index of the token of toks starting at pos, or toks->len.
+static size_t findStart(tok_buf *toks, size_t pos) {
+  size_t lo = 0, hi = toks->len;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (toks->starts[mid] < pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return (lo < toks->len && toks->starts[lo] == pos) ? lo : toks->len;
+}
+
+struct lex_job;
+
+// A slice of the input lexed by one thread of tokenize_parallel().
+typedef struct {
+  struct lex_job *job;
+  size_t start; // The chunk covers tokens starting in [start, end)
+  size_t end;
+  size_t resume; // Index one past the chunk's last token
+  tok_buf *toks;
+  size_t kept;  // Index in the output of the first of its tokens kept
+  size_t nkept; // Number of them
+} lex_chunk;
+
+// What the threads of tokenize_parallel() share.
+typedef struct lex_job {
+  str buf;
+  size_t len;
+  tok_buf *toks; // Output
+  lex_chunk *chunks;
+  size_t jobs;
+  pthread_barrier_t lexed;    // Every chunk is lexed
+  pthread_barrier_t stitched; // The chunks are stitched into the output
+} lex_job;
+
+// Appends the tokens of the chunks of job to its output in order,
+// re-lexing where a chunk started mid-token, and drops the chunks. Each
+// chunk is left with the range of its tokens kept, which are copied without
+// their names interned.
+static void stitchChunks(lex_job *job) {
+  str buf = job->buf;
+  tok_buf *toks = job->toks;
+
+  size_t total = 0;
+  for (size_t k = 0; k < job->jobs; ++k)
+    total += job->chunks[k].toks->len;
+  tok_reserve(toks, toks->len + total);
+
+  size_t resume = 0;
+  for (size_t k = 0; k < job->jobs; ++k) {
+    lex_chunk *c = &job->chunks[k];
+
+    size_t j = c->toks->len;
+    for (;;) {
+      Token tok;
+      lit_value num;
+      size_t end = lexToken(buf, resume, job->len, &tok, &num);
+      if (tok.type == EMPTY || tok.start >= c->end)
+        break;
+
+      if ((j = findStart(c->toks, tok.start)) < c->toks->len)
+        break;
+
+      pushToken(toks, buf, tok, num);
+      resume = end;
     }
 
-    // Check special character
-    else if (ispunct(at(buf, i))) {
-      Token *ptr = (Token *)malloc(sizeof(Token));
-
-      switch (at(buf, i)) {
-
-        case '+': {
-          if (at(buf, i + 1) == '+') {
-            ptr->type = INCREM;
-            ++i;
-          } else if (at(buf, i + 1) == '=') {
-            ptr->type = PLUSEQ;
-            ++i;
-          } else
-            ptr->type = PLUS;
-
-        } break;
-
-        case '-': {
-          if (at(buf, i + 1) == '-') {
-            ptr->type = DECREM;
-            ++i;
-          } else if (at(buf, i + 1) == '>') {
-            ptr->type = ARROW;
-            ++i;
-          } else if (at(buf, i + 1) == '=') {
-            ptr->type = MINUSEQ;
-            ++i;
-          } else
-            ptr->type = MINUS;
-
-        } break;
-
-        case '*': {
-          if (at(buf, i + 1) == '=') {
-            ptr->type = TIMESEQ;
-            ++i;
-          } else
-            ptr->type = ASTERISK;
-
-        } break;
-
-        case '/': {
-          if (at(buf, i + 1) == '=') {
-            ptr->type = DIVEQ;
-            ++i;
-          } else
-            ptr->type = SLASH;
-
-        } break;
-
-        case '%': {
-          if (at(buf, i + 1) == '=') {
-            ptr->type = MODEQ;
-            ++i;
-          } else
-            ptr->type = MODULO;
+    size_t n = c->toks->len - j;
+    c->kept = toks->len;
+    c->nkept = n;
+    if (n) {
+      tok_reserve(toks, toks->len + n);
+      memcpy(toks->types + toks->len, c->toks->types + j,
+             sizeof(*toks->types) * n);
+      memcpy(toks->starts + toks->len, c->toks->starts + j,
+             sizeof(*toks->starts) * n);
+      memcpy(toks->lens + toks->len, c->toks->lens + j,
+             sizeof(*toks->lens) * n);
+      memcpy(toks->ids + toks->len, c->toks->ids + j, sizeof(*toks->ids) * n);
+
+      // Append the chunk's literal values and point its tokens at them.
+      size_t first = toks->len;
+      while (first < toks->len + n && !isNumberToken(toks->types[first]))
+        ++first;
+
+      if (first < toks->len + n) {
+        size_t from = toks->ids[first];
+        uint32_t shift = (uint32_t)(toks->nums_len - from);
+        for (size_t k = first; k < toks->len + n; ++k) {
+          if (isNumberToken(toks->types[k]))
+            toks->ids[k] += shift;
         }
 
-        case '{': ptr->type = LBRACE; break;
-        case '}': ptr->type = RBRACE; break;
-        case '[': ptr->type = LBRACKET; break;
-        case ']': ptr->type = RBRACKET; break;
-        case '(': ptr->type = LPAREN; break;
-        case ')': ptr->type = RPAREN; break;
-
-        case '=': {
-          if (at(buf, i + 1) == '=') {
-            ptr->type = EQEQ;
-            ++i;
-          } else
-            ptr->type = EQUALS;
-
-        } break;
-
-        case ';': ptr->type = SEMI; break;
-        case ':': ptr->type = COLON; break;
-        case ',': ptr->type = COMMA; break;
-
-        case '>': {
-          if (at(buf, i + 1) == '=') {
-            ptr->type = GE;
-            ++i;
-          } else if (at(buf, i + 1) == '>') {
-            if (at(buf, i + 2) == '=') {
-              ptr->type = RSHIFTEQ;
-              ++i;
-            } else
-              ptr->type = RSHIFT;
-
-            ++i;
-          } else {
-            ptr->type = GT;
-          }
-        } break;
-
-        case '<': {
-          if (at(buf, i + 1) == '=') {
-            ptr->type = LE;
-            ++i;
-          } else if (at(buf, i + 1) == '<') {
-            if (at(buf, i + 2) == '=') {
-              ptr->type = LSHIFTEQ;
-              ++i;
-            } else
-              ptr->type = LSHIFT;
-
-            ++i;
-          } else {
-            ptr->type = LT;
-          }
-        } break;
-
-        case '!': {
-          if (at(buf, i + 1) == '=') {
-            ptr->type = NEQ;
-            ++i;
-          } else
-            ptr->type = NOT;
-
-        } break;
-
-        case '~': ptr->type = TILDE; break;
-        case '.': ptr->type = PERIOD; break;
-        case '#': ptr->type = HASH; break;
-
-        case '&': {
-          if (at(buf, i + 1) == '&') {
-            ptr->type = AND;
-            ++i;
-          } else if (at(buf, i + 1) == '=') {
-            ptr->type = ANDEQ;
-            ++i;
-          } else
-            ptr->type = AMPER;
-
-        } break;
-
-        case '|': {
-          if (at(buf, i + 1) == '|') {
-            ptr->type = OR;
-            ++i;
-          } else if (at(buf, i + 1) == '=') {
-            ptr->type = OREQ;
-            ++i;
-          } else
-            ptr->type = BITOR;
-
-        } break;
-
-        case '^': {
-          if (at(buf, i + 1) == '=') {
-            ptr->type = XOREQ;
-            ++i;
-          } else
-            ptr->type = XOR;
-
-        } break;
-
-        case '?':  ptr->type = QUESTION; break;
-
-        case '\\': {
-          ptr->type = BACKSLASH;
-
-        } break;
-
-        default: {
-          fprintf(stderr, "Unrecognized token %c (line %lu).\n", at(buf, i),
-                  getLineNo(buf, len, i));
-          dyn_destroy(toks);
-          exit(1);
-        }
+        for (size_t k = from; k < c->toks->nums_len; ++k)
+          tok_push_num(toks, c->toks->nums[k]);
       }
 
-      ptr->start = i;
-      dyn_push(toks, ptr);
+      toks->len += n;
+      resume = c->resume;
+    }
 
-      ++i;
+    tok_destroy(c->toks);
+    c->toks = NULL;
+  }
+}
+
+// Lexes the tokens starting inside a chunk, assuming that the chunk does not
+// begin inside a literal or comment. The last token may run past the end of
+// the chunk. Once every chunk is lexed, one thread stitches them together,
+// and then each thread interns the names of the tokens its chunk kept, so
+// none come from tokens thrown away.
+static void *lexChunk(void *arg) {
+  lex_chunk *c = (lex_chunk *)arg;
+  lex_job *job = c->job;
+
+  Token tok;
+  lit_value num;
+  size_t i = c->start;
+  for (size_t end = lexToken(job->buf, i, job->len, &tok, &num);
+       tok.type != EMPTY && tok.start < c->end;
+       end = lexToken(job->buf, i, job->len, &tok, &num)) {
+    if (isNumberToken(tok.type))
+      tok.num = tok_push_num(c->toks, num);
+
+    tok_push(c->toks, tok.type, tok.start, tok.len, tok.atom);
+    i = end;
+  }
+  c->resume = i;
+
+  if (pthread_barrier_wait(&job->lexed) == PTHREAD_BARRIER_SERIAL_THREAD)
+    stitchChunks(job);
+  pthread_barrier_wait(&job->stitched);
+
+  tok_buf *toks = job->toks;
+  for (size_t k = c->kept; k < c->kept + c->nkept; ++k)
+    if (toks->types[k] == IDENT)
+      toks->ids[k] =
+          intern(&idents, job->buf.chars + toks->starts[k], toks->lens[k]);
+
+  return NULL;
+}
+
+// Tokenizes buf like tokenize(), but splits it at line boundaries into jobs
+// chunks that are lexed on separate threads.
+//
+// Each chunk is lexed speculatively, as if it began between tokens. While
+// the chunks are stitched together in order, the next token of the correct
+// stream is lexed at each boundary. If the chunk has no token starting
+// there (it began inside a literal or comment), tokens are re-lexed serially
+// until they line up with a token of the chunk again, from where on the rest
+// of the chunk is taken as is. Only then are the names of the tokens kept
+// interned, by the thread that lexed them, so idents gets nothing from
+// tokens thrown away. The tokens are identical to those of tokenize(), but
+// names new to idents may be numbered in another order, as the threads
+// intern them side by side.
+void tokenize_parallel(str buf, tok_buf *toks, size_t len, size_t jobs) {
+  if (jobs <= 1) {
+    tokenize(buf, toks, len);
+    return;
+  }
+
+  assert(len <= UINT32_MAX, "Input too large for 32-bit token offsets");
+  initLexer();
+
+  lines_destroy(&toks->lines);
+  lines_build(&toks->lines, buf, len);
+  toks->src = buf;
+
+  lex_job job = {.buf = buf, .len = len, .toks = toks, .jobs = jobs};
+  job.chunks = (lex_chunk *)malloc(sizeof(lex_chunk) * jobs);
+  pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * jobs);
+  assert(job.chunks && threads, "Could not allocate memory for lexer threads");
+  assert(!pthread_barrier_init(&job.lexed, NULL, jobs) &&
+             !pthread_barrier_init(&job.stitched, NULL, jobs),
+         "Could not set up lexer threads");
+
+  // Chunks start on the line following their share of the input.
+  size_t start = 0;
+  for (size_t k = 0; k < jobs; ++k) {
+    size_t end = len;
+    if (k + 1 < jobs) {
+      end = len * (k + 1) / jobs;
+      if (end < start)
+        end = start;
+
+      end = scan_until(buf.chars, end, len, '\n');
+      if (end < len)
+        ++end;
     }
 
-    // Identifier/keyword
-    // First character must be alphabetic, but following characters may be
-    // alphanumeric or _
-    else if (isalpha(at(buf, i))) {
-      size_t toksize = 0;
-      while (isalnum(at(buf, i)) || at(buf, i) == '_') {
-        ++i;
-        ++toksize;
-      }
+    job.chunks[k] = (lex_chunk){.job = &job,
+                                .start = start,
+                                .end = end,
+                                .toks = tok_init((end - start) / 4)};
+    start = end;
+  }
 
-      // dupl() calls malloc, so bufcmp must be freed at the end of its
-      // lifetime.
-      char *bufcmp = dupl(buf, i - toksize, toksize);
+  for (size_t k = 1; k < jobs; ++k)
+    assert(!pthread_create(&threads[k], NULL, lexChunk, &job.chunks[k]),
+           "Could not start lexer thread");
+  lexChunk(&job.chunks[0]);
+  for (size_t k = 1; k < jobs; ++k)
+    pthread_join(threads[k], NULL);
 
-      Token *ptr = (Token *)malloc(sizeof(Token));
+  pthread_barrier_destroy(&job.lexed);
+  pthread_barrier_destroy(&job.stitched);
+  free(job.chunks);
+  free(threads);
 
-      // Strlen is safe here since we are using it on a string literal.
-      if (!strncmp(bufcmp, "auto", max(toksize, strlen("auto"))))
-        ptr->type = AUTO;
+  tok_push(toks, END, len, 0, NO_ATOM);
+}
 
-      else if (!strncmp(bufcmp, "break", max(toksize, strlen("break"))))
-        ptr->type = BREAK;
+// Returns the index of the first token of toks that ends at or after pos, or
+// toks->len.
+static size_t findEnd(tok_buf *toks, size_t pos) {
+  size_t lo = 0, hi = toks->len;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (toks->starts[mid] + toks->lens[mid] < pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
 
-      else if (!strncmp(bufcmp, "case", max(toksize, strlen("case"))))
-        ptr->type = CASE;
+  return lo;
+}
 
-      else if (!strncmp(bufcmp, "char", max(toksize, strlen("char"))))
-        ptr->type = CHAR;
+// Grows the literal side table so that it can hold at least cap values.
+static void reserveNums(tok_buf *toks, size_t cap) {
+  if (cap <= toks->nums_cap)
+    return;
 
-      else if (!strncmp(bufcmp, "const", max(toksize, strlen("const"))))
-        ptr->type = CONST;
+  toks->nums_cap = (cap < 16) ? 16 : cap * 3 / 2;
+  toks->nums = realloc(toks->nums, sizeof(*toks->nums) * toks->nums_cap);
+  assert(toks->nums != NULL, "Could not allocate memory for literals");
+}
 
-      else if (!strncmp(bufcmp, "continue", max(toksize, strlen("continue"))))
-        ptr->type = CONTINUE;
+// Updates toks, the tokens of a buffer before edit, to those of buf after it,
+// as tokenize() would lex them.
+//
+// Tokens are re-lexed from the end of the last token before the edit (a token
+// that ends right at it may be extended), until a re-lexed token starts where
+// a token after the edit started before. The lexer carries no state between
+// tokens, so from there on the old tokens are still right and are only moved
+// by the change in length. The work done is proportional to the size of the
+// edit, apart from moving the later tokens and line starts along.
+tok_splice tokenize_edit(str buf, tok_buf *toks, size_t len, text_edit edit) {
+  assert(!toks->stream, "Cannot edit a streamed token buffer");
+  assert(toks->len > 0 && toks->types[toks->len - 1] == END,
+         "Token buffer was not tokenized");
+  assert(len <= UINT32_MAX, "Input too large for 32-bit token offsets");
+  assert(edit.offset + edit.removed <= toks->starts[toks->len - 1] &&
+             edit.offset + edit.inserted <= len,
+         "Edit out of range");
+
+  lines_edit(&toks->lines, buf, edit.offset, edit.removed, edit.inserted);
+  toks->src = buf;
+  --toks->len;
+
+  size_t first = findEnd(toks, edit.offset);
+  size_t resume = first ? toks->starts[first - 1] + toks->lens[first - 1] : 0;
+
+  // Old tokens after the edit have moved by inserted - removed bytes. j is
+  // the first one that may still line up with a re-lexed token.
+  size_t after = edit.offset + edit.inserted;
+  size_t j = first;
+  tok_buf *mid = tok_init(16);
+  for (;;) {
+    Token tok;
+    lit_value num;
+    size_t end = lexToken(buf, resume, len, &tok, &num);
+    if (tok.type == EMPTY) {
+      j = toks->len;
+      break;
+    }
 
-      else if (!strncmp(bufcmp, "default", max(toksize, strlen("default"))))
-        ptr->type = DEFAULT;
+    if (tok.start >= after) {
+      size_t old = tok.start - edit.inserted + edit.removed;
+      while (j < toks->len && toks->starts[j] < old)
+        ++j;
+      if (j < toks->len && toks->starts[j] == old)
+        break;
+    }
 
-      else if (!strncmp(bufcmp, "do", max(toksize, strlen("do"))))
-        ptr->type = DO;
+    pushToken(mid, buf, tok, num);
+    resume = end;
+  }
 
-      else if (!strncmp(bufcmp, "double", max(toksize, strlen("double"))))
-        ptr->type = DOUBLE;
+  // Literal values are kept in token order, so those of the replaced tokens
+  // are the ones from n0 up to n1. Either side may have none, and no array
+  // to copy from.
+  size_t n0 = 0;
+  for (size_t k = first; k-- > 0;) {
+    if (isNumberToken(toks->types[k])) {
+      n0 = toks->ids[k] + 1;
+      break;
+    }
+  }
 
-      else if (!strncmp(bufcmp, "else", max(toksize, strlen("else"))))
-        ptr->type = ELSE;
+  size_t n1 = n0;
+  for (size_t k = first; k < j; ++k)
+    n1 += isNumberToken(toks->types[k]);
+
+  size_t nums_tail = toks->nums_len - n1;
+  reserveNums(toks, n0 + mid->nums_len + nums_tail);
+  if (nums_tail)
+    memmove(toks->nums + n0 + mid->nums_len, toks->nums + n1,
+            sizeof(*toks->nums) * nums_tail);
+  if (mid->nums_len)
+    memcpy(toks->nums + n0, mid->nums, sizeof(*toks->nums) * mid->nums_len);
+  toks->nums_len = n0 + mid->nums_len + nums_tail;
+
+  // Move the tokens after the edit into place and splice in the new ones.
+  size_t n = mid->len, tail = toks->len - j, at = first + n;
+  tok_reserve(toks, at + tail + 1);
+  memmove(toks->types + at, toks->types + j, sizeof(*toks->types) * tail);
+  memmove(toks->starts + at, toks->starts + j, sizeof(*toks->starts) * tail);
+  memmove(toks->lens + at, toks->lens + j, sizeof(*toks->lens) * tail);
+  memmove(toks->ids + at, toks->ids + j, sizeof(*toks->ids) * tail);
+
+  memcpy(toks->types + first, mid->types, sizeof(*toks->types) * n);
+  memcpy(toks->starts + first, mid->starts, sizeof(*toks->starts) * n);
+  memcpy(toks->lens + first, mid->lens, sizeof(*toks->lens) * n);
+  memcpy(toks->ids + first, mid->ids, sizeof(*toks->ids) * n);
+
+  for (size_t k = first; k < at; ++k) {
+    if (isNumberToken(toks->types[k]))
+      toks->ids[k] += (uint32_t)n0;
+  }
 
-      else if (!strncmp(bufcmp, "enum", max(toksize, strlen("enum"))))
-        ptr->type = ENUM;
+  uint32_t shift = (uint32_t)(edit.inserted - edit.removed);
+  uint32_t nums_shift = (uint32_t)(n0 + mid->nums_len - n1);
+  for (size_t k = at; k < at + tail; ++k) {
+    toks->starts[k] += shift;
+    if (isNumberToken(toks->types[k]))
+      toks->ids[k] += nums_shift;
+  }
 
-      else if (!strncmp(bufcmp, "extern", max(toksize, strlen("extern"))))
-        ptr->type = EXTERN;
+  toks->len = at + tail;
+  tok_push(toks, END, len, 0, NO_ATOM);
+  tok_destroy(mid);
 
-      else if (!strncmp(bufcmp, "float", max(toksize, strlen("float"))))
-        ptr->type = FLOAT;
+  return (tok_splice){.first = first, .removed = j - first, .inserted = n};
+}
 
-      else if (!strncmp(bufcmp, "for", max(toksize, strlen("for"))))
-        ptr->type = FOR;
+// Lexes the len bytes at text, which must be followed by a NUL sentinel, as
+// one token, as when ## pastes two tokens together. Returns false unless they
+// are exactly one valid token. Safe to call from several threads.
+bool lex_single(const char *text, size_t len, Token *tok, lit_value *num) {
+  initLexer();
+
+  size_t end = lexToken((str){.len = len, .chars = (char *)text}, 0, len, tok,
+                        num);
+  if (tok->type == EMPTY || tok->type == INVALID || tok->start != 0 ||
+      end != len)
+    return false;
+
+  tok->atom =
+      (tok->type == IDENT) ? intern(&idents, text, tok->len) : NO_ATOM;
+  return true;
+}
 
-      else if (!strncmp(bufcmp, "goto", max(toksize, strlen("goto"))))
-        ptr->type = GOTO;
+lexer_t *lexer_open(FILE *fp, size_t window) {
+  lexer_t *lex = (lexer_t *)malloc(sizeof(lexer_t));
+  assert(lex != NULL, "Could not allocate memory for lexer");
 
-      else if (!strncmp(bufcmp, "if", max(toksize, strlen("if"))))
-        ptr->type = IF;
+  lex->fp = fp;
+  lex->cap = (window < 64) ? 64 : window;
+  lex->window = (char *)malloc(lex->cap + SRC_PADDING);
+  assert(lex->window != NULL, "Could not allocate memory for lexer window");
 
-      else if (!strncmp(bufcmp, "inline", max(toksize, strlen("inline"))))
-        ptr->type = INLINE;
+  lex->fill = lex->pos = lex->origin = 0;
+  lex->window[0] = '\0';
+  lex->line = lex->col = 1;
+  lex->eof = false;
 
-      else if (!strncmp(bufcmp, "int", max(toksize, strlen("int"))))
-        ptr->type = INT;
+  initLexer();
 
-      else if (!strncmp(bufcmp, "long", max(toksize, strlen("long"))))
-        ptr->type = LONG;
+  return lex;
+}
 
-      else if (!strncmp(bufcmp, "register", max(toksize, strlen("register"))))
-        ptr->type = REGISTER;
+// Discards the window bytes before keep, moves the rest to the front and reads
+// more input after them. The window only grows when nothing can be discarded
+// and it is already full.
+static void lexer_refill(lexer_t *lex, size_t keep) {
+  // Track the line and column of the new window start.
+  for (size_t k = 0; k < keep; ++k) {
+    size_t nl = scan_until(lex->window, k, keep, '\n');
+    lex->col += nl - k;
+    if (nl == keep)
+      break;
+
+    ++lex->line;
+    lex->col = 1;
+    k = nl;
+  }
 
-      else if (!strncmp(bufcmp, "restrict", max(toksize, strlen("restrict"))))
-        ptr->type = RESTRICT;
+  memmove(lex->window, lex->window + keep, lex->fill - keep);
+  lex->fill -= keep;
+  lex->pos -= keep;
+  lex->origin += keep;
 
-      else if (!strncmp(bufcmp, "return", max(toksize, strlen("return"))))
-        ptr->type = RETURN;
+  if (lex->fill == lex->cap) {
+    lex->cap *= 2;
+    lex->window = realloc(lex->window, lex->cap + SRC_PADDING);
+    assert(lex->window != NULL, "Could not allocate memory for lexer window");
+  }
 
-      else if (!strncmp(bufcmp, "short", max(toksize, strlen("short"))))
-        ptr->type = SHORT;
+  lex->fill += fread(lex->window + lex->fill, 1, lex->cap - lex->fill, lex->fp);
+  lex->window[lex->fill] = '\0';
+  if (lex->fill < lex->cap)
+    lex->eof = true;
+}
 
-      else if (!strncmp(bufcmp, "signed", max(toksize, strlen("signed"))))
-        ptr->type = SIGNED;
+// No token looks further past its end than the longest punctuator is long, so
+// a token that ends closer than this to the end of the window may be
+// incomplete.
+#define LEX_LOOKAHEAD PUNCT_MAX_LEN
+
+// Returns the next token of the input, or an EMPTY token once it is exhausted.
+// Token offsets are input offsets, so the token text is at window index
+// tok.start - lex->origin until the next call. Window bytes from index keep
+// onwards are preserved across refills; pass lex->pos if no earlier token
+// text is still needed.
+Token next_token(lexer_t *lex, size_t keep) {
+  for (;;) {
+    Token tok;
+    size_t end = lexToken((str){.len = lex->fill, .chars = lex->window},
+                          lex->pos, lex->fill, &tok, &lex->num);
+
+    if (lex->eof || end + LEX_LOOKAHEAD <= lex->fill) {
+      lex->pos = end;
+      if (tok.type == EMPTY)
+        tok.start = lex->fill;
+      internToken(lex->window + tok.start, &tok);
+      tok.start += lex->origin;
+      return tok;
+    }
 
-      else if (!strncmp(bufcmp, "sizeof", max(toksize, strlen("sizeof"))))
-        ptr->type = SIZEOF;
+    // The token may continue past the window. Whitespace and complete
+    // comments before it never need to be lexed again.
+    if (tok.type == EMPTY)
+      lex->pos = tok.start;
+    if (keep > lex->pos)
+      keep = lex->pos;
 
-      else if (!strncmp(bufcmp, "static", max(toksize, strlen("static"))))
-        ptr->type = STATIC;
+    lexer_refill(lex, keep);
+    keep = 0;
+  }
+}
 
-      else if (!strncmp(bufcmp, "struct", max(toksize, strlen("struct"))))
-        ptr->type = STRUCT;
+// Returns the line and column of window index pos.
+src_loc lexer_locate(lexer_t *lex, size_t pos) {
+  src_loc loc = {.line = lex->line, .col = lex->col};
 
-      else if (!strncmp(bufcmp, "switch", max(toksize, strlen("switch"))))
-        ptr->type = SWITCH;
+  for (size_t k = 0; k < pos; ++k) {
+    size_t nl = scan_until(lex->window, k, pos, '\n');
+    loc.col += nl - k;
+    if (nl == pos)
+      break;
 
-      else if (!strncmp(bufcmp, "typedef", max(toksize, strlen("typedef"))))
-        ptr->type = TYPEDEF;
+    ++loc.line;
+    loc.col = 1;
+    k = nl;
+  }
 
-      else if (!strncmp(bufcmp, "union", max(toksize, strlen("union"))))
-        ptr->type = UNION;
+  return loc;
+}
 
-      else if (!strncmp(bufcmp, "unsigned", max(toksize, strlen("unsigned"))))
-        ptr->type = UNSIGNED;
+void lexer_close(lexer_t *lex) {
+  free(lex->window);
+  lex->window = NULL;
 
-      else if (!strncmp(bufcmp, "void", max(toksize, strlen("void"))))
-        ptr->type = VOID;
+  free(lex);
+  lex = NULL;
+}
 
-      else if (!strncmp(bufcmp, "volatile", max(toksize, strlen("volatile"))))
-        ptr->type = VOLATILE;
+tok_buf *tok_init(size_t cap) {
+  tok_buf *toks = (tok_buf *)malloc(sizeof(tok_buf));
+  assert(toks != NULL, "Could not allocate memory for tok_buf");
+
+  toks->len = 0;
+  toks->cap = 0;
+  toks->types = NULL;
+  toks->starts = NULL;
+  toks->lens = NULL;
+  toks->ids = NULL;
+  toks->lines = (line_index){0};
+  toks->nums = NULL;
+  toks->nums_len = 0;
+  toks->nums_cap = 0;
+  toks->nums_base = 0;
+  toks->base = 0;
+  toks->origin = 0;
+  toks->src = (str){0};
+  toks->src_origin = 0;
+  toks->stream = NULL;
+  toks->done = false;
+  toks->locate = NULL;
+  tok_reserve(toks, cap);
+
+  return toks;
+}
 
-      else if (!strncmp(bufcmp, "while", max(toksize, strlen("while"))))
-        ptr->type = WHILE;
+tok_buf *tok_init_stream(lexer_t *lex) {
+  tok_buf *toks = tok_init(TOK_STREAM_CAP);
+  toks->stream = lex;
 
-      else
-        ptr->type = IDENT;
+  return toks;
+}
 
-      ptr->start = i - toksize;
+// Grows the parallel arrays so that they can hold at least cap tokens.
+void tok_reserve(tok_buf *toks, size_t cap) {
+  if (cap <= toks->cap)
+    return;
 
-      dyn_push(toks, ptr);
+  toks->types = realloc(toks->types, sizeof(*toks->types) * cap);
+  toks->starts = realloc(toks->starts, sizeof(*toks->starts) * cap);
+  toks->lens = realloc(toks->lens, sizeof(*toks->lens) * cap);
+  toks->ids = realloc(toks->ids, sizeof(*toks->ids) * cap);
+  assert(toks->types && toks->starts && toks->lens && toks->ids,
+         "Could not allocate memory for tokens");
 
-      free(bufcmp);
-      bufcmp = NULL;
-    }
+  toks->cap = cap;
+}
 
-    // Numeric literal
-    else if (isdigit(at(buf, i))) {
-      size_t toksize = 0;
-      bool isFloat = false; // Distinguishes between floats and integers
-      while (isdigit(at(buf, i)) || at(buf, i) == '.') {
-        if (at(buf, i) == '.')
-          isFloat = true;
-        ++toksize;
-        ++i;
-      }
+void tok_push(tok_buf *toks, TokenType type, size_t start, size_t len,
+              uint32_t id) {
+  if (toks->len == toks->cap)
+    tok_reserve(toks, (toks->cap < 16) ? 16 : toks->cap * 3 / 2);
 
-      Token *ptr = (Token *)malloc(sizeof(Token));
+  toks->types[toks->len] = (uint8_t)type;
+  toks->starts[toks->len] = (uint32_t)start;
+  toks->lens[toks->len] = (uint32_t)len;
+  toks->ids[toks->len] = id;
+  toks->len++;
+}
 
-      if (isFloat)
-        ptr->type = FLOATLIT;
-      else
-        ptr->type = INTLIT;
+// Appends the value of a numeric literal and returns the index that its token
+// refers to it by.
+uint32_t tok_push_num(tok_buf *toks, lit_value val) {
+  reserveNums(toks, toks->nums_len + 1);
+  toks->nums[toks->nums_len] = val;
+  return (uint32_t)(toks->nums_base + toks->nums_len++);
+}
 
-      ptr->start = i - toksize;
-      dyn_push(toks, ptr);
+// Pulls tokens from the attached lexer until token idx is held or the input
+// ends. When the buffer is full, tokens more than TOK_STREAM_KEEP places before
+// idx are dropped, so the buffer stays at its initial capacity.
+void tok_pull(tok_buf *toks, size_t idx) {
+  lexer_t *lex = toks->stream;
+
+  while (!toks->done && toks->base + toks->len <= idx) {
+    if (toks->len == toks->cap) {
+      size_t drop = 0;
+      if (idx > toks->base + TOK_STREAM_KEEP)
+        drop = idx - TOK_STREAM_KEEP - toks->base;
+      if (drop > toks->len)
+        drop = toks->len;
+
+      if (drop == 0) {
+        tok_reserve(toks, toks->cap * 2);
+      } else {
+        // Literal values of dropped tokens go with them.
+        size_t dropped = 0;
+        for (size_t k = 0; k < drop; ++k)
+          dropped += isNumberToken(toks->types[k]);
+        if (dropped)
+          memmove(toks->nums, toks->nums + dropped,
+                  sizeof(*toks->nums) * (toks->nums_len - dropped));
+        toks->nums_len -= dropped;
+        toks->nums_base += dropped;
+
+        size_t left = toks->len - drop;
+        memmove(toks->types, toks->types + drop, sizeof(*toks->types) * left);
+        memmove(toks->starts, toks->starts + drop,
+                sizeof(*toks->starts) * left);
+        memmove(toks->lens, toks->lens + drop, sizeof(*toks->lens) * left);
+        memmove(toks->ids, toks->ids + drop, sizeof(*toks->ids) * left);
+        toks->len = left;
+        toks->base += drop;
+      }
 
+      // Rebase the held offsets on the oldest token so they stay small.
+      if (toks->len > 0) {
+        uint32_t first = toks->starts[0];
+        for (size_t k = 0; k < toks->len; ++k)
+          toks->starts[k] -= first;
+        toks->origin += first;
+      }
     }
 
-    // Panic on unrecognized characters.
-    else {
-      fprintf(stderr, "Unrecognized token %c (line %lu).\n", at(buf, i),
-              getLineNo(buf, len, i));
-      dyn_destroy(toks);
-      exit(1);
+    // Keep the text of every held token in the lexer's window.
+    size_t keep = lex->pos;
+    if (toks->len > 0)
+      keep = toks->origin + toks->starts[0] - lex->origin;
+
+    Token tok = next_token(lex, keep);
+    toks->src = (str){.len = lex->fill, .chars = lex->window};
+    toks->src_origin = lex->origin;
+
+    if (tok.type == EMPTY) {
+      tok = (Token){.type = END, .start = tok.start, .len = 0};
+      toks->done = true;
     }
+
+    if (toks->len == 0)
+      toks->origin = tok.start;
+
+    if (isNumberToken(tok.type))
+      tok.num = tok_push_num(toks, lex->num);
+
+    tok_push(toks, tok.type, tok.start - toks->origin, tok.len, tok.atom);
   }
+}
+
+src_loc tok_locate(tok_buf *toks, size_t pos) {
+  if (toks->locate)
+    return toks->locate(pos);
+  if (toks->stream)
+    return lexer_locate(toks->stream, pos - toks->stream->origin);
 
-  // Print tokens to stdout
-  dump(toks);
+  return lines_locate(&toks->lines, pos);
 }
 
-// Frees the memory used by the tokenizer's malloc() calls.
-void freeTokens(dyn_array *toks) {
-  for (size_t i = 0; i < toks->len; ++i) {
-    // Bounds checking is unnecessary because the condition is guaranteed by the
-    // for loop.
-    Token *t = (Token *)toks->el[i];
-    free(t);
-    t = NULL;
-  }
+void tok_destroy(tok_buf *toks) {
+  free(toks->types);
+  free(toks->starts);
+  free(toks->lens);
+  free(toks->ids);
+  free(toks->nums);
+  lines_destroy(&toks->lines);
+  toks->types = NULL;
+  toks->starts = NULL;
+  toks->lens = NULL;
+  toks->ids = NULL;
+  toks->nums = NULL;
+
+  free(toks);
+  toks = NULL;
 }
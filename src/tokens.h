@@ -1,104 +1,123 @@
 #pragma once
 
 #include "utils/dynarray.h"
+#include "utils/intern.h"
+#include "utils/lines.h"
+#include "utils/numlit.h"
 #include "utils/str.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
+// Keywords and punctuators are listed in TOK_LIST together with their
+// spelling, so that the keyword lookup table in tokens.c and the punctuator
+// tables generated by tools/punctgen.c come from the same list as the
+// TokenType enum. Everywhere else they expand like any other token.
+#define KW(name, spelling) X(name)
+#define OP(name, spelling) X(name)
+
 #define TOK_LIST                                                               \
-  X(AMPER)                                                                     \
-  X(AND)                                                                       \
-  X(ANDEQ)                                                                     \
-  X(ARROW)                                                                     \
-  X(AUTO)                                                                      \
-  X(ASTERISK)                                                                  \
-  X(BACKSLASH)                                                                 \
-  X(BITOR)                                                                     \
-  X(BREAK)                                                                     \
-  X(CASE)                                                                      \
-  X(CHAR)                                                                      \
+  OP(AMPER, "&")                                                               \
+  OP(AND, "&&")                                                                \
+  OP(ANDEQ, "&=")                                                              \
+  OP(ARROW, "->")                                                              \
+  KW(AUTO, "auto")                                                             \
+  OP(ASTERISK, "*")                                                            \
+  OP(BACKSLASH, "\\")                                                          \
+  OP(BITOR, "|")                                                               \
+  KW(BREAK, "break")                                                           \
+  KW(CASE, "case")                                                             \
+  KW(CHAR, "char")                                                             \
   X(CHARLIT)                                                                   \
-  X(COLON)                                                                     \
-  X(COMMA)                                                                     \
-  X(CONST)                                                                     \
-  X(CONTINUE)                                                                  \
-  X(DEFAULT)                                                                   \
-  X(DECREM)                                                                    \
-  X(DIVEQ)                                                                     \
-  X(DO)                                                                        \
-  X(DOUBLE)                                                                    \
+  OP(COLON, ":")                                                               \
+  OP(COMMA, ",")                                                               \
+  KW(CONST, "const")                                                           \
+  KW(CONTINUE, "continue")                                                     \
+  KW(DEFAULT, "default")                                                       \
+  OP(DECREM, "--")                                                             \
+  OP(DIVEQ, "/=")                                                              \
+  KW(DO, "do")                                                                 \
+  KW(DOUBLE, "double")                                                         \
   X(DQUOTE)                                                                    \
-  X(ELSE)                                                                      \
+  KW(ELSE, "else")                                                             \
   X(EMPTY)                                                                     \
-  X(ENUM)                                                                      \
-  X(EQUALS)                                                                    \
-  X(EQEQ)                                                                      \
-  X(EXTERN)                                                                    \
-  X(FLOAT)                                                                     \
+  X(END)                                                                       \
+  KW(ENUM, "enum")                                                             \
+  OP(EQUALS, "=")                                                              \
+  OP(EQEQ, "==")                                                               \
+  KW(EXTERN, "extern")                                                         \
+  KW(FLOAT, "float")                                                           \
   X(FLOATLIT)                                                                  \
-  X(FOR)                                                                       \
-  X(GE)                                                                        \
-  X(GOTO)                                                                      \
-  X(GT)                                                                        \
-  X(HASH)                                                                      \
+  KW(FOR, "for")                                                               \
+  OP(GE, ">=")                                                                 \
+  KW(GOTO, "goto")                                                             \
+  OP(GT, ">")                                                                  \
+  OP(HASH, "#")                                                                \
+  OP(HASHHASH, "##")                                                           \
   X(IDENT)                                                                     \
-  X(IF)                                                                        \
-  X(INCREM)                                                                    \
-  X(INLINE)                                                                    \
-  X(INT)                                                                       \
+  KW(IF, "if")                                                                 \
+  OP(INCREM, "++")                                                             \
+  KW(INLINE, "inline")                                                         \
+  KW(INT, "int")                                                               \
   X(INTLIT)                                                                    \
-  X(LBRACE)                                                                    \
-  X(LBRACKET)                                                                  \
-  X(LE)                                                                        \
-  X(LONG)                                                                      \
-  X(LPAREN)                                                                    \
-  X(LT)                                                                        \
-  X(LSHIFT)                                                                    \
-  X(LSHIFTEQ)                                                                  \
-  X(MINUS)                                                                     \
-  X(MINUSEQ)                                                                   \
-  X(MODEQ)                                                                     \
-  X(MODULO)                                                                    \
-  X(NOT)                                                                       \
-  X(NEQ)                                                                       \
-  X(OR)                                                                        \
-  X(OREQ)                                                                      \
-  X(PERIOD)                                                                    \
-  X(PLUS)                                                                      \
-  X(PLUSEQ)                                                                    \
+  X(INVALID)                                                                   \
+  OP(LBRACE, "{")                                                              \
+  OP(LBRACKET, "[")                                                            \
+  OP(LE, "<=")                                                                 \
+  KW(LONG, "long")                                                             \
+  OP(LPAREN, "(")                                                              \
+  OP(LT, "<")                                                                  \
+  OP(LSHIFT, "<<")                                                             \
+  OP(LSHIFTEQ, "<<=")                                                          \
+  OP(MINUS, "-")                                                               \
+  OP(MINUSEQ, "-=")                                                            \
+  OP(MODEQ, "%=")                                                              \
+  OP(MODULO, "%")                                                              \
+  OP(NOT, "!")                                                                 \
+  OP(NEQ, "!=")                                                                \
+  OP(OR, "||")                                                                 \
+  OP(OREQ, "|=")                                                               \
+  OP(PERIOD, ".")                                                              \
+  OP(PLUS, "+")                                                                \
+  OP(PLUSEQ, "+=")                                                             \
   X(QUOTE)                                                                     \
-  X(QUESTION)                                                                  \
-  X(RBRACE)                                                                    \
-  X(RBRACKET)                                                                  \
-  X(REGISTER)                                                                  \
-  X(RESTRICT)                                                                  \
-  X(RETURN)                                                                    \
-  X(RPAREN)                                                                    \
-  X(RSHIFT)                                                                    \
-  X(RSHIFTEQ)                                                                  \
-  X(SEMI)                                                                      \
-  X(SHORT)                                                                     \
-  X(SIGNED)                                                                    \
-  X(SIZEOF)                                                                    \
-  X(SLASH)                                                                     \
-  X(STATIC)                                                                    \
+  OP(QUESTION, "?")                                                            \
+  OP(RBRACE, "}")                                                              \
+  OP(RBRACKET, "]")                                                            \
+  KW(REGISTER, "register")                                                     \
+  KW(RESTRICT, "restrict")                                                     \
+  KW(RETURN, "return")                                                         \
+  OP(RPAREN, ")")                                                              \
+  OP(RSHIFT, ">>")                                                             \
+  OP(RSHIFTEQ, ">>=")                                                          \
+  OP(SEMI, ";")                                                                \
+  KW(SHORT, "short")                                                           \
+  KW(SIGNED, "signed")                                                         \
+  KW(SIZEOF, "sizeof")                                                         \
+  OP(SLASH, "/")                                                               \
+  KW(STATIC, "static")                                                         \
   X(STRINGLIT)                                                                 \
-  X(STRUCT)                                                                    \
-  X(SWITCH)                                                                    \
-  X(TILDE)                                                                     \
-  X(TIMESEQ)                                                                   \
-  X(TYPEDEF)                                                                   \
-  X(UNION)                                                                     \
-  X(UNSIGNED)                                                                  \
-  X(VOID)                                                                      \
-  X(VOLATILE)                                                                  \
-  X(WHILE)                                                                     \
-  X(XOR)                                                                       \
-  X(XOREQ)
+  KW(STRUCT, "struct")                                                         \
+  KW(SWITCH, "switch")                                                         \
+  OP(TILDE, "~")                                                               \
+  OP(TIMESEQ, "*=")                                                            \
+  KW(TYPEDEF, "typedef")                                                       \
+  KW(UNION, "union")                                                           \
+  KW(UNSIGNED, "unsigned")                                                     \
+  KW(VOID, "void")                                                             \
+  KW(VOLATILE, "volatile")                                                     \
+  KW(WHILE, "while")                                                           \
+  OP(XOR, "^")                                                                 \
+  OP(XOREQ, "^=")
 
 #define X(name) name,
 typedef enum { TOK_LIST } TokenType;
 #undef X
 
+#define X(name) +1
+enum { TOK_COUNT = 0 TOK_LIST }; // Number of token types
+#undef X
+
 #define X(name)                                                                \
   case name: return #name;
 static const char *TOK2STR(TokenType t) {
@@ -109,21 +128,159 @@ static const char *TOK2STR(TokenType t) {
 }
 #undef X
 
+// A single token as seen by the parser. Tokens are stored column-wise in a
+// tok_buf and assembled on access, so this is always passed by value.
+//
+// Identifiers are interned into idents as they are lexed, and atom is the ID
+// of their text. Numeric literals are decoded as they are lexed, and num is
+// the index of their value in the tok_buf (see tok_num()). An INVALID token,
+// which the lexer keeps for the parser to report, has its first character
+// as its atom, so it can be reported once its text is gone. It is 0 for
+// every other token.
 typedef struct {
   TokenType type;
   size_t start;
+  size_t len;
+  union {
+    uint32_t atom;
+    uint32_t num;
+  };
 } Token;
 
-void tokenize(str buf, dyn_array *toks, size_t len);
-void freeTokens(dyn_array *toks);
+// Names of all identifiers lexed so far.
+extern interner_t idents;
+
+// Pull-based lexer over a FILE. Input is read into a window that is refilled
+// as tokens are pulled, so only the window (which grows only to fit the
+// longest single token or comment) is ever held in memory.
+typedef struct {
+  FILE *fp;
+  char *window;
+  size_t cap;    // Allocated size of window
+  size_t fill;   // Number of input bytes in window
+  size_t pos;    // Window index of the next byte to lex
+  size_t origin; // Input offset of window[0]
+  size_t line;   // Line and column of window[0]
+  size_t col;
+  lit_value num; // Value of the last numeric literal returned
+  bool eof;
+} lexer_t;
+
+lexer_t *lexer_open(FILE *fp, size_t window);
+Token next_token(lexer_t *lex, size_t keep);
+src_loc lexer_locate(lexer_t *lex, size_t pos);
+void lexer_close(lexer_t *lex);
+
+// Token stream stored as parallel arrays: one byte for the type and 32-bit
+// offset, length and atom or literal index. Values of numeric literals are
+// kept in the nums side table, in token order.
+//
+// A tok_buf either holds every token of a buffer lexed by tokenize() (whose
+// line starts are indexed in lines), or is attached to a lexer_t and holds a
+// sliding range of it. In the second case tokens are pulled on demand by
+// tok_get(), and only the last TOK_STREAM_KEEP tokens before the one requested
+// are retained. Either way the last token of the input is END, so the parser
+// can stop at it instead of checking indices.
+typedef struct {
+  size_t len;
+  size_t cap;
+  uint8_t *types;
+  uint32_t *starts;
+  uint32_t *lens;
+  uint32_t *ids; // Token.atom or Token.num
+  line_index lines;
+
+  lit_value *nums;
+  size_t nums_len;
+  size_t nums_cap;
+  size_t nums_base; // Index of nums[0], like base for tokens
+
+  size_t base;    // Stream index of the first held token
+  size_t origin;  // Offset that the entries of starts are relative to
+  str src;        // Source text, starting at input offset src_origin
+  size_t src_origin;
+  lexer_t *stream;
+  bool done;      // Set once the stream has no more tokens
+
+  // Locates offsets instead of lines when the tokens come from several files
+  src_loc (*locate)(size_t pos);
+} tok_buf;
+
+#define TOK_STREAM_CAP 256
+#define TOK_STREAM_KEEP 8
+
+tok_buf *tok_init(size_t cap);
+tok_buf *tok_init_stream(lexer_t *lex);
+void tok_reserve(tok_buf *toks, size_t cap);
+void tok_push(tok_buf *toks, TokenType type, size_t start, size_t len,
+              uint32_t id);
+uint32_t tok_push_num(tok_buf *toks, lit_value val);
+void tok_pull(tok_buf *toks, size_t idx);
+src_loc tok_locate(tok_buf *toks, size_t pos);
+void tok_destroy(tok_buf *toks);
+
+// Returns true if the stream has a token at index idx, pulling it if needed.
+static inline bool tok_has(tok_buf *toks, size_t idx) {
+  if (toks->stream && idx >= toks->base + toks->len)
+    tok_pull(toks, idx);
+
+  return idx < toks->base + toks->len;
+}
+
+// Returns token idx. Streams are pulled up to it as needed. A whole buffer is
+// indexed without a check outside debug builds, since the parser never reads
+// past the END token.
+static inline Token tok_get(tok_buf *toks, size_t idx) {
+  if (toks->stream)
+    tok_has(toks, idx);
+
+  idx -= toks->base;
+  debug_assert(idx < toks->len, "Index out of bounds");
+
+  return (Token){.type = (TokenType)toks->types[idx],
+                 .start = toks->origin + toks->starts[idx],
+                 .len = toks->lens[idx],
+                 .atom = toks->ids[idx]};
+}
+
+// Returns the value of the numeric literal tok, which must still be held by
+// toks.
+static inline lit_value tok_num(tok_buf *toks, Token tok) {
+  return toks->nums[tok.num - toks->nums_base];
+}
+
+// Returns the source text of tok, which must still be held by toks.
+static inline str tok_text(tok_buf *toks, Token tok) {
+  return (str){.len = tok.len,
+               .chars = toks->src.chars + (tok.start - toks->src_origin)};
+}
+
+// An edit of a source buffer: removed bytes at offset were replaced by
+// inserted bytes.
+typedef struct {
+  size_t offset;
+  size_t removed;
+  size_t inserted;
+} text_edit;
+
+// The tokens replaced by tokenize_edit(): removed tokens starting at index
+// first were replaced by inserted tokens. Those after them are unchanged
+// apart from their offsets.
+typedef struct {
+  size_t first;
+  size_t removed;
+  size_t inserted;
+} tok_splice;
+
+void lex_init(void);
+void tokenize(str buf, tok_buf *toks, size_t len);
+void tokenize_parallel(str buf, tok_buf *toks, size_t len, size_t jobs);
+tok_splice tokenize_edit(str buf, tok_buf *toks, size_t len, text_edit edit);
+bool lex_single(const char *text, size_t len, Token *tok, lit_value *num);
 
 // Prints out the string-converted values of all the Tokens in the toks array.
-static inline void dump(dyn_array *toks) {
-  for (size_t i = 0; i < toks->len; ++i) {
-    Token *t = (Token *)dyn_get(toks, i);
-    printf("%s ", TOK2STR(t->type));
-  }
+static inline void dump(tok_buf *toks) {
+  for (size_t i = 0; i < toks->len; ++i)
+    printf("%s ", TOK2STR((TokenType)toks->types[i]));
   printf("\n\n");
 }
-
-size_t getLineNo(str buf, size_t len, size_t pos);
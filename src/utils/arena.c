@@ -7,6 +7,34 @@ void arena_init(arena_t *arena, size_t size) {
 
   arena->cap = size;
   arena->used = 0;
+  arena->chained = false;
+}
+
+// Where allocations start in a block of a chained arena, after the link to
+// the block before it.
+#define LINK sizeof(void *)
+
+void arena_init_chained(arena_t *arena, size_t size) {
+  arena_init(arena, size);
+  arena->chained = true;
+  *(void **)arena->memory = NULL;
+  arena->used = LINK;
+}
+
+// Starts a block of a chained arena at least twice the size of the last and
+// large enough for size bytes, in front of the others.
+static void chain(arena_t *arena, size_t size) {
+  size_t cap = arena->cap * 2;
+  while (cap < LINK + size + 8)
+    cap *= 2;
+
+  void *block = malloc(cap);
+  assert(block != NULL, "Allocation failed");
+  *(void **)block = arena->memory;
+
+  arena->memory = block;
+  arena->cap = cap;
+  arena->used = LINK;
 }
 
 void *arena_alloc(arena_t *arena, size_t size) {
@@ -14,24 +42,65 @@ void *arena_alloc(arena_t *arena, size_t size) {
 
   size_t aligned_used = (arena->used + (8 - 1)) & ~(8 - 1);
 
-  if (aligned_used + size >= arena->cap)
-    return NULL;
+  if (aligned_used + size >= arena->cap) {
+    if (!arena->chained)
+      return NULL;
+
+    chain(arena, size);
+    aligned_used = arena->used;
+  }
 
   void *ptr = arena->memory + aligned_used;
   arena->used = aligned_used + size;
   return ptr;
 }
 
+// Moves the block of an arena that isn't chained to one twice as large,
+// keeping what was allocated from it at the same offsets.
+void arena_grow(arena_t *arena) {
+  debug_assert(!arena->chained, "Growing a chained arena");
+  void *memory = realloc(arena->memory, arena->cap * 2);
+  assert(memory != NULL, "Allocation failed");
+
+  arena->memory = memory;
+  arena->cap *= 2;
+}
+
+// Frees the blocks of a chained arena before its current one.
+static void unchain(arena_t *arena) {
+  void *block = *(void **)arena->memory;
+  while (block) {
+    void *older = *(void **)block;
+    free(block);
+    block = older;
+  }
+  *(void **)arena->memory = NULL;
+}
+
 void arena_reset(arena_t *arena) {
   assert(arena, "Attempt to reset null");
 
   arena->used = 0;
+  if (arena->chained) {
+    unchain(arena);
+    arena->used = LINK;
+  }
 }
 
 void arena_destroy(arena_t *arena) {
   assert(arena && arena->memory, "Attempt to deallocate null");
 
+  if (arena->chained)
+    unchain(arena);
   free(arena->memory);
   arena->memory = NULL;
   arena->cap = arena->used = 0;
 }
+
+// Starts an empty stack of items of size bytes on top of arena.
+arena_stack arena_stack_init(arena_t *arena, size_t size) {
+  debug_assert(!arena->chained, "Stack on a chained arena");
+  arena->used = (arena->used + (8 - 1)) & ~(8 - 1);
+  return (arena_stack){
+      .arena = arena, .base = arena->used, .size = (size + 7) & ~7};
+}
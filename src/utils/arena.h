@@ -1,20 +1,65 @@
 #pragma once
 
+#include "assert.h"
+#include <stdbool.h>
 #include <stdlib.h>
 
+// Bump allocator over one block. A chained arena starts a new block when the
+// current one is full instead of failing, linked to the one before it from
+// its first word, so nothing allocated from it moves until it is reset.
 typedef struct {
   void *memory;
   size_t cap;
   size_t used;
+  bool chained;
 } arena_t;
 
-extern arena_t alloc;
-
 void arena_init(arena_t *arena, size_t size);
+void arena_init_chained(arena_t *arena, size_t size);
 void *arena_alloc(arena_t *arena, size_t size);
+void arena_grow(arena_t *arena);
 void arena_reset(arena_t *arena);
 void arena_destroy(arena_t *arena);
 
 #define arena_alloc_type(arena, type) ((type *)arena_alloc(arena, sizeof(type)))
 #define arena_alloc_array(arena, type, count)                                  \
   ((type *)arena_alloc(arena, sizeof(type) * (count)))
+
+// A stack of items of one size on top of an arena, which nothing else may
+// allocate from while it is in use. The arena grows when a push doesn't fit,
+// which moves the items, so a pointer to one is only valid until the next
+// push to it or a stack on top of it. A stack started on top of another must
+// be emptied before the one under it is pushed to again.
+typedef struct {
+  arena_t *arena;
+  size_t base; // Offset of the first item in the arena
+  size_t size; // Size of an item, a multiple of 8
+  size_t len;
+} arena_stack;
+
+arena_stack arena_stack_init(arena_t *arena, size_t size);
+
+// Returns room for a new item on top of stack.
+static inline void *arena_push(arena_stack *stack) {
+  debug_assert(stack->arena->used == stack->base + stack->len * stack->size,
+               "Stack pushed to under another");
+  void *item = arena_alloc(stack->arena, stack->size);
+  if (!item) {
+    arena_grow(stack->arena);
+    item = arena_alloc(stack->arena, stack->size);
+  }
+  ++stack->len;
+  return item;
+}
+
+// Returns the item on top of stack, which must not be empty.
+static inline void *arena_top(arena_stack *stack) {
+  return (char *)stack->arena->memory + stack->base +
+         (stack->len - 1) * stack->size;
+}
+
+// Removes the item on top of stack, giving its room back to the arena.
+static inline void arena_pop(arena_stack *stack) {
+  --stack->len;
+  stack->arena->used -= stack->size;
+}
@@ -9,3 +9,14 @@
       exit(EXIT_FAILURE);                                                      \
     }                                                                          \
   }
+
+// Checks on hot paths whose invariants are guaranteed by construction. They
+// are compiled out of release builds (NDEBUG) and kept in debug and test
+// builds for validation.
+#ifdef NDEBUG
+#define debug_assert(_e, _m)                                                   \
+  {                                                                            \
+  }
+#else
+#define debug_assert(_e, _m) assert(_e, _m)
+#endif
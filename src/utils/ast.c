@@ -2,110 +2,144 @@
 #include "dynarray.h"
 #include "llvm.h"
 
-arena_t alloc;
+// Returns whether node can be evaluated at compile time: it is a numeric
+// literal, or operators over them. Nodes are created after their operands,
+// so this is known for every node as it is created.
+static bool isComptime(ast_node *node) {
+  switch (node->type) {
+    case NUM_LIT:    return true;
+    case EXPR_BINOP: return node->ast_binary_op.comptime;
+    case EXPR_UNOP:  return node->ast_unary_op.comptime;
+    default:         return false;
+  }
+}
+
+// Returns room for a node in arena, which must have it.
+static ast_node *newNode(arena_t *arena) {
+  ast_node *node = arena_alloc_type(arena, ast_node);
+  assert(node, "Out of memory for AST nodes");
+  return node;
+}
 
-ast_node *create_binop(ast_node *left, ast_node *right, BinOpType op) {
+ast_node *create_binop(arena_t *arena, ast_node *left, ast_node *right,
+                       BinOpType op) {
   // OLD: ast_node *node = (ast_node *)malloc(sizeof(ast_node));
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+  ast_node *node = newNode(arena);
   node->type = EXPR_BINOP;
   node->ast_binary_op.type = op;
   node->ast_binary_op.left = left;
   node->ast_binary_op.right = right;
+  node->ast_binary_op.comptime = isComptime(left) && isComptime(right);
   node->value = getStrongerType(left->value, right->value);
   return node;
 }
 
-ast_node *create_unop(ast_node *right, UnOpType op) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_unop(arena_t *arena, ast_node *right, UnOpType op) {
+  ast_node *node = newNode(arena);
   node->type = EXPR_UNOP;
   node->ast_unary_op.type = op;
   node->ast_unary_op.right = right;
+  node->ast_unary_op.comptime = isComptime(right);
   node->value = right->value;
   return node;
 }
 
-ast_node *create_num(double num, TokenType value) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_num(arena_t *arena, double num, TokenType value) {
+  ast_node *node = newNode(arena);
   node->type = NUM_LIT;
   node->value = (value == INTLIT) ? INT : FLOAT;
   node->num_lit = num;
   return node;
 }
 
-ast_node *create_ident(char *ident, TokenType value) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_ident(arena_t *arena, uint32_t ident, TokenType value) {
+  ast_node *node = newNode(arena);
   node->type = IDENT_NODE;
   node->value = value;
   node->ident = ident;
+  node->sym = NULL;
   return node;
 }
 
-ast_node *create_prgm() {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_prgm(arena_t *arena) {
+  ast_node *node = newNode(arena);
   node->type = PRGM;
   node->value = EMPTY;
   node->ast_prgm.func_decls = dyn_init(2);
   return node;
 }
 
-ast_node *create_funcdecl(TokenType ret, char *ident, ast_node *scope) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_funcdecl(arena_t *arena, TokenType ret, uint32_t ident,
+                          ast_node *scope) {
+  ast_node *node = newNode(arena);
   node->type = FUNC_DECL;
   node->value = ret;
   node->ast_func_decl.ident = ident;
   node->ast_func_decl.params = dyn_init(2);
   node->ast_func_decl.scope = scope;
+  node->ast_func_decl.body = 0;
+  node->ast_func_decl.hash = 0;
+  node->ast_func_decl.arena = arena;
+  node->ast_func_decl.analyzed = false;
+  node->sym = NULL;
   return node;
 }
 
-ast_node *create_funccall(char *ident, TokenType value) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_funccall(arena_t *arena, uint32_t ident, TokenType value) {
+  ast_node *node = newNode(arena);
   node->type = FUNC_CALL;
   node->value = value;
   node->ast_func_call.ident = ident;
   node->ast_func_call.args = dyn_init(2);
+  node->sym = NULL;
   return node;
 }
 
-ast_node *create_param(TokenType type, char *ident) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_param(arena_t *arena, TokenType type, uint32_t ident) {
+  ast_node *node = newNode(arena);
   node->type = PARAM;
   node->value = type;
   node->ident = ident;
+  node->sym = NULL;
   return node;
 }
 
-ast_node *create_vardecl(TokenType value, char *ident) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_vardecl(arena_t *arena, TokenType value, uint32_t ident) {
+  ast_node *node = newNode(arena);
   node->type = STMT;
   node->value = value;
   node->ast_stmt.type = VAR_DECL;
   node->ast_stmt.ident_decl = ident;
+  node->sym = NULL;
   return node;
 }
 
-ast_node *create_varassign(TokenType value, char *ident, ast_node *expr) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_varassign(arena_t *arena, TokenType value, uint32_t ident,
+                           ast_node *expr) {
+  ast_node *node = newNode(arena);
   node->type = STMT;
   node->value = value;
   node->ast_stmt.type = VAR_ASSIGN;
   node->ast_stmt.var_assign.ident = ident;
   node->ast_stmt.var_assign.expr = expr;
+  node->sym = NULL;
   return node;
 }
 
-ast_node *create_reassign(TokenType value, char *ident, ast_node *expr) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_reassign(arena_t *arena, TokenType value, uint32_t ident,
+                          ast_node *expr) {
+  ast_node *node = newNode(arena);
   node->type = STMT;
   node->value = value;
   node->ast_stmt.type = REASSIGN;
   node->ast_stmt.var_assign.ident = ident;
   node->ast_stmt.var_assign.expr = expr;
+  node->sym = NULL;
   return node;
 }
 
-ast_node *create_scope() {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_scope(arena_t *arena) {
+  ast_node *node = newNode(arena);
   node->type = STMT;
   node->value = EMPTY;
   node->ast_stmt.type = SCOPE;
@@ -113,8 +147,9 @@ ast_node *create_scope() {
   return node;
 }
 
-ast_node *create_if_stmt(ast_node *pred, ast_node *scope, ast_node *alt) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_if_stmt(arena_t *arena, ast_node *pred, ast_node *scope,
+                         ast_node *alt) {
+  ast_node *node = newNode(arena);
   node->type = STMT;
   node->value = EMPTY;
   node->ast_stmt.type = IF_STMT;
@@ -124,8 +159,8 @@ ast_node *create_if_stmt(ast_node *pred, ast_node *scope, ast_node *alt) {
   return node;
 }
 
-ast_node *create_else_stmt(ast_node *scope) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_else_stmt(arena_t *arena, ast_node *scope) {
+  ast_node *node = newNode(arena);
   node->type = STMT;
   node->value = EMPTY;
   node->ast_stmt.type = ELSE_STMT;
@@ -133,8 +168,8 @@ ast_node *create_else_stmt(ast_node *scope) {
   return node;
 }
 
-ast_node *create_while_stmt(ast_node *pred, ast_node *scope) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_while_stmt(arena_t *arena, ast_node *pred, ast_node *scope) {
+  ast_node *node = newNode(arena);
   node->type = STMT;
   node->value = EMPTY;
   node->ast_stmt.type = WHILE_STMT;
@@ -143,8 +178,8 @@ ast_node *create_while_stmt(ast_node *pred, ast_node *scope) {
   return node;
 }
 
-ast_node *create_return(TokenType value, ast_node *expr) {
-  ast_node *node = arena_alloc_type(&alloc, ast_node);
+ast_node *create_return(arena_t *arena, TokenType value, ast_node *expr) {
+  ast_node *node = newNode(arena);
   node->type = STMT;
   node->value = value;
   node->ast_stmt.type = RET_STMT;
@@ -184,10 +219,8 @@ void ast_destroy(ast_node *root) {
 
         dyn_destroy(curr->ast_func_decl.params);
 
-        dyn_push(stack, curr->ast_func_decl.scope);
-
-        free(curr->ast_func_decl.ident);
-        curr->ast_func_decl.ident = NULL;
+        if (curr->ast_func_decl.scope)
+          dyn_push(stack, curr->ast_func_decl.scope);
       } break;
 
       case PRGM: {
@@ -200,9 +233,8 @@ void ast_destroy(ast_node *root) {
       case STMT: {
 
         switch (curr->ast_stmt.type) {
-          case VAR_DECL: free(curr->ast_stmt.ident_decl); break;
           case VAR_ASSIGN:
-            free(curr->ast_stmt.var_assign.ident);
+          case REASSIGN:
             dyn_push(stack, curr->ast_stmt.var_assign.expr);
             break;
           case RET_STMT: dyn_push(stack, curr->ast_stmt.ret.expr); break;
@@ -234,22 +266,11 @@ void ast_destroy(ast_node *root) {
 
       } break;
 
-      case IDENT_NODE: {
-        free(curr->ident);
-
-      } break;
-
-      case PARAM: {
-        free(curr->ident);
-
-      } break;
-
       case FUNC_CALL: {
         for (size_t i = 0; i < curr->ast_func_call.args->len; ++i)
           dyn_push(stack, dyn_get(curr->ast_func_call.args, i));
 
         dyn_destroy(curr->ast_func_call.args);
-        free(curr->ast_func_call.ident);
       } break;
 
       default: break;
@@ -53,23 +53,31 @@ typedef enum {
   SCOPE
 } StmtType;
 
+struct Symbol;
+
 // TODO: Refactor tagged union?
 typedef struct ast_node {
   NodeType type;
   TokenType value;
 
+  // Symbol a declaration, parameter, assignment, identifier or call names,
+  // resolved in its scope by the parser
+  struct Symbol *sym;
+
   union {
     double num_lit; // Number literal
 
-    char *ident; // Identifier/Function parameter
+    uint32_t ident; // Identifier/Function parameter (atom)
 
     struct { // Binary operation
       BinOpType type;
+      bool comptime; // Only numeric literals under it
       struct ast_node *left, *right;
     } ast_binary_op;
 
     struct { // Unary operation
       UnOpType type;
+      bool comptime; // Only numeric literals under it
       struct ast_node *right;
     } ast_unary_op;
 
@@ -78,13 +86,17 @@ typedef struct ast_node {
     } ast_prgm;
 
     struct { // Function declaration
-      char *ident;
+      uint32_t ident;
       dyn_array *params;
-      struct ast_node *scope;
+      struct ast_node *scope; // Body, NULL until parsed if parsed lazily
+      size_t body;            // Index of the body's first token
+      uint64_t hash;          // Of its tokens, to find it unchanged
+      arena_t *arena;         // Its nodes' arena, which casts are added to
+      bool analyzed;          // Has had its casts added
     } ast_func_decl;
 
     struct { // Function call
-      char *ident;
+      uint32_t ident;
       dyn_array *args;
     } ast_func_call;
 
@@ -92,10 +104,10 @@ typedef struct ast_node {
       StmtType type;
 
       union {
-        char *ident_decl; // Variable declaration (no assignment)
+        uint32_t ident_decl; // Variable declaration (no assignment)
 
         struct { // Variable declaration with assignment
-          char *ident;
+          uint32_t ident;
           struct ast_node *expr;
         } var_assign;
 
@@ -124,22 +136,27 @@ typedef struct ast_node {
   };
 } ast_node;
 
-ast_node *create_binop(ast_node *left, ast_node *right, BinOpType op);
-ast_node *create_unop(ast_node *right, UnOpType op);
-ast_node *create_num(double num, TokenType value);
-ast_node *create_ident(char *ident, TokenType value);
-ast_node *create_prgm();
-ast_node *create_funcdecl(TokenType ret, char *ident, ast_node *scope);
-ast_node *create_funccall(char *ident, TokenType value);
-ast_node *create_param(TokenType value, char *ident);
-ast_node *create_vardecl(TokenType value, char *ident);
-ast_node *create_varassign(TokenType value, char *ident, ast_node *expr);
-ast_node *create_reassign(TokenType value, char *ident, ast_node *expr);
-ast_node *create_scope();
-ast_node *create_if_stmt(ast_node *pred, ast_node *scope, ast_node *alt);
-ast_node *create_else_stmt(ast_node *scope);
-ast_node *create_while_stmt(ast_node *pred, ast_node *scope);
-ast_node *create_return(TokenType value, ast_node *expr);
+ast_node *create_binop(arena_t *arena, ast_node *left, ast_node *right,
+                       BinOpType op);
+ast_node *create_unop(arena_t *arena, ast_node *right, UnOpType op);
+ast_node *create_num(arena_t *arena, double num, TokenType value);
+ast_node *create_ident(arena_t *arena, uint32_t ident, TokenType value);
+ast_node *create_prgm(arena_t *arena);
+ast_node *create_funcdecl(arena_t *arena, TokenType ret, uint32_t ident,
+                          ast_node *scope);
+ast_node *create_funccall(arena_t *arena, uint32_t ident, TokenType value);
+ast_node *create_param(arena_t *arena, TokenType value, uint32_t ident);
+ast_node *create_vardecl(arena_t *arena, TokenType value, uint32_t ident);
+ast_node *create_varassign(arena_t *arena, TokenType value, uint32_t ident,
+                           ast_node *expr);
+ast_node *create_reassign(arena_t *arena, TokenType value, uint32_t ident,
+                          ast_node *expr);
+ast_node *create_scope(arena_t *arena);
+ast_node *create_if_stmt(arena_t *arena, ast_node *pred, ast_node *scope,
+                         ast_node *alt);
+ast_node *create_else_stmt(arena_t *arena, ast_node *scope);
+ast_node *create_while_stmt(arena_t *arena, ast_node *pred, ast_node *scope);
+ast_node *create_return(arena_t *arena, TokenType value, ast_node *expr);
 
 UnOpType getImplicitCastOp(TokenType, TokenType);
 
@@ -46,7 +46,7 @@ void *dyn_pop(dyn_array *list) {
 }
 
 void *dyn_get(dyn_array *list, size_t idx) {
-  assert(idx < list->len, "Index out of bounds");
+  debug_assert(idx < list->len, "Index out of bounds");
 
   return list->el[idx];
 }
@@ -0,0 +1,108 @@
+#define _DEFAULT_SOURCE // madvise(), MADV_SEQUENTIAL and MAP_ANONYMOUS
+
+#include "file.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Reads everything from fd into a heap buffer, followed by SRC_PADDING zero
+// bytes.
+static bool readAll(int fd, source_file *file) {
+  size_t cap = 64 * 1024, len = 0;
+  char *buf = (char *)malloc(cap + SRC_PADDING);
+  if (!buf)
+    return false;
+
+  for (;;) {
+    if (len == cap) {
+      cap *= 2;
+      char *grown = (char *)realloc(buf, cap + SRC_PADDING);
+      if (!grown) {
+        free(buf);
+        return false;
+      }
+
+      buf = grown;
+      continue;
+    }
+
+    ssize_t n = read(fd, buf + len, cap - len);
+    if (n < 0) {
+      free(buf);
+      return false;
+    }
+    if (n == 0)
+      break;
+
+    len += n;
+  }
+
+  memset(buf + len, 0, SRC_PADDING);
+  file->text = (str){.len = len, .chars = buf};
+  file->mapped = false;
+  return true;
+}
+
+// Maps size bytes of fd followed by SRC_PADDING zero bytes, or returns NULL.
+//
+// The kernel zero-fills the last page of a file mapping past its end, but
+// touching a page that lies entirely past the end faults. So that the padding
+// exists even when size is a multiple of the page size, anonymous zero pages
+// covering the file and its padding are reserved first and the file is then
+// mapped over their start.
+static char *mapPadded(int fd, size_t size) {
+  void *map = mmap(NULL, size + SRC_PADDING, PROT_READ,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  if (mmap(map, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+      MAP_FAILED) {
+    munmap(map, size + SRC_PADDING);
+    return NULL;
+  }
+
+  madvise(map, size, MADV_SEQUENTIAL);
+  return (char *)map;
+}
+
+// Loads the file at path into file, returning false if it could not be read.
+// The text is always followed by SRC_PADDING zero bytes.
+bool file_load(const char *path, source_file *file) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return false;
+  }
+
+  // Only non-empty regular files can be mapped.
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    char *map = mapPadded(fd, st.st_size);
+    if (map) {
+      close(fd);
+
+      file->text = (str){.len = st.st_size, .chars = map};
+      file->mapped = true;
+      return true;
+    }
+  }
+
+  bool ok = readAll(fd, file);
+  close(fd);
+  return ok;
+}
+
+void file_unload(source_file *file) {
+  if (file->mapped)
+    munmap(file->text.chars, file->text.len + SRC_PADDING);
+  else
+    free(file->text.chars);
+
+  file->text = (str){0};
+}
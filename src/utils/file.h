@@ -0,0 +1,16 @@
+#pragma once
+
+#include "str.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Contents of a source file, followed by SRC_PADDING zero bytes. Regular files
+// are memory-mapped so lexing reads the page cache directly; pipes and other
+// files that cannot be mapped are read into a heap buffer instead.
+typedef struct {
+  str text;
+  bool mapped;
+} source_file;
+
+bool file_load(const char *path, source_file *file);
+void file_unload(source_file *file);
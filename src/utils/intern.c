@@ -0,0 +1,344 @@
+#include "intern.h"
+#include "arena.h"
+#include "assert.h"
+#include <stdbool.h>
+#include <string.h>
+
+// Size of the arena blocks that interned text is copied into.
+#define INTERN_BLOCK (64 * 1024)
+
+// A slot holds the 31-bit hash of its string in the high half and its atom
+// in the low half. Atoms are never NO_ATOM, so zero is an empty slot.
+#define SLOT_EMPTY 0
+#define SLOT_MOVED UINT64_MAX // An empty slot sealed while its table is copied
+#define SLOT_COPIED (1ull << 63) // A filled slot already in the next table
+#define HASH_MASK 0x7FFFFFFFu
+
+// Slots a thread copies into a bigger table at a time.
+#define COPY_CHUNK 1024
+
+struct intern_table {
+  size_t mask;                  // Number of slots - 1 (a power of two)
+  _Atomic(intern_table *) next; // Bigger table this one is being copied to
+  _Atomic size_t claimed;       // Slots handed out to copying threads
+  _Atomic size_t copied;        // Slots copied
+  intern_table *older;          // Next replaced table, once replaced
+  _Atomic uint64_t slots[];
+};
+
+struct intern_block {
+  intern_block *next;
+  arena_t text;
+};
+
+// Block each thread copies text into, per interner. A thread switching
+// between more interners than this starts a new block for one of them.
+#define CURSORS 4
+typedef struct {
+  uint64_t id;
+  intern_block *block;
+} intern_cursor;
+
+static _Thread_local intern_cursor cursors[CURSORS];
+static _Atomic uint64_t next_id = 1;
+
+// Multiplicative hash over 8 bytes at a time. Identifiers are short, so most
+// take one or two rounds.
+static uint32_t hashBytes(const char *s, size_t len) {
+  uint64_t h = len * 0x9E3779B97F4A7C15ull;
+  for (; len >= 8; s += 8, len -= 8) {
+    uint64_t w;
+    memcpy(&w, s, 8);
+    h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 29;
+  }
+
+  uint64_t w = 0;
+  memcpy(&w, s, len);
+  h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+static intern_table *newTable(size_t slots) {
+  intern_table *t = (intern_table *)calloc(
+      1, sizeof(intern_table) + sizeof(_Atomic uint64_t) * slots);
+  assert(t != NULL, "Could not allocate memory for interner");
+  t->mask = slots - 1;
+  return t;
+}
+
+// Returns the entry of atom in the atom table, adding its chunk if no thread
+// has yet.
+static str *atomEntry(interner_t *names, uint32_t atom) {
+  uint64_t k = (uint64_t)atom + ATOM_CHUNK;
+  int chunk = 63 - __builtin_clzll(k) - ATOM_CHUNK_BITS;
+  str *atoms =
+      atomic_load_explicit(&names->atoms[chunk], memory_order_acquire);
+  if (!atoms) {
+    str *fresh = (str *)calloc((size_t)ATOM_CHUNK << chunk, sizeof(str));
+    assert(fresh != NULL, "Could not allocate memory for interner");
+    if (atomic_compare_exchange_strong_explicit(&names->atoms[chunk], &atoms,
+                                                fresh, memory_order_acq_rel,
+                                                memory_order_acquire))
+      atoms = fresh;
+    else
+      free(fresh);
+  }
+
+  return &atoms[k - ((uint64_t)ATOM_CHUNK << chunk)];
+}
+
+void intern_init(interner_t *names, size_t cap) {
+  size_t slots = 16;
+  while (slots < cap * 2)
+    slots *= 2;
+
+  *names = (interner_t){0};
+  atomic_store(&names->table, newTable(slots));
+  names->id = atomic_fetch_add(&next_id, 1);
+
+  // NO_ATOM names the empty string.
+  *atomEntry(names, NO_ATOM) = (str){.len = 0, .chars = ""};
+  atomic_store(&names->len, 1);
+}
+
+// Copies len bytes at s and a NUL terminator into this thread's block,
+// starting a new block when it is full.
+static char *copyText(interner_t *names, const char *s, size_t len) {
+  intern_cursor *c = &cursors[0];
+  for (int k = 0; k < CURSORS && c->id != names->id; ++k) {
+    if (cursors[k].id == names->id || cursors[k].id < c->id)
+      c = &cursors[k];
+  }
+  if (c->id != names->id)
+    *c = (intern_cursor){.id = names->id};
+
+  char *dst = c->block ? arena_alloc(&c->block->text, len + 1) : NULL;
+  if (!dst) {
+    intern_block *block = (intern_block *)malloc(sizeof(intern_block));
+    assert(block != NULL, "Could not allocate memory for interner");
+
+    size_t size = INTERN_BLOCK;
+    while (size <= len + 1)
+      size *= 2;
+    arena_init(&block->text, size);
+
+    block->next = atomic_load_explicit(&names->blocks, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&names->blocks, &block->next,
+                                                  block, memory_order_release,
+                                                  memory_order_relaxed))
+      ;
+
+    c->block = block;
+    dst = arena_alloc(&block->text, len + 1);
+  }
+
+  memcpy(dst, s, len);
+  dst[len] = '\0';
+  return dst;
+}
+
+static bool matches(interner_t *names, uint64_t slot, uint32_t h,
+                    const char *s, size_t len) {
+  if (((uint32_t)(slot >> 32) & HASH_MASK) != h)
+    return false;
+
+  str text = atom_str(names, (uint32_t)slot);
+  return text.len == len && !memcmp(text.chars, s, len);
+}
+
+// Adds slot to t unless another thread copying the same slot already did.
+// A thread stopped while copying may find t itself copied on by then.
+static void place(intern_table *t, uint64_t slot) {
+  for (size_t k = (slot >> 32) & t->mask;; k = (k + 1) & t->mask) {
+    uint64_t seen = SLOT_EMPTY;
+    if (atomic_compare_exchange_strong_explicit(&t->slots[k], &seen, slot,
+                                                memory_order_release,
+                                                memory_order_relaxed) ||
+        (seen & ~SLOT_COPIED) == slot)
+      return;
+  }
+}
+
+// Moves slot k of t into next: an empty slot is sealed, and a filled one is
+// copied and then marked. Returns whether this thread was the one to do so.
+static bool copySlot(intern_table *t, intern_table *next, size_t k) {
+  uint64_t slot = atomic_load_explicit(&t->slots[k], memory_order_acquire);
+  for (;;) {
+    if (slot == SLOT_MOVED || (slot & SLOT_COPIED))
+      return false;
+
+    if (slot == SLOT_EMPTY) {
+      if (atomic_compare_exchange_strong_explicit(
+              &t->slots[k], &slot, SLOT_MOVED, memory_order_acq_rel,
+              memory_order_acquire))
+        return true;
+      continue;
+    }
+
+    place(next, slot);
+    return atomic_compare_exchange_strong_explicit(
+        &t->slots[k], &slot, slot | SLOT_COPIED, memory_order_acq_rel,
+        memory_order_acquire);
+  }
+}
+
+// Makes next, which holds every atom of t, the current table.
+static void replace(interner_t *names, intern_table *t, intern_table *next) {
+  intern_table *expected = t;
+  if (!atomic_compare_exchange_strong(&names->table, &expected, next))
+    return;
+
+  t->older = atomic_load_explicit(&names->old, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak(&names->old, &t->older, t))
+    ;
+}
+
+// Copies chunks of t into the table after it until none are left. Filled
+// slots never change, so they are copied as they are, and empty ones are
+// sealed so nothing is added to them afterwards.
+static void helpCopy(interner_t *names, intern_table *t) {
+  intern_table *next = atomic_load_explicit(&t->next, memory_order_acquire);
+  size_t slots = t->mask + 1;
+
+  for (;;) {
+    size_t from = atomic_fetch_add(&t->claimed, COPY_CHUNK);
+    if (from >= slots)
+      break;
+
+    size_t to = (from + COPY_CHUNK < slots) ? from + COPY_CHUNK : slots;
+    size_t moved = 0;
+    for (size_t k = from; k < to; ++k)
+      moved += copySlot(t, next, k);
+
+    if (atomic_fetch_add(&t->copied, moved) + moved == slots) {
+      replace(names, t, next);
+      return;
+    }
+  }
+
+  // Every chunk is taken, but a thread copying one may have been stopped
+  // halfway. Rather than wait for it, copy whatever it has not, so the next
+  // table is complete before anything is added to it.
+  if (atomic_load_explicit(&names->table, memory_order_acquire) == t) {
+    size_t moved = 0;
+    for (size_t k = 0; k < slots; ++k)
+      moved += copySlot(t, next, k);
+    atomic_fetch_add(&t->copied, moved);
+    replace(names, t, next);
+  }
+}
+
+// Starts copying t into a table twice its size once atom fills it past one
+// half, if t is the current table and no thread has started yet.
+static void maybeGrow(interner_t *names, intern_table *t, uint32_t atom) {
+  if ((size_t)atom * 2 <= t->mask + 1 ||
+      atomic_load_explicit(&names->table, memory_order_acquire) != t ||
+      atomic_load_explicit(&t->next, memory_order_acquire))
+    return;
+
+  intern_table *bigger = newTable((t->mask + 1) * 2);
+  intern_table *none = NULL;
+  if (!atomic_compare_exchange_strong(&t->next, &none, bigger))
+    free(bigger);
+  helpCopy(names, t);
+}
+
+// Returns the atom of the len bytes at s, adding them if they were not
+// interned yet. Safe to call from any number of threads at once: a thread
+// only retries when another one changed the slot it was about to fill.
+uint32_t intern(interner_t *names, const char *s, size_t len) {
+  uint32_t h = hashBytes(s, len) & HASH_MASK;
+  uint32_t atom = NO_ATOM;
+
+  intern_table *t = atomic_load_explicit(&names->table, memory_order_acquire);
+  for (;;) {
+    if (atomic_load_explicit(&t->next, memory_order_acquire))
+      helpCopy(names, t);
+
+    for (size_t k = h & t->mask;; k = (k + 1) & t->mask) {
+      uint64_t slot =
+          atomic_load_explicit(&t->slots[k], memory_order_acquire);
+
+      if (slot == SLOT_EMPTY) {
+        // The atom and its text are made before they can be found, and are
+        // kept for the next empty slot if another thread fills this one.
+        if (atom == NO_ATOM) {
+          size_t id = atomic_fetch_add(&names->len, 1);
+          assert(id < UINT32_MAX, "Too many interned strings");
+          atom = (uint32_t)id;
+          *atomEntry(names, atom) =
+              (str){.len = len, .chars = copyText(names, s, len)};
+        }
+
+        if (atomic_compare_exchange_strong_explicit(
+                &t->slots[k], &slot, (uint64_t)h << 32 | atom,
+                memory_order_acq_rel, memory_order_acquire)) {
+          maybeGrow(names, t, atom);
+          return atom;
+        }
+      }
+
+      if (slot == SLOT_MOVED)
+        break;
+
+      if (matches(names, slot, h, s, len)) {
+        // Another thread added the same string first. The atom made for it
+        // is never handed out, but still names the string.
+        if (atom != NO_ATOM)
+          *atomEntry(names, atom) = atom_str(names, (uint32_t)slot);
+        return (uint32_t)slot;
+      }
+    }
+
+    // The string is not in t, and t is being copied to the next table.
+    helpCopy(names, t);
+    t = atomic_load_explicit(&t->next, memory_order_acquire);
+  }
+}
+
+// Returns the atom of the len bytes at s, or NO_ATOM if they were not
+// interned. Never waits for or helps other threads.
+uint32_t intern_find(interner_t *names, const char *s, size_t len) {
+  uint32_t h = hashBytes(s, len) & HASH_MASK;
+
+  intern_table *t = atomic_load_explicit(&names->table, memory_order_acquire);
+  for (size_t k = h & t->mask;; k = (k + 1) & t->mask) {
+    uint64_t slot = atomic_load_explicit(&t->slots[k], memory_order_acquire);
+    if (slot == SLOT_EMPTY)
+      return NO_ATOM;
+
+    if (slot == SLOT_MOVED) {
+      t = atomic_load_explicit(&t->next, memory_order_acquire);
+      k = (h & t->mask) - 1;
+      continue;
+    }
+
+    if (matches(names, slot, h, s, len))
+      return (uint32_t)slot;
+  }
+}
+
+// Frees everything the interner holds. No other thread may be using it.
+void intern_destroy(interner_t *names) {
+  for (intern_block *b = names->blocks, *next; b; b = next) {
+    next = b->next;
+    arena_destroy(&b->text);
+    free(b);
+  }
+
+  for (intern_table *t = names->old, *older; t; t = older) {
+    older = t->older;
+    free(t);
+  }
+
+  for (intern_table *t = names->table, *next; t; t = next) {
+    next = t->next;
+    free(t);
+  }
+
+  for (int k = 0; k < ATOM_CHUNKS; ++k)
+    free(names->atoms[k]);
+
+  *names = (interner_t){0};
+}
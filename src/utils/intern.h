@@ -0,0 +1,56 @@
+#pragma once
+
+#include "str.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Atom 0 is never handed out, so it marks tokens that have no name.
+#define NO_ATOM 0
+
+// Atoms in the first chunk of the atom table. Chunk c holds
+// ATOM_CHUNK << c atoms, so a table of ATOM_CHUNKS chunks never moves.
+#define ATOM_CHUNK_BITS 10
+#define ATOM_CHUNK (1u << ATOM_CHUNK_BITS)
+#define ATOM_CHUNKS (33 - ATOM_CHUNK_BITS)
+
+typedef struct intern_table intern_table;
+typedef struct intern_block intern_block;
+
+// Interned strings, shared by every thread. Each distinct string is copied
+// once and given a dense atom ID, so names can be compared, hashed and used
+// as table indices as plain integers across files and threads.
+//
+// Atoms are found through an open-addressed hash table whose slots hold a
+// hash and an atom, and are only ever filled once. intern() claims an empty
+// slot with a compare-and-swap and never blocks; when the table is half
+// full, a bigger one is linked after it and every inserting thread helps to
+// copy slots over. intern_find() and atom_str() never wait or retry. Text is
+// copied into arena blocks owned by the inserting thread, so threads never
+// share a bump pointer.
+typedef struct {
+  _Atomic(intern_table *) table; // Newest complete table
+  _Atomic(str *) atoms[ATOM_CHUNKS];
+  _Atomic size_t len; // Number of atoms handed out, including NO_ATOM
+
+  _Atomic(intern_block *) blocks; // Every text block, until intern_destroy()
+  _Atomic(intern_table *) old;    // Tables replaced by a bigger one
+  uint64_t id; // Tells this interner apart from earlier ones at its address
+} interner_t;
+
+void intern_init(interner_t *names, size_t cap);
+uint32_t intern(interner_t *names, const char *s, size_t len);
+uint32_t intern_find(interner_t *names, const char *s, size_t len);
+void intern_destroy(interner_t *names);
+
+static inline str atom_str(const interner_t *names, uint32_t atom) {
+  uint64_t k = (uint64_t)atom + ATOM_CHUNK;
+  int chunk = 63 - __builtin_clzll(k) - ATOM_CHUNK_BITS;
+  str *atoms = atomic_load_explicit(&((interner_t *)names)->atoms[chunk],
+                                    memory_order_acquire);
+  return atoms[k - ((uint64_t)ATOM_CHUNK << chunk)];
+}
+
+static inline const char *atom_name(const interner_t *names, uint32_t atom) {
+  return atom_str(names, atom).chars;
+}
@@ -0,0 +1,99 @@
+#include "lines.h"
+#include "assert.h"
+#include "scan.h"
+#include <string.h>
+
+static void lines_push(line_index *lines, size_t start) {
+  if (lines->len == lines->cap) {
+    lines->cap = (lines->cap < 64) ? 64 : lines->cap * 3 / 2;
+    lines->starts = realloc(lines->starts, sizeof(*lines->starts) * lines->cap);
+    assert(lines->starts != NULL, "Could not allocate memory for line index");
+  }
+
+  lines->starts[lines->len++] = (uint32_t)start;
+}
+
+// Records the start of every line in the first len bytes of buf. Newlines are
+// located with the vectorized scan_until(), so the cost is one call per line.
+void lines_build(line_index *lines, str buf, size_t len) {
+  lines->len = 0;
+  lines->cap = 0;
+  lines->starts = NULL;
+
+  lines_push(lines, 0);
+  for (size_t i = scan_until(buf.chars, 0, len, '\n'); i < len;
+       i = scan_until(buf.chars, i + 1, len, '\n'))
+    lines_push(lines, i + 1);
+}
+
+// Returns the index of the first line starting after pos, or lines->len.
+static size_t findLineAfter(const line_index *lines, size_t pos) {
+  size_t lo = 0, hi = lines->len;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (lines->starts[mid] <= pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+// Updates the index after removed bytes at offset were replaced by inserted
+// bytes, which are now in buf. Only the inserted bytes are scanned; the lines
+// after the edit are shifted in place.
+void lines_edit(line_index *lines, str buf, size_t offset, size_t removed,
+                size_t inserted) {
+  // Lines that started after a removed newline are gone.
+  size_t lo = findLineAfter(lines, offset);
+  size_t hi = findLineAfter(lines, offset + removed);
+
+  size_t added = 0;
+  size_t end = offset + inserted;
+  for (size_t i = scan_until(buf.chars, offset, end, '\n'); i < end;
+       i = scan_until(buf.chars, i + 1, end, '\n'))
+    ++added;
+
+  size_t tail = lines->len - hi;
+  size_t len = lo + added + tail;
+  if (len > lines->cap) {
+    lines->cap = len * 3 / 2;
+    lines->starts = realloc(lines->starts, sizeof(*lines->starts) * lines->cap);
+    assert(lines->starts != NULL, "Could not allocate memory for line index");
+  }
+
+  memmove(lines->starts + lo + added, lines->starts + hi,
+          sizeof(*lines->starts) * tail);
+  for (size_t k = lo + added; k < len; ++k)
+    lines->starts[k] = (uint32_t)(lines->starts[k] + inserted - removed);
+
+  size_t k = lo;
+  for (size_t i = scan_until(buf.chars, offset, end, '\n'); i < end;
+       i = scan_until(buf.chars, i + 1, end, '\n'))
+    lines->starts[k++] = (uint32_t)(i + 1);
+
+  lines->len = len;
+}
+
+// Binary searches for the last line starting at or before pos.
+src_loc lines_locate(const line_index *lines, size_t pos) {
+  assert(lines->len > 0, "Line index not built");
+
+  size_t lo = 0, hi = lines->len;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (lines->starts[mid] <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return (src_loc){.line = lo + 1, .col = pos - lines->starts[lo] + 1};
+}
+
+void lines_destroy(line_index *lines) {
+  free(lines->starts);
+  lines->starts = NULL;
+  lines->len = lines->cap = 0;
+}
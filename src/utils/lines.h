@@ -0,0 +1,28 @@
+#pragma once
+
+#include "str.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// Offsets of the first byte of every line in a source buffer. The table is
+// built once per buffer and shared by everything that turns a byte offset
+// into a line and column (diagnostics, source spans, debug info).
+typedef struct {
+  size_t len;
+  size_t cap;
+  uint32_t *starts;
+} line_index;
+
+// 1-based line and column of a byte offset, and the file it is in when that
+// is not implied (see pp_locate()).
+typedef struct {
+  size_t line;
+  size_t col;
+  const char *path;
+} src_loc;
+
+void lines_build(line_index *lines, str buf, size_t len);
+void lines_edit(line_index *lines, str buf, size_t offset, size_t removed,
+                size_t inserted);
+src_loc lines_locate(const line_index *lines, size_t pos);
+void lines_destroy(line_index *lines);
@@ -0,0 +1,232 @@
+#include "numlit.h"
+#include <string.h>
+
+// Longest literal decoded through strtod() from a stack copy. Longer ones are
+// copied to the heap.
+#define LIT_STACK_LEN 128
+
+// Powers of ten that are exactly representable as doubles.
+static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                               1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                               1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                               1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline int digitValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+
+  c |= 0x20;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+
+  return 16;
+}
+
+// Returns the index one past the digits of the given base from index i.
+static size_t skipDigits(const char *s, size_t i, size_t len, int base) {
+  while (i < len && digitValue(s[i]) < base)
+    ++i;
+
+  return i;
+}
+
+// Parses the suffix of a literal from index i, which must make up the rest of
+// it, into val->flags.
+static bool decodeSuffix(const char *s, size_t i, size_t len,
+                         lit_value *val) {
+  if (val->flags & LIT_FLOAT) {
+    if (i + 1 == len && (s[i] | 0x20) == 'f')
+      val->flags |= LIT_SINGLE;
+    else if (i + 1 == len && (s[i] | 0x20) == 'l')
+      val->flags |= LIT_LONG;
+    else if (i != len)
+      return false;
+
+    return true;
+  }
+
+  while (i < len) {
+    if ((s[i] | 0x20) == 'u' && !(val->flags & LIT_UNSIGNED)) {
+      val->flags |= LIT_UNSIGNED;
+      ++i;
+    } else if ((s[i] == 'l' || s[i] == 'L') &&
+               !(val->flags & (LIT_LONG | LIT_LONGLONG))) {
+      // ll and LL, but not lL or Ll
+      if (i + 1 < len && s[i + 1] == s[i]) {
+        val->flags |= LIT_LONGLONG;
+        i += 2;
+      } else {
+        val->flags |= LIT_LONG;
+        ++i;
+      }
+    } else
+      return false;
+  }
+
+  return true;
+}
+
+// Converts the len-byte floating literal at s (without suffix) with strtod()
+// on a NUL-terminated copy.
+static double slowFloat(const char *s, size_t len) {
+  char stack[LIT_STACK_LEN];
+  char *buf = (len < LIT_STACK_LEN) ? stack : (char *)malloc(len + 1);
+  memcpy(buf, s, len);
+  buf[len] = '\0';
+
+  double d = strtod(buf, NULL);
+
+  if (buf != stack)
+    free(buf);
+  return d;
+}
+
+// Decodes an integer literal of the given base whose digits are [i, end).
+static bool decodeInt(const char *s, size_t i, size_t end, int base,
+                      lit_value *val) {
+  uint64_t u = 0;
+  for (; i < end; ++i) {
+    uint64_t d = digitValue(s[i]);
+    if (u > (UINT64_MAX - d) / base)
+      return false; // Does not fit in 64 bits
+
+    u = u * base + d;
+  }
+
+  val->u = u;
+  return true;
+}
+
+// Decodes the len bytes at s, which make up one preprocessing number, as a C
+// integer or floating literal: decimal, octal or hexadecimal, with an optional
+// fraction and exponent (p for hexadecimal) and u/l/ll or f/l suffixes.
+// Returns false if they do not spell a valid literal.
+//
+// Decimal floats with at most 19 significant digits whose value times a power
+// of ten up to 10^22 fits a double's 53-bit mantissa are converted exactly
+// with one multiplication or division (Clinger's fast path), which covers
+// nearly every literal in real code. All other floats go through strtod().
+bool lit_decode(const char *s, size_t len, lit_value *val) {
+  *val = (lit_value){0};
+
+  // Hexadecimal
+  if (len >= 2 && s[0] == '0' && (s[1] | 0x20) == 'x') {
+    size_t i = skipDigits(s, 2, len, 16);
+    size_t int_end = i;
+
+    bool digits = int_end > 2;
+    if (i < len && s[i] == '.') {
+      size_t frac = i + 1;
+      i = skipDigits(s, frac, len, 16);
+      digits |= i > frac;
+      val->flags |= LIT_FLOAT;
+    }
+
+    if (!digits)
+      return false;
+
+    if (i < len && (s[i] | 0x20) == 'p') {
+      size_t exp = i + 1;
+      if (exp < len && (s[exp] == '+' || s[exp] == '-'))
+        ++exp;
+
+      i = skipDigits(s, exp, len, 10);
+      if (i == exp)
+        return false;
+      val->flags |= LIT_FLOAT;
+    } else if (val->flags & LIT_FLOAT)
+      return false; // Hexadecimal floats need an exponent
+
+    if (val->flags & LIT_FLOAT)
+      val->d = slowFloat(s, i);
+    else if (!decodeInt(s, 2, int_end, 16, val))
+      return false;
+
+    return decodeSuffix(s, i, len, val);
+  }
+
+  // Decimal or octal
+  uint64_t m = 0;  // Leading significant digits
+  int sig = 0;     // Number of them
+  int exp10 = 0;   // Power of ten that m is scaled by
+  bool exact = true;
+
+  size_t i = 0;
+  for (; i < len && s[i] >= '0' && s[i] <= '9'; ++i) {
+    if (sig < 19) {
+      m = m * 10 + (s[i] - '0');
+      sig += (m != 0);
+    } else {
+      ++exp10;
+      exact &= s[i] == '0';
+    }
+  }
+  size_t int_end = i;
+
+  if (i < len && s[i] == '.') {
+    val->flags |= LIT_FLOAT;
+    for (++i; i < len && s[i] >= '0' && s[i] <= '9'; ++i) {
+      if (sig < 19) {
+        m = m * 10 + (s[i] - '0');
+        sig += (m != 0);
+        --exp10;
+      } else
+        exact &= s[i] == '0';
+    }
+  }
+
+  if (i < len && (s[i] | 0x20) == 'e') {
+    size_t exp = i + 1;
+    bool neg = false;
+    if (exp < len && (s[exp] == '+' || s[exp] == '-'))
+      neg = s[exp++] == '-';
+
+    i = skipDigits(s, exp, len, 10);
+    if (i == exp)
+      return false;
+
+    int e = 0;
+    for (size_t k = exp; k < i; ++k)
+      e = (e < 100000) ? e * 10 + (s[k] - '0') : e;
+    exp10 += neg ? -e : e;
+    val->flags |= LIT_FLOAT;
+  }
+
+  if (!(val->flags & LIT_FLOAT)) {
+    // Decimal integers of up to 19 digits were already accumulated in m.
+    if (s[0] != '0' && exp10 == 0) {
+      val->u = m;
+      return decodeSuffix(s, i, len, val);
+    }
+
+    // A leading 0 makes the literal octal.
+    int base = (s[0] == '0') ? 8 : 10;
+    if (skipDigits(s, 0, int_end, base) != int_end)
+      return false;
+    if (!decodeInt(s, 0, int_end, base, val))
+      return false;
+
+    return decodeSuffix(s, i, len, val);
+  }
+
+  // At least one digit is needed around the point.
+  if (int_end == 0 && (len < 2 || s[1] < '0' || s[1] > '9'))
+    return false;
+
+  const uint64_t max_exact = (uint64_t)1 << 53;
+  if (exact && m <= max_exact && exp10 >= -22 && exp10 <= 22 + 15) {
+    double d = (double)m;
+    if (exp10 < 0)
+      val->d = d / pow10[-exp10];
+    else {
+      // Move powers beyond 10^22 into the mantissa while it stays exact.
+      for (; exp10 > 22 && m <= max_exact / 10; --exp10)
+        m *= 10;
+
+      val->d = (exp10 <= 22) ? (double)m * pow10[exp10] : slowFloat(s, i);
+    }
+  } else
+    val->d = slowFloat(s, i);
+
+  return decodeSuffix(s, i, len, val);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Kind and suffix of a numeric literal.
+typedef enum {
+  LIT_FLOAT = 1 << 0,    // Floating literal (has a '.' or an exponent)
+  LIT_UNSIGNED = 1 << 1, // u/U suffix
+  LIT_LONG = 1 << 2,     // l/L suffix
+  LIT_LONGLONG = 1 << 3, // ll/LL suffix
+  LIT_SINGLE = 1 << 4,   // f/F suffix
+} LitFlag;
+
+// Decoded value of a numeric literal.
+typedef struct {
+  union {
+    uint64_t u; // Integer literals
+    double d;   // Floating literals
+  };
+  uint8_t flags; // LitFlag bits
+} lit_value;
+
+bool lit_decode(const char *s, size_t len, lit_value *val);
@@ -0,0 +1,105 @@
+#include "scan.h"
+#include <stdbool.h>
+
+// Bytes checked one at a time before a vectorized scanner loads its first
+// vector (see SCAN_SHORT_RUN in scan_impl.h).
+#define SCAN_SHORT 8
+
+static inline bool isSpaceByte(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool isIdentByte(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+static inline bool isNumberByte(char c) {
+  return isIdentByte(c) || c == '.';
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SCAN_X86
+#include <immintrin.h>
+
+// SSE2 is part of x86-64, so these are the scanners every CPU starts with.
+#define SCAN_FN(name) name##Sse2
+#define SCAN_TARGET
+#define vec __m128i
+#define VEC_WIDTH 16
+#define VEC_FULL 0xFFFFu
+#define vec_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define vec_set1(c) _mm_set1_epi8(c)
+#define vec_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define vec_gt(a, b) _mm_cmpgt_epi8(a, b)
+#define vec_or(a, b) _mm_or_si128(a, b)
+#define vec_and(a, b) _mm_and_si128(a, b)
+#define vec_mask(v) ((unsigned)_mm_movemask_epi8(v))
+#include "scan_impl.h"
+#undef SCAN_FN
+#undef SCAN_TARGET
+#undef vec
+#undef VEC_WIDTH
+#undef VEC_FULL
+#undef vec_load
+#undef vec_set1
+#undef vec_eq
+#undef vec_gt
+#undef vec_or
+#undef vec_and
+#undef vec_mask
+
+// Picked by pickScanners() when the CPU has AVX2.
+#define SCAN_FN(name) name##Avx2
+#define SCAN_TARGET __attribute__((target("avx2")))
+#define vec __m256i
+#define VEC_WIDTH 32
+#define VEC_FULL 0xFFFFFFFFu
+#define vec_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define vec_set1(c) _mm256_set1_epi8(c)
+#define vec_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define vec_gt(a, b) _mm256_cmpgt_epi8(a, b)
+#define vec_or(a, b) _mm256_or_si256(a, b)
+#define vec_and(a, b) _mm256_and_si256(a, b)
+#define vec_mask(v) ((unsigned)_mm256_movemask_epi8(v))
+#include "scan_impl.h"
+#undef SCAN_FN
+#undef SCAN_TARGET
+
+#define SCAN_DEFAULT(name) name##Sse2
+#else
+#define SCAN_FN(name) name##Scalar
+#define SCAN_TARGET
+#include "scan_impl.h"
+#undef SCAN_FN
+#undef SCAN_TARGET
+
+#define SCAN_DEFAULT(name) name##Scalar
+#endif
+
+size_t (*scan_space)(const char *, size_t, size_t) = SCAN_DEFAULT(scanSpace);
+size_t (*scan_ident)(const char *, size_t, size_t) = SCAN_DEFAULT(scanIdent);
+size_t (*scan_number)(const char *, size_t, size_t) = SCAN_DEFAULT(scanNumber);
+size_t (*scan_until)(const char *, size_t, size_t,
+                     char) = SCAN_DEFAULT(scanUntil);
+size_t (*scan_until3)(const char *, size_t, size_t, char, char,
+                      char) = SCAN_DEFAULT(scanUntil3);
+size_t (*scan_pair)(const char *, size_t, size_t, char,
+                    char) = SCAN_DEFAULT(scanPair);
+
+#ifdef SCAN_X86
+// Runs before main(), and so before any thread can scan, to swap in the AVX2
+// scanners when the CPU has them.
+__attribute__((constructor)) static void pickScanners(void) {
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2"))
+    return;
+
+  scan_space = scanSpaceAvx2;
+  scan_ident = scanIdentAvx2;
+  scan_number = scanNumberAvx2;
+  scan_until = scanUntilAvx2;
+  scan_until3 = scanUntil3Avx2;
+  scan_pair = scanPairAvx2;
+}
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdlib.h>
+
+// Character-run scanners used by the lexer. Each function starts at index i of
+// the len-byte buffer s and returns the index of the first byte that ends the
+// run (or len if the run reaches the end of the buffer).
+//
+// On x86-64 the runs are checked 16 bytes at a time with SSE2, or 32 with
+// AVX2 on CPUs that have it, picked once at startup; a scalar loop covers the
+// first few bytes, the tail and other targets. They are function pointers for
+// that choice, but are called like functions.
+
+extern size_t (*scan_space)(const char *s, size_t i, size_t len);
+extern size_t (*scan_ident)(const char *s, size_t i, size_t len);
+// Numbers run over letters, digits, '_' and '.', like a preprocessing number
+// without the signs after an exponent.
+extern size_t (*scan_number)(const char *s, size_t i, size_t len);
+extern size_t (*scan_until)(const char *s, size_t i, size_t len, char c);
+extern size_t (*scan_until3)(const char *s, size_t i, size_t len, char a,
+                             char b, char c);
+
+// Returns the index of the first byte a that is directly followed by b, or len
+// if there is none.
+extern size_t (*scan_pair)(const char *s, size_t i, size_t len, char a, char b);
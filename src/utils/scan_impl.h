@@ -0,0 +1,150 @@
+// The scanners of scan.h for one instruction set. scan.c includes this once
+// for each, with SCAN_FN(name) naming its functions, SCAN_TARGET as their
+// target attribute, and vec, VEC_WIDTH, VEC_FULL and the vec_* operations
+// defined for its vectors, or VEC_WIDTH undefined for the scalar ones.
+
+#ifdef VEC_WIDTH
+// Sets every byte of v that lies in [lo, hi] to 0xFF. The comparisons are
+// signed, so bytes >= 0x80 never match an ASCII range.
+static inline SCAN_TARGET vec SCAN_FN(vecRange)(vec v, char lo, char hi) {
+  return vec_and(vec_gt(v, vec_set1(lo - 1)), vec_gt(vec_set1(hi + 1), v));
+}
+
+static inline SCAN_TARGET vec SCAN_FN(vecSpace)(vec v) {
+  return vec_or(vec_eq(v, vec_set1(' ')), SCAN_FN(vecRange)(v, '\t', '\r'));
+}
+
+static inline SCAN_TARGET vec SCAN_FN(vecIdent)(vec v) {
+  vec lower = vec_or(v, vec_set1(0x20));
+  return vec_or(vec_or(SCAN_FN(vecRange)(lower, 'a', 'z'),
+                       SCAN_FN(vecRange)(v, '0', '9')),
+                vec_eq(v, vec_set1('_')));
+}
+
+static inline SCAN_TARGET vec SCAN_FN(vecNumber)(vec v) {
+  return vec_or(SCAN_FN(vecIdent)(v), vec_eq(v, vec_set1('.')));
+}
+
+// Most runs of whitespace, names and numbers are only a few bytes long, and
+// end sooner checked a byte at a time than after a vector load. Returns from
+// the scanner if the run of bytes is_run holds for ends in the next
+// SCAN_SHORT bytes.
+#define SCAN_SHORT_RUN(is_run)                                                 \
+  for (size_t short_end = i + SCAN_SHORT < len ? i + SCAN_SHORT : len;       \
+       i < short_end; ++i)                                                     \
+    if (!is_run(s[i]))                                                         \
+      return i;
+#else
+#define SCAN_SHORT_RUN(is_run)
+#endif
+
+static SCAN_TARGET size_t SCAN_FN(scanSpace)(const char *s, size_t i,
+                                             size_t len) {
+  SCAN_SHORT_RUN(isSpaceByte)
+#ifdef VEC_WIDTH
+  for (; i + VEC_WIDTH <= len; i += VEC_WIDTH) {
+    unsigned stop = ~vec_mask(SCAN_FN(vecSpace)(vec_load(s + i))) & VEC_FULL;
+    if (stop)
+      return i + __builtin_ctz(stop);
+  }
+#endif
+
+  while (i < len && isSpaceByte(s[i]))
+    ++i;
+
+  return i;
+}
+
+static SCAN_TARGET size_t SCAN_FN(scanIdent)(const char *s, size_t i,
+                                             size_t len) {
+  SCAN_SHORT_RUN(isIdentByte)
+#ifdef VEC_WIDTH
+  for (; i + VEC_WIDTH <= len; i += VEC_WIDTH) {
+    unsigned stop = ~vec_mask(SCAN_FN(vecIdent)(vec_load(s + i))) & VEC_FULL;
+    if (stop)
+      return i + __builtin_ctz(stop);
+  }
+#endif
+
+  while (i < len && isIdentByte(s[i]))
+    ++i;
+
+  return i;
+}
+
+static SCAN_TARGET size_t SCAN_FN(scanNumber)(const char *s, size_t i,
+                                              size_t len) {
+  SCAN_SHORT_RUN(isNumberByte)
+#ifdef VEC_WIDTH
+  for (; i + VEC_WIDTH <= len; i += VEC_WIDTH) {
+    unsigned stop = ~vec_mask(SCAN_FN(vecNumber)(vec_load(s + i))) & VEC_FULL;
+    if (stop)
+      return i + __builtin_ctz(stop);
+  }
+#endif
+
+  while (i < len && isNumberByte(s[i]))
+    ++i;
+
+  return i;
+}
+
+#undef SCAN_SHORT_RUN
+
+static SCAN_TARGET size_t SCAN_FN(scanUntil)(const char *s, size_t i,
+                                             size_t len, char c) {
+#ifdef VEC_WIDTH
+  vec needle = vec_set1(c);
+  for (; i + VEC_WIDTH <= len; i += VEC_WIDTH) {
+    unsigned found = vec_mask(vec_eq(vec_load(s + i), needle));
+    if (found)
+      return i + __builtin_ctz(found);
+  }
+#endif
+
+  while (i < len && s[i] != c)
+    ++i;
+
+  return i;
+}
+
+static SCAN_TARGET size_t SCAN_FN(scanUntil3)(const char *s, size_t i,
+                                              size_t len, char a, char b,
+                                              char c) {
+#ifdef VEC_WIDTH
+  vec va = vec_set1(a), vb = vec_set1(b), vc = vec_set1(c);
+  for (; i + VEC_WIDTH <= len; i += VEC_WIDTH) {
+    vec v = vec_load(s + i);
+    unsigned found =
+        vec_mask(vec_or(vec_or(vec_eq(v, va), vec_eq(v, vb)), vec_eq(v, vc)));
+    if (found)
+      return i + __builtin_ctz(found);
+  }
+#endif
+
+  while (i < len && s[i] != a && s[i] != b && s[i] != c)
+    ++i;
+
+  return i;
+}
+
+static SCAN_TARGET size_t SCAN_FN(scanPair)(const char *s, size_t i,
+                                            size_t len, char a, char b) {
+#ifdef VEC_WIDTH
+  vec va = vec_set1(a), vb = vec_set1(b);
+  for (; i + VEC_WIDTH + 1 <= len; i += VEC_WIDTH) {
+    vec first = vec_eq(vec_load(s + i), va);
+    vec second = vec_eq(vec_load(s + i + 1), vb);
+    unsigned found = vec_mask(vec_and(first, second));
+    if (found)
+      return i + __builtin_ctz(found);
+  }
+#endif
+
+  for (; i + 1 < len; ++i) {
+    if (s[i] == a && s[i + 1] == b)
+      return i;
+  }
+
+  return len;
+}
@@ -1,12 +1,12 @@
 #include "str.h"
 
 char at(str string, size_t i) {
-  assert(i < string.len, "Index out of bounds");
+  debug_assert(i < string.len, "Index out of bounds");
   return string.chars[i];
 }
 
 char *dupl(str string, size_t start, size_t len) {
-  assert(start + len < string.len, "Index out of bounds");
+  assert(start + len <= string.len, "Index out of bounds");
   char *result = (char *)malloc(sizeof(char) * len + 1);
   assert(result != NULL, "Alloc failed");
 
@@ -15,6 +15,7 @@ char *dupl(str string, size_t start, size_t len) {
     result[i] = string.chars[start + i];
     ++i;
   }
+  result[len] = '\0';
 
   return result;
 }
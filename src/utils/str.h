@@ -8,5 +8,10 @@ typedef struct {
   char *chars;
 } str;
 
+// Source text is followed by at least this many zero bytes. The first one is
+// a sentinel that ends every token, so the lexer can look one byte past the
+// text without a bounds check.
+#define SRC_PADDING 64
+
 char at(str string, size_t i);
 char *dupl(str string, size_t start, size_t len);
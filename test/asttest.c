@@ -41,13 +41,19 @@ double eval_tree(ast_node *root) {
 }
 
 int main(void) {
+  arena_t arena;
+  arena_init(&arena, 1024);
+
   ast_node *root = create_binop(
-      create_binop(create_num(4, INT), create_num(3, INT), OP_PLUS),
-      create_num(2, INT), OP_TIMES);
+      &arena,
+      create_binop(&arena, create_num(&arena, 4, INT),
+                   create_num(&arena, 3, INT), OP_PLUS),
+      create_num(&arena, 2, INT), OP_TIMES);
 
   assert(eval_tree(root) == 14, "Incorrect calculation result");
 
   ast_destroy(root);
+  arena_destroy(&arena);
 
   printf("ALL TESTS PASSED.\n");
   return 0;
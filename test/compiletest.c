@@ -0,0 +1,681 @@
+#define _DEFAULT_SOURCE // mkstemp
+
+#include "../src/analysis.h"
+#include "../src/codegen.h"
+#include "../src/parser.h"
+#include "../src/preproc.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define assert(_e, _m)                                                         \
+  {                                                                            \
+    if (!(_e)) {                                                               \
+      fprintf(stderr, "%s\n", _m);                                             \
+      exit(EXIT_FAILURE);                                                      \
+    }                                                                          \
+  }
+
+#define THREADS 8
+#define ROUNDS 4 // Compilations per thread
+
+static tok_buf *toks;
+static char *expected;
+static char *outputs[THREADS];
+
+// Returns the LLVM IR generated for ast, analyzed in cc, followed by the
+// names of its symbols unless cc is lazy (lazily parsed locals are declared
+// after their function).
+static char *emit(compiler_t *cc, ast_node *ast) {
+  analyze(cc, ast);
+
+  FILE *out = tmpfile();
+  assert(out, "Could not create file");
+  generate_llvm(cc, ast, out);
+  for (size_t k = 0; !cc->lazy && k < cc->decls->len; ++k) {
+    Symbol *sym = (Symbol *)dyn_get(cc->decls, k);
+    fprintf(out, "%s\n", atom_name(&idents, sym->ident));
+  }
+
+  long len = ftell(out);
+  char *ir = malloc(len + 1);
+  rewind(out);
+  assert(fread(ir, 1, len, out) == (size_t)len, "Could not read output");
+  ir[len] = '\0';
+  fclose(out);
+  return ir;
+}
+
+// Compiles toks from scratch, parsing on jobs threads and leaving function
+// bodies to be parsed as they are needed if lazy is set, and returns what
+// emit() does for it.
+static char *compileWith(tok_buf *toks, size_t jobs, bool lazy) {
+  compiler_t cc;
+  compiler_init(&cc, toks->src, toks);
+  cc.lazy = lazy;
+  ast_node *ast = NULL;
+  parse_parallel(&cc, &ast, jobs);
+  char *ir = emit(&cc, ast);
+
+  ast_destroy(ast);
+  compiler_destroy(&cc);
+  return ir;
+}
+
+static char *compileOn(tok_buf *toks, size_t jobs) {
+  return compileWith(toks, jobs, false);
+}
+
+static char *compile(tok_buf *toks) { return compileOn(toks, 1); }
+
+// Compiles the file at path from tokens pulled from a lexer as the parser
+// needs them, and returns what emit() does for it.
+static char *compileStream(const char *path) {
+  FILE *fp = fopen(path, "r");
+  assert(fp, "Could not open file");
+  lexer_t *lex = lexer_open(fp, 4096);
+  tok_buf *toks = tok_init_stream(lex);
+  char *ir = compile(toks);
+
+  tok_destroy(toks);
+  lexer_close(lex);
+  fclose(fp);
+  return ir;
+}
+
+// Compiles the same tokens ROUNDS times, each with its own context, and
+// keeps the first output that differs from a serial compilation.
+static void *worker(void *arg) {
+  size_t t = (size_t)arg;
+  for (int r = 0; r < ROUNDS; ++r) {
+    char *ir = compile(toks);
+    if (!outputs[t] && strcmp(ir, expected))
+      outputs[t] = ir;
+    else
+      free(ir);
+  }
+
+  return NULL;
+}
+
+// Returns the tokens of the file at path, preprocessed.
+static tok_buf *preprocessFile(const char *path) {
+  preproc_t pp;
+  pp_init(&pp, NULL, 0, 1);
+  tok_buf *toks = tok_init(0);
+  assert(preprocess(&pp, path, toks), "Could not preprocess");
+  pp_destroy(&pp);
+  return toks;
+}
+
+// Declarations end with their scope and hide the ones of enclosing scopes,
+// however many names and scopes there are.
+static void testScopes(void) {
+  compiler_t cc;
+  compiler_init(&cc, (str){0}, NULL);
+  uint32_t x = intern(&idents, "x", 1);
+
+  Symbol *outer = sym_declare(&cc, x, INT);
+  assert(sym_lookup(&cc, x) == outer, "Declaration not found");
+
+  scope_enter(&cc);
+  Symbol *inner = sym_declare(&cc, x, FLOAT);
+  assert(sym_lookup(&cc, x) == inner, "Declaration not shadowed");
+  scope_exit(&cc);
+  assert(sym_lookup(&cc, x) == outer, "Shadowing outlived its scope");
+
+  // A sibling scope at the same depth doesn't see the closed one's names.
+  scope_enter(&cc);
+  uint32_t y = intern(&idents, "y", 1);
+  assert(!sym_lookup(&cc, y), "Undeclared name found");
+  sym_declare(&cc, y, INT);
+  scope_exit(&cc);
+  scope_enter(&cc);
+  assert(!sym_lookup(&cc, y), "Name from a closed scope found");
+  scope_exit(&cc);
+
+  // Enough names and depth to grow the table and the scope stack.
+  char name[16];
+  for (int d = 0; d < 100; ++d) {
+    scope_enter(&cc);
+    for (int n = 0; n < 10; ++n) {
+      size_t len = (size_t)sprintf(name, "v%d_%d", d, n);
+      sym_declare(&cc, intern(&idents, name, len), INT);
+    }
+    sym_declare(&cc, x, INT);
+  }
+  for (int d = 99; d >= 0; --d) {
+    size_t len = (size_t)sprintf(name, "v%d_%d", d, 9);
+    Symbol *sym = sym_lookup(&cc, intern_find(&idents, name, len));
+    assert(sym && sym->depth == (uint32_t)d + 1, "Declaration lost");
+    scope_exit(&cc);
+    assert(!sym_lookup(&cc, intern_find(&idents, name, len)),
+           "Declaration outlived its scope");
+  }
+  assert(sym_lookup(&cc, x) == outer, "Outer declaration lost");
+
+  compiler_destroy(&cc);
+}
+
+// Compiles src and returns the LLVM IR generated for it.
+static char *compileSource(const char *src) {
+  char path[] = "/tmp/compiletestXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0, "Could not create file");
+  assert(write(fd, src, strlen(src)) == (ssize_t)strlen(src),
+         "Could not write file");
+  close(fd);
+
+  tok_buf *toks = preprocessFile(path);
+  char *ir = compile(toks);
+  tok_destroy(toks);
+  remove(path);
+  return ir;
+}
+
+// A name read after an inner scope that shadowed it refers to the outer
+// declaration again.
+static void testShadowing(void) {
+  char *ir = compileSource("int main() {\n"
+                           "  int x = 1;\n"
+                           "  int y = x;\n"
+                           "  {\n"
+                           "    int x = 2;\n"
+                           "    y = x;\n"
+                           "  }\n"
+                           "  return x;\n"
+                           "}\n");
+  assert(strstr(ir, "store i32 2, ptr %5") &&
+             strstr(ir, "load i32, ptr %5") &&
+             strstr(ir, "%7 = load i32, ptr %2"),
+         "Shadowed name resolved to the wrong declaration");
+  free(ir);
+}
+
+// Binary operators group by precedence, and from the left within one.
+static void testPrecedence(void) {
+  char *ir = compileSource("int main() {\n"
+                           "  return 20 - 4 - 2 * 3 + 8 / 2 / 2 +\n"
+                           "         (1 + 2 < 4 == 1) * 100 - -1;\n"
+                           "}\n");
+  assert(strstr(ir, "ret i32 113"), "Expression grouped incorrectly");
+  free(ir);
+}
+
+#define DEPTH 100001 // Levels of nesting in testDeepNesting
+
+// Blocks and expressions nested far deeper than recursion on the C stack
+// would allow are parsed, analyzed and generated, also from a stream, whose
+// work stack starts smaller than they need.
+static void testDeepNesting(void) {
+  size_t cap = (size_t)DEPTH * 16 + 256, len = 0;
+  char *src = malloc(cap);
+  len += snprintf(src + len, cap - len, "int main() {\n  int a = 1;\n");
+
+  // -(-(...-(1)...)) is folded, a + (a + (...a...)) is generated
+  len += snprintf(src + len, cap - len, "  int b = ");
+  for (int d = 0; d < DEPTH; ++d)
+    len += snprintf(src + len, cap - len, "-(");
+  len += snprintf(src + len, cap - len, "1");
+  for (int d = 0; d < DEPTH; ++d)
+    src[len++] = ')';
+  len += snprintf(src + len, cap - len, ";\n  ");
+
+  for (int d = 0; d < DEPTH; ++d)
+    src[len++] = '{';
+  len += snprintf(src + len, cap - len, " a = ");
+  for (int d = 0; d < DEPTH; ++d)
+    len += snprintf(src + len, cap - len, "a + (");
+  len += snprintf(src + len, cap - len, "b");
+  for (int d = 0; d < DEPTH; ++d)
+    src[len++] = ')';
+  src[len++] = ';';
+  for (int d = 0; d < DEPTH; ++d)
+    src[len++] = '}';
+  len += snprintf(src + len, cap - len, "\n  return a;\n}\n");
+
+  char *ir = compileSource(src);
+  char last[64];
+  snprintf(last, sizeof(last), "%%%d = add nsw i32 %%%d, %%%d\n",
+           2 * DEPTH + 4, 2 * DEPTH + 2, 2 * DEPTH + 3);
+  assert(strstr(ir, "store i32 -1, ptr %3"), "Nested negation misfolded");
+  assert(strstr(ir, last), "Nested expression generated incorrectly");
+
+  char path[] = "/tmp/compiletestXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0 && write(fd, src, len) == (ssize_t)len,
+         "Could not write file");
+  close(fd);
+
+  char *streamed = compileStream(path);
+  assert(!strcmp(ir, streamed), "Streamed nesting compiled differently");
+
+  free(streamed);
+  free(ir);
+  free(src);
+  remove(path);
+}
+
+// Parsing the functions of a program on several threads gives the same
+// result as parsing them on one, and bodies can call functions declared
+// after them.
+static void testParallel(void) {
+  size_t cap = 1 << 20, len = 0;
+  char *src = malloc(cap);
+  len += sprintf(src + len, "int f0(int a) { return f1(a) - 1; }\n");
+  for (int f = 1; f < 1000; ++f)
+    len += sprintf(src + len,
+                   "int f%d(int a) {\n"
+                   "  int b = a * %d;\n"
+                   "  while (b > 10) {\n"
+                   "    int a = b - f%d(b);\n"
+                   "    b = a / 2;\n"
+                   "  }\n"
+                   "  return b + f%d(a);\n"
+                   "}\n",
+                   f, f, f - 1, f / 2);
+  assert(len < cap, "Program too large");
+
+  char path[] = "/tmp/compiletestXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0 && write(fd, src, len) == (ssize_t)len,
+         "Could not write file");
+  close(fd);
+  free(src);
+
+  tok_buf *toks = preprocessFile(path);
+  char *serial = compile(toks);
+  assert(strstr(serial, "define i32 @f999"), "Functions missing");
+  for (size_t jobs = 2; jobs <= 16; jobs *= 2) {
+    char *ir = compileOn(toks, jobs);
+    assert(!strcmp(ir, serial), "Parallel parse differs");
+    free(ir);
+  }
+
+  free(serial);
+  tok_destroy(toks);
+  remove(path);
+}
+
+// A streamed program has no token count to size its arena by up front, so
+// one larger than the arena starts with is compiled as it is from a buffer.
+static void testStreamGrowth(void) {
+  size_t cap = 1 << 21, len = 0;
+  char *src = malloc(cap);
+  for (int f = 0; f < 20000; ++f)
+    len += sprintf(src + len, "int f%d(int a) { return a * %d + 1; }\n", f,
+                   f);
+  assert(len < cap, "Program too large");
+
+  char path[] = "/tmp/compiletestXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0 && write(fd, src, len) == (ssize_t)len,
+         "Could not write file");
+  close(fd);
+  free(src);
+
+  tok_buf *toks = preprocessFile(path);
+  char *buffered = compile(toks);
+  char *streamed = compileStream(path);
+  assert(!strcmp(buffered, streamed), "Streamed compilation differs");
+
+  free(buffered);
+  free(streamed);
+  tok_destroy(toks);
+  remove(path);
+}
+
+// Parses toks serially, as when the scan for functions fails, and returns
+// what emit() does for it.
+static char *compileSerial(tok_buf *toks) {
+  compiler_t cc;
+  compiler_init(&cc, toks->src, toks);
+  ast_node *ast = try_parse_prgm(&cc);
+  assert(!cc.ndiags, "Serial parse failed");
+  char *ir = emit(&cc, ast);
+
+  ast_destroy(ast);
+  compiler_destroy(&cc);
+  return ir;
+}
+
+// Returns the number of errors parsing toks on jobs threads reports, all of
+// which must be msg.
+static size_t parseErrors(tok_buf *toks, size_t jobs, const char *msg) {
+  compiler_t cc;
+  compiler_init(&cc, toks->src, toks);
+  ast_node *ast = NULL;
+  parse_parallel(&cc, &ast, jobs);
+
+  size_t n = cc.ndiags;
+  for (size_t k = 0; k < n; ++k)
+    assert(!strcmp(cc.diags[k].msg, msg), "Wrong error reported");
+
+  ast_destroy(ast);
+  compiler_destroy(&cc);
+  return n;
+}
+
+// A body can call a function declared after it, with the type it returns,
+// whether the functions are found by a scan first, parsed one after another
+// or streamed. A stray token that stops the scan is the only error, and a
+// function used as a variable is reported however it is parsed.
+static void testForwardCalls(void) {
+  const char *src = "int main() {\n"
+                    "  int a = 2;\n"
+                    "  float b = half(a) + twice(a) * 2;\n"
+                    "  if (half(a) > 0.5) { a = twice(a); }\n"
+                    "  return a + b;\n"
+                    "}\n"
+                    "float half(int a) { return a / 2.0; }\n"
+                    "int twice(int a) {\n"
+                    "  if (a > 100) { return a; }\n"
+                    "  return twice(a * 2);\n"
+                    "}\n";
+
+  // Put in front of src, and the error each gives
+  const char *before[] = {"", ";\n", "int g() { return half + 1; }\n"};
+  const char *error[] = {NULL, "Expected type", "Undeclared identifier 'half'"};
+
+  char path[] = "/tmp/compiletestXXXXXX";
+  for (int k = 0; k < 3; ++k) {
+    int fd = mkstemp(path);
+    assert(fd >= 0 &&
+               write(fd, before[k], strlen(before[k])) ==
+                   (ssize_t)strlen(before[k]) &&
+               write(fd, src, strlen(src)) == (ssize_t)strlen(src),
+           "Could not write file");
+    close(fd);
+    tok_buf *toks = preprocessFile(path);
+
+    if (!error[k]) {
+      char *scanned = compile(toks);
+      char *serial = compileSerial(toks);
+      char *streamed = compileStream(path);
+      assert(strstr(scanned, "call float @half") &&
+                 !strcmp(scanned, serial) && !strcmp(scanned, streamed),
+             "Forward calls compiled differently");
+      free(scanned);
+      free(serial);
+      free(streamed);
+    } else {
+      FILE *fp = fopen(path, "r");
+      lexer_t *lex = lexer_open(fp, 4096);
+      tok_buf *stream = tok_init_stream(lex);
+      assert(parseErrors(toks, 1, error[k]) == 1 &&
+                 parseErrors(toks, 4, error[k]) == 1 &&
+                 parseErrors(stream, 1, error[k]) == 1,
+             "Forward calls reported");
+      tok_destroy(stream);
+      lexer_close(lex);
+      fclose(fp);
+    }
+
+    tok_destroy(toks);
+    remove(path);
+    strcpy(path, "/tmp/compiletestXXXXXX");
+  }
+}
+
+// Lazily parsed functions have their signatures but not their bodies until
+// asked for one, and generate the same IR once they are all parsed.
+static void testLazy(void) {
+  const char *src = "int twice(int a) { return a * 2; }\n"
+                    "float half(float a, int b) {\n"
+                    "  if (b > 0) { int c = b; return a / c; }\n"
+                    "  return a / 2.0;\n"
+                    "}\n"
+                    "int main() { int x = 4; return twice(x) + half(x, 1); }\n";
+  char path[] = "/tmp/compiletestXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0 && write(fd, src, strlen(src)) == (ssize_t)strlen(src),
+         "Could not write file");
+  close(fd);
+  tok_buf *toks = preprocessFile(path);
+
+  compiler_t cc;
+  compiler_init(&cc, toks->src, toks);
+  cc.lazy = true;
+  ast_node *ast = NULL;
+  parse(&cc, &ast);
+
+  dyn_array *funcs = ast->ast_prgm.func_decls;
+  assert(funcs->len == 3, "Functions missing");
+  ast_node *half = dyn_get(funcs, 1);
+  assert(half->ast_func_decl.params->len == 2 && half->value == FLOAT,
+         "Signature not parsed");
+  for (size_t f = 0; f < funcs->len; ++f)
+    assert(!((ast_node *)dyn_get(funcs, f))->ast_func_decl.scope,
+           "Body parsed eagerly");
+
+  ast_node *body = func_body(&cc, half);
+  assert(body && body->ast_stmt.scope.stmts->len == 2 &&
+             func_body(&cc, half) == body,
+         "Body not parsed on demand");
+  assert(!((ast_node *)dyn_get(funcs, 0))->ast_func_decl.scope,
+         "Other bodies parsed");
+
+  ast_destroy(ast);
+  compiler_destroy(&cc);
+
+  char *eager = compileWith(toks, 1, false);
+  char *lazy = compileWith(toks, 1, true);
+  char *both = compileWith(toks, 2, true);
+  assert(strstr(lazy, "define float @half") &&
+             !strncmp(eager, lazy, strlen(lazy)) && !strcmp(lazy, both),
+         "Lazy parse differs");
+
+  free(eager);
+  free(lazy);
+  free(both);
+  tok_destroy(toks);
+  remove(path);
+}
+
+// Replaces the first find in the len bytes of text with repl, lexing again
+// only what changed, and returns the tokens that were replaced.
+static tok_splice editText(char *text, size_t *len, tok_buf *toks,
+                           const char *find, const char *repl) {
+  char *at = strstr(text, find);
+  assert(at, "Text to edit not found");
+
+  size_t offset = at - text, removed = strlen(find), inserted = strlen(repl);
+  memmove(at + inserted, at + removed, *len - offset - removed);
+  memcpy(at, repl, inserted);
+  *len = *len - removed + inserted;
+  memset(text + *len, 0, SRC_PADDING);
+
+  return tokenize_edit((str){.chars = text, .len = *len}, toks, *len,
+                       (text_edit){.offset = offset,
+                                   .removed = removed,
+                                   .inserted = inserted});
+}
+
+// Returns the index of the function named name in the program ast, which
+// must have one.
+static ast_node *findFunc(ast_node *ast, const char *name) {
+  uint32_t ident = intern_find(&idents, name, strlen(name));
+  dyn_array *funcs = ast->ast_prgm.func_decls;
+  for (size_t f = 0; f < funcs->len; ++f)
+    if (((ast_node *)dyn_get(funcs, f))->ast_func_decl.ident == ident)
+      return dyn_get(funcs, f);
+
+  assert(false, "Function missing");
+  return NULL;
+}
+
+// Reparses after each edit keep the functions the edit didn't touch, or that
+// it left with the same tokens, and generate what compiling the edited text
+// from scratch does.
+static void testReparse(void) {
+  size_t cap = 1 << 16, len = 0;
+  char *text = calloc(cap + SRC_PADDING, 1);
+  for (int f = 0; f < 40; ++f)
+    len += sprintf(text + len,
+                   "int f%d(int a) {\n"
+                   "  int b = a * %d;\n"
+                   "  while (b > 10) { b = b - f%d(a); }\n"
+                   "  return b + f%d(b);\n"
+                   "}\n",
+                   f, f, f ? f - 1 : 0, f / 2);
+
+  tok_buf *toks = tok_init(0);
+  tokenize((str){.chars = text, .len = len}, toks, len);
+  compiler_t cc;
+  compiler_init(&cc, toks->src, toks);
+  ast_node *ast = NULL;
+  parse_parallel(&cc, &ast, 2);
+  free(emit(&cc, ast));
+
+  struct {
+    const char *find, *repl;
+    const char *changed; // Function that must be parsed again, if any
+    bool kept;           // Whether the others must be kept
+  } edits[] = {
+      {"a * 17;", "a * 71;", "f17", true},
+      {"a * 71;", "a *  72 ;", "f17", true},
+      {"int b = a * 5;", "int b = a /* five */ * 5;", NULL, true},
+      {"int f20(", "int g(int a) { return a + f3(a); }\nint f20(", "g", true},
+      {"f18(a); }\n  return b + f9", "f18(a); }\n  return b - f9", "f19",
+       true},
+      {"int g(int a) { return a + f3(a); }\n", "", NULL, false},
+      {"int f30(", "float f30(", NULL, false},
+  };
+
+  // A function kept by a reparse is still analyzed, as its nodes are, while
+  // a rebuilt one is yet to be.
+  for (size_t e = 0; e < sizeof(edits) / sizeof(edits[0]); ++e) {
+    size_t workers = cc.nworkers;
+    tok_splice splice =
+        editText(text, &len, toks, edits[e].find, edits[e].repl);
+    reparse(&cc, &ast, splice);
+
+    ast_node *changed =
+        edits[e].changed ? findFunc(ast, edits[e].changed) : NULL;
+    for (size_t f = 0; f < ast->ast_prgm.func_decls->len; ++f) {
+      ast_node *func = dyn_get(ast->ast_prgm.func_decls, f);
+      bool kept = func->ast_func_decl.analyzed;
+      assert(func == changed ? !kept : kept == edits[e].kept,
+             "Function rebuilt or kept wrongly");
+    }
+    assert(!edits[e].kept || cc.nworkers <= workers + 1,
+           "Workers of replaced functions kept");
+
+    char *ir = emit(&cc, ast);
+    tok_buf *fresh = tok_init(0);
+    tokenize((str){.chars = text, .len = len}, fresh, len);
+    char *expected = compile(fresh);
+    assert(!strcmp(ir, expected), "Reparse differs from a compilation");
+
+    free(ir);
+    free(expected);
+    tok_destroy(fresh);
+  }
+
+  ast_destroy(ast);
+  compiler_destroy(&cc);
+  tok_destroy(toks);
+  free(text);
+}
+
+// A program with errors in it is parsed to its end, each error reported
+// once and in source order, and the functions without any are kept. Empty
+// blocks don't end the block around them. It is reported the same however
+// many threads parse it.
+static void testRecovery(void) {
+  const char *src = "int f(int a) {\n"
+                    "  int b = a + );\n"
+                    "  int c = 2 @ 3;\n"
+                    "  if (a > 1) { }\n"
+                    "  { }\n"
+                    "  x = b + c;\n"
+                    "  return x + x;\n"
+                    "}\n"
+                    "int g(int a {\n"
+                    "  return a;\n"
+                    "}\n"
+                    "int h(int a) {\n"
+                    "  while (a > 1 { a = a - 1; }\n"
+                    "  return f(a);\n"
+                    "}\n"
+                    "int k(int a) { return h(a) + 1; }\n";
+  const char *msgs[] = {"Expected factor expression",
+                        "Unrecognized token @", "Undeclared identifier 'x'",
+                        "Expected ')'", "Expected ')'"};
+  size_t lines[] = {2, 3, 6, 9, 13};
+
+  char path[] = "/tmp/compiletestXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0 && write(fd, src, strlen(src)) == (ssize_t)strlen(src),
+         "Could not write file");
+  close(fd);
+  tok_buf *toks = preprocessFile(path);
+
+  for (size_t jobs = 1; jobs <= 4; jobs *= 4) {
+    compiler_t cc;
+    compiler_init(&cc, toks->src, toks);
+    ast_node *ast = NULL;
+    parse_parallel(&cc, &ast, jobs);
+
+    assert(cc.ndiags == 5, "Errors missed or reported twice");
+    for (size_t k = 0; k < cc.ndiags; ++k)
+      assert(!strcmp(cc.diags[k].msg, msgs[k]) &&
+                 cc.diags[k].loc.line == lines[k],
+             "Error reported wrongly");
+
+    assert(ast->ast_prgm.func_decls->len == 3 && findFunc(ast, "k"),
+           "Functions after an error lost");
+    ast_node *body = func_body(&cc, findFunc(ast, "f"));
+    assert(body->ast_stmt.scope.stmts->len == 4,
+           "Statements after an error or empty block lost");
+
+    ast_destroy(ast);
+    compiler_destroy(&cc);
+  }
+
+  tok_destroy(toks);
+  remove(path);
+}
+
+int main(void) {
+  lex_init();
+  testScopes();
+  testShadowing();
+  testPrecedence();
+  testDeepNesting();
+  testParallel();
+  testStreamGrowth();
+  testForwardCalls();
+  testLazy();
+  testReparse();
+  testRecovery();
+
+  toks = preprocessFile("simpletest.c");
+
+  // Two compilations in a row generate the same IR: nothing is left over
+  // from the first.
+  expected = compile(toks);
+  char *again = compile(toks);
+  assert(strlen(expected) > 0, "No IR generated");
+  assert(!strcmp(expected, again), "Second compilation differs");
+  free(again);
+
+  // Compilations running side by side on the same tokens don't disturb one
+  // another.
+  pthread_t threads[THREADS];
+  for (size_t t = 0; t < THREADS; ++t)
+    pthread_create(&threads[t], NULL, worker, (void *)t);
+  for (size_t t = 0; t < THREADS; ++t)
+    pthread_join(threads[t], NULL);
+
+  for (size_t t = 0; t < THREADS; ++t)
+    assert(!outputs[t], "Concurrent compilation differs");
+
+  free(expected);
+  tok_destroy(toks);
+  pp_cache_destroy(&sources);
+  intern_destroy(&idents);
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "../src/utils/intern.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NAMES (1 << 16) // Distinct identifiers
+#define LOOKUPS (1 << 22) // Names interned per run, split between threads
+#define RUNS 3
+
+static char spellings[NAMES][16];
+static size_t lens[NAMES];
+
+static interner_t names;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool locked;
+static size_t share; // Names each thread interns
+
+static double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Interns a share of LOOKUPS names in a scattered order, as lexers would
+// for identifiers that are mostly already known. Under a single lock when
+// locked is set, to compare with one shared mutex.
+static void *worker(void *arg) {
+  uint64_t x = 0x9E3779B97F4A7C15ull * ((size_t)arg + 1);
+  for (size_t k = 0; k < share; ++k) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    size_t n = x % NAMES;
+
+    if (locked)
+      pthread_mutex_lock(&lock);
+    intern(&names, spellings[n], lens[n]);
+    if (locked)
+      pthread_mutex_unlock(&lock);
+  }
+
+  return NULL;
+}
+
+// Returns the best time over RUNS to intern LOOKUPS names on jobs threads,
+// starting from an empty interner each time.
+static double run(size_t jobs) {
+  double best = 0;
+  for (int r = 0; r < RUNS; ++r) {
+    intern_init(&names, 16);
+    pthread_t threads[64];
+
+    share = LOOKUPS / jobs;
+    double start = now();
+    for (size_t t = 0; t < jobs; ++t)
+      pthread_create(&threads[t], NULL, worker, (void *)t);
+    for (size_t t = 0; t < jobs; ++t)
+      pthread_join(threads[t], NULL);
+    double elapsed = now() - start;
+
+    if (r == 0 || elapsed < best)
+      best = elapsed;
+    intern_destroy(&names);
+  }
+
+  return best;
+}
+
+// Measures interning throughput on 1, 2, 4, ... threads up to the number of
+// cores (or the count given), lock-free and behind one mutex.
+int main(int argc, char *argv[]) {
+  size_t cores = (argc > 1) ? (size_t)atol(argv[1])
+                            : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1 || cores > 64)
+    cores = 1;
+
+  for (size_t n = 0; n < NAMES; ++n)
+    lens[n] = (size_t)snprintf(spellings[n], sizeof(spellings[n]), "id_%zx",
+                               n * 2654435761u);
+
+  printf("internbench: %d names, %d interned per run, %zu cores\n", NAMES,
+         LOOKUPS, cores);
+  double base = 0;
+  for (size_t jobs = 1;; jobs *= 2) {
+    if (jobs > cores)
+      jobs = cores;
+
+    locked = false;
+    double free = run(jobs);
+    locked = true;
+    double mutex = run(jobs);
+    if (jobs == 1)
+      base = free;
+
+    printf("  %2zu threads: lock-free %.4f s (%.1f Mlookups/s, %.1fx), "
+           "one mutex %.4f s\n",
+           jobs, free, LOOKUPS / free / 1e6, base / free, mutex);
+    if (jobs == cores)
+      break;
+  }
+
+  return 0;
+}
@@ -0,0 +1,97 @@
+#include "../src/utils/intern.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define assert(_e, _m)                                                         \
+  {                                                                            \
+    if (!(_e)) {                                                               \
+      fprintf(stderr, "%s\n", _m);                                             \
+      exit(EXIT_FAILURE);                                                      \
+    }                                                                          \
+  }
+
+#define THREADS 8
+#define NAMES 100000 // Distinct names, interned by every thread
+
+static interner_t names;
+static interner_t other;
+static uint32_t atoms[THREADS][NAMES];
+
+static size_t spell(char *buf, size_t n) {
+  return (size_t)sprintf(buf, "name_%zu", n);
+}
+
+// Interns every name, starting at a different one in each thread so that
+// threads race to add the same names while the table grows under them, and
+// interns into a second interner now and then.
+static void *worker(void *arg) {
+  size_t t = (size_t)arg;
+  char buf[32];
+  for (size_t k = 0; k < NAMES; ++k) {
+    size_t n = (k + t * NAMES / THREADS) % NAMES;
+    size_t len = spell(buf, n);
+    atoms[t][n] = intern(&names, buf, len);
+
+    if (k % 64 == 0)
+      intern(&other, buf, len);
+
+    // A name found again is the one just added.
+    size_t m = (n * 7919) % NAMES;
+    len = spell(buf, m);
+    uint32_t found = intern_find(&names, buf, len);
+    assert(found == NO_ATOM || found == intern(&names, buf, len),
+           "Lookup found another atom");
+  }
+
+  return NULL;
+}
+
+int main(void) {
+  // Start small so the table is copied many times while threads insert.
+  intern_init(&names, 1);
+  intern_init(&other, 1);
+
+  pthread_t threads[THREADS];
+  for (size_t t = 0; t < THREADS; ++t)
+    pthread_create(&threads[t], NULL, worker, (void *)t);
+  for (size_t t = 0; t < THREADS; ++t)
+    pthread_join(threads[t], NULL);
+
+  // Every thread got the same atom for a name, no two names share one, and
+  // the atom spells its name.
+  char buf[32];
+  static bool used[NAMES * 2];
+  for (size_t n = 0; n < NAMES; ++n) {
+    uint32_t atom = atoms[0][n];
+    for (size_t t = 1; t < THREADS; ++t)
+      assert(atoms[t][n] == atom, "Threads got different atoms for a name");
+
+    assert(atom != NO_ATOM && atom < names.len && !used[atom],
+           "Atom handed out twice");
+    used[atom] = true;
+
+    size_t len = spell(buf, n);
+    assert(atom_str(&names, atom).len == len &&
+               !strcmp(atom_name(&names, atom), buf),
+           "Incorrect atom text");
+    assert(intern_find(&names, buf, len) == atom, "Name not found");
+  }
+
+  // Atoms lost in a race still name their string, and few are lost.
+  for (uint32_t atom = 1; atom < names.len; ++atom)
+    assert(intern_find(&names, atom_name(&names, atom),
+                       atom_str(&names, atom).len) != NO_ATOM,
+           "Atom names no interned string");
+  assert(names.len - 1 < NAMES + NAMES / 100, "Too many atoms lost");
+
+  assert(intern_find(&names, "missing", 7) == NO_ATOM, "Missing name found");
+  assert(intern_find(&names, "", 0) == NO_ATOM, "Empty string found");
+  assert(!strcmp(atom_name(&names, NO_ATOM), ""), "NO_ATOM is not empty");
+
+  intern_destroy(&names);
+  intern_destroy(&other);
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
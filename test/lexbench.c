@@ -0,0 +1,126 @@
+#include "../src/tokens.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS 5
+
+static double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define SYNTHETIC "--synthetic" // Names the generated input
+#define CORPUS_FUNCS 2000        // Functions in it
+
+// Writes the generated input to src, which has room for cap bytes, and
+// returns its length: indented functions with line and block comments and
+// long identifiers, where most of the bytes are in runs the scanners skip.
+static size_t generate(char *src, size_t cap) {
+  size_t len = 0;
+  for (int f = 0; f < CORPUS_FUNCS; ++f)
+    len += snprintf(
+        src + len, cap - len,
+        "// Adds up the weighted contribution of every neighbouring sample\n"
+        "// of block %d, skipping samples below the noise threshold.\n"
+        "double accumulate_weighted_contribution_%d(double *sample_values,\n"
+        "                                          int sample_count) {\n"
+        "  double running_weighted_total = 0.0;\n"
+        "  /* Samples are visited in the order the caller sorted them,\n"
+        "     so the total is the same on every run. */\n"
+        "  for (int sample_index = 0; sample_index < sample_count;\n"
+        "       ++sample_index) {\n"
+        "    if (sample_values[sample_index] > %d.5e-3) {\n"
+        "      running_weighted_total =\n"
+        "          running_weighted_total + sample_values[sample_index] * %d;\n"
+        "    }\n"
+        "  }\n"
+        "  return running_weighted_total;\n"
+        "}\n\n",
+        f, f, f % 100, f % 97 + 1);
+
+  return len;
+}
+
+// Lexes the given file, or the generated input if it is SYNTHETIC,
+// repeated until the input is at least the requested number of megabytes, on
+// the given number of threads and reports the best throughput over RUNS runs.
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "Fmt: ./lexbench <file | " SYNTHETIC "> [min MB] [threads]\n");
+    return EXIT_FAILURE;
+  }
+
+  size_t fsize;
+  char *unit;
+  if (!strcmp(argv[1], SYNTHETIC)) {
+    size_t cap = (size_t)CORPUS_FUNCS * 1024;
+    unit = (char *)malloc(cap);
+    if (!unit) {
+      fprintf(stderr, "Could not allocate input\n");
+      return EXIT_FAILURE;
+    }
+    fsize = generate(unit, cap);
+
+  } else {
+    FILE *fp = fopen(argv[1], "r");
+    if (!fp) {
+      fprintf(stderr, "Could not open file\n");
+      return EXIT_FAILURE;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    fsize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    unit = (char *)malloc(fsize);
+    if (!unit || fread(unit, 1, fsize, fp) != fsize) {
+      fprintf(stderr, "Could not read file into buffer\n");
+      return EXIT_FAILURE;
+    }
+    fclose(fp);
+  }
+
+  size_t target = (argc > 2) ? (size_t)atol(argv[2]) * 1024 * 1024 : fsize;
+  size_t jobs = (argc > 3) ? (size_t)atol(argv[3]) : 1;
+  size_t copies = (target + fsize - 1) / fsize;
+  size_t len = copies * (fsize + 1);
+
+  char *buf = (char *)calloc(len + SRC_PADDING, 1);
+  if (!buf) {
+    fprintf(stderr, "Could not allocate input\n");
+    return EXIT_FAILURE;
+  }
+
+  for (size_t c = 0; c < copies; ++c) {
+    memcpy(buf + c * (fsize + 1), unit, fsize);
+    buf[c * (fsize + 1) + fsize] = '\n';
+  }
+  buf[len] = '\0';
+  free(unit);
+
+  double best = 0;
+  size_t ntoks = 0;
+  for (int r = 0; r < RUNS; ++r) {
+    tok_buf *toks = tok_init(len / 4);
+
+    double start = now();
+    tokenize_parallel((str){.len = len, .chars = buf}, toks, len, jobs);
+    double elapsed = now() - start;
+
+    if (r == 0 || elapsed < best)
+      best = elapsed;
+    ntoks = toks->len;
+
+    tok_destroy(toks);
+  }
+
+  double mb = len / (1024.0 * 1024.0);
+  printf("%s: %.1f MB, %lu threads, %lu tokens, %.4f s, %.1f MB/s\n", argv[1],
+         mb, jobs, ntoks, best, mb / best);
+
+  free(buf);
+  return 0;
+}
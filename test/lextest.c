@@ -0,0 +1,451 @@
+#define _DEFAULT_SOURCE // mkstemp, fdopen
+#include "../src/tokens.h"
+#include "../src/utils/file.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define assert(_e, _m)                                                         \
+  {                                                                            \
+    if (!(_e)) {                                                               \
+      fprintf(stderr, "%s\n", _m);                                             \
+      exit(EXIT_FAILURE);                                                      \
+    }                                                                          \
+  }
+
+#define CHUNKMESH "test/chunkmesh.c"
+
+static char *readStream(FILE *fp, size_t *len) {
+  fseek(fp, 0, SEEK_END);
+  *len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  char *buf = (char *)malloc(*len + 1);
+  assert(fread(buf, 1, *len, fp) == *len, "Could not read file");
+  buf[*len] = '\0';
+
+  return buf;
+}
+
+static char *readFile(const char *path, size_t *len) {
+  FILE *fp = fopen(path, "r");
+  assert(fp, "Could not open file");
+
+  char *buf = readStream(fp, len);
+  fclose(fp);
+  return buf;
+}
+
+// Lexes a keyword and a name, as the first thing a thread does.
+static void *lexFirst(void *arg) {
+  Token tok;
+  lit_value num;
+  bool ok = lex_single("while", 5, &tok, &num) && tok.type == WHILE;
+  ok = ok && lex_single("first_name", 10, &tok, &num) && tok.type == IDENT;
+  *(uint32_t *)arg = ok ? tok.atom : NO_ATOM;
+  return NULL;
+}
+
+int main(void) {
+  // Threads that lex first side by side set the lexer up once, and agree on
+  // keywords and atoms.
+  pthread_t threads[4];
+  uint32_t atoms[4];
+  for (size_t t = 0; t < 4; ++t)
+    assert(!pthread_create(&threads[t], NULL, lexFirst, &atoms[t]),
+           "Could not start thread");
+  for (size_t t = 0; t < 4; ++t) {
+    pthread_join(threads[t], NULL);
+    assert(atoms[t] != NO_ATOM && atoms[t] == atoms[0],
+           "Lexer set up wrongly by threads");
+  }
+
+  // Keywords and identifiers
+  char src[] = "int interior while whiles do double x1 return_value\n";
+  tok_buf *toks = tok_init(4);
+  tokenize((str){.len = strlen(src), .chars = src}, toks, strlen(src));
+
+  TokenType expected[] = {INT,    IDENT, WHILE, IDENT, DO,
+                          DOUBLE, IDENT, IDENT, END};
+  assert(toks->len == 9, "Incorrect token count");
+  for (size_t i = 0; i < 9; ++i)
+    assert(tok_get(toks, i).type == expected[i], "Incorrect keyword lookup");
+
+  Token last = tok_get(toks, 7);
+  assert(last.start == 39 && last.len == 12, "Incorrect token extent");
+  assert(tok_get(toks, 8).start == strlen(src) && tok_get(toks, 8).len == 0,
+         "Incorrect END token extent");
+
+  // Identifiers get one atom per distinct name, and other tokens none.
+  assert(tok_get(toks, 0).atom == NO_ATOM, "Keyword was interned");
+  assert(!strcmp(atom_name(&idents, last.atom), "return_value"),
+         "Incorrect atom text");
+  uint32_t interior = tok_get(toks, 1).atom;
+  tok_destroy(toks);
+
+  char again[] = "whiles interior(interior)";
+  toks = tok_init(4);
+  tokenize((str){.len = strlen(again), .chars = again}, toks, strlen(again));
+  assert(tok_get(toks, 1).atom == interior &&
+             tok_get(toks, 3).atom == interior,
+         "Same name interned twice");
+  assert(tok_get(toks, 0).atom != interior, "Different names share an atom");
+  tok_destroy(toks);
+
+  // Streaming through a tiny window must give the same tokens as lexing the
+  // whole buffer.
+  size_t len;
+  char *buf = readFile(CHUNKMESH, &len);
+  toks = tok_init(len / 4);
+  tokenize((str){.len = len, .chars = buf}, toks, len);
+
+  FILE *fp = fopen(CHUNKMESH, "r");
+  lexer_t *lex = lexer_open(fp, 64);
+  tok_buf *stream = tok_init_stream(lex);
+
+  size_t i = 0;
+  for (; tok_has(stream, i); ++i) {
+    Token a = tok_get(toks, i), b = tok_get(stream, i);
+    assert(a.type == b.type && a.start == b.start && a.len == b.len &&
+               a.atom == b.atom,
+           "Streamed token differs");
+
+    str text = tok_text(stream, b);
+    assert(!memcmp(text.chars, buf + a.start, a.len), "Streamed text differs");
+  }
+  assert(i == toks->len, "Incorrect streamed token count");
+  assert(tok_get(stream, i - 1).type == END, "Stream did not end with END");
+  assert(stream->cap == TOK_STREAM_CAP, "Stream buffer grew");
+
+  tok_destroy(stream);
+  lexer_close(lex);
+  fclose(fp);
+
+  // Parallel lexing must give the same tokens for any number of chunks.
+  for (size_t jobs = 2; jobs <= 16; jobs *= 2) {
+    tok_buf *par = tok_init(0);
+    tokenize_parallel((str){.len = len, .chars = buf}, par, len, jobs);
+    assert(par->len == toks->len, "Incorrect parallel token count");
+
+    for (size_t i = 0; i < toks->len; ++i)
+      assert(par->types[i] == toks->types[i] &&
+                 par->starts[i] == toks->starts[i] &&
+                 par->lens[i] == toks->lens[i] &&
+                 par->ids[i] == toks->ids[i],
+             "Parallel token differs");
+    tok_destroy(par);
+  }
+  tok_destroy(toks);
+  free(buf);
+
+  // Numeric literals are decoded by the lexer.
+  char nums[] = "0x1F 017 42u 7ULL 10l 1.5 .25 1e3 2.5e-3f 0x1p-2 x-1e+2";
+  toks = tok_init(0);
+  tokenize((str){.len = strlen(nums), .chars = nums}, toks, strlen(nums));
+  assert(toks->len == 14, "Incorrect literal count");
+
+  uint64_t ints[] = {31, 15, 42, 7, 10};
+  uint8_t int_flags[] = {0, 0, LIT_UNSIGNED, LIT_UNSIGNED | LIT_LONGLONG,
+                         LIT_LONG};
+  for (size_t i = 0; i < 5; ++i) {
+    Token tok = tok_get(toks, i);
+    lit_value val = tok_num(toks, tok);
+    assert(tok.type == INTLIT && val.u == ints[i] && val.flags == int_flags[i],
+           "Incorrect integer literal");
+  }
+
+  double floats[] = {1.5, 0.25, 1000, 2.5e-3, 0.25};
+  for (size_t i = 0; i < 5; ++i) {
+    Token tok = tok_get(toks, 5 + i);
+    assert(tok.type == FLOATLIT && tok_num(toks, tok).d == floats[i],
+           "Incorrect float literal");
+  }
+  assert(tok_num(toks, tok_get(toks, 8)).flags == (LIT_FLOAT | LIT_SINGLE),
+         "Incorrect float suffix");
+  assert(tok_get(toks, 11).type == MINUS &&
+             tok_num(toks, tok_get(toks, 12)).d == 100,
+         "Incorrect exponent sign");
+  tok_destroy(toks);
+
+  const char *bad[] = {"08",  "0x",    "1e",  "1.5u",
+                       "12abc", "0x1.8", "1lL", "18446744073709551616"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    lit_value val;
+    assert(!lit_decode(bad[i], strlen(bad[i]), &val),
+           "Malformed literal decoded");
+  }
+
+  // Decoded floats round exactly like strtod, on and off the fast path.
+  srand(1);
+  for (int r = 0; r < 100000; ++r) {
+    char text[64];
+    int len = snprintf(text, sizeof(text), "%d.%de%d", rand() % 100000,
+                       rand(), rand() % 80 - 40);
+    if (r % 4 == 0)
+      len = snprintf(text, sizeof(text), "%d%d%d.%d", rand(), rand(),
+                     rand(), rand());
+
+    lit_value val;
+    assert(lit_decode(text, len, &val) && val.d == strtod(text, NULL),
+           "Float literal rounded incorrectly");
+  }
+
+  // Punctuators take the longest match
+  char ops[] = "a>>=b<<c->d%e%=f>>>g&&&h||=i!==j...k\\";
+  toks = tok_init(0);
+  tokenize((str){.len = strlen(ops), .chars = ops}, toks, strlen(ops));
+
+  TokenType punct[] = {IDENT,  RSHIFTEQ, IDENT,  LSHIFT,   IDENT,  ARROW,
+                       IDENT,  MODULO,   IDENT,  MODEQ,    IDENT,  RSHIFT,
+                       GT,     IDENT,    AND,    AMPER,    IDENT,  OR,
+                       EQUALS, IDENT,    NEQ,    EQUALS,   IDENT,  PERIOD,
+                       PERIOD, PERIOD,   IDENT,  BACKSLASH, END};
+  size_t npunct = sizeof(punct) / sizeof(punct[0]);
+  assert(toks->len == npunct, "Incorrect punctuator count");
+  for (size_t i = 0; i < npunct; ++i)
+    assert(tok_get(toks, i).type == punct[i], "Incorrect punctuator");
+  tok_destroy(toks);
+
+  // Escapes do not end a literal, and block comments are skipped whole.
+  char lit[] = "\"a\\\"b\" '\\'' /* \"x\n*/ / /**/* \"\\\\\"\n";
+  toks = tok_init(0);
+  tokenize((str){.len = strlen(lit), .chars = lit}, toks, strlen(lit));
+
+  TokenType lits[] = {STRINGLIT, CHARLIT, SLASH, ASTERISK, STRINGLIT, END};
+  assert(toks->len == 6, "Incorrect literal token count");
+  for (size_t i = 0; i < 6; ++i)
+    assert(tok_get(toks, i).type == lits[i], "Incorrect literal token");
+  assert(tok_get(toks, 0).len == 6 && tok_get(toks, 4).len == 4,
+         "Incorrect literal extent");
+  tok_destroy(toks);
+
+  // Chunks that begin inside a literal or block comment are re-lexed.
+  char multi[] = "x = \"a\\\n\"\nint y /*\n\"b;\n*/\n\"b\\\n\\\nc\" z;\n";
+  size_t mlen = strlen(multi);
+  toks = tok_init(0);
+  tokenize((str){.len = mlen, .chars = multi}, toks, mlen);
+
+  for (size_t jobs = 2; jobs <= 8; ++jobs) {
+    tok_buf *par = tok_init(0);
+    tokenize_parallel((str){.len = mlen, .chars = multi}, par, mlen, jobs);
+    assert(par->len == toks->len, "Incorrect re-lexed token count");
+
+    for (size_t i = 0; i < toks->len; ++i)
+      assert(par->types[i] == toks->types[i] &&
+                 par->starts[i] == toks->starts[i] &&
+                 par->ids[i] == toks->ids[i],
+             "Re-lexed token differs");
+    tok_destroy(par);
+  }
+
+  // Names lexed by a chunk that began inside a comment are not interned.
+  char junk[] = "int a;\n/*\nnot_a_name_1\nnot_a_name_2\n*/\nint b;\n";
+  size_t jlen = strlen(junk);
+  for (size_t jobs = 2; jobs <= 8; ++jobs) {
+    tok_buf *par = tok_init(0);
+    tokenize_parallel((str){.len = jlen, .chars = junk}, par, jlen, jobs);
+    assert(par->len == 7, "Incorrect re-lexed token count");
+    tok_destroy(par);
+  }
+  assert(intern_find(&idents, "not_a_name_1", 12) == NO_ATOM &&
+             intern_find(&idents, "not_a_name_2", 12) == NO_ATOM,
+         "Discarded names interned");
+
+  // Streaming must wait for comments and literals cut off by the window, even
+  // ones longer than the window itself.
+  FILE *tmp = tmpfile();
+  assert(tmp, "Could not create temporary file");
+  for (int r = 0; r < 40; ++r)
+    fprintf(tmp, "%s/* %*s */ s = \"%*s\\\"\\\n\"; // %d\n", multi, r * 5,
+            "*", r * 3, "\\\\", r);
+  rewind(tmp);
+
+  tok_destroy(toks);
+  buf = readStream(tmp, &len);
+  toks = tok_init(0);
+  tokenize((str){.len = len, .chars = buf}, toks, len);
+
+  rewind(tmp);
+  lex = lexer_open(tmp, 64);
+  stream = tok_init_stream(lex);
+  for (i = 0; tok_has(stream, i); ++i) {
+    Token a = tok_get(toks, i), b = tok_get(stream, i);
+    assert(a.type == b.type && a.start == b.start && a.len == b.len,
+           "Streamed literal differs");
+  }
+  assert(i == toks->len, "Incorrect streamed literal count");
+
+  tok_destroy(stream);
+  lexer_close(lex);
+  fclose(tmp);
+  tok_destroy(toks);
+  free(buf);
+
+  // A block comment left open is one invalid token running to the end, and
+  // the input ends where it does, whether it is lexed whole or streamed. So
+  // does a line comment with no newline after it.
+  const char *open_ends[] = {"int a; /* b\n c;", "int a; // b"};
+  for (size_t e = 0; e < 2; ++e) {
+    len = strlen(open_ends[e]);
+    buf = (char *)calloc(len + SRC_PADDING, 1);
+    memcpy(buf, open_ends[e], len);
+    toks = tok_init(0);
+    tokenize((str){.len = len, .chars = buf}, toks, len);
+    assert(toks->len == 5 - e && toks->starts[toks->len - 1] == len,
+           "Open comment lexed wrongly");
+    assert(e || (toks->types[3] == INVALID && toks->starts[3] == 7 &&
+                 toks->lens[3] == len - 7),
+           "Open block comment not invalid");
+
+    tmp = tmpfile();
+    assert(tmp && fwrite(buf, 1, len, tmp) == len,
+           "Could not create temporary file");
+    rewind(tmp);
+    lex = lexer_open(tmp, 64);
+    stream = tok_init_stream(lex);
+    for (i = 0; tok_has(stream, i); ++i) {
+      Token a = tok_get(toks, i), b = tok_get(stream, i);
+      assert(a.type == b.type && a.start == b.start && a.len == b.len,
+             "Streamed open comment differs");
+    }
+    assert(i == toks->len, "Incorrect streamed open comment count");
+
+    tok_destroy(stream);
+    lexer_close(lex);
+    fclose(tmp);
+    tok_destroy(toks);
+    free(buf);
+  }
+
+  // Re-lexing an edit must give the same tokens as lexing the edited text
+  // from scratch.
+  buf = readFile(CHUNKMESH, &len);
+  size_t cap = 2 * len + SRC_PADDING;
+  size_t orig = len;
+  char *text = (char *)calloc(cap, 1);
+  memcpy(text, buf, len);
+
+  toks = tok_init(0);
+  tokenize((str){.len = len, .chars = text}, toks, len);
+
+  // Extending an identifier only replaces its own token.
+  size_t k = 0;
+  while (tok_get(toks, k).type != IDENT)
+    ++k;
+  Token ident = tok_get(toks, k);
+  memmove(text + ident.start + ident.len + 2, text + ident.start + ident.len,
+          len - ident.start - ident.len);
+  memcpy(text + ident.start + ident.len, "_x", 2);
+  len += 2;
+
+  tok_splice splice = tokenize_edit(
+      (str){.len = len, .chars = text}, toks, len,
+      (text_edit){.offset = ident.start + ident.len, .inserted = 2});
+  assert(splice.first == k && splice.removed == 1 && splice.inserted == 1,
+         "Edit re-lexed too much");
+  assert(tok_get(toks, k).len == ident.len + 2, "Incorrect edited token");
+
+  // Random edits, kept away from the inside of words, comment openers and
+  // escapes so that the text always stays valid.
+  const char *snippets[] = {"",       " x ",  " 42 ",     " 1.5e3 ",
+                            " /* ",   " // ", " \"a\" ", " -> ",
+                            " >>= ", "\n"};
+  size_t nsnippets = sizeof(snippets) / sizeof(snippets[0]);
+  const char *unsafe = "\"'/\\";
+
+  srand(2);
+  for (int r = 0; r < 20000; ++r) {
+    // Start over now and then, before comment openers hide all of the text.
+    if (r % 500 == 0) {
+      len = orig;
+      memcpy(text, buf, len);
+      memset(text + len, 0, SRC_PADDING);
+      tok_destroy(toks);
+      toks = tok_init(0);
+      tokenize((str){.len = len, .chars = text}, toks, len);
+    }
+
+    size_t at = rand() % (len + 1), end = at + rand() % 16;
+    const char *ins = snippets[rand() % nsnippets];
+    size_t ilen = strlen(ins);
+    if (end > len || len + ilen >= cap - SRC_PADDING)
+      continue;
+
+    char before = at ? text[at - 1] : ' ', after = text[end];
+    bool word = isalnum(before) || before == '_' || before == '.' ||
+                isalnum(after) || after == '_';
+    if (word || strchr(unsafe, before) || (after && strchr(unsafe, after)) ||
+        (ins[0] == '\n' && before != '\n'))
+      continue;
+
+    bool safe = true;
+    for (size_t c = at; c < end; ++c)
+      safe = safe && !strchr(unsafe, text[c]);
+    if (!safe)
+      continue;
+
+    memmove(text + at + ilen, text + end, len - end);
+    memcpy(text + at, ins, ilen);
+    len = len - (end - at) + ilen;
+    memset(text + len, 0, SRC_PADDING);
+
+    str edited = {.len = len, .chars = text};
+    tokenize_edit(edited, toks, len,
+                  (text_edit){.offset = at, .removed = end - at,
+                              .inserted = ilen});
+
+    tok_buf *fresh = tok_init(0);
+    tokenize(edited, fresh, len);
+    assert(toks->len == fresh->len && toks->nums_len == fresh->nums_len,
+           "Incorrect edited token count");
+
+    for (size_t i = 0; i < fresh->len; ++i)
+      assert(toks->types[i] == fresh->types[i] &&
+                 toks->starts[i] == fresh->starts[i] &&
+                 toks->lens[i] == fresh->lens[i] &&
+                 toks->ids[i] == fresh->ids[i],
+             "Edited token differs");
+
+    for (size_t i = 0; i < fresh->nums_len; ++i)
+      assert(toks->nums[i].u == fresh->nums[i].u &&
+                 toks->nums[i].flags == fresh->nums[i].flags,
+             "Edited literal differs");
+
+    assert(toks->lines.len == fresh->lines.len &&
+               !memcmp(toks->lines.starts, fresh->lines.starts,
+                       sizeof(*toks->lines.starts) * fresh->lines.len),
+           "Edited line index differs");
+    tok_destroy(fresh);
+  }
+  tok_destroy(toks);
+  free(text);
+  free(buf);
+
+  // A mapped file that fills its last page exactly is still followed by
+  // zeroed padding.
+  char path[] = "/tmp/lextestXXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0, "Could not create temporary file");
+  tmp = fdopen(fd, "w");
+  for (int r = 0; r < 4096 / 8; ++r)
+    fputs("int xy;\n", tmp);
+  fclose(tmp);
+
+  source_file file;
+  assert(file_load(path, &file), "Could not load file");
+  assert(file.text.len == 4096, "Incorrect file size");
+  for (size_t i = 0; i < SRC_PADDING; ++i)
+    assert(file.text.chars[file.text.len + i] == '\0', "File is not padded");
+
+  toks = tok_init(0);
+  tokenize(file.text, toks, file.text.len);
+  assert(toks->len == 3 * 512 + 1 && tok_get(toks, 3 * 512).type == END,
+         "Incorrect padded file tokens");
+  tok_destroy(toks);
+  file_unload(&file);
+  remove(path);
+
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,167 @@
+#include "../src/parser.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FUNCS 20000 // Functions in the generated program
+#define RUNS 3
+
+static double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the best time over RUNS to parse toks on jobs threads, skipping
+// function bodies if lazy is set.
+static double run(tok_buf *toks, size_t jobs, bool lazy) {
+  double best = 0;
+  for (int r = 0; r < RUNS; ++r) {
+    compiler_t cc;
+    compiler_init(&cc, toks->src, toks);
+    cc.lazy = lazy;
+    ast_node *ast = NULL;
+
+    double start = now();
+    parse_parallel(&cc, &ast, jobs);
+    double elapsed = now() - start;
+
+    if (r == 0 || elapsed < best)
+      best = elapsed;
+    ast_destroy(ast);
+    compiler_destroy(&cc);
+  }
+
+  return best;
+}
+
+// Returns the best time over RUNS to reparse toks, the tokens of the len
+// bytes of src, after changing a literal in the body of one function.
+static double reparseOne(char *src, size_t len, tok_buf *toks) {
+  compiler_t cc;
+  compiler_init(&cc, toks->src, toks);
+  ast_node *ast = NULL;
+  parse(&cc, &ast);
+
+  char *digit = strstr(src, "a * 10000 ") + 8;
+  double best = 0;
+  for (int r = 0; r < RUNS; ++r) {
+    *digit = *digit == '0' ? '1' : '0';
+    tok_splice splice =
+        tokenize_edit((str){.chars = src, .len = len}, toks, len,
+                      (text_edit){.offset = digit - src, .removed = 1,
+                                  .inserted = 1});
+
+    double start = now();
+    reparse(&cc, &ast, splice);
+    double elapsed = now() - start;
+
+    if (r == 0 || elapsed < best)
+      best = elapsed;
+  }
+
+  ast_destroy(ast);
+  compiler_destroy(&cc);
+  return best;
+}
+
+// Writes a program of FUNCS functions to src, which has room for cap bytes,
+// with an error in every broken-th one if broken isn't 0, and returns its
+// length.
+static size_t generate(char *src, size_t cap, int broken) {
+  size_t len = 0;
+  for (int f = 0; f < FUNCS; ++f)
+    len += snprintf(src + len, cap - len,
+                    "int f%d(int a, int b) {\n"
+                    "  int c = a * %d + %s;\n"
+                    "  while (c > 10) {\n"
+                    "    c = c - (a + 2) * b;\n"
+                    "  }\n"
+                    "  return c + f%d(b, a);\n"
+                    "}\n",
+                    f, f, broken && f % broken == 0 ? "" : "b", f / 2);
+
+  return len;
+}
+
+// Returns the best time over RUNS to parse toks, which have errors in them,
+// on one thread, and sets *errors to the number reported.
+static double runErrors(tok_buf *toks, size_t *errors) {
+  double best = 0;
+  for (int r = 0; r < RUNS; ++r) {
+    compiler_t cc;
+    compiler_init(&cc, toks->src, toks);
+    ast_node *ast = NULL;
+
+    double start = now();
+    parse(&cc, &ast);
+    double elapsed = now() - start;
+
+    if (r == 0 || elapsed < best)
+      best = elapsed;
+    *errors = cc.ndiags;
+    ast_destroy(ast);
+    compiler_destroy(&cc);
+  }
+
+  return best;
+}
+
+// Parses a program of FUNCS functions on 1, 2, 4, ... threads up to the
+// number of cores (or the count given), then only their signatures, then
+// again after an edit to one of them, and then with an error in every tenth.
+int main(int argc, char *argv[]) {
+  size_t cores = (argc > 1) ? (size_t)atol(argv[1])
+                            : (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1)
+    cores = 1;
+
+  size_t cap = (size_t)FUNCS * 160;
+  char *src = (char *)calloc(cap + SRC_PADDING, 1);
+  size_t len = generate(src, cap, 0);
+
+  lex_init();
+  tok_buf *toks = tok_init(0);
+  tokenize((str){.chars = src, .len = len}, toks, len);
+
+  printf("parsebench: %d functions, %zu tokens, %zu cores\n", FUNCS,
+         toks->len, cores);
+  double base = 0;
+  for (size_t jobs = 1;; jobs *= 2) {
+    if (jobs > cores)
+      jobs = cores;
+
+    double t = run(toks, jobs, false);
+    if (jobs == 1)
+      base = t;
+
+    printf("  %2zu threads: %.4f s (%.1f Mtokens/s, %.1fx)\n", jobs, t,
+           toks->len / t / 1e6, base / t);
+    if (jobs == cores)
+      break;
+  }
+
+  double lazy = run(toks, 1, true);
+  printf("  signatures only: %.4f s (%.1fx)\n", lazy, base / lazy);
+
+  double edit = reparseOne(src, len, toks);
+  printf("  reparse after editing one function: %.6f s (%.0fx)\n", edit,
+         base / edit);
+
+  tok_destroy(toks);
+
+  len = generate(src, cap, 10);
+  toks = tok_init(0);
+  tokenize((str){.chars = src, .len = len}, toks, len);
+  size_t errors = 0;
+  double broken = runErrors(toks, &errors);
+  printf("  with an error in every tenth function: %.4f s (%zu errors, "
+         "%.1fx)\n",
+         broken, errors, base / broken);
+
+  tok_destroy(toks);
+  intern_destroy(&idents);
+  free(src);
+  return 0;
+}
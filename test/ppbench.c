@@ -0,0 +1,209 @@
+#define _DEFAULT_SOURCE // mkdtemp
+
+#include "../src/pch.h"
+#include "../src/preproc.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LEVELS 6 // Depth of the header graph
+#define WIDTH 4  // Headers per level, each including every one of the next
+#define DECLS 64 // Declarations per header
+#define UNITS 64 // Translation units, each including every top-level header
+#define NEST 64   // Depth of the chain of macros calling each other
+#define CALLS 4096 // Calls of the outermost macro
+
+static char root[] = "/tmp/ppbenchXXXXXX";
+
+static double now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static FILE *create(const char *name) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", root, name);
+  FILE *fp = fopen(path, "w");
+  if (!fp) {
+    fprintf(stderr, "Could not create %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  return fp;
+}
+
+// Writes the header graph and the translation units that include it.
+static void writeTree(void) {
+  char name[64];
+  for (int l = 0; l < LEVELS; ++l) {
+    for (int w = 0; w < WIDTH; ++w) {
+      snprintf(name, sizeof(name), "h%d_%d.h", l, w);
+      FILE *fp = create(name);
+      fprintf(fp, "#ifndef H%d_%d\n#define H%d_%d\n", l, w, l, w);
+      for (int n = 0; l + 1 < LEVELS && n < WIDTH; ++n)
+        fprintf(fp, "#include \"h%d_%d.h\"\n", l + 1, n);
+      for (int d = 0; d < DECLS; ++d)
+        fprintf(fp, "int f%d_%d_%d(int a, float b); // %d\n", l, w, d, d);
+      fprintf(fp, "#endif\n");
+      fclose(fp);
+    }
+  }
+
+  // M<n>(x) calls M<n - 1> and adds a term, so a call of the last one is
+  // expanded through every macro of the chain.
+  FILE *fp = create("macros.c");
+  fprintf(fp, "#define M0(x) (x)\n");
+  for (int n = 1; n < NEST; ++n)
+    fprintf(fp, "#define M%d(x) M%d(x) + %d\n", n, n - 1, n);
+  for (int c = 0; c < CALLS; ++c)
+    fprintf(fp, "int v%d = M%d(%d);\n", c, NEST - 1, c);
+  fclose(fp);
+
+  // The prefix every unit includes, to be precompiled
+  fp = create("common.h");
+  for (int w = 0; w < WIDTH; ++w)
+    fprintf(fp, "#include \"h0_%d.h\"\n", w);
+  fclose(fp);
+
+  for (int u = 0; u < UNITS; ++u) {
+    snprintf(name, sizeof(name), "u%d.c", u);
+    FILE *fp = create(name);
+    for (int w = 0; w < WIDTH; ++w)
+      fprintf(fp, "#include \"h0_%d.h\"\n", w);
+    fprintf(fp, "int main() { return %d; }\n", u);
+    fclose(fp);
+  }
+}
+
+static void removeTree(void) {
+  char path[256];
+  for (int l = 0; l < LEVELS; ++l) {
+    for (int w = 0; w < WIDTH; ++w) {
+      snprintf(path, sizeof(path), "%s/h%d_%d.h", root, l, w);
+      remove(path);
+    }
+  }
+
+  for (int u = 0; u < UNITS; ++u) {
+    snprintf(path, sizeof(path), "%s/u%d.c", root, u);
+    remove(path);
+  }
+
+  const char *other[] = {"macros.c", "common.h", "common.pch"};
+  for (size_t k = 0; k < sizeof(other) / sizeof(other[0]); ++k) {
+    snprintf(path, sizeof(path), "%s/%s", root, other[k]);
+    remove(path);
+  }
+  remove(root);
+}
+
+// Preprocesses every translation unit, either sharing the file cache between
+// them or clearing it before each one, as if each were compiled by its own
+// process. Each unit starts from the precompiled header pch unless it is
+// NULL.
+static double run(bool shared, const char *pch, size_t *entered,
+                  size_t *skipped, size_t *ntoks) {
+  pp_cache_destroy(&sources);
+  *entered = *skipped = *ntoks = 0;
+
+  double start = now();
+  for (int u = 0; u < UNITS; ++u) {
+    if (!shared)
+      pp_cache_destroy(&sources);
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/u%d.c", root, u);
+
+    preproc_t pp;
+    pp_init(&pp, NULL, 0, 1);
+    tok_buf *toks = tok_init(0);
+    if ((pch && !pch_load(&pp, pch)) || !preprocess(&pp, path, toks))
+      exit(EXIT_FAILURE);
+
+    *entered += pp.entered;
+    *skipped += pp.skipped;
+    *ntoks += toks->len;
+    tok_destroy(toks);
+    pp_destroy(&pp);
+  }
+
+  return now() - start;
+}
+
+// Expands every call of the macro chain, returning the time taken. The file
+// is read by a first run that is not timed.
+static double expand(size_t *ntoks) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/macros.c", root);
+
+  double time = 0;
+  for (int run = 0; run < 2; ++run) {
+    preproc_t pp;
+    pp_init(&pp, NULL, 0, 1);
+    tok_buf *toks = tok_init(0);
+
+    double start = now();
+    if (!preprocess(&pp, path, toks))
+      exit(EXIT_FAILURE);
+    time = now() - start;
+
+    *ntoks = toks->len;
+    tok_destroy(toks);
+    pp_destroy(&pp);
+  }
+
+  return time;
+}
+
+// Measures preprocessing of translation units that all include the same
+// deep, guarded header graph, with and without the shared file cache, and
+// the expansion of deeply nested macros.
+int main(void) {
+  if (!mkdtemp(root)) {
+    fprintf(stderr, "Could not create temporary directory\n");
+    return EXIT_FAILURE;
+  }
+  writeTree();
+
+  size_t entered, skipped, ntoks;
+  double cold = run(false, NULL, &entered, &skipped, &ntoks);
+  printf("ppbench: %d units, %d headers, %lu tokens\n", UNITS,
+         LEVELS * WIDTH, ntoks);
+  printf("  file read per unit: %.4f s, %lu files walked, %lu includes "
+         "skipped\n",
+         cold, entered, skipped);
+
+  double warm = run(true, NULL, &entered, &skipped, &ntoks);
+  printf("  shared file cache:  %.4f s, %lu files walked, %lu includes "
+         "skipped, %.1fx\n",
+         warm, entered, skipped, cold / warm);
+
+  // The common prefix is precompiled once, and each unit then maps it in
+  // place of reading the header graph.
+  char header[256], pch[256];
+  snprintf(header, sizeof(header), "%s/common.h", root);
+  snprintf(pch, sizeof(pch), "%s/common.pch", root);
+  pp_cache_destroy(&sources);
+  preproc_t pp;
+  pp_init(&pp, NULL, 0, 1);
+  tok_buf *toks = tok_init(0);
+  if (!preprocess(&pp, header, toks) || !pch_save(&pp, toks, pch))
+    return EXIT_FAILURE;
+  tok_destroy(toks);
+  pp_destroy(&pp);
+
+  double pre = run(false, pch, &entered, &skipped, &ntoks);
+  printf("  precompiled header: %.4f s, %lu files walked, %lu includes "
+         "skipped, %.1fx\n",
+         pre, entered, skipped, cold / pre);
+
+  double time = expand(&ntoks);
+  printf("  macro expansion:    %.4f s, %d calls %d deep, %lu tokens, "
+         "%.1f Mtok/s\n",
+         time, CALLS, NEST, ntoks, ntoks / time / 1e6);
+
+  pp_cache_destroy(&sources);
+  removeTree();
+  return 0;
+}
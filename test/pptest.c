@@ -0,0 +1,308 @@
+#define _DEFAULT_SOURCE // mkdtemp
+
+#include "../src/pch.h"
+#include "../src/preproc.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define assert(_e, _m)                                                         \
+  {                                                                            \
+    if (!(_e)) {                                                               \
+      fprintf(stderr, "%s\n", _m);                                             \
+      exit(EXIT_FAILURE);                                                      \
+    }                                                                          \
+  }
+
+static char root[] = "/tmp/pptestXXXXXX";
+
+static void writeFile(const char *name, const char *text) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", root, name);
+  FILE *fp = fopen(path, "w");
+  assert(fp, "Could not create file");
+  fputs(text, fp);
+  fclose(fp);
+}
+
+static void removeFile(const char *name) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", root, name);
+  remove(path);
+}
+
+// Returns the names of the identifiers in toks, separated by spaces.
+static const char *identNames(tok_buf *toks) {
+  static char names[1024];
+  size_t len = 0;
+  names[0] = '\0';
+
+  for (size_t i = 0; i < toks->len; ++i) {
+    Token tok = tok_get(toks, i);
+    if (tok.type == IDENT)
+      len += snprintf(names + len, sizeof(names) - len, len ? " %s" : "%s",
+                      atom_name(&idents, tok.atom));
+  }
+
+  return names;
+}
+
+// Returns toks up to END spelled out: identifiers and strings made by # by
+// their atom, integers by their value and other tokens by type.
+static const char *spell(tok_buf *toks) {
+  static char text[1024];
+  size_t len = 0;
+  text[0] = '\0';
+
+  for (size_t i = 0; i + 1 < toks->len; ++i) {
+    Token tok = tok_get(toks, i);
+    const char *sep = len ? " " : "";
+    if (tok.type == IDENT || (tok.type == STRINGLIT && tok.atom != NO_ATOM))
+      len += snprintf(text + len, sizeof(text) - len, "%s%s", sep,
+                      atom_name(&idents, tok.atom));
+    else if (tok.type == INTLIT)
+      len += snprintf(text + len, sizeof(text) - len, "%s%lu", sep,
+                      (unsigned long)tok_num(toks, tok).u);
+    else
+      len += snprintf(text + len, sizeof(text) - len, "%s%s", sep,
+                      TOK2STR(tok.type));
+  }
+
+  return text;
+}
+
+static bool run(const char *name, tok_buf **toks, preproc_t *pp) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", root, name);
+
+  *toks = tok_init(0);
+  return preprocess(pp, path, *toks);
+}
+
+int main(void) {
+  assert(mkdtemp(root), "Could not create temporary directory");
+  char dir[256];
+  snprintf(dir, sizeof(dir), "%s/sub", root);
+  mkdir(dir, 0700);
+  snprintf(dir, sizeof(dir), "%s/sys", root);
+  mkdir(dir, 0700);
+
+  writeFile("guard.h", "// Guarded\n#ifndef GUARD_H\n#define GUARD_H\n"
+                       "int guarded;\n#endif\n");
+  writeFile("once.h", "#pragma once\nint once;\n");
+  writeFile("plain.h", "int plain;\n");
+  writeFile("sub/inner.h", "#include \"../guard.h\"\nint inner = 1.5;\n");
+  writeFile("cond.h", "#ifdef GUARD_H\nint yes;\n#else\nint no;\n#endif\n"
+                      "#ifndef NOPE\n# ifdef NOPE\nint deep;\n# endif\n"
+                      "int nope;\n#else\nint never;\n#endif\n");
+  writeFile("sys/system.h", "#ifndef SYSTEM_H\n#define SYSTEM_H\n"
+                            "int sys;\n#endif\n");
+  writeFile("main.c", "#include \"guard.h\"\n#include \"guard.h\"\n"
+                      "#include \"once.h\"\n#include \"once.h\"\n"
+                      "#include \"sub/inner.h\"\n#include \"plain.h\"\n"
+                      "#include \"plain.h\"\n#include \"cond.h\"\n"
+                      "#include <system.h>\n#undef GUARD_H\n"
+                      "#include \"guard.h\"\nint main = 42;\n");
+  writeFile("macro.c",
+            "#define EMPTY\n#define ONE 1\n#define TWO ONE + ONE\n"
+            "#define ADD(a, b) ((a) + (b))\n#define STR(x) #x\n"
+            "#define XSTR(x) STR(x)\n#define CAT(a, b) a ## b\n"
+            "#define SELF SELF + 1\n#define F(x) G(x)\n#define G(x) x F\n"
+            "#define V(fmt, ...) f(fmt, __VA_ARGS__)\n"
+            "CAT(x, 12) = TWO EMPTY;\n"
+            "ADD(ONE,\n  ADD(2, 3));\n"
+            "SELF;\n"
+            "F(a)(b);\n"
+            "STR( a  \"b\\n\"  'c' ) XSTR(ONE) CAT(,y) CAT(1, 2);\n"
+            "V(s, 1, (2, 3)) V(t) ADD;\n"
+            "#undef ONE\nONE\n"
+            "#if defined(TWO) && !defined ONE && TWO - 1 == ONE - 1 && \\\n"
+            "    2 * 3 % 4 == 2 && (1 ? 1 : 1 / 0) && (-1 >> 1) == -1\n"
+            "yes1\n#elif 1\nno1\n#endif\n"
+            "#if 0\nno2\n#elif CAT(1, 0) > 9 && 'a' == 97 && ~0 == -1\n"
+            "yes2\n#else\nno3\n#endif\n"
+            "#if 0\n#elif 0\n#else\nyes3\n#endif\n");
+  writeFile("again.c", "#include \"sub/../guard.h\"\n#include \"once.h\"\n"
+                       "int again;\n");
+
+  char sys[256];
+  snprintf(sys, sizeof(sys), "%s/sys", root);
+  const char *dirs[] = {sys};
+
+  // Includes are spliced in and directives removed, and repeated includes
+  // of guarded and #pragma once files are skipped.
+  preproc_t pp;
+  pp_init(&pp, dirs, 1, 1);
+  tok_buf *toks;
+  assert(run("main.c", &toks, &pp), "Could not preprocess");
+  assert(!strcmp(identNames(toks), "guarded once inner plain plain yes nope "
+                                   "sys guarded main"),
+         "Incorrect preprocessed tokens");
+  assert(pp.skipped == 3, "Incorrect number of skipped includes");
+  assert(tok_get(toks, toks->len - 1).type == END, "Missing END token");
+  assert(!memchr(toks->types, HASH, toks->len), "Directive left in output");
+
+  // Literal values and locations follow the tokens out of their files.
+  size_t k = 0;
+  while (strcmp(atom_name(&idents, tok_get(toks, k).atom), "inner"))
+    ++k;
+  Token lit = tok_get(toks, k + 2);
+  assert(lit.type == FLOATLIT && tok_num(toks, lit).d == 1.5,
+         "Incorrect included literal");
+
+  src_loc loc = tok_locate(toks, lit.start);
+  assert(loc.path && strstr(loc.path, "sub/inner.h") && loc.line == 2 &&
+             loc.col == 13,
+         "Incorrect included token location");
+
+  loc = tok_locate(toks, tok_get(toks, toks->len - 3).start);
+  assert(strstr(loc.path, "main.c") && loc.line == 12,
+         "Incorrect main file location");
+  tok_destroy(toks);
+  pp_destroy(&pp);
+
+  // Every file was read once, and a second translation unit reads nothing
+  // new but a file reached by another path is still the same file.
+  size_t loaded = sources.len;
+  assert(loaded == 7, "Incorrect number of files read");
+
+  pp_init(&pp, dirs, 1, 1);
+  assert(run("again.c", &toks, &pp), "Could not preprocess");
+  assert(!strcmp(identNames(toks), "guarded once again"),
+         "Incorrect tokens of second file");
+  assert(sources.len == loaded + 1, "Cached file read again");
+  tok_destroy(toks);
+  pp_destroy(&pp);
+
+  // Only files wholly inside their guard are known to be guarded.
+  for (size_t i = 0; i < sources.len; ++i) {
+    pp_file *f = sources.loaded[i];
+    bool guard = strstr(f->path, "guard.h") || strstr(f->path, "system.h");
+    assert(!f->guard == !guard, "Incorrect include guard detection");
+    assert(f->once == (strstr(f->path, "once.h") != NULL),
+           "Incorrect #pragma once detection");
+  }
+
+  // Macros are expanded, with # and ## applied, and a macro is never expanded
+  // again inside its own expansion.
+  pp_init(&pp, dirs, 1, 1);
+  assert(run("macro.c", &toks, &pp), "Could not preprocess macros");
+  assert(!strcmp(spell(toks),
+                 "x12 EQUALS 1 PLUS 1 SEMI "
+                 "LPAREN LPAREN 1 RPAREN PLUS LPAREN LPAREN LPAREN 2 RPAREN "
+                 "PLUS LPAREN 3 RPAREN RPAREN RPAREN RPAREN SEMI "
+                 "SELF PLUS 1 SEMI "
+                 "a F LPAREN b RPAREN SEMI "
+                 "\"a \\\"b\\\\n\\\" 'c'\" \"1\" y 12 SEMI "
+                 "f LPAREN s COMMA 1 COMMA LPAREN 2 COMMA 3 RPAREN RPAREN "
+                 "f LPAREN t COMMA RPAREN ADD SEMI "
+                 "ONE yes1 yes2 yes3"),
+         "Incorrect macro expansion");
+
+  // Expanded tokens are located at the call, and arguments where they are.
+  loc = tok_locate(toks, tok_get(toks, 0).start);
+  assert(loc.line == 12 && loc.col == 1, "Incorrect expansion location");
+  loc = tok_locate(toks, tok_get(toks, 7).start);
+  assert(loc.line == 13 && loc.col == 1, "Incorrect expansion location");
+  loc = tok_locate(toks, tok_get(toks, 13).start);
+  assert(loc.line == 14 && loc.col == 3, "Incorrect expansion location");
+  loc = tok_locate(toks, tok_get(toks, 14).start);
+  assert(loc.line == 14 && loc.col == 7, "Incorrect argument location");
+  tok_destroy(toks);
+  pp_destroy(&pp);
+
+  // A unit using a precompiled header sees the same tokens as one including
+  // the header first, and its files are never read.
+  writeFile("pre.h", "#ifndef PRE_H\n#define PRE_H\n#include \"once.h\"\n"
+                     "#include \"guard.h\"\n#define ONE 1\n"
+                     "#define TWICE(x) ((x) * 2)\nint pre = TWICE(ONE);\n"
+                     "#endif\n");
+  writeFile("usepch.c", "#include \"pre.h\"\n#include \"once.h\"\n"
+                        "#include \"guard.h\"\nint x = TWICE(GUARD_H ONE);\n");
+  writeFile("ref.c", "#include \"pre.h\"\n#include \"usepch.c\"\n");
+
+  char expected[1024], pch[256];
+  snprintf(pch, sizeof(pch), "%s/pre.pch", root);
+  pp_init(&pp, dirs, 1, 1);
+  assert(run("ref.c", &toks, &pp), "Could not preprocess");
+  snprintf(expected, sizeof(expected), "%s", spell(toks));
+  tok_destroy(toks);
+  pp_destroy(&pp);
+
+  pp_cache_destroy(&sources);
+  pp_init(&pp, dirs, 1, 1);
+  assert(run("pre.h", &toks, &pp) && pch_save(&pp, toks, pch),
+         "Could not save precompiled header");
+  tok_destroy(toks);
+  pp_destroy(&pp);
+
+  pp_cache_destroy(&sources);
+  pp_init(&pp, dirs, 1, 1);
+  assert(pch_load(&pp, pch), "Could not load precompiled header");
+  assert(run("usepch.c", &toks, &pp), "Could not preprocess with header");
+  assert(!strcmp(spell(toks), expected), "Incorrect tokens with header");
+  assert(pp.skipped == 3, "Header files not skipped");
+  for (size_t i = 0; i < sources.len; ++i)
+    assert(sources.loaded[i]->lazy == !strstr(sources.loaded[i]->path,
+                                              "usepch.c"),
+           "Precompiled file read");
+
+  loc = tok_locate(toks, tok_get(toks, 1).start);
+  assert(strstr(loc.path, "once.h") && loc.line == 2 && loc.col == 5,
+         "Incorrect precompiled token location");
+  loc = tok_locate(toks, tok_get(toks, toks->len - 2).start);
+  assert(strstr(loc.path, "usepch.c") && loc.line == 4 && loc.col == 27,
+         "Incorrect location after precompiled header");
+  tok_destroy(toks);
+  pp_destroy(&pp);
+
+  // A header that changed since it was precompiled is not used.
+  writeFile("pre.h", "#define CHANGED\n");
+  pp_cache_destroy(&sources);
+  pp_init(&pp, dirs, 1, 1);
+  assert(!pch_load(&pp, pch), "Stale precompiled header loaded");
+  pp_destroy(&pp);
+
+  // Malformed input is reported and stops preprocessing.
+  const char *bad[] = {"#include \"missing.h\"\n", "#include missing.h\n",
+                       "#ifdef X\nint x;\n", "#endif\n",
+                       "#ifdef X\n#else\n#else\n#endif\n", "#frobnicate\n",
+                       "#error Stop here\n",
+                       "#define F(x) x\nF(1, 2)\n",
+                       "#define F(x, y) x\nF(1)\n",
+                       "#define F(x) x\nF(1\n#define G\n)\n",
+                       "#define F(x) #y\n",
+                       "#define F(x ## y\n",
+                       "#define F(x) ## x\n",
+                       "#define P(x, y) x ## y\nP(+, /)\n",
+                       "#if 1 / 0\n#endif\n",
+                       "#if (1\n#endif\n",
+                       "#if 1 2\n#endif\n",
+                       "#if defined(X\n#endif\n",
+                       "#if\n#endif\n"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "bad%zu.c", i);
+    writeFile(name, bad[i]);
+
+    pp_init(&pp, dirs, 1, 1);
+    assert(!run(name, &toks, &pp), "Malformed input was preprocessed");
+    tok_destroy(toks);
+    pp_destroy(&pp);
+    removeFile(name);
+  }
+
+  pp_cache_destroy(&sources);
+  assert(sources.len == 0, "File cache not cleared");
+
+  const char *files[] = {"guard.h", "once.h",  "plain.h",      "sub/inner.h",
+                         "cond.h",  "main.c",  "sys/system.h", "macro.c",
+                         "again.c", "pre.h",   "usepch.c",     "ref.c",
+                         "pre.pch", "sub",     "sys"};
+  for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i)
+    removeFile(files[i]);
+  remove(root);
+
+  printf("ALL TESTS PASSED.\n");
+  return 0;
+}
@@ -0,0 +1,168 @@
+#include "../src/tokens.h"
+#include <stdio.h>
+#include <string.h>
+
+// Generates the tables used by lexToken() to classify token starts and to
+// match punctuators, from the OP() entries of TOK_LIST. The output is a
+// header written to stdout:
+//
+//  - lex_start maps every byte to the kind of token it can begin. The NUL
+//    byte maps to LEX_END, as it is the sentinel after the source text.
+//  - punct_class maps every byte used by a punctuator to a small class
+//    number, and every other byte to 0.
+//  - punct_next is the transition table of a DFA over those classes. State 0
+//    is the start state, and a transition to 0 means the punctuator ends.
+//  - punct_accept is the token type of the punctuator spelled by the path to
+//    each state.
+//
+// Every prefix of a punctuator must itself be a punctuator, so the longest
+// match is always the last state reached and the lexer never backtracks.
+
+#define MAX_STATES 256
+#define MAX_CLASSES 64
+
+typedef struct {
+  const char *name;
+  const char *spelling;
+} Op;
+
+static const Op ops[] = {
+#undef OP
+#define OP(name, spelling) {#name, spelling},
+#define X(name)
+    TOK_LIST
+#undef X
+#undef OP
+};
+
+#define NUM_OPS (sizeof(ops) / sizeof(ops[0]))
+
+static int classes[256];
+static int num_classes = 1;
+
+static int next[MAX_STATES][MAX_CLASSES];
+static int accept[MAX_STATES];
+static const char *reached_by[MAX_STATES];
+static int num_states = 1;
+
+static int fail(const char *msg, const char *spelling) {
+  fprintf(stderr, "punctgen: %s \"%s\"\n", msg, spelling);
+  return EXIT_FAILURE;
+}
+
+// Prints a byte as a C character constant, or as a number if it is not
+// printable ASCII.
+static void printByte(int c) {
+  if (c == '\'' || c == '\\')
+    printf("'\\%c'", c);
+  else if (c > ' ' && c < 127)
+    printf("'%c'", c);
+  else
+    printf("%d", c);
+}
+
+static const char *startKind(int c) {
+  if (c == '\0')
+    return "LEX_END";
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+    return "LEX_IDENT";
+  if (c >= '0' && c <= '9')
+    return "LEX_NUMBER";
+  if (c == '"')
+    return "LEX_STRING";
+  if (c == '\'')
+    return "LEX_CHAR";
+  if (classes[c] && next[0][classes[c]])
+    return "LEX_PUNCT";
+
+  return "LEX_INVALID";
+}
+
+int main(void) {
+  size_t max_len = 0;
+
+  for (size_t k = 0; k < NUM_OPS; ++k) {
+    const char *s = ops[k].spelling;
+    size_t len = strlen(s);
+    if (len > max_len)
+      max_len = len;
+
+    int state = 0;
+    for (size_t j = 0; j < len; ++j) {
+      unsigned char c = s[j];
+      if (!classes[c]) {
+        if (num_classes == MAX_CLASSES)
+          return fail("Too many punctuator characters at", s);
+        classes[c] = num_classes++;
+      }
+
+      if (!next[state][classes[c]]) {
+        if (num_states == MAX_STATES)
+          return fail("Too many punctuator states at", s);
+        accept[num_states] = -1;
+        reached_by[num_states] = s;
+        next[state][classes[c]] = num_states++;
+      }
+      state = next[state][classes[c]];
+    }
+
+    if (accept[state] != -1)
+      return fail("Duplicate punctuator", s);
+    accept[state] = (int)k;
+  }
+
+  for (int state = 1; state < num_states; ++state) {
+    if (accept[state] == -1)
+      return fail("A prefix is not itself a punctuator in", reached_by[state]);
+  }
+
+  printf("// Generated by tools/punctgen.c from the OP() entries of TOK_LIST. "
+         "Do not edit.\n\n");
+  printf("#pragma once\n\n");
+  printf("#include <stdint.h>\n\n");
+
+  printf("#define PUNCT_MAX_LEN %lu\n\n", max_len);
+
+  printf("typedef enum {\n  LEX_INVALID,\n  LEX_IDENT,\n  LEX_NUMBER,\n"
+         "  LEX_STRING,\n  LEX_CHAR,\n  LEX_PUNCT,\n  LEX_END\n} LexStart;\n\n");
+
+  printf("static const uint8_t lex_start[256] = {\n");
+  for (int c = 0; c < 256; ++c) {
+    const char *kind = startKind(c);
+    if (strcmp(kind, "LEX_INVALID")) {
+      printf("    [");
+      printByte(c);
+      printf("] = %s,\n", kind);
+    }
+  }
+  printf("};\n\n");
+
+  printf("static const uint8_t punct_class[256] = {\n");
+  for (int c = 0; c < 256; ++c) {
+    if (classes[c]) {
+      printf("    [");
+      printByte(c);
+      printf("] = %d,\n", classes[c]);
+    }
+  }
+  printf("};\n\n");
+
+  printf("static const uint8_t punct_next[%d][%d] = {\n", num_states,
+         num_classes);
+  for (int state = 0; state < num_states; ++state) {
+    printf("    {");
+    for (int cls = 0; cls < num_classes; ++cls)
+      printf(cls ? ", %d" : "%d", next[state][cls]);
+    printf("},\n");
+  }
+  printf("};\n\n");
+
+  printf("static const uint8_t punct_accept[%d] = {\n", num_states);
+  printf("    INVALID,\n");
+  for (int state = 1; state < num_states; ++state)
+    printf("    %s, // \"%s\"\n", ops[accept[state]].name,
+           ops[accept[state]].spelling);
+  printf("};\n");
+
+  return EXIT_SUCCESS;
+}